@@ -11,10 +11,17 @@
 
 #define GET 1
 #define SET 2
+#include <stddef.h>
 #include <linux/videodev2.h>
 
 #define ERR -128
 
+/*
+ * Returned by non-blocking functions when the requested resource (e.g., a
+ * filled buffer) is not available yet.
+ */
+#define HELPER_AGAIN 1
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -22,36 +29,677 @@ extern "C" {
 enum io_method {
 	IO_METHOD_READ = 1,
 	IO_METHOD_MMAP,
-	IO_METHOD_USERPTR
+	IO_METHOD_USERPTR,
+	IO_METHOD_DMABUF
+};
+
+/*
+ * Opaque handle holding the state of a single device. A handle is obtained
+ * via helper_ctx_init_cam() and freed by helper_ctx_deinit_cam(). Using a
+ * separate handle for each device allows a single process to stream from
+ * multiple devices simultaneously.
+ *
+ * Note: A handle must not be used from multiple threads at the same time
+ * without external synchronisation. Different handles can be used from
+ * different threads freely.
+ */
+struct helper_ctx;
+
+#define HELPER_MAX_PLANES 3
+
+/*
+ * A color plane of a frame, e.g., the Y or the interleaved CbCr plane of an
+ * NV12 frame. 'width' and 'height' are in samples of the plane (e.g., half the
+ * frame size for the CbCr plane of NV12, each sample being a Cb/Cr pair) and
+ * lines are 'bytesperline' bytes apart. This maps directly to a strided
+ * matrix header (e.g., an OpenCV cv::Mat) without copying the data.
+ *
+ * Formats whose planes aren't exposed separately (packed and compressed
+ * formats) have a single plane the size of the frame.
+ */
+struct helper_plane {
+	unsigned char *data;
+	unsigned int bytesperline;
+	unsigned int width;
+	unsigned int height;
+};
+
+/*
+ * A memory plane of a buffer, as given to the driver: a buffer has a single
+ * one unless the multi-planar API is used with a format storing its color
+ * planes separately (e.g., NV12M). 'length' is the size of the memory, which
+ * spans whole pages (from a page aligned 'data') for the buffers allocated
+ * or mapped by the library. This is what is needed to pass a buffer on as a
+ * whole, e.g., to write it with O_DIRECT (see v4l2_helper_record.h).
+ */
+struct helper_mem_plane {
+	unsigned char *data;
+	size_t length;
+	unsigned int bytesused;  /* Bytes filled by the driver from 'data' */
+};
+
+/*
+ * A lease on a single dequeued capture buffer. The data pointed to by a lease
+ * remains valid (and isn't overwritten by the driver) until the lease is
+ * released via helper_ctx_release_lease().
+ *
+ * Multiple leases, up to the number of buffers in the capture ring, can be
+ * held at the same time and they can be released in any order. Leases can be
+ * released from a thread other than the one that acquired them. This allows
+ * frame N to be processed while frame N+1 is being captured.
+ */
+struct helper_lease {
+	unsigned int index;      /* Index of the buffer in the capture ring */
+	unsigned char *data;
+	unsigned int bytesused;
+	unsigned int sequence;   /* Sequence number set by the driver */
+	struct timeval timestamp;
+	unsigned int flags;      /* V4L2_BUF_FLAG_* flags set by the driver */
+	unsigned int dropped;    /* Number of frames dropped (sequence gap) before this one */
+	unsigned int skipped;    /* Number of older frames skipped in latest frame only mode */
+	int dmabuf_fd;           /* dma-buf backing the buffer, -1 if none (see helper_ctx_export_buffer()) */
+
+	/*
+	 * Color planes of the frame. Planar YUV formats (NV12, NV16, YUV420 and
+	 * their variants) have one per component, whether they are stored one
+	 * after the other in a single buffer or in buffers of their own with
+	 * the multi-planar API (e.g., NV12M). 'data' is the first plane.
+	 */
+	unsigned int n_planes;
+	struct helper_plane planes[HELPER_MAX_PLANES];
+
+	unsigned int n_mem_planes;
+	struct helper_mem_plane mem_planes[HELPER_MAX_PLANES];
+};
+
+/*
+ * Metadata of a frame obtained via helper_ctx_get_cam_frame_meta(). It allows
+ * telling frames dropped by the driver ('dropped' non-zero) from frames that
+ * were merely slow to arrive (see 'timestamp').
+ */
+struct helper_frame_meta {
+	unsigned int bytesused;
+	unsigned int sequence;   /* Sequence number set by the driver */
+	struct timeval timestamp;
+	unsigned int flags;      /* V4L2_BUF_FLAG_* flags; V4L2_BUF_FLAG_ERROR marks corrupt data */
+	unsigned int dropped;    /* Number of frames dropped (sequence gap) before this one */
+	unsigned int skipped;    /* Number of older frames skipped in latest frame only mode */
+};
+
+/*
+ * Running counters maintained for each device since initialisation (or the
+ * last helper_ctx_reset_stats()).
+ */
+struct helper_stats {
+	unsigned long long frames;          /* Frames received */
+	unsigned long long sequence_gaps;   /* Gaps in the sequence numbers */
+	unsigned long long dropped_frames;  /* Frames missing in those gaps */
+	unsigned long long error_frames;    /* Frames with V4L2_BUF_FLAG_ERROR set */
+	unsigned long long eagain_spins;    /* VIDIOC_DQBUF attempts that returned EAGAIN */
+	unsigned long long select_timeouts; /* Waits for a frame that timed out */
+	unsigned long long skipped_frames;  /* Frames skipped in latest frame only mode */
 };
 
-/**
- * FIXME: All the state for the library is maintained via global variables.
- * So, it's not possible to use this library to access multiple devices
- * simultaneously. This is done to simplify the process of assessment.
+/*
+ * Points on the path of a frame at which the latency probe measures the time
+ * elapsed since the frame's time stamp (see helper_ctx_set_latency_probe()).
+ */
+enum helper_probe_point {
+	HELPER_PROBE_DEQUEUE,   /* Buffer dequeued (recorded by the library) */
+	HELPER_PROBE_CONVERT,   /* Frame converted (recorded by the application) */
+	HELPER_PROBE_DISPLAY,   /* Frame displayed (recorded by the application) */
+	HELPER_PROBE_POINTS
+};
+
+/*
+ * Distribution of the latency measured at a probe point since the probe was
+ * enabled or the statistics were last reset. The latencies are in
+ * microseconds, to within 1.6 %.
+ */
+struct helper_latency_stats {
+	unsigned long long frames;          /* Frames measured */
+	unsigned long long unsynced_frames; /* Frames whose time stamp isn't CLOCK_MONOTONIC based (not measured) */
+	unsigned int tstamp_src;            /* V4L2_BUF_FLAG_TSTAMP_SRC_* of the last frame measured */
+	double mean_us;
+	double p50_us;
+	double p90_us;
+	double p99_us;
+	double p99_9_us;
+	double max_us;
+};
+
+/*
+ * Pages backing the memory of IO_METHOD_USERPTR buffers. A 13MP UYVY frame
+ * spans about 6500 4 KB pages but only 13 2 MB pages, so that the stages
+ * going through whole frames (conversion, processing) miss the TLB far less
+ * often with huge pages.
  *
- * Hint: To access multiple devices at the same time using this application,
- * the public helper functions can be made to accept a new structure, that holds
- * the global state, as parameter.
+ * HELPER_ALLOC_HEAP: page aligned heap memory (the default). Whether it gets
+ *     transparent huge pages depends on the system's policy
+ *     (/sys/kernel/mm/transparent_hugepage/enabled).
+ * HELPER_ALLOC_SMALL_PAGES: an anonymous mapping kept to base (4 KB) pages,
+ *     whatever the system's policy.
+ * HELPER_ALLOC_THP: a 2 MB aligned anonymous mapping advised to use
+ *     transparent huge pages (MADV_HUGEPAGE). The kernel backs it with huge
+ *     pages as available, unless transparent huge pages are disabled.
+ * HELPER_ALLOC_HUGETLB: 2 MB pages reserved from the hugetlbfs pool
+ *     (MAP_HUGETLB; see /proc/sys/vm/nr_hugepages). Falls back to
+ *     HELPER_ALLOC_THP when the pool is too small.
+ */
+enum helper_alloc_pages {
+	HELPER_ALLOC_HEAP = 0,
+	HELPER_ALLOC_SMALL_PAGES,
+	HELPER_ALLOC_THP,
+	HELPER_ALLOC_HUGETLB
+};
+
+/*
+ * Given as 'numa_node' to allocate the buffers on the NUMA node of the CPU
+ * initialising the device (e.g., a thread pinned next to the consuming
+ * threads).
+ */
+#define HELPER_NUMA_LOCAL -2
+
+/*
+ * Memory actually obtained for the IO_METHOD_USERPTR buffers (see
+ * helper_ctx_get_buffer_memory()), which may differ from what was asked for
+ * as the allocation options fall back rather than fail.
+ */
+struct helper_buffer_memory {
+	enum helper_alloc_pages pages;  /* Pages of the buffers (the least huge if they differ) */
+	int locked;                     /* All the buffers are locked in memory */
+	int numa_node;                  /* Node all the buffers are bound to, -1 if not bound */
+	size_t bytes;                   /* Memory of all the buffers, including padding to the page size */
+	size_t reused_bytes;            /* Part of 'bytes' kept by the last helper_ctx_reconfigure() */
+};
+
+/*
+ * A control of the device (see helper_ctx_enum_ctrl()). 'type' and 'flags'
+ * are those of struct v4l2_query_ext_ctrl (V4L2_CTRL_TYPE_*, V4L2_CTRL_FLAG_*).
+ */
+struct helper_ctrl_info {
+	unsigned int id;
+	char name[32];
+	unsigned int type;
+	long long minimum;
+	long long maximum;
+	unsigned long long step;
+	long long default_value;
+	unsigned int flags;
+	int has_value;                  /* 'value' is known; never for volatile controls */
+	long long value;                /* Last value read or written */
+};
+
+/*
+ * Control traffic since the control cache was created (see
+ * helper_ctx_get_ctrl_stats()).
+ */
+struct helper_ctrl_stats {
+	unsigned long long ioctls;      /* Control ioctls issued, enumeration included */
+	unsigned long long writes;      /* Control values written to the device */
+	unsigned long long unchanged;   /* Updates dropped as the control already had the value */
+	unsigned long long failures;    /* Control values the device refused */
+	int requests;                   /* Frame controls go through the Request API */
+};
+
+/*
+ * A capture mode of the device: a format, a frame size and a frame interval
+ * (see helper_ctx_enum_mode()). Sizes and intervals the driver enumerates
+ * as ranges (stepwise or continuous) span width x height to max_width x
+ * max_height, in steps of step_width x step_height, and 'interval' to
+ * 'max_interval'; for the others, the bounds are equal. A frame interval of
+ * 0/0 isn't known.
+ */
+struct helper_mode {
+	unsigned int format;            /* V4L2 fourcc */
+	unsigned int format_flags;      /* V4L2_FMT_FLAG_* (e.g., V4L2_FMT_FLAG_COMPRESSED) */
+	unsigned int width;
+	unsigned int height;
+	unsigned int max_width;
+	unsigned int max_height;
+	unsigned int step_width;
+	unsigned int step_height;
+	struct v4l2_fract interval;     /* Shortest frame interval, i.e., highest frame rate */
+	struct v4l2_fract max_interval;
+};
+
+/*
+ * What the application needs from a capture mode (see
+ * helper_ctx_select_mode()). Members left to 0 don't constrain the choice.
+ */
+struct helper_mode_target {
+	unsigned int min_width;
+	unsigned int min_height;
+	double min_fps;
+	unsigned int max_width;
+	unsigned int max_height;
+	int prefer_uncompressed;        /* Compressed formats only if no other fits */
+	/*
+	 * Acceptable formats (e.g., those the application can convert). When
+	 * none are given, all the colour formats are, but not the monochrome
+	 * ones (GREY, Y10, Y12, Y16), which must be listed to be selected.
+	 */
+	const unsigned int *formats;
+	unsigned int n_formats;
+};
+
+/*
+ * Phases of the initialisation of a device, up to the first frame (see
+ * helper_ctx_get_init_times()).
+ */
+enum helper_init_phase {
+	HELPER_INIT_OPEN,        /* Opening the device file */
+	HELPER_INIT_QUERYCAP,    /* VIDIOC_QUERYCAP */
+	HELPER_INIT_PROFILE,     /* Reading and writing the device profile */
+	HELPER_INIT_MODES,       /* Selecting the capture mode (see 'target' in struct helper_cam_params) */
+	HELPER_INIT_CROP,        /* VIDIOC_CROPCAP, resetting the crop rectangle */
+	HELPER_INIT_FORMAT,      /* VIDIOC_S_FMT, VIDIOC_S_PARM */
+	HELPER_INIT_BUFFERS,     /* VIDIOC_REQBUFS, VIDIOC_QUERYBUF, mapping or allocating the buffers */
+	HELPER_INIT_STREAMON,    /* Queueing the buffers, VIDIOC_STREAMON */
+	HELPER_INIT_FIRST_FRAME, /* Until the first frame is dequeued */
+	HELPER_INIT_PHASES
+};
+
+/*
+ * Time spent initialising a device, measured once by the library.
+ */
+struct helper_init_times {
+	unsigned long long phase_ns[HELPER_INIT_PHASES];
+	unsigned long long first_frame_ns;  /* From the call initialising the device to the first frame, 0 until then */
+	int warm_start;                     /* The device profile was found, so the device wasn't probed */
+};
+
+/*
+ * Parameters used to initialise a device. helper_cam_params_init() must be
+ * used to fill in the defaults before modifying the parameters of interest.
  */
+struct helper_cam_params {
+	unsigned int width;
+	unsigned int height;
+	unsigned int format;
+	enum io_method io_meth;
+
+	/*
+	 * Number of buffers in the capture ring (default: 4). More buffers absorb
+	 * more processing jitter at the cost of memory. The driver may adjust it.
+	 * At most VIDEO_MAX_FRAME (32), the number of requests kept per device
+	 * for the frame controls (see helper_ctx_set_frame_ctrls()).
+	 */
+	unsigned int num_buffers;
+
+	/*
+	 * When non-zero, the ring is grown when the driver drops frames (gaps in
+	 * the buffer sequence numbers) and shrunk after a long period without
+	 * drops. The size is kept within [min_buffers, max_buffers] (default:
+	 * [2, 16], 'max_buffers' being capped at VIDEO_MAX_FRAME) and, if
+	 * non-zero, within 'memory_budget' bytes.
+	 *
+	 * Growing is done on the fly when the driver supports VIDIOC_CREATE_BUFS.
+	 * Otherwise, and for shrinking, the stream is restarted when no buffers
+	 * are leased. Not supported with IO_METHOD_READ and application-given
+	 * dma-bufs.
+	 */
+	int adaptive_buffers;
+	unsigned int min_buffers;
+	unsigned int max_buffers;
+	size_t memory_budget;
+
+	/*
+	 * dma-bufs to capture into, with IO_METHOD_DMABUF (see
+	 * helper_ctx_init_cam_dmabuf()). 'num_buffers' is ignored when given.
+	 */
+	const int *dmabuf_fds;
+	unsigned int n_dmabuf_fds;
+
+	/*
+	 * Latest frame only mode (default: off). See
+	 * helper_ctx_set_latest_frame_only().
+	 */
+	int latest_frame_only;
+
+	/*
+	 * Memory of the IO_METHOD_USERPTR buffers (default: heap memory, not
+	 * locked nor bound). Ignored with the other methods.
+	 *
+	 * 'lock_buffers' locks the buffers in memory (mlock()) so that they are
+	 * never paged out, within RLIMIT_MEMLOCK. 'numa_node' binds them to a
+	 * NUMA node (-1: none, HELPER_NUMA_LOCAL: the node of the calling CPU),
+	 * which should be the node of the threads processing the frames. The
+	 * buffers are touched at initialisation so that no page faults are taken
+	 * while streaming. An option that can't be honoured is reported and
+	 * dropped (see struct helper_buffer_memory).
+	 */
+	enum helper_alloc_pages alloc_pages;
+	int lock_buffers;
+	int numa_node;
+
+	/*
+	 * Frame interval to set with VIDIOC_S_PARM (e.g., 1/60 for 60 fps);
+	 * 0/0 (default) keeps that of the driver.
+	 */
+	struct v4l2_fract frame_interval;
+
+	/*
+	 * When given, the capture mode is selected among those the device
+	 * enumerates (see helper_ctx_select_mode()) and 'width', 'height',
+	 * 'format' and 'frame_interval' are ignored.
+	 */
+	const struct helper_mode_target *target;
+
+	/*
+	 * File caching the profiles of the devices (NULL by default: none).
+	 * What is learnt by probing a device (cropping support and default
+	 * rectangle, capture modes) is stored in it, keyed by the driver, card
+	 * and bus of the device, so that the next initialisations skip the
+	 * probing and only reset the crop rectangle when it isn't the
+	 * default one (see helper_ctx_get_init_times()).
+	 */
+	const char *profile_path;
+};
+
+void helper_cam_params_init(struct helper_cam_params *params, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth);
 
 /*
  * All functions return 0 on success and ERR ( a negative value) in case of failure.
  */
 
+/*
+ * Devices that only support the multi-planar API (V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+ * and formats with a memory plane per color plane (e.g., V4L2_PIX_FMT_NV12M,
+ * only available with that API) are handled transparently; see the 'planes'
+ * of struct helper_lease.
+ */
+int helper_ctx_init_cam_params(struct helper_ctx **ctx, const char* devname, const struct helper_cam_params *params);
+
+int helper_ctx_init_cam(struct helper_ctx **ctx, const char* devname, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth);
+
+/*
+ * Initialises the device to capture into the given (externally allocated)
+ * dma-bufs using IO_METHOD_DMABUF; one buffer per dma-buf. The dma-bufs must
+ * be at least as large as the image and must remain open until the context is
+ * de-initialised. They can be allocated using udmabuf, a dma-heap, a GPU, etc.
+ *
+ * When helper_ctx_init_cam() is used with IO_METHOD_DMABUF, the library
+ * allocates the dma-bufs itself using udmabuf (/dev/udmabuf).
+ */
+int helper_ctx_init_cam_dmabuf(struct helper_ctx **ctx, const char* devname, unsigned int width, unsigned int height, unsigned int format, const int *dmabuf_fds, unsigned int n_dmabuf_fds);
+
+int helper_ctx_get_cam_frame(struct helper_ctx *ctx, unsigned char** pointer_to_cam_data, int *size);
+
+/*
+ * Same as helper_ctx_get_cam_frame() but also returns the metadata of the frame.
+ */
+int helper_ctx_get_cam_frame_meta(struct helper_ctx *ctx, unsigned char** pointer_to_cam_data, struct helper_frame_meta *meta);
+
+int helper_ctx_release_cam_frame(struct helper_ctx *ctx);
+
+int helper_ctx_deinit_cam(struct helper_ctx *ctx);
+
+/*
+ * Switches the device to another resolution and/or format without closing
+ * it: streaming is stopped, the ring is re-created with as many buffers for
+ * the new format, and streaming is restarted. With IO_METHOD_USERPTR, the
+ * memory of the buffers large enough for the new format is reused; reused
+ * buffers keep their size, so that switching to a smaller format (e.g., from
+ * still capture to preview) and back allocates nothing.
+ *
+ * No lease may be held, and the context must not use application-given
+ * dma-bufs. If the new format can't be set, the previous one is restored
+ * and ERR is returned; if that fails too, the context can only be
+ * de-initialised.
+ */
+int helper_ctx_reconfigure(struct helper_ctx *ctx, unsigned int width, unsigned int height, unsigned int format);
+
+/*
+ * Gets the format negotiated with the driver, which may differ from the one
+ * requested.
+ */
+int helper_ctx_get_format(struct helper_ctx *ctx, unsigned int *width, unsigned int *height, unsigned int *format);
+
+/*
+ * Capture modes. The formats, frame sizes and frame intervals of the device
+ * (VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES, VIDIOC_ENUM_FRAMEINTERVALS) are
+ * enumerated once, when first needed, for the buffer type in use.
+ */
+unsigned int helper_ctx_get_num_modes(struct helper_ctx *ctx);
+
+int helper_ctx_enum_mode(struct helper_ctx *ctx, unsigned int index, struct helper_mode *mode);
+
+/*
+ * Selects the capture mode that best meets 'target': among the modes that
+ * are at least as large and fast as asked for (and within the maximums),
+ * the one that delivers the most useful throughput per CPU time, i.e., the
+ * pixels per second up to the target over the estimated time to turn them
+ * into BGR (see helper_mode_frame_cost()). So the smallest, slowest mode
+ * that meets the target is preferred, in the cheapest format (a colour
+ * one unless monochrome formats are listed in 'target'); without a
+ * size or rate target, the largest or fastest. Sizes and intervals given as
+ * ranges are fitted to the target. The mode returned has a single size and
+ * interval, and can be set with helper_ctx_set_mode(). Returns ERR when no
+ * mode fits.
+ */
+int helper_ctx_select_mode(struct helper_ctx *ctx, const struct helper_mode_target *target, struct helper_mode *mode);
+
+/*
+ * Switches to the format, size and frame interval of 'mode', like
+ * helper_ctx_reconfigure() does.
+ */
+int helper_ctx_set_mode(struct helper_ctx *ctx, const struct helper_mode *mode);
+
+/*
+ * Gets the current format, size and frame interval (0/0 if the driver
+ * doesn't report it).
+ */
+int helper_ctx_get_mode(struct helper_ctx *ctx, struct helper_mode *mode);
+
+/*
+ * Estimated CPU time, in seconds, to turn a frame of the given format and
+ * size into BGR: the cost model of helper_ctx_select_mode().
+ */
+double helper_mode_frame_cost(unsigned int format, unsigned int width, unsigned int height);
+
+/*
+ * Returns the number of buffers in the capture ring i.e., the maximum
+ * number of leases that can be held simultaneously. This can change over
+ * time when the ring depth is adaptive.
+ */
+unsigned int helper_ctx_get_num_buffers(struct helper_ctx *ctx);
+
+/*
+ * Waits for a filled buffer and leases it. Leases must only be acquired from
+ * one thread at a time for a given context.
+ */
+int helper_ctx_acquire_lease(struct helper_ctx *ctx, struct helper_lease *lease);
+
+/*
+ * Leases a filled buffer without waiting. Returns HELPER_AGAIN when no filled
+ * buffer is available or when all the buffers are already leased.
+ */
+int helper_ctx_try_acquire_lease(struct helper_ctx *ctx, struct helper_lease *lease);
+
+int helper_ctx_release_lease(struct helper_ctx *ctx, const struct helper_lease *lease);
+
+/*
+ * In latest frame only mode, getting a frame (or acquiring a lease) dequeues
+ * all the filled buffers available and immediately requeues all but the
+ * newest one, which is returned. The number of frames skipped that way is
+ * reported in the 'skipped' member of the lease (or frame metadata). This
+ * bounds the age of the frames a slow consumer gets at the cost of not seeing
+ * every frame; it's meant for closed-loop control.
+ */
+int helper_ctx_set_latest_frame_only(struct helper_ctx *ctx, int enable);
+
+unsigned int helper_ctx_get_num_leased(struct helper_ctx *ctx);
+
+/*
+ * Statistics can be queried from any thread.
+ */
+int helper_ctx_get_stats(struct helper_ctx *ctx, struct helper_stats *stats);
+
+int helper_ctx_reset_stats(struct helper_ctx *ctx);
+
+/*
+ * Enables (or disables) the latency probe, which measures how long after its
+ * capture a frame reaches each point of its path: the time elapsed since the
+ * time stamp the driver gave the buffer is recorded when the buffer is
+ * dequeued and, by the application via helper_ctx_probe_frame(), when the
+ * frame is converted and displayed.
+ *
+ * The time stamps are only comparable with the time of the application when
+ * the driver takes them from CLOCK_MONOTONIC (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC);
+ * other frames are counted as unsynced instead of being measured. Depending
+ * on V4L2_BUF_FLAG_TSTAMP_SRC_*, the time stamp is taken at the start of the
+ * exposure (SOE) or when the last pixel was received (EOF); in the latter
+ * case, the exposure and read out times aren't included.
+ *
+ * Recording costs a clock read and a few atomic increments per frame and
+ * probe point.
+ */
+int helper_ctx_set_latency_probe(struct helper_ctx *ctx, int enable);
+
+/*
+ * Records the latency of a frame at 'point' (HELPER_PROBE_CONVERT or
+ * HELPER_PROBE_DISPLAY) from its time stamp and flags, as found in its lease
+ * or metadata. The buffer may have been released already. Each point should
+ * be recorded by a single thread. Does nothing unless the probe is enabled.
+ */
+int helper_ctx_probe_frame(struct helper_ctx *ctx, enum helper_probe_point point, const struct timeval *timestamp, unsigned int flags);
+
+/*
+ * Gets the latency distribution at 'point'. helper_ctx_reset_stats() also
+ * resets the distributions.
+ */
+int helper_ctx_get_latency_stats(struct helper_ctx *ctx, enum helper_probe_point point, struct helper_latency_stats *stats);
+
+/*
+ * Gets the time spent in each phase of the initialisation and the time to
+ * the first frame, which includes the time the application took to ask for
+ * it. Can be called from any thread.
+ */
+int helper_ctx_get_init_times(struct helper_ctx *ctx, struct helper_init_times *times);
+
+/*
+ * Gets the memory obtained for the IO_METHOD_USERPTR buffers (see 'alloc_pages'
+ * in struct helper_cam_params). Fails with the other methods.
+ */
+int helper_ctx_get_buffer_memory(struct helper_ctx *ctx, struct helper_buffer_memory *memory);
+
+/*
+ * Returns the (non-blocking) file descriptor of the device. It becomes readable
+ * when a filled buffer is available. It's meant to be used with poll/epoll and
+ * must not be closed by the caller.
+ */
+int helper_ctx_get_fd(struct helper_ctx *ctx);
+
+/*
+ * Returns the dma-buf backing the buffer at 'index' of the capture ring, to pass
+ * frames to other devices (encoders, GPUs) or processes without a CPU copy.
+ * MMAP buffers are exported via VIDIOC_EXPBUF on first use. The descriptor is
+ * owned by the library and stays valid until the context is de-initialised;
+ * it must be dup()-ed to be used beyond that.
+ */
+int helper_ctx_export_buffer(struct helper_ctx *ctx, unsigned int index, int *dmabuf_fd);
+
+/*
+ * Same as helper_ctx_export_buffer() for a memory plane of the buffer, with
+ * the multi-planar API and a format with a memory plane per color plane
+ * (e.g., V4L2_PIX_FMT_NV12M). helper_ctx_export_buffer() exports the first.
+ */
+int helper_ctx_export_plane(struct helper_ctx *ctx, unsigned int index, unsigned int plane, int *dmabuf_fd);
+
+/*
+ * Signals the eventfd 'notify_fd' once, the next time a lease is released.
+ * This allows an event loop to wait for leased buffers to return to the
+ * driver without being woken up for every release. Pass -1 to cancel a
+ * pending request.
+ */
+int helper_ctx_notify_on_release(struct helper_ctx *ctx, int notify_fd);
+
+/*
+ * Controls. The controls of the device are enumerated, and their values
+ * read, once, when one of the following is first called; only controls with
+ * a scalar value are listed (not compound or string controls). Values are
+ * clamped to the range of the control and rounded to its step, and writing
+ * the value a control already has costs nothing. The values of volatile
+ * controls (e.g., an exposure time set by the automatic exposure) are
+ * always read from the device.
+ *
+ * These can be called from any thread.
+ */
+unsigned int helper_ctx_get_num_ctrls(struct helper_ctx *ctx);
+
+int helper_ctx_enum_ctrl(struct helper_ctx *ctx, unsigned int index, struct helper_ctrl_info *info);
+
+int helper_ctx_query_ctrl(struct helper_ctx *ctx, unsigned int id, struct helper_ctrl_info *info);
+
+int helper_ctx_get_ctrl(struct helper_ctx *ctx, unsigned int id, long long *value);
+
+/*
+ * Writes a control right away (one ioctl), superseding an update of it
+ * staged by helper_ctx_stage_ctrl().
+ */
+int helper_ctx_set_ctrl(struct helper_ctx *ctx, unsigned int id, long long value);
+
+/*
+ * Stages an update of a control. The staged updates are written together,
+ * in a single VIDIOC_S_EXT_CTRLS, by helper_ctx_apply_ctrls() or, in frame
+ * controls mode, with the next buffer queued. Staging a control again
+ * replaces its pending update.
+ */
+int helper_ctx_stage_ctrl(struct helper_ctx *ctx, unsigned int id, long long value);
+
+int helper_ctx_apply_ctrls(struct helper_ctx *ctx);
+
+/*
+ * In frame controls mode, the staged updates are applied when the next
+ * buffer is queued (i.e., when a lease is released), so that a control loop
+ * updating several controls per frame (e.g., exposure, gain and white
+ * balance) costs at most one ioctl per frame. When the driver supports the
+ * Request API (V4L2_BUF_CAP_SUPPORTS_REQUESTS), each buffer is queued with
+ * a request of the media device holding the updates, which then apply
+ * exactly from the frame captured into that buffer (until that buffer is
+ * dequeued, the controls it updates are read from the device); otherwise
+ * they apply as soon as they are written, like with
+ * helper_ctx_apply_ctrls(). The mode can only be switched into (or out of)
+ * requests while no lease is held, from the thread acquiring the leases.
+ */
+int helper_ctx_set_frame_ctrls(struct helper_ctx *ctx, int enable);
+
+int helper_ctx_get_ctrl_stats(struct helper_ctx *ctx, struct helper_ctrl_stats *stats);
+
+/*
+ * Legacy functions that operate on a single default context. Only one device
+ * can be accessed at a time using these.
+ */
+
 int helper_init_cam(const char* devname, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth);
 
 int helper_get_cam_frame(unsigned char** pointer_to_cam_data, int *size);
 
+int helper_get_cam_frame_meta(unsigned char** pointer_to_cam_data, struct helper_frame_meta *meta);
+
 int helper_release_cam_frame();
 
+int helper_get_stats(struct helper_stats *stats);
+
+int helper_set_latest_frame_only(int enable);
+
 int helper_deinit_cam();
 
-//int helper_change_cam_res(unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth);
+/*
+ * Same as helper_ctx_reconfigure(), also switching to the I/O method 'io_meth'.
+ */
+int helper_change_cam_res(unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth);
 
-//int helper_ctrl(unsigned int, int,int*);
+/*
+ * Gets (flag GET) or sets (flag SET) a control of the default context.
+ */
+int helper_ctrl(unsigned int id, int flag, int *value);
 
-//int helper_queryctrl(unsigned int,struct v4l2_queryctrl* );
+/*
+ * Fills 'qctrl' from the cached description of the control 'id'.
+ */
+int helper_queryctrl(unsigned int id, struct v4l2_queryctrl *qctrl);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,130 @@
+/*
+ * opencv_v4l2 - v4l2_helper_convert.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Header file for the v4l2_helper color conversion functions.
+
+#ifndef V4L2_HELPER_CONVERT_H
+#define V4L2_HELPER_CONVERT_H
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Color matrix the YUV data was encoded with.
+ */
+enum helper_yuv_matrix {
+	HELPER_YUV_BT601 = 0,
+	HELPER_YUV_BT709
+};
+
+/*
+ * Quantisation range of the YUV data. Limited range ("video" range) uses 16-235
+ * for Y and 16-240 for U/V; full range uses 0-255 for all.
+ */
+enum helper_yuv_range {
+	HELPER_YUV_RANGE_LIMITED = 0,
+	HELPER_YUV_RANGE_FULL
+};
+
+/*
+ * Implementations of the conversion kernels. HELPER_CONVERT_AUTO selects the
+ * fastest one supported by the CPU at run time.
+ */
+enum helper_convert_backend {
+	HELPER_CONVERT_AUTO = 0,
+	HELPER_CONVERT_SCALAR,
+	HELPER_CONVERT_SSE4,
+	HELPER_CONVERT_AVX2,
+	HELPER_CONVERT_NEON
+};
+
+/*
+ * Converts UYVY (as in V4L2_PIX_FMT_UYVY) to packed 24-bit BGR (as in an
+ * OpenCV CV_8UC3 matrix). 'width' must be even. The strides are in bytes, so
+ * that the destination can be a preallocated matrix (e.g., mat.data and
+ * mat.step) and no allocation is done per frame.
+ *
+ * With HELPER_YUV_BT601 and HELPER_YUV_RANGE_LIMITED, the result matches
+ * cv::cvtColor(COLOR_YUV2BGR_UYVY) to within one level. All the backends give
+ * identical results.
+ *
+ * Returns 0 on success and ERR in case of failure.
+ */
+int helper_convert_uyvy_to_bgr(const unsigned char *src, size_t src_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range);
+
+/*
+ * Same as helper_convert_uyvy_to_bgr() but converts stripes of rows in
+ * parallel on the threads of 'pool' (see v4l2_helper_pool.h). Falls back to
+ * converting on the calling thread when 'pool' is NULL.
+ */
+int helper_convert_uyvy_to_bgr_parallel(struct helper_pool *pool,
+		const unsigned char *src, size_t src_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range);
+
+/*
+ * Converts NV12 (as in V4L2_PIX_FMT_NV12 and V4L2_PIX_FMT_NV12M) to packed
+ * 24-bit BGR in a single pass, reading the Y plane and the interleaved CbCr
+ * plane where they are. The planes can be apart (e.g., in separate buffers
+ * with the multi-planar API; see the 'planes' of struct helper_lease), so
+ * nothing has to be copied to make the frame contiguous first. 'width' must
+ * be even; the CbCr plane has (height + 1) / 2 rows.
+ *
+ * With HELPER_YUV_BT601 and HELPER_YUV_RANGE_LIMITED, the result matches
+ * cv::cvtColor(COLOR_YUV2BGR_NV12) to within one level. All the backends give
+ * identical results.
+ *
+ * Returns 0 on success and ERR in case of failure.
+ */
+int helper_convert_nv12_to_bgr(const unsigned char *y, size_t y_stride,
+		const unsigned char *uv, size_t uv_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range);
+
+/*
+ * Same as helper_convert_nv12_to_bgr() but converts stripes of rows in
+ * parallel on the threads of 'pool'. Falls back to converting on the calling
+ * thread when 'pool' is NULL.
+ */
+int helper_convert_nv12_to_bgr_parallel(struct helper_pool *pool,
+		const unsigned char *y, size_t y_stride,
+		const unsigned char *uv, size_t uv_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range);
+
+/*
+ * Forces the backend used by the conversion functions (mainly meant for
+ * benchmarking). Returns ERR if the backend isn't supported by the CPU.
+ */
+int helper_convert_set_backend(enum helper_convert_backend backend);
+
+/*
+ * Returns the backend currently in use (never HELPER_CONVERT_AUTO).
+ */
+enum helper_convert_backend helper_convert_get_backend(void);
+
+/*
+ * Returns non-zero if 'backend' is supported by the CPU.
+ */
+int helper_convert_backend_supported(enum helper_convert_backend backend);
+
+const char *helper_convert_backend_name(enum helper_convert_backend backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * opencv_v4l2 - v4l2_helper_jpeg.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Header file for the v4l2_helper JPEG (MJPEG) decoding functions.
+
+#ifndef V4L2_HELPER_JPEG_H
+#define V4L2_HELPER_JPEG_H
+
+#include <stddef.h>
+#include "v4l2_helper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * What a JPEG image is decoded to.
+ *
+ * HELPER_JPEG_BGR: packed 24-bit BGR (as in an OpenCV CV_8UC3 matrix).
+ *
+ * HELPER_JPEG_YUV: the Y, Cb and Cr planes as they are stored in the JPEG
+ *     image, at the chroma subsampling of the image (usually 4:2:2 for
+ *     MJPEG cameras). No color conversion nor chroma upsampling is done,
+ *     which makes it the fastest output when BGR isn't needed (e.g., for
+ *     processing the luma or encoding).
+ */
+enum helper_jpeg_output {
+	HELPER_JPEG_BGR = 0,
+	HELPER_JPEG_YUV
+};
+
+/*
+ * Destination of a decoded image. The memory is owned by the caller and is
+ * usually preallocated (e.g., the data of an OpenCV matrix) so that nothing
+ * is allocated per frame.
+ *
+ * For HELPER_JPEG_BGR, only planes[0] and strides[0] are used. For
+ * HELPER_JPEG_YUV, planes[0] gets the Y plane and planes[1] and planes[2]
+ * the Cb and Cr planes; each plane must be able to hold 'width' x 'height'
+ * samples (the chroma planes get fewer when subsampled). For greyscale
+ * images, only the Y plane is written.
+ *
+ * The strides are in bytes.
+ */
+struct helper_jpeg_image {
+	enum helper_jpeg_output output;
+	unsigned int width;
+	unsigned int height;
+	unsigned char *planes[3];
+	size_t strides[3];
+
+	/*
+	 * Set when decoding to HELPER_JPEG_YUV: size of the chroma planes
+	 * (0 for greyscale images).
+	 */
+	unsigned int chroma_width;
+	unsigned int chroma_height;
+};
+
+/*
+ * All functions return 0 on success and ERR ( a negative value) in case of
+ * failure, unless noted otherwise.
+ */
+
+/*
+ * Reads the size of a JPEG image from its header.
+ */
+int helper_jpeg_get_size(const unsigned char *jpeg, size_t size, unsigned int *width, unsigned int *height);
+
+/*
+ * Decodes a JPEG image on the calling thread. The size of the image must be
+ * that of 'image'. MJPEG frames without Huffman tables (as sent by most UVC
+ * cameras) are supported.
+ *
+ * A decoder is set up for each call; use a helper_jpeg_decoder to decode a
+ * stream of frames.
+ */
+int helper_jpeg_decode(const unsigned char *jpeg, size_t size, struct helper_jpeg_image *image);
+
+/*
+ * A pool of worker threads decoding a stream of JPEG frames (e.g., the
+ * buffers dequeued from an MJPEG capture device) in parallel, each with its
+ * own decoder that is set up once and reused for every frame.
+ *
+ * Frames are submitted in order and collected in the same order, whatever
+ * the order the workers finish them in.
+ */
+struct helper_jpeg_decoder;
+
+/*
+ * 'n_threads' is the number of worker threads (0: one per online CPU) and
+ * 'max_in_flight' the number of frames that can be submitted but not yet
+ * collected (0: twice the number of threads).
+ */
+int helper_jpeg_decoder_create(struct helper_jpeg_decoder **dec, unsigned int n_threads, unsigned int max_in_flight);
+
+int helper_jpeg_decoder_destroy(struct helper_jpeg_decoder *dec);
+
+unsigned int helper_jpeg_decoder_get_max_in_flight(const struct helper_jpeg_decoder *dec);
+
+/*
+ * Queues a frame for decoding into 'image'. Waits while 'max_in_flight'
+ * frames are in flight. The compressed data and 'image' must stay valid
+ * until the frame is collected. 'tag' is given back by
+ * helper_jpeg_decoder_collect() (e.g., the lease of the capture buffer).
+ */
+int helper_jpeg_decoder_submit(struct helper_jpeg_decoder *dec, const unsigned char *jpeg, size_t size,
+		struct helper_jpeg_image *image, void *tag);
+
+/*
+ * Waits for the oldest frame in flight to be decoded and returns its image
+ * and tag. 'status' is set to 0 if it was decoded successfully and to ERR
+ * otherwise (the frame is collected either way, so that its buffer can be
+ * released).
+ *
+ * Returns ERR once the decoder is closed and all the frames are collected.
+ */
+int helper_jpeg_decoder_collect(struct helper_jpeg_decoder *dec, struct helper_jpeg_image **image,
+		void **tag, int *status);
+
+/*
+ * Marks the end of the stream: helper_jpeg_decoder_collect() fails instead
+ * of waiting once the frames in flight are collected. Meant to be called by
+ * the thread submitting the frames when a separate thread collects them.
+ */
+int helper_jpeg_decoder_close(struct helper_jpeg_decoder *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * opencv_v4l2 - v4l2_helper_loop.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Header file for the v4l2_helper event loop functions.
+
+#ifndef V4L2_HELPER_LOOP_H
+#define V4L2_HELPER_LOOP_H
+
+#include "v4l2_helper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An epoll based event loop that owns the file descriptors of multiple
+ * devices (helper contexts) and dispatches the filled buffers of each device
+ * to a per-device callback. This avoids a thread and a select() call per
+ * device and frame when streaming from many devices.
+ */
+struct helper_loop;
+
+enum helper_loop_event_type {
+	HELPER_LOOP_FRAME = 1,  /* A filled buffer was leased */
+	HELPER_LOOP_STALL,      /* No frame was received within the stall timeout */
+	HELPER_LOOP_ERROR       /* The device reported an error; it's no longer polled */
+};
+
+struct helper_loop_event {
+	enum helper_loop_event_type type;
+	struct helper_ctx *ctx;
+
+	/*
+	 * Valid only for HELPER_LOOP_FRAME. The callback owns the lease and must
+	 * release it via helper_ctx_release_lease(), either before returning or
+	 * later (possibly from another thread).
+	 */
+	struct helper_lease lease;
+
+	/*
+	 * Valid only for HELPER_LOOP_STALL. Time elapsed since the last frame
+	 * (or since the device was added) in milliseconds.
+	 */
+	unsigned int stall_ms;
+};
+
+typedef void (*helper_loop_cb)(const struct helper_loop_event *event, void *user_data);
+
+/*
+ * All functions return 0 on success and ERR ( a negative value) in case of failure.
+ *
+ * A stall event is dispatched for a device every 'stall_timeout_ms' milliseconds
+ * for as long as no frames are received from it. Pass 0 to disable stall events.
+ */
+int helper_loop_create(struct helper_loop **loop, unsigned int stall_timeout_ms);
+
+int helper_loop_add_cam(struct helper_loop *loop, struct helper_ctx *ctx, helper_loop_cb cb, void *user_data);
+
+int helper_loop_remove_cam(struct helper_loop *loop, struct helper_ctx *ctx);
+
+/*
+ * Waits for at most 'timeout_ms' milliseconds (-1 to wait indefinitely) and
+ * dispatches all the pending events. Returns the number of events dispatched.
+ */
+int helper_loop_run_once(struct helper_loop *loop, int timeout_ms);
+
+/*
+ * Dispatches events until helper_loop_stop() is called.
+ */
+int helper_loop_run(struct helper_loop *loop);
+
+/*
+ * Makes helper_loop_run() return. Can be called from any thread (including
+ * from the callbacks).
+ */
+int helper_loop_stop(struct helper_loop *loop);
+
+/*
+ * Frees the loop. The contexts added to it are not de-initialised.
+ */
+int helper_loop_destroy(struct helper_loop *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
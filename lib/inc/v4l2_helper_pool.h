@@ -0,0 +1,68 @@
+/*
+ * opencv_v4l2 - v4l2_helper_pool.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Header file for the v4l2_helper worker pool functions.
+
+#ifndef V4L2_HELPER_POOL_H
+#define V4L2_HELPER_POOL_H
+
+#include "v4l2_helper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A persistent pool of worker threads that processes a frame in stripes of
+ * rows in parallel. The threads are created once, when the pool is created,
+ * and wait for work in between frames; no thread is created per frame.
+ *
+ * The stripes are sized so that the data read and written for a stripe fits
+ * in half of the L2 cache. The stripes are handed out dynamically so that a
+ * thread that is preempted doesn't hold up the whole frame.
+ */
+struct helper_pool;
+
+/*
+ * Processes the rows [first_row, first_row + n_rows) of a frame.
+ */
+typedef void (*helper_pool_fn)(void *arg, unsigned int first_row, unsigned int n_rows);
+
+/*
+ * All functions return 0 on success and ERR ( a negative value) in case of failure.
+ *
+ * 'n_threads' is the total number of threads processing a frame, including
+ * the thread calling helper_pool_run_stripes(); so, 'n_threads' - 1 worker
+ * threads are created. Pass 0 to use one thread per online CPU. When
+ * 'pin_threads' is non-zero, each worker thread is pinned to a separate CPU.
+ */
+int helper_pool_create(struct helper_pool **pool, unsigned int n_threads, int pin_threads);
+
+int helper_pool_destroy(struct helper_pool *pool);
+
+unsigned int helper_pool_get_num_threads(const struct helper_pool *pool);
+
+/*
+ * Returns the number of rows per stripe used for frames with 'n_rows' rows of
+ * 'bytes_per_row' bytes each (the bytes read and written for a row).
+ */
+unsigned int helper_pool_get_stripe_rows(const struct helper_pool *pool, unsigned int n_rows, size_t bytes_per_row);
+
+/*
+ * Calls 'fn' for all the stripes of a frame with 'n_rows' rows, from all the
+ * threads of the pool, and returns once all the stripes are processed.
+ *
+ * Note: A pool processes a single frame at a time; this function must not be
+ * called from multiple threads at the same time for the same pool.
+ */
+int helper_pool_run_stripes(struct helper_pool *pool, helper_pool_fn fn, void *arg,
+		unsigned int n_rows, size_t bytes_per_row);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * opencv_v4l2 - v4l2_helper_record.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Header file for the v4l2_helper raw stream recording functions.
+
+#ifndef V4L2_HELPER_RECORD_H
+#define V4L2_HELPER_RECORD_H
+
+#include <stdint.h>
+#include "v4l2_helper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Recording container
+ *
+ * The raw frames as captured, each followed by an index of their metadata:
+ *
+ *   offset 0             struct helper_record_header, padded to 'alignment'
+ *   offset 'alignment'   the frames, one after the other
+ *   'index_offset'       'n_frames' struct helper_record_entry, in order
+ *
+ * Every memory plane of a frame (see struct helper_mem_plane) is stored at an
+ * offset that is a multiple of 'alignment' and padded to the next one, so
+ * that frames are written straight from the capture buffers with O_DIRECT.
+ * All the fields are in host byte order.
+ *
+ * The 'record:' virtual source replays a recording (see the README).
+ */
+#define HELPER_RECORD_MAGIC      "V4L2REC1"
+#define HELPER_RECORD_VERSION    1
+#define HELPER_RECORD_ALIGNMENT  4096
+
+struct helper_record_header {
+	char magic[8];             /* HELPER_RECORD_MAGIC, not NUL terminated */
+	uint32_t version;
+	uint32_t alignment;
+	uint32_t pixelformat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesperline;     /* Of the first color plane */
+	uint32_t sizeimage;        /* Of all the memory planes together */
+	uint32_t n_mem_planes;
+	uint64_t n_frames;
+	uint64_t index_offset;
+	uint64_t dropped;          /* Frames dropped while recording (see struct helper_recorder_stats) */
+};
+
+struct helper_record_entry {
+	uint64_t offset;           /* Of the first memory plane of the frame */
+	int64_t tv_sec;            /* Capture time stamp */
+	int64_t tv_usec;
+	uint32_t sequence;
+	uint32_t flags;            /* V4L2_BUF_FLAG_*; V4L2_BUF_FLAG_ERROR also marks failed writes */
+	uint32_t bytesused[HELPER_MAX_PLANES];  /* Of each memory plane */
+	uint32_t reserved;
+};
+
+/*
+ * Recorder
+ *
+ * Writes the frames of a capture context to a recording with io_uring. The
+ * writes are asynchronous: a lease given to the recorder is held until the
+ * write of its frame completes, and only then released. So, the number of
+ * buffers of the context bounds the frames in flight; a recorder falling
+ * behind shows up as frames dropped by the driver.
+ *
+ * The submissions are batched: the kernel is entered once every 'batch'
+ * frames (and when completions are waited for) rather than once per frame.
+ * Completions are reaped from the completion ring without entering the
+ * kernel.
+ *
+ * The recording is written with O_DIRECT so that it doesn't go through (and
+ * evict) the page cache. Buffered writes are used instead, with a warning,
+ * when the file system doesn't support it or a buffer isn't aligned.
+ *
+ * Note: A recorder isn't thread safe; it must be used from the thread that
+ * acquires the leases.
+ */
+struct helper_recorder;
+
+struct helper_recorder_stats {
+	uint64_t frames;           /* Frames written */
+	uint64_t bytes;            /* Bytes written, padding included */
+	uint64_t dropped;          /* Frames dropped by the driver (sequence gaps) */
+	uint64_t rejected;         /* Frames not recorded as all the writes were in flight */
+	uint64_t write_errors;     /* Failed or short writes */
+	unsigned int in_flight;    /* Frames being written now */
+	unsigned int max_in_flight;
+	double seconds;            /* From the first submission to the last completion */
+	double mb_per_s;           /* Sustained write throughput (10^6 bytes per second) */
+	int direct;                /* Non-zero while O_DIRECT is used */
+};
+
+/*
+ * All functions return 0 on success and ERR ( a negative value) in case of failure.
+ *
+ * Creates (or truncates) the recording at 'path' for the frames of 'ctx',
+ * which must use the MMAP, USERPTR or DMABUF method. 'queue_depth' is the
+ * maximum number of frames in flight; 0 selects the number of buffers of
+ * 'ctx'. 'batch' is the number of frames submitted at once; 0 selects 1.
+ */
+int helper_recorder_create(struct helper_recorder **rec, struct helper_ctx *ctx, const char *path,
+		unsigned int queue_depth, unsigned int batch);
+
+/*
+ * Starts writing the frame of 'lease'. On success, the recorder takes over
+ * the lease, which is released once the write completes. Returns HELPER_AGAIN
+ * (leaving the lease to the caller, to be released) when 'queue_depth' frames
+ * are already in flight; the frame counts as rejected.
+ */
+int helper_recorder_submit(struct helper_recorder *rec, struct helper_lease *lease);
+
+/*
+ * Releases the leases of the frames whose writes have completed. When 'wait'
+ * is non-zero, submits the pending frames and waits for at least one write
+ * to complete if any is in flight. Returns the number of completed writes.
+ */
+int helper_recorder_reap(struct helper_recorder *rec, int wait);
+
+int helper_recorder_get_stats(struct helper_recorder *rec, struct helper_recorder_stats *stats);
+
+/*
+ * Waits for all the writes, writes the index and the header, and frees the
+ * recorder. The context must still be initialised.
+ */
+int helper_recorder_close(struct helper_recorder *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * opencv_v4l2 - v4l2_helper_share.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Header file for the v4l2_helper shared memory frame fan-out functions.
+
+#ifndef V4L2_HELPER_SHARE_H
+#define V4L2_HELPER_SHARE_H
+
+#include <stdint.h>
+#include "v4l2_helper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Frame fan-out to local processes
+ *
+ * A device can only be streamed from by a single process. A publisher, in
+ * that process, copies each frame once into a ring of slots in shared memory
+ * (a memfd) that any number of subscribers, in other processes, read the
+ * frames from without copying them.
+ *
+ * Subscribers connect to the publisher through a UNIX socket ('@' at the
+ * start of its path selects the abstract namespace), over which they get the
+ * memfd and an eventfd that is signalled for every frame published. They map
+ * the ring read-only: the frames of a lease must not be written to. The
+ * publisher accepts connections and notices disconnections when publishing,
+ * never waiting for a connecting subscriber: its request is answered on the
+ * first publish after it has arrived.
+ *
+ * Each subscriber has its own read cursor in the ring and holds at most one
+ * frame at a time, which the publisher doesn't overwrite until it's released.
+ * What happens to a subscriber that doesn't keep up is chosen when it
+ * connects:
+ *
+ *   HELPER_SHARE_DROP_OLDEST
+ *       Frames are read in order. A subscriber more than half the ring
+ *       behind skips to the newer half, dropping the frames in between, so
+ *       that the frame it holds isn't about to be overwritten (the default).
+ *   HELPER_SHARE_LATEST_ONLY
+ *       The latest frame is read; all the older ones are dropped.
+ *   HELPER_SHARE_BACKPRESSURE
+ *       No frame is dropped for this subscriber: a frame that would overwrite
+ *       one it hasn't read isn't published, to any subscriber. For consumers
+ *       that must see every frame published (e.g., a recorder).
+ *
+ * When /dev/udmabuf is available, the ring is also exported as a dma-buf, so
+ * that subscribers can import the frames into other devices (e.g., an encoder
+ * or a GPU) without copying them (see helper_subscriber_get_dmabuf()).
+ */
+#define HELPER_SHARE_MAX_SUBSCRIBERS 16
+
+enum helper_share_policy {
+	HELPER_SHARE_DROP_OLDEST = 0,
+	HELPER_SHARE_LATEST_ONLY,
+	HELPER_SHARE_BACKPRESSURE
+};
+
+struct helper_publisher;
+struct helper_subscriber;
+
+struct helper_share_subscriber_stats {
+	int active;
+	enum helper_share_policy policy;
+	uint64_t frames;           /* Frames read */
+	uint64_t dropped;          /* Frames published but not read */
+	uint64_t blocked;          /* Frames not published because of this subscriber */
+	uint64_t lag;              /* Frames published and not read yet */
+};
+
+struct helper_publisher_stats {
+	uint64_t published;
+	uint64_t blocked;          /* Frames not published (held or unread slot) */
+	unsigned int n_subscribers;
+	int has_dmabuf;
+	struct helper_share_subscriber_stats subscribers[HELPER_SHARE_MAX_SUBSCRIBERS];
+};
+
+/*
+ * All functions return 0 on success and ERR ( a negative value) in case of failure.
+ */
+
+/*
+ * Creates a publisher of the frames of 'ctx' listening on 'socket_path', with
+ * a ring of 'n_slots' frames (0: 8). The ring is allocated when the first
+ * frame is published, with slots as large as the buffers of that frame.
+ */
+int helper_publisher_create(struct helper_publisher **pub, struct helper_ctx *ctx, const char *socket_path,
+		unsigned int n_slots);
+
+/*
+ * Copies the frame of 'lease' to the ring and signals the subscribers. The
+ * lease is left to the caller. Returns HELPER_AGAIN if the frame wasn't
+ * published as its slot is held by a subscriber, or unread by a
+ * HELPER_SHARE_BACKPRESSURE one.
+ */
+int helper_publisher_publish(struct helper_publisher *pub, const struct helper_lease *lease);
+
+int helper_publisher_get_stats(struct helper_publisher *pub, struct helper_publisher_stats *stats);
+
+/*
+ * Disconnects the subscribers, which see the end of the stream, and frees the
+ * publisher.
+ */
+int helper_publisher_destroy(struct helper_publisher *pub);
+
+/*
+ * Connects to the publisher listening on 'socket_path'. This waits until the
+ * publisher publishes its next frame (or the one after, when the request
+ * arrives late).
+ */
+int helper_subscriber_connect(struct helper_subscriber **sub, const char *socket_path, enum helper_share_policy policy);
+
+/*
+ * Leases the next frame, as chosen by the policy of the subscriber, waiting
+ * up to 'timeout_ms' milliseconds (-1: forever) for one to be published. The
+ * lease describes the frame in the ring ('dropped' being the frames the
+ * subscriber missed before it) and must be released before the next one is
+ * acquired. Returns HELPER_AGAIN on timeout and ERR once the publisher is gone.
+ */
+int helper_subscriber_acquire(struct helper_subscriber *sub, struct helper_lease *lease, int timeout_ms);
+
+int helper_subscriber_release(struct helper_subscriber *sub, const struct helper_lease *lease);
+
+/*
+ * Returns the format of the frames.
+ */
+int helper_subscriber_get_format(struct helper_subscriber *sub, unsigned int *width, unsigned int *height, unsigned int *format);
+
+/*
+ * Returns an fd readable when frames have been published, to be polled
+ * along with other fds.
+ */
+int helper_subscriber_get_fd(struct helper_subscriber *sub);
+
+/*
+ * Gets the dma-buf of the ring and the offset of the frame of 'lease' in it.
+ * Fails if the ring isn't exported as a dma-buf. The dma-buf belongs to the
+ * subscriber.
+ */
+int helper_subscriber_get_dmabuf(struct helper_subscriber *sub, const struct helper_lease *lease, int *dmabuf_fd, size_t *offset);
+
+int helper_subscriber_disconnect(struct helper_subscriber *sub);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
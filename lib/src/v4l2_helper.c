@@ -5,9 +5,12 @@
  *
  */
 
+#define _GNU_SOURCE             /* memfd_create(), file sealing */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <fcntl.h>              /* low-level i/o */
 #include <unistd.h>
@@ -17,35 +20,242 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <time.h>
 
 #include <linux/videodev2.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+#include <linux/media.h>
 #include "v4l2_helper.h"
+#include "v4l2_helper_source.h"
+#include "v4l2_helper_probe.h"
+#include "v4l2_helper_alloc.h"
+#include "v4l2_helper_ctrl.h"
+#include "v4l2_helper_mode.h"
+#include "v4l2_helper_profile.h"
 
 #define NUM_BUFFS	4
+#define MIN_BUFFS	2
+#define MAX_BUFFS	16
+
+/*
+ * Adaptive ring depth tuning: number of frames to wait after resizing the
+ * ring before resizing it again and the number of consecutive frames without
+ * drops after which the ring is shrunk.
+ */
+#define ADAPT_SETTLE_FRAMES	30
+#define ADAPT_SHRINK_FRAMES	900
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
 
-struct buffer {
+/*
+ * A memory plane of a buffer. Buffers have a single memory plane except with
+ * the multi-planar API and a format storing its planes separately (e.g.,
+ * V4L2_PIX_FMT_NV12M).
+ */
+struct buffer_plane {
 	void   *start;
 	size_t  length;
+	int     dmabuf_fd;      /* -1 if the plane isn't (yet) backed by a dma-buf */
+	char    owns_dmabuf;    /* dmabuf_fd was created by the library */
+	size_t  alloc_length;   /* USERPTR: length of the mapping, 0 for heap memory */
 };
 
-/**
- * FIXME: All the state for the library is maintained via global variables.
- * So, it's not possible to use this library to access multiple devices
- * simultaneously. This is done to simplify the process of assessment.
- *
- * Hint: To access multiple devices at the same time using this application,
- * the public helper functions can be made to accept a new structure, that holds
- * the global state, as parameter.
+struct buffer {
+	struct buffer_plane planes[VIDEO_MAX_PLANES];
+	char    is_leased;
+	struct v4l2_buffer dq_buf; /* Valid only while the buffer is leased */
+	struct v4l2_plane dq_planes[VIDEO_MAX_PLANES]; /* dq_buf.m.planes with the multi-planar API */
+};
+
+/*
+ * Layout of the color planes of the YUV formats whose planes are exposed
+ * separately in leases. The chroma planes have height / 'vsub' lines of
+ * bytesperline / 'chroma_div' bytes, bytesperline being that of the luma
+ * plane unless the chroma planes are in memory planes of their own.
+ */
+struct color_planes {
+	unsigned int fourcc;
+	unsigned char n_planes;
+	unsigned char mem_planes;  /* Memory planes with the multi-planar API */
+	unsigned char vsub;
+	unsigned char chroma_div;
+};
+
+static const struct color_planes planar_formats[] = {
+	{ V4L2_PIX_FMT_NV12,    2, 1, 2, 1 },
+	{ V4L2_PIX_FMT_NV21,    2, 1, 2, 1 },
+	{ V4L2_PIX_FMT_NV16,    2, 1, 1, 1 },
+	{ V4L2_PIX_FMT_NV61,    2, 1, 1, 1 },
+	{ V4L2_PIX_FMT_YUV420,  3, 1, 2, 2 },
+	{ V4L2_PIX_FMT_YVU420,  3, 1, 2, 2 },
+	{ V4L2_PIX_FMT_NV12M,   2, 2, 2, 1 },
+	{ V4L2_PIX_FMT_NV21M,   2, 2, 2, 1 },
+	{ V4L2_PIX_FMT_NV16M,   2, 2, 1, 1 },
+	{ V4L2_PIX_FMT_NV61M,   2, 2, 1, 1 },
+	{ V4L2_PIX_FMT_YUV420M, 3, 3, 2, 2 },
+	{ V4L2_PIX_FMT_YVU420M, 3, 3, 2, 2 },
+};
+
+/*
+ * Bytes per pixel of the packed formats, used to check the line size given by
+ * the driver. Formats not listed here, other than the planar ones above, are
+ * trusted as is (e.g., compressed formats, whose lines have no fixed size).
+ */
+struct packed_format {
+	unsigned int fourcc;
+	unsigned char bytes_per_pixel;
+};
+
+static const struct packed_format packed_formats[] = {
+	{ V4L2_PIX_FMT_GREY,   1 },
+	{ V4L2_PIX_FMT_Y10,    2 },
+	{ V4L2_PIX_FMT_Y12,    2 },
+	{ V4L2_PIX_FMT_Y16,    2 },
+	{ V4L2_PIX_FMT_YUYV,   2 },
+	{ V4L2_PIX_FMT_UYVY,   2 },
+	{ V4L2_PIX_FMT_YVYU,   2 },
+	{ V4L2_PIX_FMT_VYUY,   2 },
+	{ V4L2_PIX_FMT_RGB565, 2 },
+	{ V4L2_PIX_FMT_RGB24,  3 },
+	{ V4L2_PIX_FMT_BGR24,  3 },
+	{ V4L2_PIX_FMT_RGB32,  4 },
+	{ V4L2_PIX_FMT_BGR32,  4 },
+};
+
+/*
+ * All the state needed to stream from a single device. Each device opened
+ * via helper_ctx_init_cam() gets its own context, so that a single process
+ * can stream from multiple devices simultaneously.
  */
+struct helper_ctx {
+	enum io_method      io;
+	int                 fd;
+	struct virt_source *src;           /* NULL unless a virtual source is used */
+	struct buffer      *buffers;
+	unsigned int        n_buffers;
+	unsigned int        req_buffers;   /* Number of buffers requested from the driver */
+	unsigned int        sizeimage;     /* Sum of the sizes of the memory planes */
+
+	/*
+	 * Negotiated format. With the single-planar API, there is one memory
+	 * plane described by plane_fmt[0].
+	 */
+	enum v4l2_buf_type  buf_type;      /* V4L2_BUF_TYPE_VIDEO_CAPTURE(_MPLANE) */
+	unsigned int        width;
+	unsigned int        height;
+	unsigned int        pixelformat;
+	unsigned int        n_mem_planes;
+	struct v4l2_plane_pix_format plane_fmt[VIDEO_MAX_PLANES];
+
+	/*
+	 * Adaptive ring depth state. Only accessed by the thread acquiring
+	 * leases.
+	 */
+	char                adaptive;
+	char                no_create_bufs; /* VIDIOC_CREATE_BUFS isn't supported */
+	unsigned int        min_buffers;
+	unsigned int        max_buffers;
+	size_t              memory_budget;
+	unsigned int        target_buffers;
+	unsigned int        frames_since_resize;
+	unsigned int        frames_without_drops;
+	char                has_last_sequence;
+	unsigned int        last_sequence;
+
+	/*
+	 * Latest frame only mode: frames dropped by the driver before the
+	 * frames skipped since the last lease.
+	 */
+	char                latest_frame_only;
+	unsigned int        skipped_dropped;
+
+	/*
+	 * dma-bufs given by the application for IO_METHOD_DMABUF. The library
+	 * allocates them itself when none are given.
+	 */
+	const int          *ext_dmabuf_fds;
+	unsigned int        n_ext_dmabuf_fds;
+
+	/*
+	 * Allocation options of the USERPTR buffers and the memory obtained
+	 * for the buffers of the ring.
+	 */
+	enum helper_alloc_pages alloc_pages;
+	char                lock_buffers;
+	int                 numa_node;
+	struct helper_buffer_memory memory;
+
+	/*
+	 * Capabilities of the device and, while it's being reconfigured, the
+	 * USERPTR buffer planes of the previous ring, to be reused by the new
+	 * one (see helper_ctx_reconfigure()).
+	 */
+	unsigned int        caps;
+	struct buffer_plane *spare_planes;
+	unsigned int        n_spare_planes;
+
+	/*
+	 * Leases can be released (and statistics queried) from a thread other
+	 * than the one acquiring them. So, the lease book-keeping and the
+	 * statistics are protected by this lock.
+	 */
+	pthread_mutex_t     lease_lock;
+	struct helper_stats stats;
+	unsigned int        n_leased;
+	int                 release_notify_fd;
+
+	/*
+	 * Lease used by helper_ctx_get_cam_frame()/helper_ctx_release_cam_frame()
+	 */
+	struct helper_lease frame_lease;
+	char                is_released;
+
+	/*
+	 * Latency probe; allocated when first enabled
+	 */
+	struct latency_probe *probe;
+	int                 probe_enabled;
+
+	/*
+	 * Control cache, created on first use. In frame controls mode, the
+	 * staged control updates are applied when a buffer is queued, within
+	 * the request of the buffer (see submit_buffer()) when the media
+	 * device is open.
+	 */
+	struct ctrl_cache  *ctrls;
+	char                frame_ctrls;
+	unsigned int        buf_caps;      /* V4L2_BUF_CAP_* reported by VIDIOC_REQBUFS */
+	int                 media_fd;      /* -1 unless requests are used */
+	int                 request_fds[VIDEO_MAX_FRAME];  /* Request per buffer, -1 until allocated */
+
+	/*
+	 * Capture modes, enumerated on first use, and the frame interval
+	 * requested (0/0: the driver's) and set (0/0: not known).
+	 */
+	struct helper_mode *modes;
+	unsigned int        n_modes;
+	char                has_modes;
+	struct v4l2_fract   req_interval;
+	struct v4l2_fract   interval;
+
+	/*
+	 * Initialisation timing. Once streaming, it's only updated with the
+	 * first frame, under the lease lock.
+	 */
+	struct helper_init_times init_times;
+	uint64_t            init_start_ns;
+	uint64_t            phase_start_ns;
+};
 
-static enum io_method   io = IO_METHOD_MMAP;
-static int              fd = -1;
-static struct buffer          *buffers;
-static unsigned int     n_buffers;
-static struct v4l2_buffer frame_buf;
-static char is_initialised = 0, is_released = 1;
+/*
+ * Context used by the legacy (context-less) public helper functions.
+ */
+static struct helper_ctx *default_ctx = NULL;
 
 /**
  * Start of static (internal) helper functions
@@ -61,14 +271,199 @@ static int xioctl(int fh, unsigned long request, void *arg)
 	return r;
 }
 
-static int set_io_method(enum io_method io_meth)
+/*
+ * Device access goes through the following so that virtual sources (see
+ * v4l2_helper_source.h) use the same code paths as real devices.
+ */
+static int dev_ioctl(struct helper_ctx *ctx, unsigned long request, void *arg)
+{
+	if (ctx->src)
+		return virt_source_ioctl(ctx->src, request, arg);
+
+	return xioctl(ctx->fd, request, arg);
+}
+
+/*
+ * dev_ioctl() for the internal modules, which don't know the context.
+ */
+static int module_ioctl(void *dev, unsigned long request, void *arg)
+{
+	return dev_ioctl((struct helper_ctx *) dev, request, arg);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/*
+ * Accounts the time since the end of the previous initialisation phase to
+ * 'phase'.
+ */
+static void end_init_phase(struct helper_ctx *ctx, enum helper_init_phase phase)
+{
+	uint64_t now = now_ns();
+
+	ctx->init_times.phase_ns[phase] += now - ctx->phase_start_ns;
+	ctx->phase_start_ns = now;
+}
+
+static void *dev_mmap(struct helper_ctx *ctx, size_t length, long offset)
+{
+	if (ctx->src)
+		return virt_source_mmap(ctx->src, length, offset);
+
+	return mmap(NULL /* start anywhere */,
+			length,
+			PROT_READ | PROT_WRITE /* required */,
+			MAP_SHARED /* recommended */,
+			ctx->fd, offset);
+}
+
+static int dev_munmap(struct helper_ctx *ctx, void *start, size_t length)
+{
+	if (ctx->src)
+		return virt_source_munmap(ctx->src, start, length);
+
+	return munmap(start, length);
+}
+
+static enum v4l2_memory buf_memory(struct helper_ctx *ctx)
+{
+	switch (ctx->io) {
+		case IO_METHOD_USERPTR:
+			return V4L2_MEMORY_USERPTR;
+
+		case IO_METHOD_DMABUF:
+			return V4L2_MEMORY_DMABUF;
+
+		default:
+			return V4L2_MEMORY_MMAP;
+	}
+}
+
+static int is_mplane(struct helper_ctx *ctx)
+{
+	return ctx->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+}
+
+/*
+ * Prepares 'buf' for a VIDIOC_QUERYBUF/QBUF/DQBUF of the buffer at 'index'.
+ * With the multi-planar API, the plane information is exchanged through
+ * 'planes', which must have room for VIDEO_MAX_PLANES planes.
+ */
+static void init_v4l2_buffer(struct helper_ctx *ctx, struct v4l2_buffer *buf, struct v4l2_plane *planes, unsigned int index)
+{
+	CLEAR(*buf);
+	buf->type = ctx->buf_type;
+	buf->memory = buf_memory(ctx);
+	buf->index = index;
+
+	if (is_mplane(ctx)) {
+		memset(planes, 0, VIDEO_MAX_PLANES * sizeof(*planes));
+		buf->m.planes = planes;
+		buf->length = ctx->n_mem_planes;
+	}
+}
+
+static const struct color_planes *find_planar_format(unsigned int fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(planar_formats) / sizeof(planar_formats[0]); i++)
+		if (planar_formats[i].fourcc == fourcc)
+			return &planar_formats[i];
+
+	return NULL;
+}
+
+/*
+ * Sets the minimum line and image sizes of a single-planar 'format' of
+ * 'width' x 'height' pixels. Returns ERR when they aren't known.
+ */
+static int min_pix_sizes(unsigned int format, unsigned int width, unsigned int height,
+		unsigned int *bytesperline, unsigned int *sizeimage)
+{
+	const struct color_planes *planar = find_planar_format(format);
+	unsigned int i;
+
+	if (planar) {
+		unsigned int chroma_lines = (height + planar->vsub - 1) / planar->vsub;
+
+		*bytesperline = width;
+		*sizeimage = width * height + (planar->n_planes - 1) * (width / planar->chroma_div) * chroma_lines;
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(packed_formats) / sizeof(packed_formats[0]); i++) {
+		if (packed_formats[i].fourcc == format) {
+			*bytesperline = width * packed_formats[i].bytes_per_pixel;
+			*sizeimage = *bytesperline * height;
+			return 0;
+		}
+	}
+
+	return ERR;
+}
+
+static void clear_buffer(struct buffer *buffer)
+{
+	unsigned int p;
+
+	memset(buffer, 0, sizeof(*buffer));
+	for (p = 0; p < VIDEO_MAX_PLANES; p++)
+		buffer->planes[p].dmabuf_fd = -1;
+}
+
+static struct buffer *alloc_buffers(unsigned int count)
+{
+	struct buffer *bufs = (struct buffer *) calloc(count, sizeof(*bufs));
+	unsigned int i;
+
+	if (bufs) {
+		for (i = 0; i < count; i++)
+			clear_buffer(&bufs[i]);
+	}
+
+	return bufs;
+}
+
+/*
+ * Synchronises CPU access to the dma-buf backed planes of a buffer. 'flags'
+ * is a combination of DMA_BUF_SYNC_* flags.
+ */
+static void sync_dmabuf(struct helper_ctx *ctx, struct buffer *buffer, unsigned long long flags)
+{
+	struct dma_buf_sync sync;
+	unsigned int p;
+
+	for (p = 0; p < ctx->n_mem_planes; p++) {
+		if (buffer->planes[p].dmabuf_fd < 0)
+			continue;
+
+		sync.flags = flags;
+		if (-1 == xioctl(buffer->planes[p].dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync))
+		{
+			/*
+			 * Errors ignored as not all exporters require (or
+			 * support) explicit synchronisation.
+			 */
+		}
+	}
+}
+
+static int set_io_method(struct helper_ctx *ctx, enum io_method io_meth)
 {
 	switch (io_meth)
 	{
 		case IO_METHOD_READ:
 		case IO_METHOD_MMAP:
 		case IO_METHOD_USERPTR:
-			io = io_meth;
+		case IO_METHOD_DMABUF:
+			ctx->io = io_meth;
 			return 0;
 		default:
 			fprintf(stderr, "Invalid I/O method\n");
@@ -76,268 +471,666 @@ static int set_io_method(enum io_method io_meth)
 	}
 }
 
-static int stop_capturing(void)
+static int stop_capturing(struct helper_ctx *ctx)
 {
 	enum v4l2_buf_type type;
 
-	switch (io) {
+	switch (ctx->io) {
 		case IO_METHOD_READ:
 			/* Nothing to do. */
 			break;
 
 		case IO_METHOD_MMAP:
 		case IO_METHOD_USERPTR:
-			type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			if (-1 == xioctl(fd, VIDIOC_STREAMOFF, &type))
+		case IO_METHOD_DMABUF:
+			type = ctx->buf_type;
+			if (-1 == dev_ioctl(ctx, VIDIOC_STREAMOFF, &type))
 			{
 				fprintf(stderr, "Error occurred when streaming off\n");
 				return ERR;
 			}
+
+			/* The control updates of the requests still queued may never apply */
+			if (ctx->media_fd >= 0 && ctx->ctrls)
+				ctrl_request_done(ctx->ctrls, -1, 0);
 			break;
 	}
 
 	return 0;
 }
 
-static int start_capturing(void)
+/*
+ * Opens the media device the video device belongs to, found in sysfs (e.g.,
+ * /sys/dev/char/81:0/device/media0), for the Request API.
+ */
+static int open_media_device(struct helper_ctx *ctx)
 {
-	unsigned int i;
-	enum v4l2_buf_type type;
-
-	switch (io) {
-		case IO_METHOD_READ:
-			/* Nothing to do. */
-			break;
+	struct stat st;
+	struct dirent *entry;
+	char path[300];
+	DIR *dir;
+	int fd = -1;
 
-		case IO_METHOD_MMAP:
-			for (i = 0; i < n_buffers; ++i) {
-				struct v4l2_buffer buf;
+	if (-1 == fstat(ctx->fd, &st))
+		return -1;
 
-				CLEAR(buf);
-				buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-				buf.memory = V4L2_MEMORY_MMAP;
-				buf.index = i;
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device", major(st.st_rdev), minor(st.st_rdev));
+	dir = opendir(path);
+	if (!dir)
+		return -1;
 
-				if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-				{
-					fprintf(stderr, "Error occurred when queueing buffer\n");
-					return ERR;
-				}
-			}
-			type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
-			{
-				fprintf(stderr, "Error occurred when turning on stream\n");
-				return ERR;
-			}
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "media", 5) == 0 && isdigit((unsigned char) entry->d_name[5])) {
+			snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+			fd = open(path, O_RDWR | O_CLOEXEC);
 			break;
+		}
+	}
+	closedir(dir);
 
-		case IO_METHOD_USERPTR:
-			for (i = 0; i < n_buffers; ++i) {
-				struct v4l2_buffer buf;
+	return fd;
+}
 
-				CLEAR(buf);
-				buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-				buf.memory = V4L2_MEMORY_USERPTR;
-				buf.index = i;
-				buf.m.userptr = (unsigned long)buffers[i].start;
-				buf.length = buffers[i].length;
+static int open_requests(struct helper_ctx *ctx)
+{
+	unsigned int i;
 
-				if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-				{
-					fprintf(stderr, "Error occurred when queueing buffer\n");
-					return ERR;
-				}
-			}
-			type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
-			{
-				fprintf(stderr, "Error when turning on stream\n");
-				return ERR;
-			}
-			break;
-	}
+	ctx->media_fd = open_media_device(ctx);
+	if (ctx->media_fd < 0)
+		return ERR;
+
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+		ctx->request_fds[i] = -1;
 
 	return 0;
 }
 
-static int uninit_device(void)
+static void close_requests(struct helper_ctx *ctx)
 {
 	unsigned int i;
-	int ret = 0;
 
-	switch (io) {
-		case IO_METHOD_READ:
-			free(buffers[0].start);
-			break;
-
-		case IO_METHOD_MMAP:
-			for (i = 0; i < n_buffers; ++i)
-				if (-1 == munmap(buffers[i].start, buffers[i].length))
-					ret = ERR;
-			break;
+	if (ctx->media_fd < 0)
+		return;
 
-		case IO_METHOD_USERPTR:
-			for (i = 0; i < n_buffers; ++i)
-				free(buffers[i].start);
-			break;
-	}
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+		if (ctx->request_fds[i] >= 0)
+			close(ctx->request_fds[i]);
 
-	free(buffers);
-	return ret;
+	close(ctx->media_fd);
+	ctx->media_fd = -1;
 }
 
-static int init_read(unsigned int buffer_size)
+/*
+ * Returns the request of the buffer at 'index', ready to be filled in: a
+ * request is allocated for each buffer once and re-initialised each time
+ * the buffer is queued again, its previous use being complete by then.
+ */
+static int buffer_request(struct helper_ctx *ctx, unsigned int index)
 {
-	buffers = (struct buffer *) calloc(1, sizeof(*buffers));
-
-	if (!buffers) {
-		fprintf(stderr, "Out of memory\n");
-		return ERR;
-	}
+	int *request_fd;
 
-	buffers[0].length = buffer_size;
-	buffers[0].start = malloc(buffer_size);
+	/* Drivers may give more buffers than asked for */
+	if (index >= VIDEO_MAX_FRAME)
+		return -1;
 
-	if (!buffers[0].start) {
-		fprintf(stderr, "Out of memory\n");
-		return ERR;
+	request_fd = &ctx->request_fds[index];
+	if (*request_fd < 0) {
+		if (-1 == xioctl(ctx->media_fd, MEDIA_IOC_REQUEST_ALLOC, request_fd)) {
+			*request_fd = -1;
+			return -1;
+		}
+	} else if (-1 == xioctl(*request_fd, MEDIA_REQUEST_IOC_REINIT, NULL)) {
+		return -1;
 	}
 
-	return 0;
+	return *request_fd;
 }
 
-static int init_mmap(void)
+/*
+ * Tells the control cache that the request of the buffer at 'index' has
+ * been applied (the buffer was filled) or won't be.
+ */
+static void complete_request(struct helper_ctx *ctx, unsigned int index, int applied)
 {
-	struct v4l2_requestbuffers req;
-	int ret = 0;
+	if (ctx->media_fd >= 0 && ctx->ctrls && index < VIDEO_MAX_FRAME && ctx->request_fds[index] >= 0)
+		ctrl_request_done(ctx->ctrls, ctx->request_fds[index], applied);
+}
 
-	CLEAR(req);
+/*
+ * Queues 'buf' to the driver. In frame controls mode, the staged control
+ * updates are written first, into the request the buffer is queued with
+ * when requests are used, so that a frame costs a single control ioctl
+ * however many controls change.
+ */
+static int submit_buffer(struct helper_ctx *ctx, struct v4l2_buffer *buf)
+{
+	int request_fd = -1;
+
+	buf->flags &= ~V4L2_BUF_FLAG_REQUEST_FD;
+	if (ctx->media_fd >= 0) {
+		/* Once a buffer is queued with a request, all of them must be */
+		request_fd = buffer_request(ctx, buf->index);
+		if (request_fd < 0) {
+			fprintf(stderr, "Error occurred when allocating a request\n");
+			return -1;
+		}
+		buf->flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf->request_fd = request_fd;
+	}
 
-	req.count = NUM_BUFFS;
-	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	req.memory = V4L2_MEMORY_MMAP;
+	/* A failed update is dropped; the frame is captured anyway */
+	if (ctx->frame_ctrls && ctx->ctrls)
+		ctrl_apply(ctx->ctrls, request_fd);
 
-	if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
-		if (EINVAL == errno) {
-			fprintf(stderr, "The device does not support "
-					"memory mapping\n");
-		}
-		return ERR;
+	if (-1 == dev_ioctl(ctx, VIDIOC_QBUF, buf)) {
+		complete_request(ctx, buf->index, 0);
+		return -1;
 	}
 
-	if (req.count < 1) {
-		fprintf(stderr, "Insufficient memory to allocate "
-				"buffers");
-		return ERR;
+	if (request_fd >= 0 && -1 == xioctl(request_fd, MEDIA_REQUEST_IOC_QUEUE, NULL)) {
+		fprintf(stderr, "Error occurred when queueing a request\n");
+		complete_request(ctx, buf->index, 0);
+		return -1;
 	}
 
-	buffers = (struct buffer *) calloc(req.count, sizeof(*buffers));
+	return 0;
+}
 
-	if (!buffers) {
-		fprintf(stderr, "Out of memory\n");
+/*
+ * Queues the buffer at 'index' of the capture ring to the driver.
+ */
+static int queue_buffer(struct helper_ctx *ctx, unsigned int index)
+{
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct buffer_plane *plane = ctx->buffers[index].planes;
+	unsigned int p;
+
+	init_v4l2_buffer(ctx, &buf, planes, index);
+
+	if (is_mplane(ctx)) {
+		for (p = 0; p < ctx->n_mem_planes; p++) {
+			if (ctx->io == IO_METHOD_USERPTR)
+				planes[p].m.userptr = (unsigned long)plane[p].start;
+			else if (ctx->io == IO_METHOD_DMABUF)
+				planes[p].m.fd = plane[p].dmabuf_fd;
+			planes[p].length = plane[p].length;
+		}
+	} else {
+		switch (ctx->io) {
+			case IO_METHOD_USERPTR:
+				buf.m.userptr = (unsigned long)plane[0].start;
+				buf.length = plane[0].length;
+				break;
+
+			case IO_METHOD_DMABUF:
+				buf.m.fd = plane[0].dmabuf_fd;
+				buf.length = plane[0].length;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	if (-1 == submit_buffer(ctx, &buf))
+	{
+		fprintf(stderr, "Error occurred when queueing buffer\n");
 		return ERR;
 	}
 
-	for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
-		int loop_err = 0;
-		struct v4l2_buffer buf;
+	return 0;
+}
 
-		CLEAR(buf);
-		buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory      = V4L2_MEMORY_MMAP;
-		buf.index       = n_buffers;
+static int start_capturing(struct helper_ctx *ctx)
+{
+	unsigned int i;
+	enum v4l2_buf_type type;
 
-		if (-1 == xioctl(fd, VIDIOC_QUERYBUF, &buf))
-		{
-			fprintf(stderr, "Error occurred when querying buffer\n");
-			loop_err = 1;
-			goto LOOP_FREE_EXIT;
-		}
+	switch (ctx->io) {
+		case IO_METHOD_READ:
+			/* Nothing to do. */
+			break;
 
-		buffers[n_buffers].length = buf.length;
-		buffers[n_buffers].start =
-			mmap(NULL /* start anywhere */,
-					buf.length,
-					PROT_READ | PROT_WRITE /* required */,
-					MAP_SHARED /* recommended */,
-					fd, buf.m.offset);
+		case IO_METHOD_MMAP:
+		case IO_METHOD_USERPTR:
+		case IO_METHOD_DMABUF:
+			for (i = 0; i < ctx->n_buffers; ++i) {
+				if (queue_buffer(ctx, i) < 0)
+					return ERR;
+			}
+			type = ctx->buf_type;
+			if (-1 == dev_ioctl(ctx, VIDIOC_STREAMON, &type))
+			{
+				fprintf(stderr, "Error occurred when turning on stream\n");
+				return ERR;
+			}
+			break;
+	}
+
+	return 0;
+}
+
+static int uninit_device(struct helper_ctx *ctx)
+{
+	unsigned int i, p;
+	int ret = 0;
 
-		if (MAP_FAILED == buffers[n_buffers].start) {
-			fprintf(stderr, "Error occurred when mapping memory\n");
-			loop_err = 1;
-			goto LOOP_FREE_EXIT;
+	if (ctx->io == IO_METHOD_READ) {
+		if (ctx->buffers)
+			free(ctx->buffers[0].planes[0].start);
+		free(ctx->buffers);
+		ctx->buffers = NULL;
+		return 0;
+	}
+
+	for (i = 0; i < ctx->n_buffers; ++i) {
+		for (p = 0; p < ctx->n_mem_planes; p++) {
+			struct buffer_plane *plane = &ctx->buffers[i].planes[p];
+
+			switch (ctx->io) {
+				case IO_METHOD_MMAP:
+					if (-1 == dev_munmap(ctx, plane->start, plane->length))
+						ret = ERR;
+					break;
+
+				case IO_METHOD_USERPTR:
+					free_userptr(plane->start, plane->alloc_length);
+					break;
+
+				case IO_METHOD_DMABUF:
+					if (-1 == munmap(plane->start, plane->length))
+						ret = ERR;
+					break;
+
+				default:
+					break;
+			}
+
+			/*
+			 * Close the dma-bufs created by the library (either allocated for
+			 * IO_METHOD_DMABUF or exported from MMAP buffers).
+			 */
+			if (plane->owns_dmabuf)
+				close(plane->dmabuf_fd);
 		}
+	}
 
-LOOP_FREE_EXIT:
-		if (loop_err)
-		{
-			unsigned int curr_buf_to_free;
-			for (curr_buf_to_free = 0;
-				curr_buf_to_free < n_buffers;
-				curr_buf_to_free++)
+	CLEAR(ctx->memory);
+	free(ctx->buffers);
+	ctx->buffers = NULL;
+	ctx->n_buffers = 0;
+	return ret;
+}
+
+/*
+ * Releases the memory planes of the buffer at 'index' after a failure to set
+ * it up.
+ */
+static void free_buffer_planes(struct helper_ctx *ctx, unsigned int index)
+{
+	unsigned int p;
+
+	for (p = 0; p < ctx->n_mem_planes; p++) {
+		struct buffer_plane *plane = &ctx->buffers[index].planes[p];
+
+		if (!plane->start)
+			continue;
+
+		if (ctx->io == IO_METHOD_MMAP) {
+			if (dev_munmap(ctx, plane->start, plane->length) != 0)
 			{
-				if (
-					munmap(buffers[curr_buf_to_free].start,
-					buffers[curr_buf_to_free].length) != 0
-				)
-				{
-					/*
-					 * Errors ignored as mapping itself
-					 * failed for a buffer
-					 */
-				}
+				/*
+				 * Errors ignored as mapping itself
+				 * failed for a buffer
+				 */
 			}
-			free(buffers);
+		} else if (ctx->io == IO_METHOD_USERPTR) {
+			free_userptr(plane->start, plane->alloc_length);
+		} else {
+			munmap(plane->start, plane->length);
+		}
+
+		if (plane->owns_dmabuf)
+			close(plane->dmabuf_fd);
+	}
+}
+
+/*
+ * Releases the memory planes of the first 'count' buffers after a failure
+ * to set up the ring.
+ */
+static void free_planes(struct helper_ctx *ctx, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		free_buffer_planes(ctx, i);
+}
+
+static int init_read(struct helper_ctx *ctx, unsigned int buffer_size)
+{
+	ctx->buffers = alloc_buffers(1);
+
+	if (!ctx->buffers) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	ctx->buffers[0].planes[0].length = buffer_size;
+	ctx->buffers[0].planes[0].start = malloc(buffer_size);
+
+	if (!ctx->buffers[0].planes[0].start) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocates a dma-buf of (at least) 'size' bytes using udmabuf, backed by a
+ * memfd. This works on any kernel with udmabuf support without the need for
+ * a dedicated allocator device (e.g., a dma-heap).
+ */
+static int alloc_udmabuf(size_t size)
+{
+	struct udmabuf_create create;
+	int memfd, devfd, dmabuf_fd;
+
+	devfd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (-1 == devfd) {
+		fprintf(stderr, "Cannot open '/dev/udmabuf': %d, %s\n",
+				errno, strerror(errno));
+		return ERR;
+	}
+
+	memfd = memfd_create("v4l2_helper", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	if (
+		-1 == memfd ||
+		-1 == ftruncate(memfd, size) ||
+		/* udmabuf requires the memfd to be sealed against shrinking */
+		-1 == fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)
+	)
+	{
+		fprintf(stderr, "Error occurred when creating memfd: %d, %s\n",
+				errno, strerror(errno));
+		if (memfd != -1)
+			close(memfd);
+		close(devfd);
+		return ERR;
+	}
+
+	CLEAR(create);
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size = size;
+
+	dmabuf_fd = xioctl(devfd, UDMABUF_CREATE, &create);
+	if (-1 == dmabuf_fd) {
+		fprintf(stderr, "Error occurred when creating udmabuf: %d, %s\n",
+				errno, strerror(errno));
+	}
+
+	/*
+	 * The dma-buf holds a reference to the memfd pages. So, the memfd
+	 * is no longer needed.
+	 */
+	close(memfd);
+	close(devfd);
+
+	return (-1 == dmabuf_fd) ? ERR : dmabuf_fd;
+}
+
+/*
+ * Accounts for the memory of a USERPTR buffer plane in what the ring got:
+ * the options obtained for every buffer.
+ */
+static void note_buffer_memory(struct helper_ctx *ctx, const struct userptr_alloc *alloc, size_t size)
+{
+	struct helper_buffer_memory *memory = &ctx->memory;
+	size_t page_size = getpagesize();
+	size_t length = (alloc->length) ? alloc->length : ((size + page_size - 1) / page_size) * page_size;
+
+	if (memory->bytes == 0) {
+		memory->pages = alloc->pages;
+		memory->locked = alloc->locked;
+		memory->numa_node = alloc->numa_node;
+	} else {
+		if (alloc->pages < memory->pages)
+			memory->pages = alloc->pages;
+		memory->locked = memory->locked && alloc->locked;
+		if (alloc->numa_node != memory->numa_node)
+			memory->numa_node = -1;
+	}
+	memory->bytes += length;
+}
+
+/*
+ * Takes the smallest spare USERPTR plane of at least 'size' bytes for
+ * 'plane'. Returns ERR if none is large enough.
+ */
+static int take_spare_plane(struct helper_ctx *ctx, size_t size, struct buffer_plane *plane)
+{
+	size_t page_size = getpagesize(), length;
+	unsigned int i, best = ctx->n_spare_planes;
+
+	for (i = 0; i < ctx->n_spare_planes; i++) {
+		if (
+			ctx->spare_planes[i].length >= size &&
+			(best == ctx->n_spare_planes || ctx->spare_planes[i].length < ctx->spare_planes[best].length)
+		)
+		{
+			best = i;
+		}
+	}
+
+	if (best == ctx->n_spare_planes)
+		return ERR;
+
+	*plane = ctx->spare_planes[best];
+	ctx->spare_planes[best] = ctx->spare_planes[--ctx->n_spare_planes];
+	length = (plane->alloc_length) ? plane->alloc_length : ((plane->length + page_size - 1) / page_size) * page_size;
+	ctx->memory.bytes += length;
+	ctx->memory.reused_bytes += length;
+	return 0;
+}
+
+static void free_spare_planes(struct helper_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->n_spare_planes; i++)
+		free_userptr(ctx->spare_planes[i].start, ctx->spare_planes[i].alloc_length);
+
+	free(ctx->spare_planes);
+	ctx->spare_planes = NULL;
+	ctx->n_spare_planes = 0;
+}
+
+/*
+ * Sets up the memory of each plane of the buffer at 'index' of the ring;
+ * maps the driver's memory for MMAP and allocates it for USERPTR and DMABUF.
+ * On failure, the planes set up so far are left for free_planes().
+ */
+static int setup_buffer(struct helper_ctx *ctx, unsigned int index)
+{
+	struct buffer *buffer = &ctx->buffers[index];
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	size_t page_size = getpagesize();
+	unsigned int p;
+
+	buffer->is_leased = 0;
+
+	if (ctx->io == IO_METHOD_MMAP) {
+		init_v4l2_buffer(ctx, &buf, planes, index);
+
+		if (-1 == dev_ioctl(ctx, VIDIOC_QUERYBUF, &buf))
+		{
+			fprintf(stderr, "Error occurred when querying buffer\n");
 			return ERR;
 		}
 	}
 
-	return ret;
+	for (p = 0; p < ctx->n_mem_planes; p++) {
+		struct buffer_plane *plane = &buffer->planes[p];
+		size_t size = ctx->plane_fmt[p].sizeimage;
+		struct userptr_alloc alloc;
+		void *start;
+
+		plane->start = NULL;
+		plane->dmabuf_fd = -1;
+		plane->owns_dmabuf = 0;
+		plane->alloc_length = 0;
+
+		switch (ctx->io) {
+			case IO_METHOD_MMAP:
+				plane->length = (is_mplane(ctx)) ? planes[p].length : buf.length;
+				start = dev_mmap(ctx, plane->length,
+						(is_mplane(ctx)) ? planes[p].m.mem_offset : buf.m.offset);
+				if (MAP_FAILED == start)
+				{
+					fprintf(stderr, "Error occurred when mapping memory\n");
+					return ERR;
+				}
+				plane->start = start;
+				break;
+
+			case IO_METHOD_USERPTR:
+				/* The length of a reused plane is what it can hold */
+				if (take_spare_plane(ctx, size, plane) == 0)
+					break;
+
+				plane->length = size;
+				if (alloc_userptr(size, ctx->alloc_pages, ctx->lock_buffers, ctx->numa_node, &alloc) < 0)
+					return ERR;
+				plane->start = alloc.start;
+				plane->alloc_length = alloc.length;
+				note_buffer_memory(ctx, &alloc, size);
+
+				/*
+				 * Options that couldn't be honoured are dropped for the
+				 * next buffers, so that they are reported only once.
+				 */
+				if (ctx->alloc_pages != HELPER_ALLOC_HEAP)
+					ctx->alloc_pages = alloc.pages;
+				ctx->lock_buffers = alloc.locked;
+				ctx->numa_node = alloc.numa_node;
+				break;
+
+			case IO_METHOD_DMABUF:
+				if (ctx->ext_dmabuf_fds) {
+					off_t ext_size = lseek(ctx->ext_dmabuf_fds[index], 0, SEEK_END);
+
+					plane->dmabuf_fd = ctx->ext_dmabuf_fds[index];
+					plane->length = (ext_size > 0) ? (size_t) ext_size : size;
+					if (plane->length < size) {
+						fprintf(stderr, "Given dma-buf is smaller than the image size\n");
+						return ERR;
+					}
+				} else {
+					plane->length = ((size + page_size - 1) / page_size) * page_size;
+					plane->dmabuf_fd = alloc_udmabuf(plane->length);
+					if (plane->dmabuf_fd < 0)
+						return ERR;
+					plane->owns_dmabuf = 1;
+				}
+
+				/*
+				 * Map the dma-buf so that the frame data can also be accessed
+				 * by the CPU, like the other I/O methods.
+				 */
+				start = mmap(NULL, plane->length, PROT_READ | PROT_WRITE,
+						MAP_SHARED, plane->dmabuf_fd, 0);
+				if (MAP_FAILED == start)
+				{
+					fprintf(stderr, "Error occurred when mapping dma-buf\n");
+					if (plane->owns_dmabuf)
+						close(plane->dmabuf_fd);
+					plane->owns_dmabuf = 0;
+					return ERR;
+				}
+				plane->start = start;
+				break;
+
+			default:
+				return ERR;
+		}
+	}
+
+	return 0;
 }
 
-static int init_userp(unsigned int buffer_size)
+/*
+ * Requests the buffers of the ring from the driver, for the MMAP, USERPTR and
+ * DMABUF methods, and sets up their memory.
+ */
+static int init_streaming(struct helper_ctx *ctx)
 {
 	struct v4l2_requestbuffers req;
 
 	CLEAR(req);
 
-	req.count  = NUM_BUFFS;
-	req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	req.memory = V4L2_MEMORY_USERPTR;
+	req.count  = (ctx->n_ext_dmabuf_fds) ? ctx->n_ext_dmabuf_fds : ctx->req_buffers;
+	req.type   = ctx->buf_type;
+	req.memory = buf_memory(ctx);
+
+	if (ctx->n_ext_dmabuf_fds && ctx->n_mem_planes != 1) {
+		fprintf(stderr, "Application-given dma-bufs need a format with a single memory plane\n");
+		return ERR;
+	}
 
-	if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
+	if (-1 == dev_ioctl(ctx, VIDIOC_REQBUFS, &req)) {
 		if (EINVAL == errno) {
-			fprintf(stderr, "The device does not "
-					"support user pointer i/o\n");
+			switch (ctx->io) {
+				case IO_METHOD_MMAP:
+					fprintf(stderr, "The device does not support "
+							"memory mapping\n");
+					break;
+
+				case IO_METHOD_USERPTR:
+					fprintf(stderr, "The device does not "
+							"support user pointer i/o\n");
+					break;
+
+				default:
+					fprintf(stderr, "The device does not "
+							"support dma-buf i/o\n");
+					break;
+			}
 		}
 		return ERR;
 	}
 
-	buffers = (struct buffer *) calloc(req.count, sizeof(*buffers));
+	ctx->buf_caps = req.capabilities;
+
+	if (req.count < 1) {
+		fprintf(stderr, "Insufficient memory to allocate "
+				"buffers");
+		return ERR;
+	}
+
+	if (ctx->n_ext_dmabuf_fds && req.count != ctx->n_ext_dmabuf_fds) {
+		fprintf(stderr, "The device does not support %u dma-buf buffers\n",
+				ctx->n_ext_dmabuf_fds);
+		return ERR;
+	}
+
+	ctx->buffers = alloc_buffers(req.count);
 
-	if (!buffers) {
+	if (!ctx->buffers) {
 		fprintf(stderr, "Out of memory\n");
 		return ERR;
 	}
 
-	for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
-		buffers[n_buffers].length = buffer_size;
-		if(posix_memalign(&buffers[n_buffers].start,getpagesize(),buffer_size) != 0)
-		{
-			/*
-			 * This happens only in case of ENOMEM
-			 */
-			unsigned int curr_buf_to_free;
-			for (curr_buf_to_free = 0;
-				curr_buf_to_free < n_buffers;
-				curr_buf_to_free++
-			)
-			{
-				free(buffers[curr_buf_to_free].start);
-			}
-			free(buffers);
-			fprintf(stderr, "Error occurred when allocating memory for buffers\n");
+	for (ctx->n_buffers = 0; ctx->n_buffers < req.count; ++ctx->n_buffers) {
+		if (setup_buffer(ctx, ctx->n_buffers) < 0) {
+			free_planes(ctx, ctx->n_buffers + 1);
+			free(ctx->buffers);
+			ctx->buffers = NULL;
+			ctx->n_buffers = 0;
 			return ERR;
 		}
 	}
@@ -345,407 +1138,2109 @@ static int init_userp(unsigned int buffer_size)
 	return 0;
 }
 
-static int init_device(unsigned int width, unsigned int height, unsigned int format)
+static int init_buffers(struct helper_ctx *ctx)
+{
+	if (ctx->io == IO_METHOD_READ)
+		return init_read(ctx, ctx->sizeimage);
+
+	return init_streaming(ctx);
+}
+
+/*
+ * Sets the format with the multi-planar API. Returns the format the driver
+ * picked in 'fmt'.
+ */
+static int set_format_mplane(struct helper_ctx *ctx, struct v4l2_format *fmt, unsigned int width, unsigned int height, unsigned int format)
+{
+	const struct color_planes *planar = find_planar_format(format);
+	unsigned int p;
+
+	CLEAR(*fmt);
+
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt->fmt.pix_mp.width       = width;
+	fmt->fmt.pix_mp.height      = height;
+	fmt->fmt.pix_mp.pixelformat = format;
+	fmt->fmt.pix_mp.field       = V4L2_FIELD_ANY;
+	fmt->fmt.pix_mp.num_planes  = (planar) ? planar->mem_planes : 1;
+
+	if (-1 == dev_ioctl(ctx, VIDIOC_S_FMT, fmt))
+	{
+		fprintf(stderr, "Error occurred when trying to set format\n");
+		return ERR;
+	}
+
+	if (fmt->fmt.pix_mp.num_planes < 1 || fmt->fmt.pix_mp.num_planes > VIDEO_MAX_PLANES)
+	{
+		fprintf(stderr, "Driver returned an invalid number of planes: %u\n",
+				fmt->fmt.pix_mp.num_planes);
+		return ERR;
+	}
+
+	ctx->n_mem_planes = fmt->fmt.pix_mp.num_planes;
+	ctx->sizeimage = 0;
+	for (p = 0; p < ctx->n_mem_planes; p++) {
+		ctx->plane_fmt[p] = fmt->fmt.pix_mp.plane_fmt[p];
+		ctx->sizeimage += ctx->plane_fmt[p].sizeimage;
+	}
+
+	return 0;
+}
+
+/*
+ * Picks the buffer type for 'format' among those supported by the device and
+ * checks that the device supports the I/O method.
+ */
+static int check_caps(struct helper_ctx *ctx, unsigned int format)
+{
+	const struct color_planes *planar = find_planar_format(format);
+
+	/*
+	 * The multi-planar API is used when the device only supports that one
+	 * (e.g., most ISPs and codecs) or when the format has its planes in
+	 * separate buffers (e.g., V4L2_PIX_FMT_NV12M), which can't be described
+	 * with the single-planar one.
+	 */
+	if (
+		(ctx->caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) &&
+		(!(ctx->caps & V4L2_CAP_VIDEO_CAPTURE) || (planar && planar->mem_planes > 1))
+	)
+	{
+		ctx->buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	}
+	else if (ctx->caps & V4L2_CAP_VIDEO_CAPTURE)
+	{
+		ctx->buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	}
+	else
+	{
+		fprintf(stderr, "Given device is no video capture device\n");
+		return ERR;
+	}
+
+	switch (ctx->io) {
+		case IO_METHOD_READ:
+			if (!(ctx->caps & V4L2_CAP_READWRITE)) {
+				fprintf(stderr, "Given device does not "
+						"support read i/o\n");
+				return ERR;
+			}
+			break;
+
+		case IO_METHOD_MMAP:
+		case IO_METHOD_USERPTR:
+		case IO_METHOD_DMABUF:
+			if (!(ctx->caps & V4L2_CAP_STREAMING)) {
+				fprintf(stderr, "Given device does not "
+						"support streaming i/o\n");
+				return ERR;
+			}
+			break;
+	}
+
+	return 0;
+}
+
+static int same_interval(const struct v4l2_fract *a, const struct v4l2_fract *b)
+{
+	return (uint64_t) a->numerator * b->denominator == (uint64_t) b->numerator * a->denominator;
+}
+
+/*
+ * Sets the frame interval requested, if any, after the format as drivers
+ * reset it to the default of the format (e.g., UVC). The driver rounds it to
+ * one it supports, which is only warned about.
+ */
+static void set_frame_interval(struct helper_ctx *ctx)
+{
+	struct v4l2_streamparm parm;
+
+	CLEAR(parm);
+	parm.type = ctx->buf_type;
+
+	if (ctx->req_interval.numerator && ctx->req_interval.denominator) {
+		parm.parm.capture.timeperframe = ctx->req_interval;
+		if (-1 == dev_ioctl(ctx, VIDIOC_S_PARM, &parm) || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+			fprintf(stderr, "Warning: the frame interval of the device can't be set\n");
+		} else if (!same_interval(&parm.parm.capture.timeperframe, &ctx->req_interval)) {
+			fprintf(stderr, "Warning: frame interval %u/%u set instead of %u/%u\n",
+					parm.parm.capture.timeperframe.numerator, parm.parm.capture.timeperframe.denominator,
+					ctx->req_interval.numerator, ctx->req_interval.denominator);
+		}
+	} else if (-1 == dev_ioctl(ctx, VIDIOC_G_PARM, &parm)) {
+		CLEAR(parm);
+	}
+
+	ctx->interval = parm.parm.capture.timeperframe;
+}
+
+/*
+ * Sets the format with the buffer type picked by check_caps() and checks that
+ * the driver accepted it as is.
+ */
+static int set_format(struct helper_ctx *ctx, unsigned int width, unsigned int height, unsigned int format)
 {
-	struct v4l2_capability cap;
-	struct v4l2_cropcap cropcap;
-	struct v4l2_crop crop;
 	struct v4l2_format fmt;
-	unsigned int min;
+	unsigned int min_bpl, min_size, got_width, got_height, got_format;
 
-	if (-1 == xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
-		if (EINVAL == errno) {
-			fprintf(stderr, "Given device is no V4L2 device\n");
+	if (is_mplane(ctx))
+	{
+		if (ctx->io == IO_METHOD_READ)
+		{
+			fprintf(stderr, "Read i/o is not supported with the multi-planar API\n");
+			return ERR;
 		}
-		fprintf(stderr, "Error occurred when querying capabilities\n");
+
+		if (set_format_mplane(ctx, &fmt, width, height, format) < 0)
+			return ERR;
+
+		got_width = fmt.fmt.pix_mp.width;
+		got_height = fmt.fmt.pix_mp.height;
+		got_format = fmt.fmt.pix_mp.pixelformat;
+	}
+	else
+	{
+		CLEAR(fmt);
+
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		fmt.fmt.pix.width       = width;
+		fmt.fmt.pix.height      = height;
+		fmt.fmt.pix.pixelformat = format;
+		fmt.fmt.pix.field       = V4L2_FIELD_ANY;
+
+		if (-1 == dev_ioctl(ctx, VIDIOC_S_FMT, &fmt))
+		{
+			fprintf(stderr, "Error occurred when trying to set format\n");
+			return ERR;
+		}
+
+		got_width = fmt.fmt.pix.width;
+		got_height = fmt.fmt.pix.height;
+		got_format = fmt.fmt.pix.pixelformat;
+		ctx->n_mem_planes = 1;
+
+		/*
+		 * Buggy driver paranoia. The minimum sizes depend on the
+		 * format; unknown (e.g., compressed) formats are trusted.
+		 */
+		if (
+			min_pix_sizes(got_format, got_width, got_height, &min_bpl, &min_size) == 0 &&
+			min_bpl > 0
+		) {
+			if (fmt.fmt.pix.bytesperline < min_bpl)
+				fmt.fmt.pix.bytesperline = min_bpl;
+
+			/* All the planes scale with the line size */
+			min_size = (unsigned int) ((uint64_t) min_size * fmt.fmt.pix.bytesperline / min_bpl);
+			if (fmt.fmt.pix.sizeimage < min_size)
+				fmt.fmt.pix.sizeimage = min_size;
+		}
+
+		ctx->plane_fmt[0].bytesperline = fmt.fmt.pix.bytesperline;
+		ctx->plane_fmt[0].sizeimage = fmt.fmt.pix.sizeimage;
+		ctx->sizeimage = fmt.fmt.pix.sizeimage;
+	}
+
+	/* Note VIDIOC_S_FMT may change width and height. */
+
+	printf("pixfmt = %c %c %c %c \n", (got_format & 0x000000ff) , (got_format & 0x0000ff00) >>8 , (got_format & 0x00ff0000) >>16, (got_format & 0xff000000) >>24 );
+	printf("width = %d height = %d\n",got_width,got_height);
+
+	if (
+		got_width != width ||
+		got_height != height ||
+		got_format != format
+	)
+	{
+		fprintf(stderr, "Warning: The current format does not match requested format/resolution!\n");
+		return ERR;
+	}
+
+	ctx->width = got_width;
+	ctx->height = got_height;
+	ctx->pixelformat = got_format;
+	set_frame_interval(ctx);
+	return 0;
+}
+
+/*
+ * Buffer type of the capture modes enumerated before a format is set: the
+ * single-planar one unless the device only supports the multi-planar one.
+ */
+static unsigned int default_buf_type(struct helper_ctx *ctx)
+{
+	return (ctx->caps & V4L2_CAP_VIDEO_CAPTURE) ? V4L2_BUF_TYPE_VIDEO_CAPTURE : V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+}
+
+/*
+ * Enumerates the capture modes on first use, for the buffer type picked by
+ * check_caps() or, before a format is set, the default one.
+ */
+static int get_modes(struct helper_ctx *ctx)
+{
+	unsigned int buf_type = (ctx->buf_type) ? (unsigned int) ctx->buf_type : default_buf_type(ctx);
+
+	if (ctx->has_modes)
+		return 0;
+
+	if (mode_enumerate(module_ioctl, ctx, buf_type, &ctx->modes, &ctx->n_modes) < 0)
+		return ERR;
+
+	ctx->has_modes = 1;
+	return 0;
+}
+
+static void print_mode(const char *label, const struct helper_mode *mode)
+{
+	printf("%s: %c%c%c%c %ux%u", label, mode->format & 0xff, (mode->format >> 8) & 0xff,
+			(mode->format >> 16) & 0xff, (mode->format >> 24) & 0xff, mode->width, mode->height);
+	if (mode->interval.numerator && mode->interval.denominator)
+		printf(" at %.2f fps", (double) mode->interval.denominator / mode->interval.numerator);
+	printf("\n");
+}
+
+/*
+ * Selects the mode meeting 'target' (see helper_ctx_select_mode()) as the
+ * one to initialise the device with.
+ */
+static int select_init_mode(struct helper_ctx *ctx, const struct helper_mode_target *target,
+		unsigned int *width, unsigned int *height, unsigned int *format)
+{
+	struct helper_mode mode;
+
+	if (get_modes(ctx) < 0 || mode_select(ctx->modes, ctx->n_modes, target, &mode) < 0)
+		return ERR;
+
+	print_mode("Selected mode", &mode);
+	*width = mode.width;
+	*height = mode.height;
+	*format = mode.format;
+	ctx->req_interval = mode.interval;
+	return 0;
+}
+
+/*
+ * Resets the crop rectangle to the default one. With a profile of the
+ * device, cropping is only probed the first time, and the rectangle only
+ * reset when it isn't the default one already, as drivers may reprogram
+ * the sensor even when it doesn't change.
+ */
+static void reset_crop(struct helper_ctx *ctx, struct device_profile *profile)
+{
+	struct v4l2_cropcap cropcap;
+	struct v4l2_crop crop;
+	int has_cropcap;
+
+	if (profile && profile->has_crop) {
+		if (!profile->crop_supported)
+			return;
+
+		CLEAR(crop);
+		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (
+			0 == dev_ioctl(ctx, VIDIOC_G_CROP, &crop) &&
+			!memcmp(&crop.c, &profile->crop_default, sizeof(crop.c))
+		)
+			return;
+
+		crop.c = profile->crop_default;
+		/* Errors ignored, as below. */
+		dev_ioctl(ctx, VIDIOC_S_CROP, &crop);
+		return;
+	}
+
+	CLEAR(cropcap);
+
+	cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	has_cropcap = (0 == dev_ioctl(ctx, VIDIOC_CROPCAP, &cropcap));
+	if (has_cropcap) {
+		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		crop.c = cropcap.defrect; /* reset to default */
+
+		if (-1 == dev_ioctl(ctx, VIDIOC_S_CROP, &crop)) {
+			switch (errno) {
+				case EINVAL:
+					/* Cropping not supported. */
+					break;
+				default:
+					/* Errors ignored. */
+					break;
+			}
+		}
+	} else {
+		/* Errors ignored. */
+	}
+
+	/* Drivers that can't crop may still implement VIDIOC_CROPCAP */
+	if (profile) {
+		CLEAR(crop);
+		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		profile->has_crop = 1;
+		profile->crop_supported = (has_cropcap && 0 == dev_ioctl(ctx, VIDIOC_G_CROP, &crop));
+		profile->crop_default = cropcap.defrect;
+	}
+}
+
+/*
+ * Takes the capture modes of the profile of the device, if it has those of
+ * the default buffer type.
+ */
+static void take_profile_modes(struct helper_ctx *ctx, struct device_profile *profile)
+{
+	if (!profile->has_modes || profile->modes_buf_type != default_buf_type(ctx))
+		return;
+
+	ctx->modes = profile->modes;
+	ctx->n_modes = profile->n_modes;
+	ctx->has_modes = 1;
+	profile->modes = NULL;
+}
+
+static int init_device(struct helper_ctx *ctx, const struct helper_cam_params *params)
+{
+	unsigned int width = params->width, height = params->height, format = params->format;
+	struct v4l2_capability cap;
+	struct device_profile profile;
+	int warm_start = 0, ret;
+
+	if (-1 == dev_ioctl(ctx, VIDIOC_QUERYCAP, &cap)) {
+		if (EINVAL == errno) {
+			fprintf(stderr, "Given device is no V4L2 device\n");
+		}
+		fprintf(stderr, "Error occurred when querying capabilities\n");
+		return ERR;
+	}
+
+	ctx->caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	end_init_phase(ctx, HELPER_INIT_QUERYCAP);
+
+	if (params->profile_path) {
+		profile_init(&profile, &cap);
+		warm_start = profile_load(params->profile_path, &profile);
+		take_profile_modes(ctx, &profile);
+		free(profile.modes);
+		profile.modes = NULL;
+		ctx->init_times.warm_start = warm_start;
+		end_init_phase(ctx, HELPER_INIT_PROFILE);
+	}
+
+	if (params->target) {
+		if (select_init_mode(ctx, params->target, &width, &height, &format) < 0)
+			return ERR;
+		end_init_phase(ctx, HELPER_INIT_MODES);
+	}
+
+	if (check_caps(ctx, format) < 0)
+		return ERR;
+
+	/* Select video input, video standard and tune here. */
+
+	reset_crop(ctx, (params->profile_path) ? &profile : NULL);
+	end_init_phase(ctx, HELPER_INIT_CROP);
+
+	if (set_format(ctx, width, height, format) < 0)
+		return ERR;
+	end_init_phase(ctx, HELPER_INIT_FORMAT);
+
+	ret = init_buffers(ctx);
+	end_init_phase(ctx, HELPER_INIT_BUFFERS);
+
+	/*
+	 * The profile is written again only when something new was probed:
+	 * on a cold start, or when the modes were enumerated for the first
+	 * time.
+	 */
+	if (ret == 0 && params->profile_path && (!warm_start || (ctx->has_modes && !profile.has_modes))) {
+		profile.has_modes = ctx->has_modes;
+		profile.modes_buf_type = default_buf_type(ctx);
+		profile.modes = ctx->modes;
+		profile.n_modes = ctx->n_modes;
+		/* Not being able to write it isn't fatal */
+		profile_save(params->profile_path, &profile);
+		end_init_phase(ctx, HELPER_INIT_PROFILE);
+	}
+
+	return ret;
+}
+
+static int close_device(struct helper_ctx *ctx)
+{
+	if (ctx->src) {
+		virt_source_close(ctx->src);
+		ctx->src = NULL;
+	}
+	else if (-1 == close(ctx->fd))
+	{
+		fprintf(stderr, "Error occurred when closing device\n");
+		return ERR;
+	}
+
+	ctx->fd = -1;
+
+	return 0;
+}
+
+static int open_device(struct helper_ctx *ctx, const char *dev_name)
+{
+	struct stat st;
+
+	if (virt_source_is_virtual(dev_name)) {
+		ctx->fd = virt_source_open(&ctx->src, dev_name);
+		return ctx->fd;
+	}
+
+	if (-1 == stat(dev_name, &st)) {
+		fprintf(stderr, "Cannot identify '%s': %d, %s\n",
+				dev_name, errno, strerror(errno));
+		return ERR;
+	}
+
+	if (!S_ISCHR(st.st_mode)) {
+		fprintf(stderr, "%s is no device\n", dev_name);
+		return ERR;
+	}
+
+	ctx->fd = open(dev_name, O_RDWR /* required */ | O_NONBLOCK, 0);
+
+	if (-1 == ctx->fd) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n",
+				dev_name, errno, strerror(errno));
+		return ERR;
+	}
+
+	return ctx->fd;
+}
+/*
+ * Dequeues a filled buffer into 'buf' without waiting. Returns HELPER_AGAIN
+ * when no filled buffer is available. 'planes' receives the planes with the
+ * multi-planar API (see init_v4l2_buffer()).
+ */
+static int try_dequeue_buffer(struct helper_ctx *ctx, struct v4l2_buffer *buf, struct v4l2_plane *planes)
+{
+	init_v4l2_buffer(ctx, buf, planes, 0);
+
+	if (-1 == dev_ioctl(ctx, VIDIOC_DQBUF, buf)) {
+		switch (errno) {
+			case EAGAIN:
+				pthread_mutex_lock(&ctx->lease_lock);
+				ctx->stats.eagain_spins++;
+				pthread_mutex_unlock(&ctx->lease_lock);
+				return HELPER_AGAIN;
+
+			case EIO:
+				/* Could ignore EIO, see spec. */
+				return HELPER_AGAIN;
+
+			default:
+				return ERR;
+		}
+	}
+
+	complete_request(ctx, buf->index, 1);
+	return 0;
+}
+
+/*
+ * Waits for a filled buffer to be available and dequeues it into 'buf'.
+ */
+static int dequeue_buffer(struct helper_ctx *ctx, struct v4l2_buffer *buf, struct v4l2_plane *planes)
+{
+	static unsigned char max_timeout_retries = 10;
+	unsigned char timeout_retries = 0;
+
+	for (;;) {
+		fd_set fds;
+		struct timeval tv;
+		int r;
+
+		FD_ZERO(&fds);
+		FD_SET(ctx->fd, &fds);
+
+		/* Timeout. */
+		tv.tv_sec = 2;
+		tv.tv_usec = 0;
+
+		r = select(ctx->fd + 1, &fds, NULL, NULL, &tv);
+
+		if (-1 == r) {
+			if (EINTR == errno)
+				continue;
+		}
+
+		if (0 == r) {
+			fprintf(stderr, "select timeout\n");
+			timeout_retries++;
+
+			pthread_mutex_lock(&ctx->lease_lock);
+			ctx->stats.select_timeouts++;
+			pthread_mutex_unlock(&ctx->lease_lock);
+
+			if (timeout_retries == max_timeout_retries)
+			{
+				fprintf(stderr, "Could not get frame after multiple retries\n");
+				return ERR;
+			}
+		}
+
+		/*
+		 * Errors other than EAGAIN are also retried, as done
+		 * originally, as they are mostly transient.
+		 */
+		if (try_dequeue_buffer(ctx, buf, planes) != 0)
+			continue;
+
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the largest ring size allowed by the configuration.
+ */
+static unsigned int max_ring_size(struct helper_ctx *ctx)
+{
+	unsigned int max = ctx->max_buffers;
+
+	if (ctx->memory_budget && ctx->sizeimage && ctx->memory_budget / ctx->sizeimage < max)
+		max = ctx->memory_budget / ctx->sizeimage;
+
+	return (max < ctx->min_buffers) ? ctx->min_buffers : max;
+}
+
+/*
+ * Tracks the sequence numbers of dequeued buffers and returns the number of
+ * frames dropped before 'buf'. A gap in them means the driver had no buffer
+ * to fill and dropped frames. In adaptive mode, this is used to decide
+ * whether the ring must grow (frames dropped) or can shrink (no frames
+ * dropped for a long time).
+ */
+static unsigned int track_sequence(struct helper_ctx *ctx, const struct v4l2_buffer *buf)
+{
+	unsigned int gap = 0;
+
+	if (ctx->has_last_sequence && buf->sequence > ctx->last_sequence + 1)
+		gap = buf->sequence - ctx->last_sequence - 1;
+
+	ctx->last_sequence = buf->sequence;
+	ctx->has_last_sequence = 1;
+
+	if (!ctx->adaptive)
+		return gap;
+
+	ctx->frames_since_resize++;
+	ctx->frames_without_drops = (gap) ? 0 : ctx->frames_without_drops + 1;
+
+	if (ctx->frames_since_resize < ADAPT_SETTLE_FRAMES || ctx->target_buffers != ctx->n_buffers)
+		return gap;
+
+	if (gap && ctx->n_buffers < max_ring_size(ctx))
+	{
+		ctx->target_buffers = ctx->n_buffers + 1;
+	}
+	else if (ctx->frames_without_drops >= ADAPT_SHRINK_FRAMES && ctx->n_buffers > ctx->min_buffers)
+	{
+		ctx->target_buffers = ctx->n_buffers - 1;
+		ctx->frames_without_drops = 0;
+	}
+
+	return gap;
+}
+
+/*
+ * Adds 'count' buffers to the ring without stopping the stream, using
+ * VIDIOC_CREATE_BUFS.
+ */
+static int grow_ring(struct helper_ctx *ctx, unsigned int count)
+{
+	struct v4l2_create_buffers create;
+	struct buffer *bufs;
+	unsigned int i;
+
+	CLEAR(create);
+	create.count = count;
+	create.memory = buf_memory(ctx);
+	create.format.type = ctx->buf_type;
+
+	if (
+		-1 == dev_ioctl(ctx, VIDIOC_G_FMT, &create.format) ||
+		-1 == dev_ioctl(ctx, VIDIOC_CREATE_BUFS, &create) ||
+		create.count == 0 ||
+		create.index != ctx->n_buffers
+	)
+	{
+		return ERR;
+	}
+
+	/*
+	 * The buffer array can be accessed by threads releasing leases.
+	 */
+	pthread_mutex_lock(&ctx->lease_lock);
+	bufs = (struct buffer *) realloc(ctx->buffers, (ctx->n_buffers + create.count) * sizeof(*bufs));
+	if (bufs)
+		ctx->buffers = bufs;
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	if (!bufs)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	for (i = 0; i < create.count; i++)
+	{
+		clear_buffer(&ctx->buffers[ctx->n_buffers]);
+		if (
+			setup_buffer(ctx, ctx->n_buffers) < 0 ||
+			queue_buffer(ctx, ctx->n_buffers) < 0
+		)
+		{
+			/*
+			 * The buffers set up so far are usable. The remaining
+			 * ones are left unused in the driver.
+			 */
+			free_buffer_planes(ctx, ctx->n_buffers);
+			return (i > 0) ? 0 : ERR;
+		}
+
+		ctx->n_buffers++;
+	}
+
+	return 0;
+}
+
+/*
+ * Frees the ring and the buffers of the driver, so that the format can be
+ * changed. With IO_METHOD_USERPTR, the memory planes of the buffers are kept
+ * as spare planes, for the next ring to reuse. The stream must be stopped.
+ */
+static int release_ring(struct helper_ctx *ctx)
+{
+	struct v4l2_requestbuffers req;
+	struct buffer_plane *spares = NULL;
+	unsigned int i, p;
+
+	if (ctx->io == IO_METHOD_USERPTR && ctx->n_buffers) {
+		spares = (struct buffer_plane *) realloc(ctx->spare_planes,
+				(ctx->n_spare_planes + ctx->n_buffers * ctx->n_mem_planes) * sizeof(*spares));
+	}
+
+	if (!ctx->buffers) {
+		/* No ring, e.g., after a failure to set it up */
+	} else if (spares) {
+		ctx->spare_planes = spares;
+		for (i = 0; i < ctx->n_buffers; i++) {
+			for (p = 0; p < ctx->n_mem_planes; p++)
+				ctx->spare_planes[ctx->n_spare_planes++] = ctx->buffers[i].planes[p];
+		}
+		free(ctx->buffers);
+		ctx->memory.bytes = 0;
+	} else if (uninit_device(ctx) < 0) {
+		return ERR;
+	}
+
+	ctx->buffers = NULL;
+	ctx->n_buffers = 0;
+	ctx->memory.reused_bytes = 0;
+
+	if (ctx->io == IO_METHOD_READ)
+		return 0;
+
+	CLEAR(req);
+	req.count  = 0;
+	req.type   = ctx->buf_type;
+	req.memory = buf_memory(ctx);
+
+	if (-1 == dev_ioctl(ctx, VIDIOC_REQBUFS, &req)) {
+		fprintf(stderr, "Error occurred when freeing the buffers of the driver\n");
+		return ERR;
+	}
+
+	return 0;
+}
+
+/*
+ * Creates the ring of 'req_buffers' buffers for the current format and
+ * starts streaming. On failure, the ring is released again.
+ */
+static int start_ring(struct helper_ctx *ctx)
+{
+	if (
+		init_buffers(ctx) < 0 ||
+		start_capturing(ctx) < 0
+	)
+	{
+		if (ctx->n_buffers)
+			stop_capturing(ctx);
+		release_ring(ctx);
+		return ERR;
+	}
+
+	return 0;
+}
+
+/*
+ * Re-creates the ring with 'count' buffers. This requires the stream to be
+ * restarted. So, it must only be done when no buffers are leased. When the
+ * new ring can't be set up (e.g., out of memory), one with the previous
+ * number of buffers is set up again and the ring isn't grown any further.
+ */
+static int restart_ring(struct helper_ctx *ctx, unsigned int count)
+{
+	unsigned int old_count = ctx->n_buffers;
+
+	if (stop_capturing(ctx) < 0)
+	{
+		fprintf(stderr, "Error occurred when resizing the capture ring\n");
+		return ERR;
+	}
+
+	/* The ring is freed even if unmapping some buffer fails */
+	uninit_device(ctx);
+
+	ctx->req_buffers = count;
+	if (start_ring(ctx) < 0)
+	{
+		ctx->req_buffers = old_count;
+		if (start_ring(ctx) < 0)
+		{
+			fprintf(stderr, "Error occurred when restoring the capture ring; the camera must be de-initialised\n");
+			free_spare_planes(ctx);
+			return ERR;
+		}
+
+		fprintf(stderr, "Warning: the capture ring can't be resized to %u buffers; %u are kept\n", count, ctx->n_buffers);
+		if (count > old_count && ctx->max_buffers > ctx->n_buffers)
+			ctx->max_buffers = (ctx->n_buffers > ctx->min_buffers) ? ctx->n_buffers : ctx->min_buffers;
+	}
+
+	/* The buffer planes of a failed ring, with IO_METHOD_USERPTR */
+	free_spare_planes(ctx);
+
+	/* The driver restarts the sequence numbers along with the stream */
+	ctx->has_last_sequence = 0;
+	return 0;
+}
+
+/*
+ * Sets a format, re-creates the ring (see release_ring()) for it and starts
+ * streaming. On failure, the ring is released again.
+ */
+static int start_format(struct helper_ctx *ctx, unsigned int width, unsigned int height, unsigned int format)
+{
+	if (
+		check_caps(ctx, format) < 0 ||
+		set_format(ctx, width, height, format) < 0
+	)
+	{
+		return ERR;
+	}
+
+	return start_ring(ctx);
+}
+
+/*
+ * Switches to another format and I/O method (see helper_ctx_reconfigure()).
+ */
+static int reconfigure(struct helper_ctx *ctx, unsigned int width, unsigned int height, unsigned int format,
+		const struct v4l2_fract *interval, enum io_method io_meth)
+{
+	unsigned int old_width = ctx->width, old_height = ctx->height, old_format = ctx->pixelformat;
+	struct v4l2_fract old_interval = ctx->req_interval;
+	enum io_method old_io = ctx->io;
+
+	if (helper_ctx_get_num_leased(ctx) > 0)
+	{
+		fprintf(stderr, "Error: can't reconfigure the camera while frames are leased\n");
+		return ERR;
+	}
+
+	if (ctx->n_ext_dmabuf_fds)
+	{
+		fprintf(stderr, "Error: can't reconfigure a camera capturing into application-given dma-bufs\n");
+		return ERR;
+	}
+
+	if (set_io_method(ctx, io_meth) < 0)
+		return ERR;
+	ctx->io = old_io;
+
+	/* The new ring has as many buffers as the current one */
+	ctx->req_buffers = ctx->n_buffers;
+
+	if (
+		stop_capturing(ctx) < 0 ||
+		release_ring(ctx) < 0
+	)
+	{
+		fprintf(stderr, "Error occurred when reconfiguring camera\n");
+		free_spare_planes(ctx);
+		return ERR;
+	}
+
+	ctx->io = io_meth;
+	ctx->req_interval = *interval;
+	if (start_format(ctx, width, height, format) < 0)
+	{
+		ctx->io = old_io;
+		ctx->req_interval = old_interval;
+		if (start_format(ctx, old_width, old_height, old_format) < 0)
+		{
+			fprintf(stderr, "Error occurred when restoring the previous format; the camera must be de-initialised\n");
+			free_spare_planes(ctx);
+			return ERR;
+		}
+
+		fprintf(stderr, "Error occurred when reconfiguring camera; the previous format is kept\n");
+		free_spare_planes(ctx);
+		return ERR;
+	}
+
+	free_spare_planes(ctx);
+
+	/* The driver restarts the sequence numbers along with the stream */
+	ctx->has_last_sequence = 0;
+	ctx->target_buffers = ctx->n_buffers;
+	ctx->frames_since_resize = 0;
+	ctx->frames_without_drops = 0;
+	return 0;
+}
+
+/*
+ * Resizes the ring in adaptive mode when a new size has been decided upon.
+ * Growing is done on the fly if the driver allows it. Otherwise, and for
+ * shrinking, it's deferred until no buffers are leased (a safe point).
+ */
+static int adapt_ring(struct helper_ctx *ctx)
+{
+	unsigned int target = ctx->target_buffers;
+	int ret = 0;
+
+	if (!ctx->adaptive || target == ctx->n_buffers)
+		return 0;
+
+	if (target > ctx->n_buffers && !ctx->no_create_bufs)
+	{
+		if (grow_ring(ctx, target - ctx->n_buffers) == 0)
+		{
+			ctx->target_buffers = ctx->n_buffers;
+			ctx->frames_since_resize = 0;
+			return 0;
+		}
+		ctx->no_create_bufs = 1;
+	}
+
+	if (helper_ctx_get_num_leased(ctx) > 0)
+		return 0;
+
+	ret = restart_ring(ctx, target);
+	ctx->target_buffers = ctx->n_buffers;
+	ctx->frames_since_resize = 0;
+	return ret;
+}
+
+/*
+ * Latest frame only mode: dequeues all the filled buffers available after
+ * 'buf', requeueing each older one right away, so that 'buf' ends up holding
+ * the newest frame. Returns the number of frames skipped.
+ */
+static unsigned int skip_stale_buffers(struct helper_ctx *ctx, struct v4l2_buffer *buf)
+{
+	struct v4l2_buffer next;
+	struct v4l2_plane next_planes[VIDEO_MAX_PLANES];
+	unsigned int skipped = 0, dropped;
+
+	/*
+	 * At most one pass over the ring: a buffer requeued here may be filled
+	 * again before the loop ends when the frames come in faster than they
+	 * can be dequeued, which must not keep the caller here forever.
+	 */
+	while (skipped < ctx->n_buffers)
+	{
+		/*
+		 * Not try_dequeue_buffer(): running out of filled buffers is
+		 * the expected way out of the loop, not a spin.
+		 */
+		init_v4l2_buffer(ctx, &next, next_planes, 0);
+		if (-1 == dev_ioctl(ctx, VIDIOC_DQBUF, &next))
+			break;
+		complete_request(ctx, next.index, 1);
+
+		dropped = track_sequence(ctx, buf);
+
+		pthread_mutex_lock(&ctx->lease_lock);
+		ctx->stats.frames++;
+		ctx->stats.skipped_frames++;
+		if (dropped) {
+			ctx->stats.sequence_gaps++;
+			ctx->stats.dropped_frames += dropped;
+		}
+		if (buf->flags & V4L2_BUF_FLAG_ERROR)
+			ctx->stats.error_frames++;
+		pthread_mutex_unlock(&ctx->lease_lock);
+
+		ctx->skipped_dropped += dropped;
+
+		/*
+		 * The skipped buffer was never accessed by the CPU, so no dma-buf
+		 * sync is needed before giving it back.
+		 */
+		if (-1 == submit_buffer(ctx, buf))
+			fprintf(stderr, "Error occurred when requeueing skipped buffer\n");
+
+		/* 'buf' keeps its own plane array */
+		if (is_mplane(ctx)) {
+			memcpy(buf->m.planes, next_planes, sizeof(next_planes));
+			next.m.planes = buf->m.planes;
+		}
+		*buf = next;
+		skipped++;
+	}
+
+	return skipped;
+}
+
+/*
+ * Describes the color planes of the frame in the dequeued buffer 'buf' in
+ * 'lease' and sets its data pointer and size.
+ */
+static void fill_lease_planes(struct helper_ctx *ctx, const struct v4l2_buffer *buf, struct helper_lease *lease)
+{
+	struct buffer *buffer = &ctx->buffers[buf->index];
+	const struct color_planes *planar = find_planar_format(ctx->pixelformat);
+	unsigned char *mem[VIDEO_MAX_PLANES] = { NULL };
+	unsigned int p, bytesused = 0;
+
+	if (is_mplane(ctx)) {
+		for (p = 0; p < ctx->n_mem_planes; p++) {
+			const struct v4l2_plane *plane = &buf->m.planes[p];
+			unsigned int offset = (plane->data_offset < plane->bytesused) ? plane->data_offset : 0;
+
+			mem[p] = (unsigned char *) buffer->planes[p].start + offset;
+			bytesused += plane->bytesused - offset;
+		}
+	} else {
+		mem[0] = (unsigned char *) buffer->planes[0].start;
+		bytesused = buf->bytesused;
+	}
+
+	lease->n_mem_planes = (ctx->n_mem_planes < HELPER_MAX_PLANES) ? ctx->n_mem_planes : HELPER_MAX_PLANES;
+	for (p = 0; p < lease->n_mem_planes; p++) {
+		lease->mem_planes[p].data = (unsigned char *) buffer->planes[p].start;
+		/* The memory of all the buffers spans whole pages */
+		lease->mem_planes[p].length = ((buffer->planes[p].length + getpagesize() - 1) / getpagesize()) * getpagesize();
+		lease->mem_planes[p].bytesused = (is_mplane(ctx)) ? buf->m.planes[p].bytesused : buf->bytesused;
+	}
+
+	lease->data = mem[0];
+	lease->bytesused = bytesused;
+
+	lease->planes[0].data = mem[0];
+	lease->planes[0].bytesperline = ctx->plane_fmt[0].bytesperline;
+	lease->planes[0].width = ctx->width;
+	lease->planes[0].height = ctx->height;
+	lease->n_planes = 1;
+
+	if (!planar)
+		return;
+
+	/*
+	 * Chroma planes: subsampled horizontally by 2 in all the formats
+	 * supported, and stored after the luma plane unless they have memory
+	 * planes of their own.
+	 */
+	for (p = 1; p < planar->n_planes; p++) {
+		struct helper_plane *chroma = &lease->planes[p];
+		const struct helper_plane *prev = &lease->planes[p - 1];
+
+		chroma->width = (ctx->width + 1) / 2;
+		chroma->height = (ctx->height + planar->vsub - 1) / planar->vsub;
+		if (ctx->n_mem_planes > p) {
+			chroma->data = mem[p];
+			chroma->bytesperline = ctx->plane_fmt[p].bytesperline;
+		} else {
+			chroma->data = prev->data + (size_t) prev->bytesperline * prev->height;
+			chroma->bytesperline = ctx->plane_fmt[0].bytesperline / planar->chroma_div;
+		}
+	}
+	lease->n_planes = planar->n_planes;
+}
+
+static void lease_buffer(struct helper_ctx *ctx, const struct v4l2_buffer *buf, struct helper_lease *lease, unsigned int skipped)
+{
+	unsigned int dropped;
+	struct buffer *buffer = &ctx->buffers[buf->index];
+
+	if (ctx->probe_enabled)
+		probe_record(ctx->probe, HELPER_PROBE_DEQUEUE, &buf->timestamp, buf->flags);
+
+	dropped = track_sequence(ctx, buf);
+
+	pthread_mutex_lock(&ctx->lease_lock);
+	buffer->is_leased = 1;
+	buffer->dq_buf = *buf;
+	if (is_mplane(ctx))
+		memcpy(buffer->dq_planes, buf->m.planes, sizeof(buffer->dq_planes));
+	ctx->n_leased++;
+
+	ctx->stats.frames++;
+	if (!ctx->init_times.first_frame_ns) {
+		end_init_phase(ctx, HELPER_INIT_FIRST_FRAME);
+		ctx->init_times.first_frame_ns = ctx->phase_start_ns - ctx->init_start_ns;
+	}
+	if (dropped) {
+		ctx->stats.sequence_gaps++;
+		ctx->stats.dropped_frames += dropped;
+	}
+	if (buf->flags & V4L2_BUF_FLAG_ERROR)
+		ctx->stats.error_frames++;
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	if (ctx->io == IO_METHOD_DMABUF)
+		sync_dmabuf(ctx, buffer, DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+
+	lease->index = buf->index;
+	fill_lease_planes(ctx, buf, lease);
+	lease->dmabuf_fd = buffer->planes[0].dmabuf_fd;
+	lease->sequence = buf->sequence;
+	lease->timestamp = buf->timestamp;
+	lease->flags = buf->flags;
+	/*
+	 * The frames dropped before the skipped ones were dropped before this
+	 * one too, as far as the application is concerned.
+	 */
+	lease->dropped = dropped + ctx->skipped_dropped;
+	lease->skipped = skipped;
+	ctx->skipped_dropped = 0;
+}
+
+/*
+ * Returns the control cache, enumerating the controls on first use. It's
+ * created under the lease lock as leases released from other threads use it
+ * (see submit_buffer()).
+ */
+static struct ctrl_cache *get_ctrls(struct helper_ctx *ctx)
+{
+	struct ctrl_cache *cache;
+
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to access controls without initialising camera\n");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&ctx->lease_lock);
+	if (!ctx->ctrls && ctrl_cache_create(&ctx->ctrls, module_ioctl, ctx) < 0)
+		ctx->ctrls = NULL;
+	cache = ctx->ctrls;
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	return cache;
+}
+
+/*
+ * Restarts streaming with (or without) a request per queued buffer. The
+ * driver only accepts the switch while no buffer is queued, so no lease may
+ * be held.
+ */
+static int set_requests(struct helper_ctx *ctx, int use_requests)
+{
+	unsigned int n_leased;
+
+	pthread_mutex_lock(&ctx->lease_lock);
+	n_leased = ctx->n_leased;
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	if (n_leased)
+	{
+		fprintf(stderr, "Error: can't switch to or from requests while leases are held\n");
+		return ERR;
+	}
+
+	if (stop_capturing(ctx) < 0)
+		return ERR;
+
+	if (!use_requests)
+		close_requests(ctx);
+	else if (ctx->n_buffers > VIDEO_MAX_FRAME)
+		fprintf(stderr, "Warning: more than %u buffers, frame controls are applied without requests\n", VIDEO_MAX_FRAME);
+	else if (open_requests(ctx) < 0)
+		fprintf(stderr, "Warning: no media device found, frame controls are applied without requests\n");
+
+	ctx->has_last_sequence = 0;
+	return start_capturing(ctx);
+}
+
+/**
+ * End of static (internal) helper functions
+ */
+
+
+/**
+ * Start of public helper functions
+ */
+void helper_cam_params_init(struct helper_cam_params *params, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth)
+{
+	memset(params, 0, sizeof(*params));
+	params->width = width;
+	params->height = height;
+	params->format = format;
+	params->io_meth = io_meth;
+	params->num_buffers = NUM_BUFFS;
+	params->min_buffers = MIN_BUFFS;
+	params->max_buffers = MAX_BUFFS;
+	params->numa_node = -1;
+}
+
+int helper_ctx_init_cam_params(struct helper_ctx **ctx_out, const char* devname, const struct helper_cam_params *params)
+{
+	struct helper_ctx *ctx;
+
+	if (!ctx_out || !params)
+	{
+		fprintf(stderr, "Error: no location given to store the camera context\n");
+		return ERR;
+	}
+
+	if (params->num_buffers < 1)
+	{
+		fprintf(stderr, "Error: at least one buffer is required\n");
+		return ERR;
+	}
+
+	if (params->num_buffers > VIDEO_MAX_FRAME || params->n_dmabuf_fds > VIDEO_MAX_FRAME)
+	{
+		fprintf(stderr, "Error: at most %u buffers are supported\n", VIDEO_MAX_FRAME);
+		return ERR;
+	}
+
+	ctx = (struct helper_ctx *) calloc(1, sizeof(*ctx));
+	if (!ctx)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	ctx->init_start_ns = ctx->phase_start_ns = now_ns();
+	ctx->fd = -1;
+	ctx->media_fd = -1;
+	ctx->req_interval = params->frame_interval;
+	ctx->release_notify_fd = -1;
+	ctx->is_released = 1;
+	ctx->req_buffers = params->num_buffers;
+	ctx->ext_dmabuf_fds = params->dmabuf_fds;
+	ctx->n_ext_dmabuf_fds = params->n_dmabuf_fds;
+	ctx->latest_frame_only = (params->latest_frame_only && params->io_meth != IO_METHOD_READ);
+	ctx->alloc_pages = params->alloc_pages;
+	ctx->lock_buffers = (params->lock_buffers) ? 1 : 0;
+	ctx->numa_node = (params->io_meth == IO_METHOD_USERPTR) ? alloc_resolve_node(params->numa_node) : -1;
+
+	/*
+	 * The ring can't be resized with the read() method or when the
+	 * buffers are given by the application.
+	 */
+	if (params->adaptive_buffers && params->io_meth != IO_METHOD_READ && !params->n_dmabuf_fds)
+	{
+		ctx->adaptive = 1;
+		ctx->min_buffers = (params->min_buffers) ? params->min_buffers : MIN_BUFFS;
+		ctx->max_buffers = (params->max_buffers > ctx->min_buffers) ? params->max_buffers : ctx->min_buffers;
+		if (ctx->max_buffers > VIDEO_MAX_FRAME)
+			ctx->max_buffers = VIDEO_MAX_FRAME;
+		if (ctx->min_buffers > ctx->max_buffers)
+			ctx->min_buffers = ctx->max_buffers;
+		ctx->memory_budget = params->memory_budget;
+	}
+
+	if (pthread_mutex_init(&ctx->lease_lock, NULL) != 0)
+	{
+		fprintf(stderr, "Error occurred when initialising lease lock\n");
+		free(ctx);
+		return ERR;
+	}
+
+	if (
+		set_io_method(ctx, params->io_meth) < 0 ||
+		open_device(ctx, devname) < 0
+	)
+	{
+		fprintf(stderr, "Error occurred when initialising camera\n");
+		pthread_mutex_destroy(&ctx->lease_lock);
+		free(ctx);
+		return ERR;
+	}
+	end_init_phase(ctx, HELPER_INIT_OPEN);
+
+	if (init_device(ctx, params) < 0)
+	{
+		fprintf(stderr, "Error occurred when initialising camera\n");
+		close_device(ctx);
+		pthread_mutex_destroy(&ctx->lease_lock);
+		free(ctx->modes);
+		free(ctx);
+		return ERR;
+	}
+
+	if (start_capturing(ctx) < 0)
+	{
+		fprintf(stderr, "Error occurred when initialising camera\n");
+		uninit_device(ctx);
+		close_device(ctx);
+		pthread_mutex_destroy(&ctx->lease_lock);
+		free(ctx->modes);
+		free(ctx);
+		return ERR;
+	}
+	end_init_phase(ctx, HELPER_INIT_STREAMON);
+
+	/*
+	 * The dma-bufs are owned by the application; only the copies of the
+	 * descriptors in the buffers are used after initialisation.
+	 */
+	ctx->ext_dmabuf_fds = NULL;
+	ctx->target_buffers = ctx->n_buffers;
+
+	*ctx_out = ctx;
+	return 0;
+}
+
+int helper_ctx_init_cam(struct helper_ctx **ctx_out, const char* devname, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth)
+{
+	struct helper_cam_params params;
+
+	helper_cam_params_init(&params, width, height, format, io_meth);
+	return helper_ctx_init_cam_params(ctx_out, devname, &params);
+}
+
+int helper_ctx_init_cam_dmabuf(struct helper_ctx **ctx_out, const char* devname, unsigned int width, unsigned int height, unsigned int format, const int *dmabuf_fds, unsigned int n_dmabuf_fds)
+{
+	struct helper_cam_params params;
+
+	if (!dmabuf_fds || n_dmabuf_fds == 0)
+	{
+		fprintf(stderr, "Error: no dma-bufs given\n");
+		return ERR;
+	}
+
+	helper_cam_params_init(&params, width, height, format, IO_METHOD_DMABUF);
+	params.dmabuf_fds = dmabuf_fds;
+	params.n_dmabuf_fds = n_dmabuf_fds;
+	return helper_ctx_init_cam_params(ctx_out, devname, &params);
+}
+
+int helper_ctx_deinit_cam(struct helper_ctx *ctx)
+{
+	int ret = 0;
+
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to de-initialise without initialising camera\n");
+		return ERR;
+	}
+
+	/*
+	 * The context is freed even if the de-initialisation fails as
+	 * the device can't be used reliably after a failed attempt anyway.
+	 */
+	if(
+		stop_capturing(ctx) < 0 ||
+		uninit_device(ctx) < 0 ||
+		close_device(ctx) < 0
+	)
+	{
+		fprintf(stderr, "Error occurred when de-initialising camera\n");
+		ret = ERR;
+	}
+
+	close_requests(ctx);
+	ctrl_cache_destroy(ctx->ctrls);
+	free(ctx->modes);
+	pthread_mutex_destroy(&ctx->lease_lock);
+	probe_destroy(ctx->probe);
+	free(ctx);
+	return ret;
+}
+
+int helper_ctx_reconfigure(struct helper_ctx *ctx, unsigned int width, unsigned int height, unsigned int format)
+{
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to reconfigure without initialising camera\n");
+		return ERR;
+	}
+
+	return reconfigure(ctx, width, height, format, &ctx->req_interval, ctx->io);
+}
+
+int helper_ctx_get_format(struct helper_ctx *ctx, unsigned int *width, unsigned int *height, unsigned int *format)
+{
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to get the format without successfully initialising camera\n");
+		return ERR;
+	}
+
+	if (width)
+		*width = ctx->width;
+	if (height)
+		*height = ctx->height;
+	if (format)
+		*format = ctx->pixelformat;
+
+	return 0;
+}
+
+unsigned int helper_ctx_get_num_modes(struct helper_ctx *ctx)
+{
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to enumerate modes without initialising camera\n");
+		return 0;
+	}
+
+	return (get_modes(ctx) < 0) ? 0 : ctx->n_modes;
+}
+
+int helper_ctx_enum_mode(struct helper_ctx *ctx, unsigned int index, struct helper_mode *mode)
+{
+	if (!ctx || !mode)
+	{
+		fprintf(stderr, "Error: trying to enumerate modes without initialising camera\n");
+		return ERR;
+	}
+
+	if (get_modes(ctx) < 0)
+		return ERR;
+
+	if (index >= ctx->n_modes)
+	{
+		fprintf(stderr, "Error: no mode at index %u\n", index);
+		return ERR;
+	}
+
+	*mode = ctx->modes[index];
+	return 0;
+}
+
+int helper_ctx_select_mode(struct helper_ctx *ctx, const struct helper_mode_target *target, struct helper_mode *mode)
+{
+	if (!ctx || !target || !mode)
+	{
+		fprintf(stderr, "Error: trying to select a mode without initialising camera\n");
+		return ERR;
+	}
+
+	if (get_modes(ctx) < 0)
+		return ERR;
+
+	return mode_select(ctx->modes, ctx->n_modes, target, mode);
+}
+
+int helper_ctx_set_mode(struct helper_ctx *ctx, const struct helper_mode *mode)
+{
+	if (!ctx || !mode)
+	{
+		fprintf(stderr, "Error: trying to set a mode without initialising camera\n");
+		return ERR;
+	}
+
+	return reconfigure(ctx, mode->width, mode->height, mode->format, &mode->interval, ctx->io);
+}
+
+int helper_ctx_get_mode(struct helper_ctx *ctx, struct helper_mode *mode)
+{
+	unsigned int i;
+
+	if (!ctx || !mode)
+	{
+		fprintf(stderr, "Error: trying to get the mode without initialising camera\n");
+		return ERR;
+	}
+
+	CLEAR(*mode);
+	mode->format = ctx->pixelformat;
+	mode->width = mode->max_width = ctx->width;
+	mode->height = mode->max_height = ctx->height;
+	mode->interval = mode->max_interval = ctx->interval;
+
+	/* The flags are only known from the enumeration */
+	for (i = 0; i < ctx->n_modes; i++)
+	{
+		if (ctx->modes[i].format == ctx->pixelformat)
+		{
+			mode->format_flags = ctx->modes[i].format_flags;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+unsigned int helper_ctx_get_num_buffers(struct helper_ctx *ctx)
+{
+	return (ctx) ? ctx->n_buffers : 0;
+}
+
+unsigned int helper_ctx_get_num_leased(struct helper_ctx *ctx)
+{
+	unsigned int n_leased;
+
+	if (!ctx)
+		return 0;
+
+	pthread_mutex_lock(&ctx->lease_lock);
+	n_leased = ctx->n_leased;
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	return n_leased;
+}
+
+int helper_ctx_get_fd(struct helper_ctx *ctx)
+{
+	return (ctx) ? ctx->fd : ERR;
+}
+
+int helper_ctx_export_buffer(struct helper_ctx *ctx, unsigned int index, int *dmabuf_fd)
+{
+	return helper_ctx_export_plane(ctx, index, 0, dmabuf_fd);
+}
+
+int helper_ctx_export_plane(struct helper_ctx *ctx, unsigned int index, unsigned int plane, int *dmabuf_fd)
+{
+	struct v4l2_exportbuffer expbuf;
+	struct buffer_plane *mem_plane;
+
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to export buffer without initialising camera\n");
+		return ERR;
+	}
+
+	if (index >= ctx->n_buffers || plane >= ctx->n_mem_planes)
+	{
+		fprintf(stderr, "Error: trying to export an invalid buffer\n");
+		return ERR;
+	}
+
+	mem_plane = &ctx->buffers[index].planes[plane];
+	if (mem_plane->dmabuf_fd >= 0)
+	{
+		*dmabuf_fd = mem_plane->dmabuf_fd;
+		return 0;
+	}
+
+	if (ctx->io != IO_METHOD_MMAP)
+	{
+		fprintf(stderr, "Error: only MMAP and DMABUF buffers can be exported\n");
+		return ERR;
+	}
+
+	CLEAR(expbuf);
+	expbuf.type = ctx->buf_type;
+	expbuf.index = index;
+	expbuf.plane = plane;
+	expbuf.flags = O_RDWR | O_CLOEXEC;
+
+	if (-1 == dev_ioctl(ctx, VIDIOC_EXPBUF, &expbuf))
+	{
+		fprintf(stderr, "Error occurred when exporting buffer: %d, %s\n",
+				errno, strerror(errno));
+		return ERR;
+	}
+
+	mem_plane->dmabuf_fd = expbuf.fd;
+	mem_plane->owns_dmabuf = 1;
+	*dmabuf_fd = expbuf.fd;
+	return 0;
+}
+
+int helper_ctx_notify_on_release(struct helper_ctx *ctx, int notify_fd)
+{
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to request release notification without initialising camera\n");
+		return ERR;
+	}
+
+	pthread_mutex_lock(&ctx->lease_lock);
+	ctx->release_notify_fd = notify_fd;
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	return 0;
+}
+
+int helper_ctx_acquire_lease(struct helper_ctx *ctx, struct helper_lease *lease)
+{
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	unsigned int skipped = 0;
+
+	if (!ctx)
+	{
+		fprintf (stderr, "Error: trying to get frame without successfully initialising camera\n");
+		return ERR;
+	}
+
+	/*
+	 * Waiting for a buffer when all of them are leased would only
+	 * end in a timeout as the driver has nothing to fill.
+	 */
+	if (helper_ctx_get_num_leased(ctx) >= ctx->n_buffers)
+	{
+		fprintf (stderr, "Error: trying to get a frame when all buffers are leased\n");
+		return ERR;
+	}
+
+	if (
+		adapt_ring(ctx) < 0 ||
+		dequeue_buffer(ctx, &buf, planes) < 0
+	)
+	{
+		return ERR;
+	}
+
+	if (ctx->latest_frame_only)
+		skipped = skip_stale_buffers(ctx, &buf);
+
+	lease_buffer(ctx, &buf, lease, skipped);
+	return 0;
+}
+
+int helper_ctx_try_acquire_lease(struct helper_ctx *ctx, struct helper_lease *lease)
+{
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	unsigned int skipped = 0;
+	int ret;
+
+	if (!ctx)
+	{
+		fprintf (stderr, "Error: trying to get frame without successfully initialising camera\n");
+		return ERR;
+	}
+
+	if (helper_ctx_get_num_leased(ctx) >= ctx->n_buffers)
+	{
+		return HELPER_AGAIN;
+	}
+
+	if (adapt_ring(ctx) < 0)
+	{
+		return ERR;
+	}
+
+	ret = try_dequeue_buffer(ctx, &buf, planes);
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	if (ctx->latest_frame_only)
+		skipped = skip_stale_buffers(ctx, &buf);
+
+	lease_buffer(ctx, &buf, lease, skipped);
+	return 0;
+}
+
+int helper_ctx_release_lease(struct helper_ctx *ctx, const struct helper_lease *lease)
+{
+	struct buffer *leased_buf;
+	int ret = 0;
+
+	if (!ctx)
+	{
+		fprintf (stderr, "Error: trying to release frame without successfully initialising camera\n");
+		return ERR;
+	}
+
+	if (lease->index >= ctx->n_buffers)
+	{
+		fprintf (stderr, "Error: trying to release an invalid lease\n");
+		return ERR;
+	}
+
+	/*
+	 * Taken under the lock as the buffer array may be moved by
+	 * grow_ring() (and so may the plane array dq_buf points to).
+	 */
+	pthread_mutex_lock(&ctx->lease_lock);
+	leased_buf = &ctx->buffers[lease->index];
+	if (leased_buf->is_leased && ctx->io == IO_METHOD_DMABUF)
+	{
+		sync_dmabuf(ctx, leased_buf, DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
+	}
+
+	if (is_mplane(ctx))
+		leased_buf->dq_buf.m.planes = leased_buf->dq_planes;
+
+	if (!leased_buf->is_leased)
+	{
+		fprintf (stderr, "Error: trying to release already released frame\n");
+		ret = ERR;
+	}
+	else if (-1 == submit_buffer(ctx, &leased_buf->dq_buf))
+	{
+		/*
+		 * We assume the frame hasn't been released if an error occurred as
+		 * we couldn't queue the frame for streaming.
+		 *
+		 * Assuming it to be released in case an error occurs causes issues
+		 * such as the loss of a buffer, etc.
+		 */
+		fprintf(stderr, "Error occurred when queueing frame for re-capture\n");
+		ret = ERR;
+	}
+	else
+	{
+		leased_buf->is_leased = 0;
+		ctx->n_leased--;
+
+		if (ctx->release_notify_fd >= 0)
+		{
+			uint64_t one = 1;
+			if (write(ctx->release_notify_fd, &one, sizeof(one)) != sizeof(one))
+			{
+				/*
+				 * Errors ignored as the counter of the eventfd
+				 * is already non-zero (EAGAIN) in such cases.
+				 */
+			}
+			ctx->release_notify_fd = -1;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lease_lock);
+
+	return ret;
+}
+
+int helper_ctx_get_cam_frame(struct helper_ctx *ctx, unsigned char **pointer_to_cam_data, int *size)
+{
+	if (!ctx)
+	{
+		fprintf (stderr, "Error: trying to get frame without successfully initialising camera\n");
 		return ERR;
 	}
 
-	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
-		fprintf(stderr, "Given device is no video capture device\n");
+	if (!ctx->is_released)
+	{
+		fprintf (stderr, "Error: trying to get another frame without releasing already obtained frame\n");
 		return ERR;
 	}
 
-	switch (io) {
-		case IO_METHOD_READ:
-			if (!(cap.capabilities & V4L2_CAP_READWRITE)) {
-				fprintf(stderr, "Given device does not "
-						"support read i/o\n");
-				return ERR;
-			}
-			break;
-
-		case IO_METHOD_MMAP:
-		case IO_METHOD_USERPTR:
-			if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-				fprintf(stderr, "Given device does not "
-						"support streaming i/o\n");
-				return ERR;
-			}
-			break;
+	if (helper_ctx_acquire_lease(ctx, &ctx->frame_lease) < 0)
+	{
+		return ERR;
 	}
 
+	*pointer_to_cam_data = ctx->frame_lease.data;
+	*size = ctx->frame_lease.bytesused;
+	ctx->is_released = 0;
+	return 0;
+}
 
-	/* Select video input, video standard and tune here. */
-
-	CLEAR(cropcap);
+int helper_ctx_get_cam_frame_meta(struct helper_ctx *ctx, unsigned char **pointer_to_cam_data, struct helper_frame_meta *meta)
+{
+	int size;
 
-	cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (helper_ctx_get_cam_frame(ctx, pointer_to_cam_data, &size) < 0)
+	{
+		return ERR;
+	}
 
-	if (0 == xioctl(fd, VIDIOC_CROPCAP, &cropcap)) {
-		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		crop.c = cropcap.defrect; /* reset to default */
+	meta->bytesused = ctx->frame_lease.bytesused;
+	meta->sequence = ctx->frame_lease.sequence;
+	meta->timestamp = ctx->frame_lease.timestamp;
+	meta->flags = ctx->frame_lease.flags;
+	meta->dropped = ctx->frame_lease.dropped;
+	meta->skipped = ctx->frame_lease.skipped;
+	return 0;
+}
 
-		if (-1 == xioctl(fd, VIDIOC_S_CROP, &crop)) {
-			switch (errno) {
-				case EINVAL:
-					/* Cropping not supported. */
-					break;
-				default:
-					/* Errors ignored. */
-					break;
-			}
-		}
-	} else {
-		/* Errors ignored. */
+int helper_ctx_set_latest_frame_only(struct helper_ctx *ctx, int enable)
+{
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to set latest frame only mode without initialising camera\n");
+		return ERR;
 	}
 
-	CLEAR(fmt);
+	if (enable && ctx->io == IO_METHOD_READ)
+	{
+		fprintf(stderr, "Error: latest frame only mode needs a streaming I/O method\n");
+		return ERR;
+	}
 
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt.fmt.pix.width       = width;
-	fmt.fmt.pix.height      = height;
-	fmt.fmt.pix.pixelformat = format;
-	fmt.fmt.pix.field       = V4L2_FIELD_INTERLACED;
+	ctx->latest_frame_only = (enable != 0);
+	return 0;
+}
 
-	if (-1 == xioctl(fd, VIDIOC_S_FMT, &fmt))
+int helper_ctx_get_stats(struct helper_ctx *ctx, struct helper_stats *stats)
+{
+	if (!ctx)
 	{
-		fprintf(stderr, "Error occurred when trying to set format\n");
+		fprintf(stderr, "Error: trying to get statistics without initialising camera\n");
 		return ERR;
 	}
 
-	/* Note VIDIOC_S_FMT may change width and height. */
+	pthread_mutex_lock(&ctx->lease_lock);
+	*stats = ctx->stats;
+	pthread_mutex_unlock(&ctx->lease_lock);
 
-	printf("pixfmt = %c %c %c %c \n", (fmt.fmt.pix.pixelformat & 0x000000ff) , (fmt.fmt.pix.pixelformat & 0x0000ff00) >>8 , (fmt.fmt.pix.pixelformat & 0x00ff0000) >>16, (fmt.fmt.pix.pixelformat & 0xff000000) >>24 );
-	printf("width = %d height = %d\n",fmt.fmt.pix.width,fmt.fmt.pix.height);
+	return 0;
+}
 
-	if (
-		fmt.fmt.pix.width != width ||
-		fmt.fmt.pix.height != height ||
-		fmt.fmt.pix.pixelformat != format
-	)
+int helper_ctx_reset_stats(struct helper_ctx *ctx)
+{
+	if (!ctx)
 	{
-		fprintf(stderr, "Warning: The current format does not match requested format/resolution!\n");
+		fprintf(stderr, "Error: trying to reset statistics without initialising camera\n");
 		return ERR;
 	}
 
-	/* Buggy driver paranoia. */
-	min = fmt.fmt.pix.width * 2;
-	if (fmt.fmt.pix.bytesperline < min)
-		fmt.fmt.pix.bytesperline = min;
-	min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
-	if (fmt.fmt.pix.sizeimage < min)
-		fmt.fmt.pix.sizeimage = min;
+	pthread_mutex_lock(&ctx->lease_lock);
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	pthread_mutex_unlock(&ctx->lease_lock);
 
-	switch (io) {
-		case IO_METHOD_READ:
-			return init_read(fmt.fmt.pix.sizeimage);
-			break;
+	if (ctx->probe)
+		probe_reset(ctx->probe);
 
-		case IO_METHOD_MMAP:
-			return init_mmap();
-			break;
+	return 0;
+}
 
-		case IO_METHOD_USERPTR:
-			return init_userp(fmt.fmt.pix.sizeimage);
-			break;
+int helper_ctx_set_latency_probe(struct helper_ctx *ctx, int enable)
+{
+	if (!ctx)
+	{
+		fprintf(stderr, "Error: trying to set up the latency probe without initialising camera\n");
+		return ERR;
+	}
+
+	if (enable && !ctx->probe)
+	{
+		ctx->probe = probe_create();
+		if (!ctx->probe)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return ERR;
+		}
 	}
 
+	ctx->probe_enabled = (enable) ? 1 : 0;
 	return 0;
 }
 
-static int close_device(void)
+int helper_ctx_probe_frame(struct helper_ctx *ctx, enum helper_probe_point point, const struct timeval *timestamp, unsigned int flags)
 {
-	if (-1 == close(fd))
+	if (!ctx || !timestamp || (unsigned int) point >= HELPER_PROBE_POINTS)
 	{
-		fprintf(stderr, "Error occurred when closing device\n");
+		fprintf(stderr, "Invalid parameters for the latency probe\n");
 		return ERR;
 	}
 
-	fd = -1;
+	if (ctx->probe_enabled)
+		probe_record(ctx->probe, point, timestamp, flags);
 
 	return 0;
 }
 
-static int open_device(const char *dev_name)
+int helper_ctx_get_latency_stats(struct helper_ctx *ctx, enum helper_probe_point point, struct helper_latency_stats *stats)
 {
-	struct stat st;
-
-	if (-1 == stat(dev_name, &st)) {
-		fprintf(stderr, "Cannot identify '%s': %d, %s\n",
-				dev_name, errno, strerror(errno));
+	if (!ctx || !stats || (unsigned int) point >= HELPER_PROBE_POINTS)
+	{
+		fprintf(stderr, "Invalid parameters for the latency probe\n");
 		return ERR;
 	}
 
-	if (!S_ISCHR(st.st_mode)) {
-		fprintf(stderr, "%s is no device\n", dev_name);
+	if (!ctx->probe)
+	{
+		fprintf(stderr, "Error: the latency probe has never been enabled\n");
 		return ERR;
 	}
 
-	fd = open(dev_name, O_RDWR /* required */ | O_NONBLOCK, 0);
+	return probe_get_stats(ctx->probe, point, stats);
+}
 
-	if (-1 == fd) {
-		fprintf(stderr, "Cannot open '%s': %d, %s\n",
-				dev_name, errno, strerror(errno));
+int helper_ctx_get_init_times(struct helper_ctx *ctx, struct helper_init_times *times)
+{
+	if (!ctx || !times)
+	{
+		fprintf(stderr, "Error: trying to get the initialisation times without initialising camera\n");
 		return ERR;
 	}
 
-	return fd;
+	pthread_mutex_lock(&ctx->lease_lock);
+	*times = ctx->init_times;
+	pthread_mutex_unlock(&ctx->lease_lock);
+	return 0;
 }
-/**
- * End of static (internal) helper functions
- */
-
 
-/**
- * Start of public helper functions
- */
-int helper_init_cam(const char* devname, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth)
+int helper_ctx_get_buffer_memory(struct helper_ctx *ctx, struct helper_buffer_memory *memory)
 {
-	if (is_initialised)
+	if (!ctx || !memory)
 	{
-		/*
-		 * The library currently doesn't support
-		 * accessing multiple devices simultaneously.
-		 * So, return an error when such access is attempted.
-		 */
-		fprintf(stderr, "Cannot use the library to initialise multiple devices, simultaneously.\n");
+		fprintf(stderr, "Error: trying to get the buffer memory without successfully initialising camera\n");
 		return ERR;
 	}
 
-	if(
-		set_io_method(io_meth) < 0 ||
-		open_device(devname) < 0 ||
-		init_device(width,height,format) < 0 ||
-		start_capturing() < 0
-	)
+	if (ctx->io != IO_METHOD_USERPTR)
 	{
-		fprintf(stderr, "Error occurred when initialising camera\n");
+		fprintf(stderr, "Error: the buffer memory is only known with the user pointer method\n");
 		return ERR;
 	}
 
-	is_initialised = 1;
+	*memory = ctx->memory;
+
 	return 0;
 }
 
-int helper_deinit_cam()
+unsigned int helper_ctx_get_num_ctrls(struct helper_ctx *ctx)
 {
-	if (!is_initialised)
-	{
-		fprintf(stderr, "Error: trying to de-initialise without initialising camera\n");
-		return ERR;
-	}
+	struct ctrl_cache *cache = get_ctrls(ctx);
 
-	/*
-	 * It's better to turn off is_initialised even if the
-	 * de-initialisation fails as it shouldn't have affect
-	 * re-initialisation a lot.
-	 */
-	is_initialised = 0;
+	return (cache) ? ctrl_count(cache) : 0;
+}
 
-	if(
-		stop_capturing() < 0 ||
-		uninit_device() < 0 ||
-		close_device() < 0
-	)
-	{
-		fprintf(stderr, "Error occurred when de-initialising camera\n");
+int helper_ctx_enum_ctrl(struct helper_ctx *ctx, unsigned int index, struct helper_ctrl_info *info)
+{
+	struct ctrl_cache *cache = get_ctrls(ctx);
+
+	if (!cache || !info)
 		return ERR;
-	}
 
-	return 0;
+	return ctrl_info(cache, index, info);
 }
 
-int helper_get_cam_frame(unsigned char **pointer_to_cam_data, int *size)
+int helper_ctx_query_ctrl(struct helper_ctx *ctx, unsigned int id, struct helper_ctrl_info *info)
 {
-	static unsigned char max_timeout_retries = 10;
-	unsigned char timeout_retries = 0;
+	struct ctrl_cache *cache = get_ctrls(ctx);
 
-	if (!is_initialised)
-	{
-		fprintf (stderr, "Error: trying to get frame without successfully initialising camera\n");
+	if (!cache || !info)
 		return ERR;
-	}
 
-	if (!is_released)
-	{
-		fprintf (stderr, "Error: trying to get another frame without releasing already obtained frame\n");
+	return ctrl_query(cache, id, info);
+}
+
+int helper_ctx_get_ctrl(struct helper_ctx *ctx, unsigned int id, long long *value)
+{
+	struct ctrl_cache *cache = get_ctrls(ctx);
+
+	if (!cache || !value)
 		return ERR;
-	}
 
-	for (;;) {
-		fd_set fds;
-		struct timeval tv;
-		int r;
+	return ctrl_get(cache, id, value);
+}
 
-		FD_ZERO(&fds);
-		FD_SET(fd, &fds);
+int helper_ctx_set_ctrl(struct helper_ctx *ctx, unsigned int id, long long value)
+{
+	struct ctrl_cache *cache = get_ctrls(ctx);
 
-		/* Timeout. */
-		tv.tv_sec = 2;
-		tv.tv_usec = 0;
+	if (!cache)
+		return ERR;
 
-		r = select(fd + 1, &fds, NULL, NULL, &tv);
+	return ctrl_set(cache, id, value);
+}
 
-		if (-1 == r) {
-			if (EINTR == errno)
-				continue;
-		}
+int helper_ctx_stage_ctrl(struct helper_ctx *ctx, unsigned int id, long long value)
+{
+	struct ctrl_cache *cache = get_ctrls(ctx);
 
-		if (0 == r) {
-			fprintf(stderr, "select timeout\n");
-			timeout_retries++;
+	if (!cache)
+		return ERR;
 
-			if (timeout_retries == max_timeout_retries)
-			{
-				fprintf(stderr, "Could not get frame after multiple retries\n");
-				return ERR;
-			}
-		}
+	return ctrl_stage(cache, id, value);
+}
 
-		CLEAR(frame_buf);
-		frame_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+int helper_ctx_apply_ctrls(struct helper_ctx *ctx)
+{
+	struct ctrl_cache *cache = get_ctrls(ctx);
 
-		if (-1 == xioctl(fd, VIDIOC_DQBUF, &frame_buf)) {
-			switch (errno) {
-				case EAGAIN:
-					continue;
+	if (!cache)
+		return ERR;
 
-				case EIO:
-					/* Could ignore EIO, see spec. */
+	return ctrl_apply(cache, -1);
+}
 
-					/* fall through */
+int helper_ctx_set_frame_ctrls(struct helper_ctx *ctx, int enable)
+{
+	int use_requests;
 
-				default:
-					continue;
-			}
-		}
-		*pointer_to_cam_data = (unsigned char*) buffers[frame_buf.index].start;
-		*size = frame_buf.bytesused;
-		break;
-		/* EAGAIN - continue select loop. */
+	if (!get_ctrls(ctx))
+		return ERR;
+
+	if (enable && ctx->io == IO_METHOD_READ)
+	{
+		fprintf(stderr, "Error: frame controls need a streaming I/O method\n");
+		return ERR;
+	}
+
+	/* Virtual sources don't emulate the Request API */
+	use_requests = enable && !ctx->src && (ctx->buf_caps & V4L2_BUF_CAP_SUPPORTS_REQUESTS);
+	if (use_requests != (ctx->media_fd >= 0) && set_requests(ctx, use_requests) < 0)
+	{
+		fprintf(stderr, "Error occurred when switching frame controls\n");
+		return ERR;
 	}
 
-	is_released = 0;
+	ctx->frame_ctrls = (enable != 0);
 	return 0;
 }
 
-int helper_release_cam_frame()
+int helper_ctx_get_ctrl_stats(struct helper_ctx *ctx, struct helper_ctrl_stats *stats)
+{
+	struct ctrl_cache *cache = get_ctrls(ctx);
+
+	if (!cache || !stats)
+		return ERR;
+
+	ctrl_get_stats(cache, stats);
+	stats->requests = (ctx->media_fd >= 0);
+	return 0;
+}
+
+int helper_ctx_release_cam_frame(struct helper_ctx *ctx)
 {
-	if (!is_initialised)
+	if (!ctx)
 	{
 		fprintf (stderr, "Error: trying to release frame without successfully initialising camera\n");
 		return ERR;
 	}
 
-	if (is_released)
+	if (ctx->is_released)
 	{
 		fprintf (stderr, "Error: trying to release already released frame\n");
 		return ERR;
 	}
 
-	if (-1 == xioctl(fd, VIDIOC_QBUF, &frame_buf))
+	if (helper_ctx_release_lease(ctx, &ctx->frame_lease) < 0)
 	{
-		fprintf(stderr, "Error occurred when queueing frame for re-capture\n");
 		return ERR;
 	}
 
-	/*
-	 * We assume the frame hasn't been released if an error occurred as
-	 * we couldn't queue the frame for streaming.
-	 *
-	 * Assuming it to be released in case an error occurs causes issues
-	 * such as the loss of a buffer, etc.
-	 */
-	is_released = 1;
+	ctx->is_released = 1;
 	return 0;
 }
 
-/**
- * End of public helper functions
+/*
+ * Legacy helper functions. These operate on a single, library-wide
+ * default context and are kept for applications that only access
+ * one device.
  */
+int helper_init_cam(const char* devname, unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth)
+{
+	if (default_ctx)
+	{
+		/*
+		 * The legacy functions only have a single default context.
+		 * Applications that need to access multiple devices
+		 * simultaneously must use the helper_ctx_* functions.
+		 */
+		fprintf(stderr, "Cannot use the legacy functions to initialise multiple devices, simultaneously.\n");
+		return ERR;
+	}
 
-/**
- * Untested for misusages
- */
-/*
-int helper_change_cam_res(unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth)
+	return helper_ctx_init_cam(&default_ctx, devname, width, height, format, io_meth);
+}
+
+int helper_deinit_cam()
 {
-	if (!is_initialised)
+	int ret;
+
+	if (!default_ctx)
 	{
 		fprintf(stderr, "Error: trying to de-initialise without initialising camera\n");
 		return ERR;
 	}
 
-	if (
-		stop_capturing() < 0 ||
-		uninit_device() < 0 ||
-		set_io_method(io_meth) < 0 ||
-		init_device(width,height,format) < 0 ||
-		start_capturing() < 0
-	)
+	ret = helper_ctx_deinit_cam(default_ctx);
+	default_ctx = NULL;
+	return ret;
+}
+
+int helper_get_cam_frame(unsigned char **pointer_to_cam_data, int *size)
+{
+	return helper_ctx_get_cam_frame(default_ctx, pointer_to_cam_data, size);
+}
+
+int helper_get_cam_frame_meta(unsigned char **pointer_to_cam_data, struct helper_frame_meta *meta)
+{
+	return helper_ctx_get_cam_frame_meta(default_ctx, pointer_to_cam_data, meta);
+}
+
+int helper_release_cam_frame()
+{
+	return helper_ctx_release_cam_frame(default_ctx);
+}
+
+int helper_get_stats(struct helper_stats *stats)
+{
+	return helper_ctx_get_stats(default_ctx, stats);
+}
+
+int helper_set_latest_frame_only(int enable)
+{
+	return helper_ctx_set_latest_frame_only(default_ctx, enable);
+}
+
+int helper_change_cam_res(unsigned int width, unsigned int height, unsigned int format, enum io_method io_meth)
+{
+	if (!default_ctx)
 	{
-		fprintf(stderr, "Error occurred when changing camera resolution\n");
+		fprintf(stderr, "Error: trying to change resolution without initialising camera\n");
 		return ERR;
 	}
 
-	return 0;
+	return reconfigure(default_ctx, width, height, format, &default_ctx->req_interval, io_meth);
 }
 
-int helper_queryctrl(unsigned int id,struct v4l2_queryctrl* qctrl)
+int helper_ctrl(unsigned int id, int flag, int *value)
 {
-	if (!is_initialised)
+	long long ctrl_value;
+
+	if (!value)
 	{
-		fprintf(stderr, "Error: trying to query control without initialising camera\n");
+		fprintf(stderr, "Error: no location given for the control value\n");
 		return ERR;
 	}
 
-	qctrl->id = id;
-	if (-1 == xioctl(fd, VIDIOC_QUERYCTRL, qctrl)) {
-		fprintf(stderr, "Error QUERYCTRL\n");
-		return -1;
+	if (flag == GET)
+	{
+		if (helper_ctx_get_ctrl(default_ctx, id, &ctrl_value) < 0)
+			return ERR;
+		*value = (int) ctrl_value;
+		return 0;
 	}
 
-	return 0;
+	if (flag == SET)
+		return helper_ctx_set_ctrl(default_ctx, id, *value);
+
+	fprintf(stderr, "Error: invalid control flag %d (GET or SET)\n", flag);
+	return ERR;
 }
 
-int helper_ctrl(unsigned int id, int flag,int* value)
+int helper_queryctrl(unsigned int id, struct v4l2_queryctrl *qctrl)
 {
-	if (!is_initialised)
+	struct helper_ctrl_info info;
+
+	if (!qctrl)
 	{
-		fprintf(stderr, "Error: trying to get/set control without initialising camera\n");
+		fprintf(stderr, "Error: no location given for the control description\n");
 		return ERR;
 	}
 
-	unsigned int ioctl_num = 0;
-	struct v4l2_control ctrl;
-	ctrl.id = id;
-
-	if (flag == GET) {
-		ioctl_num = VIDIOC_G_CTRL;
-	} else if (flag == SET) {
-		ioctl_num = VIDIOC_S_CTRL;
-		ctrl.value = *value;
-	}
-	if (-1 == xioctl(fd, ioctl_num, &ctrl)) {
-		printf("Error GET/SET\n");
-		return -1;
-	}
-
-	if (flag == GET) {
-		*value = ctrl.value;
-	}
+	if (helper_ctx_query_ctrl(default_ctx, id, &info) < 0)
+		return ERR;
 
+	CLEAR(*qctrl);
+	qctrl->id = info.id;
+	qctrl->type = info.type;
+	snprintf((char *) qctrl->name, sizeof(qctrl->name), "%s", info.name);
+	qctrl->minimum = (int) info.minimum;
+	qctrl->maximum = (int) info.maximum;
+	qctrl->step = (int) info.step;
+	qctrl->default_value = (int) info.default_value;
+	qctrl->flags = info.flags;
 	return 0;
 }
-*/
+
+/**
+ * End of public helper functions
+ */
@@ -0,0 +1,222 @@
+/*
+ * opencv_v4l2 - v4l2_helper_alloc.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#define _GNU_SOURCE             /* MAP_HUGETLB, MADV_HUGEPAGE */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_alloc.h"
+
+#define HUGE_PAGE_SIZE  (2UL * 1024 * 1024)
+
+/*
+ * The 2 MB size is asked for explicitly as the default huge page size may
+ * differ (e.g., 1 GB).
+ */
+#ifdef MAP_HUGE_SHIFT
+#define MAP_HUGE_2M     (21 << MAP_HUGE_SHIFT)
+#else
+#define MAP_HUGE_2M     0
+#endif
+
+/**
+ * Start of static (internal) helper functions
+ */
+static size_t round_up(size_t size, size_t align)
+{
+	return ((size + align - 1) / align) * align;
+}
+
+/*
+ * Maps 'length' bytes (a multiple of HUGE_PAGE_SIZE) aligned to
+ * HUGE_PAGE_SIZE, so that transparent huge pages can back the whole
+ * mapping: the kernel only uses them for aligned 2 MB ranges.
+ */
+static void *map_huge_aligned(size_t length)
+{
+	uintptr_t start, aligned;
+	void *map;
+
+	map = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == map)
+		return MAP_FAILED;
+
+	start = (uintptr_t) map;
+	aligned = round_up(start, HUGE_PAGE_SIZE);
+	if (aligned > start)
+		munmap(map, aligned - start);
+	if (aligned + length < start + length + HUGE_PAGE_SIZE)
+		munmap((void *) (aligned + length), start + HUGE_PAGE_SIZE - aligned);
+
+	return (void *) aligned;
+}
+
+static void *map_pages(size_t *length, enum helper_alloc_pages *pages)
+{
+	size_t page_size = getpagesize();
+	void *map;
+
+	if (*pages == HELPER_ALLOC_HUGETLB) {
+		size_t huge_length = round_up(*length, HUGE_PAGE_SIZE);
+
+		map = mmap(NULL, huge_length, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2M, -1, 0);
+		if (MAP_FAILED != map) {
+			*length = huge_length;
+			return map;
+		}
+
+		fprintf(stderr, "Warning: no huge pages left for the buffers (%s), using transparent huge pages\n",
+				strerror(errno));
+		*pages = HELPER_ALLOC_THP;
+	}
+
+	if (*pages == HELPER_ALLOC_THP) {
+		*length = round_up(*length, HUGE_PAGE_SIZE);
+		map = map_huge_aligned(*length);
+		if (MAP_FAILED != map && madvise(map, *length, MADV_HUGEPAGE) != 0) {
+			/*
+			 * Transparent huge pages aren't supported by the kernel;
+			 * the mapping is still usable.
+			 */
+			fprintf(stderr, "Warning: transparent huge pages are not available: %s\n", strerror(errno));
+			*pages = HELPER_ALLOC_SMALL_PAGES;
+		}
+		return map;
+	}
+
+	*length = round_up(*length, page_size);
+	map = mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED != map && *pages == HELPER_ALLOC_SMALL_PAGES)
+		madvise(map, *length, MADV_NOHUGEPAGE);
+
+	return map;
+}
+
+/*
+ * Binds the pages of [start, start + length) to 'node'. This must be done
+ * before they are touched for the first time.
+ */
+static int bind_node(void *start, size_t length, int node)
+{
+	unsigned long nodemask[4];
+	const unsigned int bits = 8 * sizeof(unsigned long);
+
+	if (node < 0 || (unsigned int) node >= sizeof(nodemask) * 8) {
+		fprintf(stderr, "Warning: invalid NUMA node %d\n", node);
+		return ERR;
+	}
+
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / bits] = 1UL << (node % bits);
+
+	if (syscall(SYS_mbind, start, length, MPOL_BIND, nodemask,
+			(unsigned long) sizeof(nodemask) * 8, MPOL_MF_STRICT | MPOL_MF_MOVE) != 0) {
+		fprintf(stderr, "Warning: cannot bind the buffers to NUMA node %d: %s\n", node, strerror(errno));
+		return ERR;
+	}
+
+	return 0;
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+int alloc_resolve_node(int numa_node)
+{
+	unsigned int cpu, node;
+
+	if (numa_node != HELPER_NUMA_LOCAL)
+		return numa_node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		fprintf(stderr, "Warning: cannot get the NUMA node of the CPU: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return (int) node;
+}
+
+int alloc_userptr(size_t size, enum helper_alloc_pages pages, int lock, int numa_node, struct userptr_alloc *alloc)
+{
+	size_t length = size;
+	void *start;
+
+	memset(alloc, 0, sizeof(*alloc));
+	alloc->numa_node = -1;
+
+	/*
+	 * Heap memory is kept for the default options. Memory to be locked or
+	 * bound is mapped instead, as it must not be shared with other heap
+	 * allocations.
+	 */
+	if (pages == HELPER_ALLOC_HEAP && !lock && numa_node < 0) {
+		/*
+		 * Whole pages, so that the buffers can be written with O_DIRECT
+		 * (see struct helper_mem_plane).
+		 */
+		if (posix_memalign(&alloc->start, getpagesize(), round_up(size, getpagesize())) != 0) {
+			/*
+			 * This happens only in case of ENOMEM
+			 */
+			alloc->start = NULL;
+			fprintf(stderr, "Error occurred when allocating memory for buffers\n");
+			return ERR;
+		}
+		alloc->pages = HELPER_ALLOC_HEAP;
+		return 0;
+	}
+
+	start = map_pages(&length, &pages);
+	if (MAP_FAILED == start) {
+		fprintf(stderr, "Error occurred when allocating memory for buffers: %s\n", strerror(errno));
+		return ERR;
+	}
+
+	alloc->start = start;
+	alloc->length = length;
+	alloc->pages = pages;
+
+	if (numa_node >= 0 && bind_node(start, length, numa_node) == 0)
+		alloc->numa_node = numa_node;
+
+	/*
+	 * Touch every page now (mlock() does it as well) rather than when the
+	 * first frames are captured.
+	 */
+	if (lock) {
+		if (mlock(start, length) == 0) {
+			alloc->locked = 1;
+		} else {
+			fprintf(stderr, "Warning: cannot lock the buffers in memory (see RLIMIT_MEMLOCK): %s\n",
+					strerror(errno));
+		}
+	}
+	if (!alloc->locked)
+		memset(start, 0, length);
+
+	return 0;
+}
+
+void free_userptr(void *start, size_t length)
+{
+	if (length)
+		munmap(start, length);
+	else
+		free(start);
+}
@@ -0,0 +1,41 @@
+/*
+ * opencv_v4l2 - v4l2_helper_alloc.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Internal header file for the allocation of USERPTR buffers (see 'alloc_pages' in struct helper_cam_params).
+
+#ifndef V4L2_HELPER_ALLOC_H
+#define V4L2_HELPER_ALLOC_H
+
+#include <stddef.h>
+#include "v4l2_helper.h"
+
+/*
+ * Memory allocated for a USERPTR buffer plane.
+ */
+struct userptr_alloc {
+	void *start;
+	size_t length;                  /* Length of the mapping, 0 for heap memory */
+	enum helper_alloc_pages pages;  /* Pages obtained */
+	char locked;
+	int numa_node;                  /* -1 if not bound */
+};
+
+/*
+ * Resolves HELPER_NUMA_LOCAL to the node of the calling CPU. Other values
+ * are returned as is.
+ */
+int alloc_resolve_node(int numa_node);
+
+/*
+ * Allocates 'size' bytes of page aligned memory with the given options,
+ * falling back (with a warning) on what can't be done: huge pages to
+ * transparent huge pages, and no locking or binding.
+ */
+int alloc_userptr(size_t size, enum helper_alloc_pages pages, int lock, int numa_node, struct userptr_alloc *alloc);
+
+void free_userptr(void *start, size_t length);
+
+#endif
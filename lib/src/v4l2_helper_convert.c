@@ -0,0 +1,750 @@
+/*
+ * opencv_v4l2 - v4l2_helper_convert.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_convert.h"
+
+/*
+ * Fixed point conversion shared by all the backends, so that they give
+ * identical results:
+ *
+ *   ys = (Y - y_off) << 6, u = (U - 128) << 6, v = (V - 128) << 6
+ *   c  = ys * cy + v * crv                   (R)
+ *        ys * cy + u * cgu + v * cgv         (G)
+ *        ys * cy + u * cbu                   (B)
+ *
+ * where each product is a rounding Q15 multiply (as done by pmulhrsw on x86
+ * and vqrdmulh on ARM) with coefficients stored as (coefficient / 4) in Q15.
+ * This gives the channels in Q4 which are rounded to 8 bits with saturation.
+ */
+struct yuv_coeffs {
+	int16_t y_off;
+	int16_t cy;
+	int16_t crv;
+	int16_t cgu;
+	int16_t cgv;
+	int16_t cbu;
+};
+
+typedef void (*uyvy_row_fn)(const uint8_t *src, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c);
+
+/*
+ * Converts a row of luma samples along with the row of interleaved CbCr
+ * samples it shares with the next (or previous) row.
+ */
+typedef void (*nv12_row_fn)(const uint8_t *y, const uint8_t *uv, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c);
+
+static struct yuv_coeffs coeffs[2][2]; /* [matrix][range] */
+static enum helper_convert_backend backend = HELPER_CONVERT_SCALAR;
+static uyvy_row_fn uyvy_row = NULL;
+static nv12_row_fn nv12_row = NULL;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Start of static (internal) helper functions
+ */
+static int16_t to_q15_quarter(double coeff)
+{
+	double q = coeff / 4 * 32768;
+
+	return (int16_t) ((q >= 0) ? q + 0.5 : q - 0.5);
+}
+
+static void init_coeffs(struct yuv_coeffs *c, double kr, double kb, int full_range)
+{
+	double kg = 1 - kr - kb;
+	double y_scale = (full_range) ? 1.0 : 255.0 / 219;
+	double c_scale = (full_range) ? 1.0 : 255.0 / 224;
+
+	c->y_off = (full_range) ? 0 : 16;
+	c->cy = to_q15_quarter(y_scale);
+	c->crv = to_q15_quarter(2 * (1 - kr) * c_scale);
+	c->cgu = to_q15_quarter(-2 * kb * (1 - kb) / kg * c_scale);
+	c->cgv = to_q15_quarter(-2 * kr * (1 - kr) / kg * c_scale);
+	c->cbu = to_q15_quarter(2 * (1 - kb) * c_scale);
+}
+
+static inline int mulhrs(int a, int b)
+{
+	return (a * b + (1 << 14)) >> 15;
+}
+
+static inline uint8_t round_q4(int x)
+{
+	x = (x + 8) >> 4;
+	return (x < 0) ? 0 : (x > 255) ? 255 : x;
+}
+
+static void uyvy_row_scalar(const uint8_t *src, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	unsigned int x;
+
+	for (x = 0; x < width; x += 2, src += 4, dst += 6) {
+		int u = (src[0] - 128) * 64;
+		int v = (src[2] - 128) * 64;
+		int cr = mulhrs(v, c->crv);
+		int cg = mulhrs(u, c->cgu) + mulhrs(v, c->cgv);
+		int cb = mulhrs(u, c->cbu);
+		int y0 = mulhrs((src[1] - c->y_off) * 64, c->cy);
+		int y1 = mulhrs((src[3] - c->y_off) * 64, c->cy);
+
+		dst[0] = round_q4(y0 + cb);
+		dst[1] = round_q4(y0 + cg);
+		dst[2] = round_q4(y0 + cr);
+		dst[3] = round_q4(y1 + cb);
+		dst[4] = round_q4(y1 + cg);
+		dst[5] = round_q4(y1 + cr);
+	}
+}
+
+static void nv12_row_scalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	unsigned int x;
+
+	for (x = 0; x < width; x += 2, y += 2, uv += 2, dst += 6) {
+		int u = (uv[0] - 128) * 64;
+		int v = (uv[1] - 128) * 64;
+		int cr = mulhrs(v, c->crv);
+		int cg = mulhrs(u, c->cgu) + mulhrs(v, c->cgv);
+		int cb = mulhrs(u, c->cbu);
+		int y0 = mulhrs((y[0] - c->y_off) * 64, c->cy);
+		int y1 = mulhrs((y[1] - c->y_off) * 64, c->cy);
+
+		dst[0] = round_q4(y0 + cb);
+		dst[1] = round_q4(y0 + cg);
+		dst[2] = round_q4(y0 + cr);
+		dst[3] = round_q4(y1 + cb);
+		dst[4] = round_q4(y1 + cg);
+		dst[5] = round_q4(y1 + cr);
+	}
+}
+
+#ifdef CONVERT_X86
+/*
+ * Both x86 kernels convert 8 pixels per 128-bit lane: the Y, U and V samples
+ * are spread to 16-bit lanes with a byte shuffle, converted, packed back to
+ * bytes as [B0..B7 G0..G7] and [R0..R7] and interleaved to 24 bytes of BGR
+ * with two more shuffles.
+ */
+#define SHUF_Y     1, -1, 3, -1, 5, -1, 7, -1, 9, -1, 11, -1, 13, -1, 15, -1
+#define SHUF_U     0, -1, 0, -1, 4, -1, 4, -1, 8, -1, 8, -1, 12, -1, 12, -1
+#define SHUF_V     2, -1, 2, -1, 6, -1, 6, -1, 10, -1, 10, -1, 14, -1, 14, -1
+#define SHUF_BG0   0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5
+#define SHUF_R0    -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1
+#define SHUF_BG1   13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define SHUF_R1    -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1
+
+/*
+ * NV12: the luma samples are zero extended as they are and each CbCr pair is
+ * duplicated for the two pixels sharing it; to 16-bit lanes for SSE4 and to
+ * bytes (zero extended afterwards) for AVX2.
+ */
+#define SHUF_NV_U  0, -1, 0, -1, 2, -1, 2, -1, 4, -1, 4, -1, 6, -1, 6, -1
+#define SHUF_NV_V  1, -1, 1, -1, 3, -1, 3, -1, 5, -1, 5, -1, 7, -1, 7, -1
+#define SHUF_NV_U8 0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14
+#define SHUF_NV_V8 1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15
+
+__attribute__((target("sse4.1")))
+static void uyvy_row_sse4(const uint8_t *src, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	const __m128i shuf_y = _mm_setr_epi8(SHUF_Y);
+	const __m128i shuf_u = _mm_setr_epi8(SHUF_U);
+	const __m128i shuf_v = _mm_setr_epi8(SHUF_V);
+	const __m128i shuf_bg0 = _mm_setr_epi8(SHUF_BG0);
+	const __m128i shuf_r0 = _mm_setr_epi8(SHUF_R0);
+	const __m128i shuf_bg1 = _mm_setr_epi8(SHUF_BG1);
+	const __m128i shuf_r1 = _mm_setr_epi8(SHUF_R1);
+	const __m128i y_off = _mm_set1_epi16(c->y_off);
+	const __m128i uv_off = _mm_set1_epi16(128);
+	const __m128i rounding = _mm_set1_epi16(8);
+	const __m128i cy = _mm_set1_epi16(c->cy);
+	const __m128i crv = _mm_set1_epi16(c->crv);
+	const __m128i cgu = _mm_set1_epi16(c->cgu);
+	const __m128i cgv = _mm_set1_epi16(c->cgv);
+	const __m128i cbu = _mm_set1_epi16(c->cbu);
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8, src += 16, dst += 24) {
+		__m128i in = _mm_loadu_si128((const __m128i *) src);
+		__m128i ys = _mm_slli_epi16(_mm_sub_epi16(_mm_shuffle_epi8(in, shuf_y), y_off), 6);
+		__m128i u = _mm_slli_epi16(_mm_sub_epi16(_mm_shuffle_epi8(in, shuf_u), uv_off), 6);
+		__m128i v = _mm_slli_epi16(_mm_sub_epi16(_mm_shuffle_epi8(in, shuf_v), uv_off), 6);
+		__m128i yt = _mm_add_epi16(_mm_mulhrs_epi16(ys, cy), rounding);
+		__m128i r = _mm_srai_epi16(_mm_add_epi16(yt, _mm_mulhrs_epi16(v, crv)), 4);
+		__m128i g = _mm_srai_epi16(_mm_add_epi16(yt,
+				_mm_add_epi16(_mm_mulhrs_epi16(u, cgu), _mm_mulhrs_epi16(v, cgv))), 4);
+		__m128i b = _mm_srai_epi16(_mm_add_epi16(yt, _mm_mulhrs_epi16(u, cbu)), 4);
+		__m128i bg = _mm_packus_epi16(b, g);
+		__m128i rr = _mm_packus_epi16(r, r);
+
+		_mm_storeu_si128((__m128i *) dst,
+				_mm_or_si128(_mm_shuffle_epi8(bg, shuf_bg0), _mm_shuffle_epi8(rr, shuf_r0)));
+		_mm_storel_epi64((__m128i *) (dst + 16),
+				_mm_or_si128(_mm_shuffle_epi8(bg, shuf_bg1), _mm_shuffle_epi8(rr, shuf_r1)));
+	}
+
+	uyvy_row_scalar(src, dst, width - x, c);
+}
+
+__attribute__((target("sse4.1")))
+static void nv12_row_sse4(const uint8_t *y, const uint8_t *uv, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	const __m128i shuf_u = _mm_setr_epi8(SHUF_NV_U);
+	const __m128i shuf_v = _mm_setr_epi8(SHUF_NV_V);
+	const __m128i shuf_bg0 = _mm_setr_epi8(SHUF_BG0);
+	const __m128i shuf_r0 = _mm_setr_epi8(SHUF_R0);
+	const __m128i shuf_bg1 = _mm_setr_epi8(SHUF_BG1);
+	const __m128i shuf_r1 = _mm_setr_epi8(SHUF_R1);
+	const __m128i y_off = _mm_set1_epi16(c->y_off);
+	const __m128i uv_off = _mm_set1_epi16(128);
+	const __m128i rounding = _mm_set1_epi16(8);
+	const __m128i cy = _mm_set1_epi16(c->cy);
+	const __m128i crv = _mm_set1_epi16(c->crv);
+	const __m128i cgu = _mm_set1_epi16(c->cgu);
+	const __m128i cgv = _mm_set1_epi16(c->cgv);
+	const __m128i cbu = _mm_set1_epi16(c->cbu);
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8, y += 8, uv += 8, dst += 24) {
+		__m128i in_uv = _mm_loadl_epi64((const __m128i *) uv);
+		__m128i ys = _mm_slli_epi16(_mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) y)), y_off), 6);
+		__m128i u = _mm_slli_epi16(_mm_sub_epi16(_mm_shuffle_epi8(in_uv, shuf_u), uv_off), 6);
+		__m128i v = _mm_slli_epi16(_mm_sub_epi16(_mm_shuffle_epi8(in_uv, shuf_v), uv_off), 6);
+		__m128i yt = _mm_add_epi16(_mm_mulhrs_epi16(ys, cy), rounding);
+		__m128i r = _mm_srai_epi16(_mm_add_epi16(yt, _mm_mulhrs_epi16(v, crv)), 4);
+		__m128i g = _mm_srai_epi16(_mm_add_epi16(yt,
+				_mm_add_epi16(_mm_mulhrs_epi16(u, cgu), _mm_mulhrs_epi16(v, cgv))), 4);
+		__m128i b = _mm_srai_epi16(_mm_add_epi16(yt, _mm_mulhrs_epi16(u, cbu)), 4);
+		__m128i bg = _mm_packus_epi16(b, g);
+		__m128i rr = _mm_packus_epi16(r, r);
+
+		_mm_storeu_si128((__m128i *) dst,
+				_mm_or_si128(_mm_shuffle_epi8(bg, shuf_bg0), _mm_shuffle_epi8(rr, shuf_r0)));
+		_mm_storel_epi64((__m128i *) (dst + 16),
+				_mm_or_si128(_mm_shuffle_epi8(bg, shuf_bg1), _mm_shuffle_epi8(rr, shuf_r1)));
+	}
+
+	nv12_row_scalar(y, uv, dst, width - x, c);
+}
+
+__attribute__((target("avx2")))
+static void uyvy_row_avx2(const uint8_t *src, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	const __m256i shuf_y = _mm256_setr_epi8(SHUF_Y, SHUF_Y);
+	const __m256i shuf_u = _mm256_setr_epi8(SHUF_U, SHUF_U);
+	const __m256i shuf_v = _mm256_setr_epi8(SHUF_V, SHUF_V);
+	const __m256i shuf_bg0 = _mm256_setr_epi8(SHUF_BG0, SHUF_BG0);
+	const __m256i shuf_r0 = _mm256_setr_epi8(SHUF_R0, SHUF_R0);
+	const __m256i shuf_bg1 = _mm256_setr_epi8(SHUF_BG1, SHUF_BG1);
+	const __m256i shuf_r1 = _mm256_setr_epi8(SHUF_R1, SHUF_R1);
+	const __m256i y_off = _mm256_set1_epi16(c->y_off);
+	const __m256i uv_off = _mm256_set1_epi16(128);
+	const __m256i rounding = _mm256_set1_epi16(8);
+	const __m256i cy = _mm256_set1_epi16(c->cy);
+	const __m256i crv = _mm256_set1_epi16(c->crv);
+	const __m256i cgu = _mm256_set1_epi16(c->cgu);
+	const __m256i cgv = _mm256_set1_epi16(c->cgv);
+	const __m256i cbu = _mm256_set1_epi16(c->cbu);
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16, src += 32, dst += 48) {
+		__m256i in = _mm256_loadu_si256((const __m256i *) src);
+		__m256i ys = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_shuffle_epi8(in, shuf_y), y_off), 6);
+		__m256i u = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_shuffle_epi8(in, shuf_u), uv_off), 6);
+		__m256i v = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_shuffle_epi8(in, shuf_v), uv_off), 6);
+		__m256i yt = _mm256_add_epi16(_mm256_mulhrs_epi16(ys, cy), rounding);
+		__m256i r = _mm256_srai_epi16(_mm256_add_epi16(yt, _mm256_mulhrs_epi16(v, crv)), 4);
+		__m256i g = _mm256_srai_epi16(_mm256_add_epi16(yt,
+				_mm256_add_epi16(_mm256_mulhrs_epi16(u, cgu), _mm256_mulhrs_epi16(v, cgv))), 4);
+		__m256i b = _mm256_srai_epi16(_mm256_add_epi16(yt, _mm256_mulhrs_epi16(u, cbu)), 4);
+		__m256i bg = _mm256_packus_epi16(b, g);
+		__m256i rr = _mm256_packus_epi16(r, r);
+		__m256i out0 = _mm256_or_si256(_mm256_shuffle_epi8(bg, shuf_bg0), _mm256_shuffle_epi8(rr, shuf_r0));
+		__m256i out1 = _mm256_or_si256(_mm256_shuffle_epi8(bg, shuf_bg1), _mm256_shuffle_epi8(rr, shuf_r1));
+
+		/* Each 128-bit lane holds 24 bytes (8 pixels) of output */
+		_mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(out0));
+		_mm_storel_epi64((__m128i *) (dst + 16), _mm256_castsi256_si128(out1));
+		_mm_storeu_si128((__m128i *) (dst + 24), _mm256_extracti128_si256(out0, 1));
+		_mm_storel_epi64((__m128i *) (dst + 40), _mm256_extracti128_si256(out1, 1));
+	}
+
+	uyvy_row_scalar(src, dst, width - x, c);
+}
+
+__attribute__((target("avx2")))
+static void nv12_row_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	const __m128i shuf_u = _mm_setr_epi8(SHUF_NV_U8);
+	const __m128i shuf_v = _mm_setr_epi8(SHUF_NV_V8);
+	const __m256i shuf_bg0 = _mm256_setr_epi8(SHUF_BG0, SHUF_BG0);
+	const __m256i shuf_r0 = _mm256_setr_epi8(SHUF_R0, SHUF_R0);
+	const __m256i shuf_bg1 = _mm256_setr_epi8(SHUF_BG1, SHUF_BG1);
+	const __m256i shuf_r1 = _mm256_setr_epi8(SHUF_R1, SHUF_R1);
+	const __m256i y_off = _mm256_set1_epi16(c->y_off);
+	const __m256i uv_off = _mm256_set1_epi16(128);
+	const __m256i rounding = _mm256_set1_epi16(8);
+	const __m256i cy = _mm256_set1_epi16(c->cy);
+	const __m256i crv = _mm256_set1_epi16(c->crv);
+	const __m256i cgu = _mm256_set1_epi16(c->cgu);
+	const __m256i cgv = _mm256_set1_epi16(c->cgv);
+	const __m256i cbu = _mm256_set1_epi16(c->cbu);
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16, y += 16, uv += 16, dst += 48) {
+		__m128i in_uv = _mm_loadu_si128((const __m128i *) uv);
+		__m256i ys = _mm256_slli_epi16(_mm256_sub_epi16(
+				_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) y)), y_off), 6);
+		__m256i u = _mm256_slli_epi16(_mm256_sub_epi16(
+				_mm256_cvtepu8_epi16(_mm_shuffle_epi8(in_uv, shuf_u)), uv_off), 6);
+		__m256i v = _mm256_slli_epi16(_mm256_sub_epi16(
+				_mm256_cvtepu8_epi16(_mm_shuffle_epi8(in_uv, shuf_v)), uv_off), 6);
+		__m256i yt = _mm256_add_epi16(_mm256_mulhrs_epi16(ys, cy), rounding);
+		__m256i r = _mm256_srai_epi16(_mm256_add_epi16(yt, _mm256_mulhrs_epi16(v, crv)), 4);
+		__m256i g = _mm256_srai_epi16(_mm256_add_epi16(yt,
+				_mm256_add_epi16(_mm256_mulhrs_epi16(u, cgu), _mm256_mulhrs_epi16(v, cgv))), 4);
+		__m256i b = _mm256_srai_epi16(_mm256_add_epi16(yt, _mm256_mulhrs_epi16(u, cbu)), 4);
+		__m256i bg = _mm256_packus_epi16(b, g);
+		__m256i rr = _mm256_packus_epi16(r, r);
+		__m256i out0 = _mm256_or_si256(_mm256_shuffle_epi8(bg, shuf_bg0), _mm256_shuffle_epi8(rr, shuf_r0));
+		__m256i out1 = _mm256_or_si256(_mm256_shuffle_epi8(bg, shuf_bg1), _mm256_shuffle_epi8(rr, shuf_r1));
+
+		/* Each 128-bit lane holds 24 bytes (8 pixels) of output */
+		_mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(out0));
+		_mm_storel_epi64((__m128i *) (dst + 16), _mm256_castsi256_si128(out1));
+		_mm_storeu_si128((__m128i *) (dst + 24), _mm256_extracti128_si256(out0, 1));
+		_mm_storel_epi64((__m128i *) (dst + 40), _mm256_extracti128_si256(out1, 1));
+	}
+
+	nv12_row_scalar(y, uv, dst, width - x, c);
+}
+#endif
+
+#ifdef CONVERT_NEON
+/*
+ * Converts 16 pixels per iteration. vld4 de-interleaves UYVY into U, even Y,
+ * V and odd Y; the even and odd pixels are converted separately and zipped
+ * back together before the interleaving store.
+ */
+static void uyvy_row_neon(const uint8_t *src, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	const int16x8_t y_off = vdupq_n_s16(c->y_off);
+	const int16x8_t uv_off = vdupq_n_s16(128);
+	const int16x8_t cy = vdupq_n_s16(c->cy);
+	const int16x8_t crv = vdupq_n_s16(c->crv);
+	const int16x8_t cgu = vdupq_n_s16(c->cgu);
+	const int16x8_t cgv = vdupq_n_s16(c->cgv);
+	const int16x8_t cbu = vdupq_n_s16(c->cbu);
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16, src += 32, dst += 48) {
+		uint8x8x4_t in = vld4_u8(src);
+		int16x8_t u = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[0])), uv_off), 6);
+		int16x8_t v = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[2])), uv_off), 6);
+		int16x8_t ye = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[1])), y_off), 6);
+		int16x8_t yo = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[3])), y_off), 6);
+		int16x8_t cr = vqrdmulhq_s16(v, crv);
+		int16x8_t cg = vaddq_s16(vqrdmulhq_s16(u, cgu), vqrdmulhq_s16(v, cgv));
+		int16x8_t cb = vqrdmulhq_s16(u, cbu);
+		uint8x8x2_t r, g, b;
+		uint8x16x3_t out;
+
+		ye = vqrdmulhq_s16(ye, cy);
+		yo = vqrdmulhq_s16(yo, cy);
+
+		r = vzip_u8(vqrshrun_n_s16(vaddq_s16(ye, cr), 4), vqrshrun_n_s16(vaddq_s16(yo, cr), 4));
+		g = vzip_u8(vqrshrun_n_s16(vaddq_s16(ye, cg), 4), vqrshrun_n_s16(vaddq_s16(yo, cg), 4));
+		b = vzip_u8(vqrshrun_n_s16(vaddq_s16(ye, cb), 4), vqrshrun_n_s16(vaddq_s16(yo, cb), 4));
+
+		out.val[0] = vcombine_u8(b.val[0], b.val[1]);
+		out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+		out.val[2] = vcombine_u8(r.val[0], r.val[1]);
+		vst3q_u8(dst, out);
+	}
+
+	uyvy_row_scalar(src, dst, width - x, c);
+}
+
+/*
+ * Same as uyvy_row_neon() with the even and odd luma samples and the CbCr
+ * pairs de-interleaved from their own planes by vld2.
+ */
+static void nv12_row_neon(const uint8_t *y, const uint8_t *uv, uint8_t *dst, unsigned int width,
+		const struct yuv_coeffs *c)
+{
+	const int16x8_t y_off = vdupq_n_s16(c->y_off);
+	const int16x8_t uv_off = vdupq_n_s16(128);
+	const int16x8_t cy = vdupq_n_s16(c->cy);
+	const int16x8_t crv = vdupq_n_s16(c->crv);
+	const int16x8_t cgu = vdupq_n_s16(c->cgu);
+	const int16x8_t cgv = vdupq_n_s16(c->cgv);
+	const int16x8_t cbu = vdupq_n_s16(c->cbu);
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16, y += 16, uv += 16, dst += 48) {
+		uint8x8x2_t in_y = vld2_u8(y);
+		uint8x8x2_t in_uv = vld2_u8(uv);
+		int16x8_t u = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in_uv.val[0])), uv_off), 6);
+		int16x8_t v = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in_uv.val[1])), uv_off), 6);
+		int16x8_t ye = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in_y.val[0])), y_off), 6);
+		int16x8_t yo = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in_y.val[1])), y_off), 6);
+		int16x8_t cr = vqrdmulhq_s16(v, crv);
+		int16x8_t cg = vaddq_s16(vqrdmulhq_s16(u, cgu), vqrdmulhq_s16(v, cgv));
+		int16x8_t cb = vqrdmulhq_s16(u, cbu);
+		uint8x8x2_t r, g, b;
+		uint8x16x3_t out;
+
+		ye = vqrdmulhq_s16(ye, cy);
+		yo = vqrdmulhq_s16(yo, cy);
+
+		r = vzip_u8(vqrshrun_n_s16(vaddq_s16(ye, cr), 4), vqrshrun_n_s16(vaddq_s16(yo, cr), 4));
+		g = vzip_u8(vqrshrun_n_s16(vaddq_s16(ye, cg), 4), vqrshrun_n_s16(vaddq_s16(yo, cg), 4));
+		b = vzip_u8(vqrshrun_n_s16(vaddq_s16(ye, cb), 4), vqrshrun_n_s16(vaddq_s16(yo, cb), 4));
+
+		out.val[0] = vcombine_u8(b.val[0], b.val[1]);
+		out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+		out.val[2] = vcombine_u8(r.val[0], r.val[1]);
+		vst3q_u8(dst, out);
+	}
+
+	nv12_row_scalar(y, uv, dst, width - x, c);
+}
+#endif
+
+/*
+ * A frame converted in stripes by helper_convert_uyvy_to_bgr_parallel()
+ */
+struct uyvy_job {
+	const unsigned char *src;
+	size_t src_stride;
+	unsigned char *dst;
+	size_t dst_stride;
+	unsigned int width;
+	enum helper_yuv_matrix matrix;
+	enum helper_yuv_range range;
+};
+
+static void uyvy_stripe(void *arg, unsigned int first_row, unsigned int n_rows)
+{
+	const struct uyvy_job *job = (const struct uyvy_job *) arg;
+
+	helper_convert_uyvy_to_bgr(job->src + first_row * job->src_stride, job->src_stride,
+			job->dst + first_row * job->dst_stride, job->dst_stride,
+			job->width, n_rows, job->matrix, job->range);
+}
+
+/*
+ * A frame converted by helper_convert_nv12_to_bgr(_parallel)(). Stripes may
+ * start on an odd row, so the rows are addressed from the top of the frame.
+ */
+struct nv12_job {
+	const unsigned char *y;
+	size_t y_stride;
+	const unsigned char *uv;
+	size_t uv_stride;
+	unsigned char *dst;
+	size_t dst_stride;
+	unsigned int width;
+	const struct yuv_coeffs *c;
+};
+
+static void nv12_stripe(void *arg, unsigned int first_row, unsigned int n_rows)
+{
+	const struct nv12_job *job = (const struct nv12_job *) arg;
+	unsigned int row;
+
+	for (row = first_row; row < first_row + n_rows; row++)
+		nv12_row(job->y + row * job->y_stride, job->uv + (row / 2) * job->uv_stride,
+				job->dst + row * job->dst_stride, job->width, job->c);
+}
+
+static uyvy_row_fn backend_uyvy_row(enum helper_convert_backend b)
+{
+	switch (b) {
+		case HELPER_CONVERT_SCALAR:
+			return uyvy_row_scalar;
+
+#ifdef CONVERT_X86
+		case HELPER_CONVERT_SSE4:
+			return (__builtin_cpu_supports("sse4.1")) ? uyvy_row_sse4 : NULL;
+
+		case HELPER_CONVERT_AVX2:
+			return (__builtin_cpu_supports("avx2")) ? uyvy_row_avx2 : NULL;
+#endif
+
+#ifdef CONVERT_NEON
+		case HELPER_CONVERT_NEON:
+			return uyvy_row_neon;
+#endif
+
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Every backend has both kernels, so backend_uyvy_row() tells whether a
+ * backend is supported.
+ */
+static nv12_row_fn backend_nv12_row(enum helper_convert_backend b)
+{
+	switch (b) {
+		case HELPER_CONVERT_SCALAR:
+			return nv12_row_scalar;
+
+#ifdef CONVERT_X86
+		case HELPER_CONVERT_SSE4:
+			return (__builtin_cpu_supports("sse4.1")) ? nv12_row_sse4 : NULL;
+
+		case HELPER_CONVERT_AVX2:
+			return (__builtin_cpu_supports("avx2")) ? nv12_row_avx2 : NULL;
+#endif
+
+#ifdef CONVERT_NEON
+		case HELPER_CONVERT_NEON:
+			return nv12_row_neon;
+#endif
+
+		default:
+			return NULL;
+	}
+}
+
+static void init_convert(void)
+{
+	static const enum helper_convert_backend preferred[] = {
+		HELPER_CONVERT_AVX2,
+		HELPER_CONVERT_NEON,
+		HELPER_CONVERT_SSE4,
+		HELPER_CONVERT_SCALAR
+	};
+	unsigned int i;
+
+	init_coeffs(&coeffs[HELPER_YUV_BT601][HELPER_YUV_RANGE_LIMITED], 0.299, 0.114, 0);
+	init_coeffs(&coeffs[HELPER_YUV_BT601][HELPER_YUV_RANGE_FULL], 0.299, 0.114, 1);
+	init_coeffs(&coeffs[HELPER_YUV_BT709][HELPER_YUV_RANGE_LIMITED], 0.2126, 0.0722, 0);
+	init_coeffs(&coeffs[HELPER_YUV_BT709][HELPER_YUV_RANGE_FULL], 0.2126, 0.0722, 1);
+
+#ifdef CONVERT_X86
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+		uyvy_row = backend_uyvy_row(preferred[i]);
+		if (uyvy_row) {
+			nv12_row = backend_nv12_row(preferred[i]);
+			backend = preferred[i];
+			break;
+		}
+	}
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+int helper_convert_uyvy_to_bgr(const unsigned char *src, size_t src_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range)
+{
+	const struct yuv_coeffs *c;
+	unsigned int y;
+
+	if (
+		!src || !dst || (width % 2) ||
+		src_stride < (size_t) width * 2 || dst_stride < (size_t) width * 3 ||
+		(matrix != HELPER_YUV_BT601 && matrix != HELPER_YUV_BT709) ||
+		(range != HELPER_YUV_RANGE_LIMITED && range != HELPER_YUV_RANGE_FULL)
+	)
+	{
+		fprintf(stderr, "Invalid parameters for UYVY to BGR conversion\n");
+		return ERR;
+	}
+
+	pthread_once(&init_once, init_convert);
+	c = &coeffs[matrix][range];
+
+	for (y = 0; y < height; y++)
+		uyvy_row(src + y * src_stride, dst + y * dst_stride, width, c);
+
+	return 0;
+}
+
+int helper_convert_uyvy_to_bgr_parallel(struct helper_pool *pool,
+		const unsigned char *src, size_t src_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range)
+{
+	struct uyvy_job job;
+
+	/*
+	 * Validate the parameters once for the whole frame (no rows are
+	 * converted).
+	 */
+	if (helper_convert_uyvy_to_bgr(src, src_stride, dst, dst_stride, width, 0, matrix, range) < 0)
+		return ERR;
+
+	if (!pool)
+		return helper_convert_uyvy_to_bgr(src, src_stride, dst, dst_stride, width, height, matrix, range);
+
+	job.src = src;
+	job.src_stride = src_stride;
+	job.dst = dst;
+	job.dst_stride = dst_stride;
+	job.width = width;
+	job.matrix = matrix;
+	job.range = range;
+
+	return helper_pool_run_stripes(pool, uyvy_stripe, &job, height, (size_t) width * 5);
+}
+
+/*
+ * Checks the parameters of an NV12 conversion and fills 'job' for it.
+ */
+static int init_nv12_job(struct nv12_job *job, const unsigned char *y, size_t y_stride,
+		const unsigned char *uv, size_t uv_stride,
+		unsigned char *dst, size_t dst_stride, unsigned int width,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range)
+{
+	if (
+		!y || !uv || !dst || (width % 2) ||
+		y_stride < width || uv_stride < width || dst_stride < (size_t) width * 3 ||
+		(matrix != HELPER_YUV_BT601 && matrix != HELPER_YUV_BT709) ||
+		(range != HELPER_YUV_RANGE_LIMITED && range != HELPER_YUV_RANGE_FULL)
+	)
+	{
+		fprintf(stderr, "Invalid parameters for NV12 to BGR conversion\n");
+		return ERR;
+	}
+
+	pthread_once(&init_once, init_convert);
+
+	job->y = y;
+	job->y_stride = y_stride;
+	job->uv = uv;
+	job->uv_stride = uv_stride;
+	job->dst = dst;
+	job->dst_stride = dst_stride;
+	job->width = width;
+	job->c = &coeffs[matrix][range];
+	return 0;
+}
+
+int helper_convert_nv12_to_bgr(const unsigned char *y, size_t y_stride,
+		const unsigned char *uv, size_t uv_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range)
+{
+	struct nv12_job job;
+
+	if (init_nv12_job(&job, y, y_stride, uv, uv_stride, dst, dst_stride, width, matrix, range) < 0)
+		return ERR;
+
+	nv12_stripe(&job, 0, height);
+	return 0;
+}
+
+int helper_convert_nv12_to_bgr_parallel(struct helper_pool *pool,
+		const unsigned char *y, size_t y_stride,
+		const unsigned char *uv, size_t uv_stride,
+		unsigned char *dst, size_t dst_stride,
+		unsigned int width, unsigned int height,
+		enum helper_yuv_matrix matrix, enum helper_yuv_range range)
+{
+	struct nv12_job job;
+
+	if (init_nv12_job(&job, y, y_stride, uv, uv_stride, dst, dst_stride, width, matrix, range) < 0)
+		return ERR;
+
+	if (!pool) {
+		nv12_stripe(&job, 0, height);
+		return 0;
+	}
+
+	return helper_pool_run_stripes(pool, nv12_stripe, &job, height, (size_t) width * 4);
+}
+
+int helper_convert_set_backend(enum helper_convert_backend b)
+{
+	uyvy_row_fn row;
+
+	pthread_once(&init_once, init_convert);
+
+	if (b == HELPER_CONVERT_AUTO) {
+		/* Re-run the selection done at initialisation */
+		init_convert();
+		return 0;
+	}
+
+	row = backend_uyvy_row(b);
+	if (!row)
+	{
+		fprintf(stderr, "Conversion backend %s isn't supported\n", helper_convert_backend_name(b));
+		return ERR;
+	}
+
+	uyvy_row = row;
+	nv12_row = backend_nv12_row(b);
+	backend = b;
+	return 0;
+}
+
+enum helper_convert_backend helper_convert_get_backend(void)
+{
+	pthread_once(&init_once, init_convert);
+	return backend;
+}
+
+int helper_convert_backend_supported(enum helper_convert_backend b)
+{
+	pthread_once(&init_once, init_convert);
+	return b == HELPER_CONVERT_AUTO || backend_uyvy_row(b) != NULL;
+}
+
+const char *helper_convert_backend_name(enum helper_convert_backend b)
+{
+	switch (b) {
+		case HELPER_CONVERT_AUTO:
+			return "auto";
+		case HELPER_CONVERT_SCALAR:
+			return "scalar";
+		case HELPER_CONVERT_SSE4:
+			return "sse4";
+		case HELPER_CONVERT_AVX2:
+			return "avx2";
+		case HELPER_CONVERT_NEON:
+			return "neon";
+		default:
+			return "unknown";
+	}
+}
@@ -0,0 +1,652 @@
+/*
+ * opencv_v4l2 - v4l2_helper_ctrl.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <linux/videodev2.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_ctrl.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+struct ctrl_entry {
+	struct helper_ctrl_info info;  /* info.has_value: info.value is what the device has */
+	char      stale;               /* The flags and range must be queried again */
+	char      staged;
+	long long staged_value;
+	int       request_fd;          /* Request holding a value not applied yet, -1 if none */
+	long long request_value;
+};
+
+/*
+ * The entries are sorted by id. 'batch' has room for all of them, so that
+ * applying the staged updates allocates nothing.
+ */
+struct ctrl_cache {
+	pthread_mutex_t lock;
+	ctrl_ioctl_func ioctl;
+	void           *dev;
+	int             use_ext;        /* The driver has VIDIOC_QUERY_EXT_CTRL */
+
+	struct ctrl_entry *entries;
+	unsigned int    n_entries;
+	unsigned int    n_staged;
+	unsigned int    n_in_requests;  /* Entries with a request_fd */
+	struct v4l2_ext_control *batch;
+
+	struct helper_ctrl_stats stats;
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static int has_value64(unsigned int type)
+{
+	return type == V4L2_CTRL_TYPE_INTEGER64;
+}
+
+/*
+ * Controls whose value can't be cached: it changes on its own (e.g., the
+ * exposure chosen by an automatic exposure control), can't be read back or,
+ * for buttons, doesn't exist.
+ */
+static int is_uncached(const struct helper_ctrl_info *info)
+{
+	return (info->flags & (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_WRITE_ONLY)) ||
+		info->type == V4L2_CTRL_TYPE_BUTTON;
+}
+
+static int is_readable(const struct helper_ctrl_info *info)
+{
+	return !(info->flags & V4L2_CTRL_FLAG_WRITE_ONLY) && info->type != V4L2_CTRL_TYPE_BUTTON;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	unsigned int id_a = ((const struct ctrl_entry *) a)->info.id;
+	unsigned int id_b = ((const struct ctrl_entry *) b)->info.id;
+
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static struct ctrl_entry *find_entry(struct ctrl_cache *cache, unsigned int id)
+{
+	unsigned int low = 0, high = cache->n_entries;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+
+		if (cache->entries[mid].info.id == id)
+			return &cache->entries[mid];
+		if (cache->entries[mid].info.id < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	fprintf(stderr, "Error: unknown control 0x%08x\n", id);
+	return NULL;
+}
+
+static int cache_ioctl(struct ctrl_cache *cache, unsigned long request, void *arg)
+{
+	cache->stats.ioctls++;
+	return cache->ioctl(cache->dev, request, arg);
+}
+
+static void set_ext_value(struct v4l2_ext_control *ctrl, const struct helper_ctrl_info *info, long long value)
+{
+	CLEAR(*ctrl);
+	ctrl->id = info->id;
+	if (has_value64(info->type))
+		ctrl->value64 = value;
+	else
+		ctrl->value = (int) value;
+}
+
+static long long ext_value(const struct v4l2_ext_control *ctrl, const struct helper_ctrl_info *info)
+{
+	return (has_value64(info->type)) ? ctrl->value64 : ctrl->value;
+}
+
+/*
+ * Makes 'value' a valid value of the control, as the driver would: clamped
+ * to the range and rounded to the step. Fails for read-only controls.
+ */
+static int normalize_value(const struct helper_ctrl_info *info, long long *value)
+{
+	long long v = *value;
+
+	if (info->flags & V4L2_CTRL_FLAG_READ_ONLY) {
+		fprintf(stderr, "Error: control '%s' is read-only\n", info->name);
+		return ERR;
+	}
+
+	switch (info->type) {
+		case V4L2_CTRL_TYPE_BOOLEAN:
+			v = (v != 0);
+			break;
+
+		case V4L2_CTRL_TYPE_BUTTON:
+			v = 0;
+			break;
+
+		case V4L2_CTRL_TYPE_BITMASK:
+			v &= info->maximum;
+			break;
+
+		default:
+			if (v < info->minimum)
+				v = info->minimum;
+			if (v > info->maximum)
+				v = info->maximum;
+			if (info->step > 1) {
+				v = info->minimum + (long long) (((unsigned long long) (v - info->minimum) + info->step / 2) / info->step * info->step);
+				if (v > info->maximum)
+					v -= (long long) info->step;
+			}
+			break;
+	}
+
+	*value = v;
+	return 0;
+}
+
+/*
+ * Whether writing 'value' would change nothing, in which case the update is
+ * dropped.
+ */
+static int is_unchanged(const struct helper_ctrl_info *info, long long value)
+{
+	return info->has_value && !is_uncached(info) && info->value == value;
+}
+
+static void unstage(struct ctrl_cache *cache, struct ctrl_entry *entry)
+{
+	if (entry->staged) {
+		entry->staged = 0;
+		cache->n_staged--;
+	}
+}
+
+/*
+ * Whether the value of a control can be kept: it can't while a request
+ * holding another one is pending.
+ */
+static int is_cacheable(const struct ctrl_entry *entry)
+{
+	return !is_uncached(&entry->info) && entry->request_fd < 0;
+}
+
+/*
+ * Setting a control with V4L2_CTRL_FLAG_UPDATE may change other controls
+ * (e.g., switching automatic exposure on makes the exposure time volatile),
+ * so their values and flags are no longer known. They're queried again when
+ * next read (see refresh_entry()) rather than right away, which would cost
+ * an ioctl per control.
+ */
+static void invalidate_all(struct ctrl_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->n_entries; i++) {
+		cache->entries[i].info.has_value = 0;
+		cache->entries[i].stale = 1;
+	}
+}
+
+/*
+ * Called after writing 'n' controls of 'batch', into the request
+ * 'request_fd' unless it's -1. The values of a request only become current
+ * when it's applied (see ctrl_request_done()); until then, the controls
+ * are read from the device.
+ */
+static void note_written(struct ctrl_cache *cache, unsigned int n, int request_fd)
+{
+	unsigned int i, invalidate = 0;
+
+	for (i = 0; i < n; i++) {
+		struct ctrl_entry *entry = find_entry(cache, cache->batch[i].id);
+
+		if (!entry)
+			continue;
+		if (request_fd >= 0) {
+			if (entry->request_fd < 0)
+				cache->n_in_requests++;
+			entry->request_fd = request_fd;
+			entry->request_value = ext_value(&cache->batch[i], &entry->info);
+			entry->info.has_value = 0;
+			continue;
+		}
+		if (entry->info.flags & V4L2_CTRL_FLAG_UPDATE)
+			invalidate = 1;
+		entry->info.value = ext_value(&cache->batch[i], &entry->info);
+		entry->info.has_value = is_cacheable(entry);
+	}
+
+	if (invalidate)
+		invalidate_all(cache);
+}
+
+/*
+ * Writes the first 'n' controls of 'batch' in a single ioctl.
+ */
+static int write_batch(struct ctrl_cache *cache, unsigned int n, int request_fd)
+{
+	struct v4l2_ext_controls ctrls;
+	unsigned int i;
+
+	CLEAR(ctrls);
+	ctrls.which = (request_fd >= 0) ? V4L2_CTRL_WHICH_REQUEST_VAL : V4L2_CTRL_WHICH_CUR_VAL;
+	ctrls.request_fd = (request_fd >= 0) ? request_fd : 0;
+	ctrls.count = n;
+	ctrls.controls = cache->batch;
+
+	if (-1 == cache_ioctl(cache, VIDIOC_S_EXT_CTRLS, &ctrls)) {
+		struct ctrl_entry *entry = (ctrls.error_idx < n) ? find_entry(cache, cache->batch[ctrls.error_idx].id) : NULL;
+
+		/*
+		 * error_idx == count: the values were refused before any was
+		 * written. Otherwise the ones before error_idx may have been
+		 * written, so none of the values are known anymore.
+		 */
+		fprintf(stderr, "Error occurred when setting control%s%s (%s)\n",
+				(entry) ? " " : "s", (entry) ? entry->info.name : "", strerror(errno));
+		for (i = 0; i < n; i++) {
+			entry = find_entry(cache, cache->batch[i].id);
+			if (entry)
+				entry->info.has_value = 0;
+		}
+		cache->stats.failures += n;
+		return ERR;
+	}
+
+	cache->stats.writes += n;
+	note_written(cache, n, request_fd);
+	return 0;
+}
+
+/*
+ * Reads the current values of the first 'n' controls of 'batch' in a single
+ * ioctl.
+ */
+static int read_batch(struct ctrl_cache *cache, unsigned int n)
+{
+	struct v4l2_ext_controls ctrls;
+
+	CLEAR(ctrls);
+	ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	ctrls.count = n;
+	ctrls.controls = cache->batch;
+
+	return (-1 == cache_ioctl(cache, VIDIOC_G_EXT_CTRLS, &ctrls)) ? ERR : 0;
+}
+
+/*
+ * Queries the control 'id', or the one following it with
+ * V4L2_CTRL_FLAG_NEXT_CTRL, with VIDIOC_QUERYCTRL for the drivers that lack
+ * VIDIOC_QUERY_EXT_CTRL. Returns 1 when there is none.
+ */
+static int query_ctrl(struct ctrl_cache *cache, unsigned int id, struct helper_ctrl_info *info)
+{
+	struct v4l2_query_ext_ctrl qc;
+	struct v4l2_queryctrl old_qc;
+
+	CLEAR(*info);
+	if (cache->use_ext) {
+		CLEAR(qc);
+		qc.id = id;
+		if (0 == cache_ioctl(cache, VIDIOC_QUERY_EXT_CTRL, &qc)) {
+			info->id = qc.id;
+			snprintf(info->name, sizeof(info->name), "%s", qc.name);
+			info->type = qc.type;
+			info->minimum = qc.minimum;
+			info->maximum = qc.maximum;
+			info->step = qc.step;
+			info->default_value = qc.default_value;
+			info->flags = qc.flags;
+			return 0;
+		}
+		if (errno != ENOTTY || id != V4L2_CTRL_FLAG_NEXT_CTRL)
+			return 1;
+		cache->use_ext = 0;
+	}
+
+	CLEAR(old_qc);
+	old_qc.id = id;
+	if (-1 == cache_ioctl(cache, VIDIOC_QUERYCTRL, &old_qc))
+		return 1;
+
+	info->id = old_qc.id;
+	snprintf(info->name, sizeof(info->name), "%s", (const char *) old_qc.name);
+	info->type = old_qc.type;
+	info->minimum = old_qc.minimum;
+	info->maximum = old_qc.maximum;
+	info->step = old_qc.step;
+	info->default_value = old_qc.default_value;
+	info->flags = old_qc.flags;
+	return 0;
+}
+
+/*
+ * Queries the flags and range of a stale entry again (see note_written()).
+ * They're kept if the query fails.
+ */
+static void refresh_entry(struct ctrl_cache *cache, struct ctrl_entry *entry)
+{
+	struct helper_ctrl_info info;
+
+	if (!entry->stale)
+		return;
+
+	if (query_ctrl(cache, entry->info.id, &info) == 0) {
+		entry->info.minimum = info.minimum;
+		entry->info.maximum = info.maximum;
+		entry->info.step = info.step;
+		entry->info.default_value = info.default_value;
+		entry->info.flags = info.flags;
+	}
+	entry->stale = 0;
+}
+
+static int enumerate(struct ctrl_cache *cache)
+{
+	struct helper_ctrl_info info;
+	unsigned int id = 0, capacity = 0;
+
+	cache->use_ext = 1;
+	while (query_ctrl(cache, id | V4L2_CTRL_FLAG_NEXT_CTRL, &info) == 0) {
+		id = info.id;
+
+		if (
+			(info.flags & V4L2_CTRL_FLAG_DISABLED) ||
+			info.type == V4L2_CTRL_TYPE_CTRL_CLASS ||
+			info.type == V4L2_CTRL_TYPE_STRING ||
+			info.type >= V4L2_CTRL_COMPOUND_TYPES
+		)
+		{
+			continue;
+		}
+
+		if (cache->n_entries == capacity) {
+			struct ctrl_entry *entries;
+
+			capacity = (capacity) ? 2 * capacity : 32;
+			entries = (struct ctrl_entry *) realloc(cache->entries, capacity * sizeof(*entries));
+			if (!entries) {
+				fprintf(stderr, "Out of memory\n");
+				return ERR;
+			}
+			cache->entries = entries;
+		}
+		CLEAR(cache->entries[cache->n_entries]);
+		cache->entries[cache->n_entries].info = info;
+		cache->entries[cache->n_entries].request_fd = -1;
+		cache->n_entries++;
+	}
+
+	if (cache->n_entries)
+		qsort(cache->entries, cache->n_entries, sizeof(*cache->entries), compare_entries);
+
+	return 0;
+}
+
+/*
+ * Reads the values of all the readable controls. Some drivers refuse to
+ * read several controls at once, or one of them; their values are then
+ * read when first asked for.
+ */
+static void read_values(struct ctrl_cache *cache)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < cache->n_entries; i++)
+		if (is_readable(&cache->entries[i].info))
+			set_ext_value(&cache->batch[n++], &cache->entries[i].info, 0);
+
+	if (n == 0 || read_batch(cache, n) < 0)
+		return;
+
+	for (i = 0, n = 0; i < cache->n_entries; i++) {
+		struct helper_ctrl_info *info = &cache->entries[i].info;
+
+		if (!is_readable(info))
+			continue;
+		info->value = ext_value(&cache->batch[n++], info);
+		info->has_value = !is_uncached(info);
+	}
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+int ctrl_cache_create(struct ctrl_cache **cache_out, ctrl_ioctl_func func, void *dev)
+{
+	struct ctrl_cache *cache = (struct ctrl_cache *) calloc(1, sizeof(*cache));
+
+	if (!cache) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	cache->ioctl = func;
+	cache->dev = dev;
+
+	if (enumerate(cache) < 0) {
+		free(cache->entries);
+		free(cache);
+		return ERR;
+	}
+
+	cache->batch = (struct v4l2_ext_control *) calloc(cache->n_entries + 1, sizeof(*cache->batch));
+	if (!cache->batch || pthread_mutex_init(&cache->lock, NULL) != 0) {
+		fprintf(stderr, "Error occurred when creating control cache\n");
+		free(cache->batch);
+		free(cache->entries);
+		free(cache);
+		return ERR;
+	}
+
+	read_values(cache);
+
+	*cache_out = cache;
+	return 0;
+}
+
+void ctrl_cache_destroy(struct ctrl_cache *cache)
+{
+	if (!cache)
+		return;
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->batch);
+	free(cache->entries);
+	free(cache);
+}
+
+unsigned int ctrl_count(struct ctrl_cache *cache)
+{
+	return cache->n_entries;
+}
+
+int ctrl_info(struct ctrl_cache *cache, unsigned int index, struct helper_ctrl_info *info)
+{
+	if (index >= cache->n_entries) {
+		fprintf(stderr, "Error: no control at index %u\n", index);
+		return ERR;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	refresh_entry(cache, &cache->entries[index]);
+	*info = cache->entries[index].info;
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+int ctrl_query(struct ctrl_cache *cache, unsigned int id, struct helper_ctrl_info *info)
+{
+	struct ctrl_entry *entry;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_entry(cache, id);
+	if (entry) {
+		refresh_entry(cache, entry);
+		*info = entry->info;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return (entry) ? 0 : ERR;
+}
+
+int ctrl_get(struct ctrl_cache *cache, unsigned int id, long long *value)
+{
+	struct ctrl_entry *entry;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_entry(cache, id);
+	if (entry)
+		refresh_entry(cache, entry);
+	if (!entry) {
+		ret = ERR;
+	} else if (!entry->info.has_value) {
+		if (!is_readable(&entry->info)) {
+			fprintf(stderr, "Error: control '%s' can't be read\n", entry->info.name);
+			ret = ERR;
+		} else {
+			set_ext_value(&cache->batch[0], &entry->info, 0);
+			if (read_batch(cache, 1) < 0) {
+				fprintf(stderr, "Error occurred when getting control '%s'\n", entry->info.name);
+				ret = ERR;
+			} else {
+				entry->info.value = ext_value(&cache->batch[0], &entry->info);
+				entry->info.has_value = is_cacheable(entry);
+				*value = entry->info.value;
+			}
+		}
+	} else {
+		*value = entry->info.value;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+int ctrl_set(struct ctrl_cache *cache, unsigned int id, long long value)
+{
+	struct ctrl_entry *entry;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_entry(cache, id);
+	if (!entry || normalize_value(&entry->info, &value) < 0) {
+		ret = ERR;
+	} else {
+		unstage(cache, entry);
+		if (is_unchanged(&entry->info, value)) {
+			cache->stats.unchanged++;
+		} else {
+			set_ext_value(&cache->batch[0], &entry->info, value);
+			ret = write_batch(cache, 1, -1);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+int ctrl_stage(struct ctrl_cache *cache, unsigned int id, long long value)
+{
+	struct ctrl_entry *entry;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_entry(cache, id);
+	if (!entry || normalize_value(&entry->info, &value) < 0) {
+		ret = ERR;
+	} else if (is_unchanged(&entry->info, value)) {
+		/* Also cancels an update staged earlier */
+		unstage(cache, entry);
+		cache->stats.unchanged++;
+	} else {
+		if (!entry->staged) {
+			entry->staged = 1;
+			cache->n_staged++;
+		}
+		entry->staged_value = value;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+int ctrl_apply(struct ctrl_cache *cache, int request_fd)
+{
+	unsigned int i, n = 0;
+	int ret;
+
+	pthread_mutex_lock(&cache->lock);
+	if (cache->n_staged == 0) {
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	for (i = 0; i < cache->n_entries && n < cache->n_staged; i++) {
+		struct ctrl_entry *entry = &cache->entries[i];
+
+		if (entry->staged) {
+			set_ext_value(&cache->batch[n++], &entry->info, entry->staged_value);
+			entry->staged = 0;
+		}
+	}
+	cache->n_staged = 0;
+
+	/* Failed updates are dropped rather than retried with every frame */
+	ret = write_batch(cache, n, request_fd);
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+void ctrl_request_done(struct ctrl_cache *cache, int request_fd, int applied)
+{
+	unsigned int i, invalidate = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->n_entries && cache->n_in_requests; i++) {
+		struct ctrl_entry *entry = &cache->entries[i];
+
+		if (entry->request_fd < 0 || (request_fd >= 0 && entry->request_fd != request_fd))
+			continue;
+
+		entry->request_fd = -1;
+		cache->n_in_requests--;
+		if (applied) {
+			if (entry->info.flags & V4L2_CTRL_FLAG_UPDATE)
+				invalidate = 1;
+			entry->info.value = entry->request_value;
+			entry->info.has_value = is_cacheable(entry);
+		} else {
+			entry->info.has_value = 0;
+		}
+	}
+
+	if (invalidate)
+		invalidate_all(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void ctrl_get_stats(struct ctrl_cache *cache, struct helper_ctrl_stats *stats)
+{
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,78 @@
+/*
+ * opencv_v4l2 - v4l2_helper_ctrl.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Internal header file for the control cache (see helper_ctx_enum_ctrl()).
+
+#ifndef V4L2_HELPER_CTRL_H
+#define V4L2_HELPER_CTRL_H
+
+#include "v4l2_helper.h"
+
+/*
+ * The controls of a device, enumerated once, with their last known values
+ * and the updates staged to be written together.
+ */
+struct ctrl_cache;
+
+/*
+ * Issues a control ioctl to the device 'dev'; the cache doesn't know whether
+ * it's a real device or a virtual source.
+ */
+typedef int (*ctrl_ioctl_func)(void *dev, unsigned long request, void *arg);
+
+/*
+ * Enumerates the controls of 'dev' and reads their values, with a single
+ * VIDIOC_G_EXT_CTRLS when the driver allows it. Controls without a scalar
+ * value (compound and string controls) are left out.
+ */
+int ctrl_cache_create(struct ctrl_cache **cache_out, ctrl_ioctl_func func, void *dev);
+
+void ctrl_cache_destroy(struct ctrl_cache *cache);
+
+unsigned int ctrl_count(struct ctrl_cache *cache);
+
+int ctrl_info(struct ctrl_cache *cache, unsigned int index, struct helper_ctrl_info *info);
+
+int ctrl_query(struct ctrl_cache *cache, unsigned int id, struct helper_ctrl_info *info);
+
+/*
+ * Returns the cached value unless the control is volatile or its value
+ * isn't known, in which case it's read from the device.
+ */
+int ctrl_get(struct ctrl_cache *cache, unsigned int id, long long *value);
+
+/*
+ * Writes a control right away, superseding an update staged for it. Nothing
+ * is written when the control already has the value.
+ */
+int ctrl_set(struct ctrl_cache *cache, unsigned int id, long long value);
+
+/*
+ * Stages an update of a control, clamped to its range and rounded to its
+ * step, for the next ctrl_apply(). Updates to the value the control already
+ * has are dropped.
+ */
+int ctrl_stage(struct ctrl_cache *cache, unsigned int id, long long value);
+
+/*
+ * Writes the staged updates in a single VIDIOC_S_EXT_CTRLS, into the request
+ * 'request_fd' unless it's -1. Does nothing when no update is staged. The
+ * values written into a request aren't taken as current until
+ * ctrl_request_done() is called for it.
+ */
+int ctrl_apply(struct ctrl_cache *cache, int request_fd);
+
+/*
+ * The request 'request_fd' (-1: all the pending ones) has been applied to
+ * the device, its buffer being dequeued, or won't be ('applied' zero, e.g.,
+ * it couldn't be queued or streaming stopped). The values it holds become
+ * current, or unknown.
+ */
+void ctrl_request_done(struct ctrl_cache *cache, int request_fd, int applied);
+
+void ctrl_get_stats(struct ctrl_cache *cache, struct helper_ctrl_stats *stats);
+
+#endif
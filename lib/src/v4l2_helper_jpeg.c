@@ -0,0 +1,550 @@
+/*
+ * opencv_v4l2 - v4l2_helper_jpeg.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_jpeg.h"
+
+/*
+ * libjpeg(-turbo) decompressor set up once and reused for every frame, along
+ * with the scratch rows used for the raw (YUV) output.
+ */
+struct jpeg_state {
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr         jerr;
+	jmp_buf                       on_error;
+	int                           is_created;
+
+	unsigned char                *scratch;
+	size_t                        scratch_size;
+};
+
+enum slot_state {
+	SLOT_PENDING,
+	SLOT_DECODING,
+	SLOT_DONE
+};
+
+struct jpeg_slot {
+	const unsigned char       *jpeg;
+	size_t                     size;
+	struct helper_jpeg_image  *image;
+	void                      *tag;
+	enum slot_state            state;
+	int                        status;
+};
+
+struct jpeg_worker {
+	struct helper_jpeg_decoder *dec;
+	struct jpeg_state           state;
+	pthread_t                   thread;
+};
+
+struct helper_jpeg_decoder {
+	struct jpeg_worker *workers;
+	unsigned int        n_workers;
+
+	/*
+	 * Frames in flight, in submission order: slots[seq % max_in_flight]
+	 * for 'collected' <= seq < 'submitted'. Those from 'next_to_decode'
+	 * on haven't been picked by a worker yet.
+	 */
+	struct jpeg_slot   *slots;
+	unsigned int        max_in_flight;
+	unsigned long       submitted;
+	unsigned long       next_to_decode;
+	unsigned long       collected;
+
+	pthread_mutex_t     lock;
+	pthread_cond_t      work_cond;    /* Signalled when a frame is submitted */
+	pthread_cond_t      done_cond;    /* Signalled when a frame is decoded */
+	pthread_cond_t      space_cond;   /* Signalled when a frame is collected */
+	int                 stop;
+	int                 closed;
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static void on_jpeg_error(j_common_ptr cinfo)
+{
+	struct jpeg_state *st = (struct jpeg_state *) cinfo->client_data;
+	char message[JMSG_LENGTH_MAX];
+
+	/*
+	 * The default handler exits the process; return to the decoding
+	 * function instead.
+	 */
+	(*cinfo->err->format_message)(cinfo, message);
+	fprintf(stderr, "Error occurred when decoding JPEG frame: %s\n", message);
+	longjmp(st->on_error, 1);
+}
+
+static void on_jpeg_warning(j_common_ptr cinfo, int msg_level)
+{
+	/*
+	 * Corrupt data warnings are frequent with MJPEG cameras (e.g., on
+	 * frames cut short by a USB hiccup); the frame is decoded anyway.
+	 */
+	(void) cinfo;
+	(void) msg_level;
+}
+
+static void jpeg_state_init(struct jpeg_state *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->cinfo.err = jpeg_std_error(&st->jerr);
+	st->jerr.error_exit = on_jpeg_error;
+	st->jerr.emit_message = on_jpeg_warning;
+	st->cinfo.client_data = st;
+	jpeg_create_decompress(&st->cinfo);
+	st->is_created = 1;
+}
+
+static void jpeg_state_free(struct jpeg_state *st)
+{
+	if (st->is_created)
+		jpeg_destroy_decompress(&st->cinfo);
+	free(st->scratch);
+	st->is_created = 0;
+	st->scratch = NULL;
+}
+
+static int read_bgr(struct jpeg_state *st, struct helper_jpeg_image *image)
+{
+	struct jpeg_decompress_struct *cinfo = &st->cinfo;
+	JSAMPROW rows[4];
+	unsigned int i, n;
+
+	cinfo->out_color_space = JCS_EXT_BGR;
+	jpeg_start_decompress(cinfo);
+
+	while (cinfo->output_scanline < cinfo->output_height)
+	{
+		n = cinfo->output_height - cinfo->output_scanline;
+		if (n > sizeof(rows) / sizeof(rows[0]))
+			n = sizeof(rows) / sizeof(rows[0]);
+
+		for (i = 0; i < n; i++)
+			rows[i] = image->planes[0] + (size_t) (cinfo->output_scanline + i) * image->strides[0];
+
+		jpeg_read_scanlines(cinfo, rows, n);
+	}
+
+	return 0;
+}
+
+/*
+ * Decodes the planes as they are stored in the image (raw data), an iMCU row
+ * at a time. libjpeg writes whole blocks, which may go past the width and
+ * height of the planes; so, the rows are decoded into scratch rows and then
+ * copied into the planes.
+ */
+static int read_yuv(struct jpeg_state *st, struct helper_jpeg_image *image)
+{
+	struct jpeg_decompress_struct *cinfo = &st->cinfo;
+	JSAMPROW rows[3][4 * DCTSIZE];
+	JSAMPARRAY planes[3];
+	unsigned int widths[3], heights[3], row_stride[3], n_rows[3];
+	unsigned int c, y, i, n_comps = cinfo->num_components;
+	size_t needed = 0, offset = 0;
+
+	if (
+		(n_comps != 1 && n_comps != 3) ||
+		(n_comps == 3 && cinfo->jpeg_color_space != JCS_YCbCr) ||
+		cinfo->max_v_samp_factor > 4
+	)
+	{
+		fprintf(stderr, "Error: JPEG frame isn't YCbCr or greyscale\n");
+		return ERR;
+	}
+
+	cinfo->raw_data_out = TRUE;
+	cinfo->out_color_space = cinfo->jpeg_color_space;
+	jpeg_start_decompress(cinfo);
+
+	for (c = 0; c < n_comps; c++)
+	{
+		jpeg_component_info *comp = &cinfo->comp_info[c];
+
+		widths[c] = comp->downsampled_width;
+		heights[c] = comp->downsampled_height;
+		row_stride[c] = comp->width_in_blocks * DCTSIZE;
+		n_rows[c] = comp->v_samp_factor * DCTSIZE;
+		needed += (size_t) row_stride[c] * n_rows[c];
+	}
+
+	if (needed > st->scratch_size)
+	{
+		unsigned char *scratch = (unsigned char *) realloc(st->scratch, needed);
+
+		if (!scratch)
+		{
+			fprintf(stderr, "Out of memory\n");
+			jpeg_abort_decompress(cinfo);
+			return ERR;
+		}
+		st->scratch = scratch;
+		st->scratch_size = needed;
+	}
+
+	for (c = 0; c < n_comps; c++)
+	{
+		for (i = 0; i < n_rows[c]; i++)
+			rows[c][i] = st->scratch + offset + (size_t) i * row_stride[c];
+		planes[c] = rows[c];
+		offset += (size_t) row_stride[c] * n_rows[c];
+	}
+
+	while (cinfo->output_scanline < cinfo->output_height)
+	{
+		/* First row of the iMCU row in each plane */
+		unsigned int imcu_row = cinfo->output_scanline / (cinfo->max_v_samp_factor * DCTSIZE);
+
+		if (jpeg_read_raw_data(cinfo, planes, cinfo->max_v_samp_factor * DCTSIZE) == 0)
+			break;
+
+		for (c = 0; c < n_comps; c++)
+		{
+			for (i = 0, y = imcu_row * n_rows[c]; i < n_rows[c] && y < heights[c]; i++, y++)
+				memcpy(image->planes[c] + (size_t) y * image->strides[c], rows[c][i], widths[c]);
+		}
+	}
+
+	image->chroma_width = (n_comps == 3) ? widths[1] : 0;
+	image->chroma_height = (n_comps == 3) ? heights[1] : 0;
+	return 0;
+}
+
+static int decode_with(struct jpeg_state *st, const unsigned char *jpeg, size_t size, struct helper_jpeg_image *image)
+{
+	struct jpeg_decompress_struct *cinfo = &st->cinfo;
+	int ret;
+
+	if (!jpeg || size == 0 || !image || !image->planes[0])
+		return ERR;
+
+	if (setjmp(st->on_error))
+	{
+		jpeg_abort_decompress(cinfo);
+		return ERR;
+	}
+
+	/*
+	 * libjpeg-turbo uses the standard Huffman tables for frames that
+	 * don't define them, as MJPEG frames usually don't.
+	 */
+	jpeg_mem_src(cinfo, (unsigned char *) jpeg, (unsigned long) size);
+	jpeg_read_header(cinfo, TRUE);
+
+	if (cinfo->image_width != image->width || cinfo->image_height != image->height)
+	{
+		fprintf(stderr, "Error: JPEG frame is %ux%u instead of %ux%u\n",
+				cinfo->image_width, cinfo->image_height, image->width, image->height);
+		jpeg_abort_decompress(cinfo);
+		return ERR;
+	}
+
+	switch (image->output)
+	{
+		case HELPER_JPEG_BGR:
+			ret = read_bgr(st, image);
+			break;
+
+		case HELPER_JPEG_YUV:
+			ret = read_yuv(st, image);
+			break;
+
+		default:
+			jpeg_abort_decompress(cinfo);
+			return ERR;
+	}
+
+	if (ret == 0)
+		jpeg_finish_decompress(cinfo);
+	else
+		jpeg_abort_decompress(cinfo);
+
+	return ret;
+}
+
+static void *worker(void *arg)
+{
+	struct jpeg_worker *w = (struct jpeg_worker *) arg;
+	struct helper_jpeg_decoder *dec = w->dec;
+	struct jpeg_slot *slot;
+
+	pthread_mutex_lock(&dec->lock);
+	while (1) {
+		while (!dec->stop && dec->next_to_decode == dec->submitted)
+			pthread_cond_wait(&dec->work_cond, &dec->lock);
+
+		if (dec->stop)
+			break;
+
+		slot = &dec->slots[dec->next_to_decode++ % dec->max_in_flight];
+		slot->state = SLOT_DECODING;
+		pthread_mutex_unlock(&dec->lock);
+
+		slot->status = decode_with(&w->state, slot->jpeg, slot->size, slot->image);
+
+		pthread_mutex_lock(&dec->lock);
+		slot->state = SLOT_DONE;
+		pthread_cond_signal(&dec->done_cond);
+	}
+	pthread_mutex_unlock(&dec->lock);
+
+	return NULL;
+}
+
+static void stop_workers(struct helper_jpeg_decoder *dec, unsigned int n_started)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&dec->lock);
+	dec->stop = 1;
+	pthread_cond_broadcast(&dec->work_cond);
+	pthread_mutex_unlock(&dec->lock);
+
+	for (i = 0; i < n_started; i++)
+		pthread_join(dec->workers[i].thread, NULL);
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+int helper_jpeg_get_size(const unsigned char *jpeg, size_t size, unsigned int *width, unsigned int *height)
+{
+	struct jpeg_state st;
+	volatile int ret = ERR;  /* Set between setjmp() and a possible longjmp() */
+
+	if (!jpeg || size == 0)
+		return ERR;
+
+	jpeg_state_init(&st);
+	if (setjmp(st.on_error) == 0)
+	{
+		jpeg_mem_src(&st.cinfo, (unsigned char *) jpeg, (unsigned long) size);
+		jpeg_read_header(&st.cinfo, TRUE);
+		*width = st.cinfo.image_width;
+		*height = st.cinfo.image_height;
+		ret = 0;
+	}
+	jpeg_state_free(&st);
+
+	return ret;
+}
+
+int helper_jpeg_decode(const unsigned char *jpeg, size_t size, struct helper_jpeg_image *image)
+{
+	struct jpeg_state st;
+	int ret;
+
+	jpeg_state_init(&st);
+	ret = decode_with(&st, jpeg, size, image);
+	jpeg_state_free(&st);
+
+	return ret;
+}
+
+int helper_jpeg_decoder_create(struct helper_jpeg_decoder **dec_out, unsigned int n_threads, unsigned int max_in_flight)
+{
+	struct helper_jpeg_decoder *dec;
+	unsigned int i;
+
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		n_threads = (n_cpus > 0) ? (unsigned int) n_cpus : 1;
+	}
+
+	if (max_in_flight == 0)
+		max_in_flight = 2 * n_threads;
+
+	dec = (struct helper_jpeg_decoder *) calloc(1, sizeof(*dec));
+	if (!dec)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	dec->n_workers = n_threads;
+	dec->max_in_flight = max_in_flight;
+	dec->workers = (struct jpeg_worker *) calloc(n_threads, sizeof(*dec->workers));
+	dec->slots = (struct jpeg_slot *) calloc(max_in_flight, sizeof(*dec->slots));
+	if (!dec->workers || !dec->slots)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(dec->workers);
+		free(dec->slots);
+		free(dec);
+		return ERR;
+	}
+
+	if (
+		pthread_mutex_init(&dec->lock, NULL) != 0 ||
+		pthread_cond_init(&dec->work_cond, NULL) != 0 ||
+		pthread_cond_init(&dec->done_cond, NULL) != 0 ||
+		pthread_cond_init(&dec->space_cond, NULL) != 0
+	)
+	{
+		fprintf(stderr, "Error occurred when initialising JPEG decoder\n");
+		free(dec->workers);
+		free(dec->slots);
+		free(dec);
+		return ERR;
+	}
+
+	for (i = 0; i < n_threads; i++)
+	{
+		dec->workers[i].dec = dec;
+		jpeg_state_init(&dec->workers[i].state);
+
+		if (pthread_create(&dec->workers[i].thread, NULL, worker, &dec->workers[i]) != 0)
+		{
+			fprintf(stderr, "Error occurred when creating JPEG decoder thread\n");
+			stop_workers(dec, i);
+			dec->n_workers = i + 1;
+			helper_jpeg_decoder_destroy(dec);
+			return ERR;
+		}
+	}
+
+	*dec_out = dec;
+	return 0;
+}
+
+int helper_jpeg_decoder_destroy(struct helper_jpeg_decoder *dec)
+{
+	unsigned int i;
+
+	if (!dec)
+		return ERR;
+
+	if (!dec->stop)
+		stop_workers(dec, dec->n_workers);
+
+	for (i = 0; i < dec->n_workers; i++)
+		jpeg_state_free(&dec->workers[i].state);
+
+	pthread_cond_destroy(&dec->space_cond);
+	pthread_cond_destroy(&dec->done_cond);
+	pthread_cond_destroy(&dec->work_cond);
+	pthread_mutex_destroy(&dec->lock);
+	free(dec->workers);
+	free(dec->slots);
+	free(dec);
+	return 0;
+}
+
+unsigned int helper_jpeg_decoder_get_max_in_flight(const struct helper_jpeg_decoder *dec)
+{
+	return (dec) ? dec->max_in_flight : 0;
+}
+
+int helper_jpeg_decoder_submit(struct helper_jpeg_decoder *dec, const unsigned char *jpeg, size_t size,
+		struct helper_jpeg_image *image, void *tag)
+{
+	struct jpeg_slot *slot;
+
+	if (!dec || !image)
+		return ERR;
+
+	pthread_mutex_lock(&dec->lock);
+	while (!dec->closed && dec->submitted - dec->collected >= dec->max_in_flight)
+		pthread_cond_wait(&dec->space_cond, &dec->lock);
+
+	if (dec->closed)
+	{
+		pthread_mutex_unlock(&dec->lock);
+		fprintf(stderr, "Error: trying to submit a frame to a closed JPEG decoder\n");
+		return ERR;
+	}
+
+	slot = &dec->slots[dec->submitted % dec->max_in_flight];
+	slot->jpeg = jpeg;
+	slot->size = size;
+	slot->image = image;
+	slot->tag = tag;
+	slot->state = SLOT_PENDING;
+	slot->status = ERR;
+	dec->submitted++;
+
+	pthread_cond_signal(&dec->work_cond);
+	pthread_mutex_unlock(&dec->lock);
+
+	return 0;
+}
+
+int helper_jpeg_decoder_collect(struct helper_jpeg_decoder *dec, struct helper_jpeg_image **image,
+		void **tag, int *status)
+{
+	struct jpeg_slot *slot;
+
+	if (!dec)
+		return ERR;
+
+	pthread_mutex_lock(&dec->lock);
+	while (1)
+	{
+		if (dec->collected == dec->submitted)
+		{
+			if (dec->closed)
+			{
+				pthread_mutex_unlock(&dec->lock);
+				return ERR;
+			}
+		}
+		else if (dec->slots[dec->collected % dec->max_in_flight].state == SLOT_DONE)
+		{
+			break;
+		}
+
+		pthread_cond_wait(&dec->done_cond, &dec->lock);
+	}
+
+	/*
+	 * Frames are collected in submission order, even if a later one was
+	 * decoded first.
+	 */
+	slot = &dec->slots[dec->collected++ % dec->max_in_flight];
+	if (image)
+		*image = slot->image;
+	if (tag)
+		*tag = slot->tag;
+	if (status)
+		*status = slot->status;
+
+	pthread_cond_signal(&dec->space_cond);
+	pthread_mutex_unlock(&dec->lock);
+
+	return 0;
+}
+
+int helper_jpeg_decoder_close(struct helper_jpeg_decoder *dec)
+{
+	if (!dec)
+		return ERR;
+
+	pthread_mutex_lock(&dec->lock);
+	dec->closed = 1;
+	pthread_cond_broadcast(&dec->done_cond);
+	pthread_cond_broadcast(&dec->space_cond);
+	pthread_mutex_unlock(&dec->lock);
+
+	return 0;
+}
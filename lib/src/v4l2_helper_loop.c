@@ -0,0 +1,446 @@
+/*
+ * opencv_v4l2 - v4l2_helper_loop.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "v4l2_helper_loop.h"
+
+#define MAX_EVENTS	16
+
+struct loop_cam {
+	struct helper_ctx *ctx;
+	helper_loop_cb     cb;
+	void              *user_data;
+	int                fd;
+	char               is_armed;  /* fd is being polled for frames */
+	char               is_failed; /* error reported; fd is not polled anymore */
+	uint64_t           last_frame_ms;
+	uint64_t           last_stall_ms;
+};
+
+struct helper_loop {
+	int                epoll_fd;
+	int                wake_fd;     /* signalled by helper_loop_stop() */
+	int                release_fd;  /* signalled when a lease of a waiting device is released */
+	struct loop_cam  **cams;
+	unsigned int       n_cams;
+	unsigned int       stall_timeout_ms;
+	volatile int       stop_requested;
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static int watch_fd(struct helper_loop *loop, int op, int fd, unsigned int events, void *ptr)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	if (-1 == epoll_ctl(loop->epoll_fd, op, fd, &ev))
+	{
+		fprintf(stderr, "Error occurred when updating the polled descriptors: %d, %s\n",
+				errno, strerror(errno));
+		return ERR;
+	}
+
+	return 0;
+}
+
+static void drain_eventfd(int fd)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count))
+	{
+		/* Errors ignored; the counter was already zero (EAGAIN). */
+	}
+}
+
+static int arm_cam(struct helper_loop *loop, struct loop_cam *cam, char arm)
+{
+	if (cam->is_armed == arm)
+		return 0;
+
+	if (watch_fd(loop, EPOLL_CTL_MOD, cam->fd, (arm) ? EPOLLIN : 0, cam) < 0)
+		return ERR;
+
+	cam->is_armed = arm;
+	return 0;
+}
+
+static int dispatch(struct loop_cam *cam, enum helper_loop_event_type type, const struct helper_lease *lease, unsigned int stall_ms)
+{
+	struct helper_loop_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.type = type;
+	event.ctx = cam->ctx;
+	if (lease)
+		event.lease = *lease;
+	event.stall_ms = stall_ms;
+
+	cam->cb(&event, cam->user_data);
+	return 1;
+}
+
+/*
+ * Leases and dispatches all the filled buffers of a device.
+ */
+static int service_cam(struct helper_loop *loop, struct loop_cam *cam, unsigned int events)
+{
+	struct helper_lease lease;
+	int dispatched = 0, ret;
+
+	while ((ret = helper_ctx_try_acquire_lease(cam->ctx, &lease)) == 0)
+	{
+		cam->last_frame_ms = now_ms();
+		dispatched += dispatch(cam, HELPER_LOOP_FRAME, &lease, 0);
+	}
+
+	/*
+	 * The driver reports an error (POLLERR) when there are no buffers
+	 * queued in it, which is the case when all of them are leased. So, stop
+	 * polling the device until a lease is released instead of treating
+	 * it as an error. Only when the device still reports an error with all
+	 * the buffers returned to it, the error is considered as genuine.
+	 */
+	if (
+		ret == ERR ||
+		(dispatched == 0 && (events & EPOLLERR) && helper_ctx_get_num_leased(cam->ctx) == 0)
+	)
+	{
+		arm_cam(loop, cam, 0);
+		cam->is_failed = 1;
+		dispatched += dispatch(cam, HELPER_LOOP_ERROR, NULL, 0);
+	}
+	else if (
+		(events & EPOLLERR) ||
+		helper_ctx_get_num_leased(cam->ctx) >= helper_ctx_get_num_buffers(cam->ctx)
+	)
+	{
+		arm_cam(loop, cam, 0);
+		helper_ctx_notify_on_release(cam->ctx, loop->release_fd);
+
+		/*
+		 * A lease might have been released before the notification
+		 * was requested.
+		 */
+		if (
+			!(events & EPOLLERR) &&
+			helper_ctx_get_num_leased(cam->ctx) < helper_ctx_get_num_buffers(cam->ctx)
+		)
+		{
+			arm_cam(loop, cam, 1);
+		}
+	}
+
+	return dispatched;
+}
+
+/*
+ * Re-arms the devices that were waiting for leases to be released.
+ */
+static void rearm_cams(struct helper_loop *loop)
+{
+	unsigned int i;
+
+	for (i = 0; i < loop->n_cams; i++)
+	{
+		struct loop_cam *cam = loop->cams[i];
+
+		if (
+			!cam->is_armed && !cam->is_failed &&
+			helper_ctx_get_num_leased(cam->ctx) < helper_ctx_get_num_buffers(cam->ctx)
+		)
+		{
+			arm_cam(loop, cam, 1);
+		}
+	}
+}
+
+/*
+ * Dispatches stall events for devices that haven't delivered frames within
+ * the stall timeout. Returns the time until the next stall event is due
+ * (-1 if there's no such event).
+ */
+static int check_stalls(struct helper_loop *loop, int *dispatched)
+{
+	uint64_t now = now_ms();
+	int next_due = -1;
+	unsigned int i;
+
+	if (loop->stall_timeout_ms == 0)
+		return -1;
+
+	for (i = 0; i < loop->n_cams; i++)
+	{
+		struct loop_cam *cam = loop->cams[i];
+		uint64_t since, due;
+
+		if (cam->is_failed)
+			continue;
+
+		since = (cam->last_frame_ms > cam->last_stall_ms) ? cam->last_frame_ms : cam->last_stall_ms;
+		due = since + loop->stall_timeout_ms;
+
+		if (now >= due)
+		{
+			cam->last_stall_ms = now;
+			*dispatched += dispatch(cam, HELPER_LOOP_STALL, NULL, (unsigned int) (now - cam->last_frame_ms));
+			due = now + loop->stall_timeout_ms;
+		}
+
+		if (next_due < 0 || (int) (due - now) < next_due)
+			next_due = (int) (due - now);
+	}
+
+	return next_due;
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+/**
+ * Start of public helper functions
+ */
+int helper_loop_create(struct helper_loop **loop_out, unsigned int stall_timeout_ms)
+{
+	struct helper_loop *loop;
+
+	if (!loop_out)
+	{
+		fprintf(stderr, "Error: no location given to store the event loop\n");
+		return ERR;
+	}
+
+	loop = (struct helper_loop *) calloc(1, sizeof(*loop));
+	if (!loop)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	loop->stall_timeout_ms = stall_timeout_ms;
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	loop->release_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (
+		loop->epoll_fd < 0 || loop->wake_fd < 0 || loop->release_fd < 0 ||
+		watch_fd(loop, EPOLL_CTL_ADD, loop->wake_fd, EPOLLIN, &loop->wake_fd) < 0 ||
+		watch_fd(loop, EPOLL_CTL_ADD, loop->release_fd, EPOLLIN, &loop->release_fd) < 0
+	)
+	{
+		fprintf(stderr, "Error occurred when creating event loop\n");
+		if (loop->epoll_fd >= 0)
+			close(loop->epoll_fd);
+		if (loop->wake_fd >= 0)
+			close(loop->wake_fd);
+		if (loop->release_fd >= 0)
+			close(loop->release_fd);
+		free(loop);
+		return ERR;
+	}
+
+	*loop_out = loop;
+	return 0;
+}
+
+int helper_loop_add_cam(struct helper_loop *loop, struct helper_ctx *ctx, helper_loop_cb cb, void *user_data)
+{
+	struct loop_cam *cam, **cams;
+
+	if (!loop || !ctx || !cb)
+	{
+		fprintf(stderr, "Error: invalid arguments when adding camera to event loop\n");
+		return ERR;
+	}
+
+	cam = (struct loop_cam *) calloc(1, sizeof(*cam));
+	cams = (struct loop_cam **) realloc(loop->cams, (loop->n_cams + 1) * sizeof(*cams));
+	if (!cam || !cams)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(cam);
+		if (cams)
+			loop->cams = cams;
+		return ERR;
+	}
+	loop->cams = cams;
+
+	cam->ctx = ctx;
+	cam->cb = cb;
+	cam->user_data = user_data;
+	cam->fd = helper_ctx_get_fd(ctx);
+	cam->last_frame_ms = cam->last_stall_ms = now_ms();
+
+	if (watch_fd(loop, EPOLL_CTL_ADD, cam->fd, EPOLLIN, cam) < 0)
+	{
+		fprintf(stderr, "Error occurred when adding camera to event loop\n");
+		free(cam);
+		return ERR;
+	}
+	cam->is_armed = 1;
+
+	loop->cams[loop->n_cams++] = cam;
+	return 0;
+}
+
+int helper_loop_remove_cam(struct helper_loop *loop, struct helper_ctx *ctx)
+{
+	unsigned int i;
+
+	if (!loop)
+	{
+		fprintf(stderr, "Error: trying to remove camera from invalid event loop\n");
+		return ERR;
+	}
+
+	for (i = 0; i < loop->n_cams; i++)
+	{
+		if (loop->cams[i]->ctx == ctx)
+		{
+			epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->cams[i]->fd, NULL);
+			helper_ctx_notify_on_release(ctx, -1);
+			free(loop->cams[i]);
+			loop->cams[i] = loop->cams[--loop->n_cams];
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "Error: trying to remove camera that isn't part of the event loop\n");
+	return ERR;
+}
+
+int helper_loop_run_once(struct helper_loop *loop, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int dispatched = 0, stall_due, n, i;
+
+	if (!loop)
+	{
+		fprintf(stderr, "Error: trying to run invalid event loop\n");
+		return ERR;
+	}
+
+	stall_due = check_stalls(loop, &dispatched);
+	if (stall_due >= 0 && (timeout_ms < 0 || stall_due < timeout_ms))
+		timeout_ms = stall_due;
+
+	n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout_ms);
+	if (-1 == n)
+	{
+		if (EINTR == errno)
+			return dispatched;
+
+		fprintf(stderr, "Error occurred when waiting for events: %d, %s\n",
+				errno, strerror(errno));
+		return ERR;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		void *ptr = events[i].data.ptr;
+
+		if (ptr == &loop->wake_fd)
+		{
+			drain_eventfd(loop->wake_fd);
+		}
+		else if (ptr == &loop->release_fd)
+		{
+			drain_eventfd(loop->release_fd);
+			rearm_cams(loop);
+		}
+		else
+		{
+			dispatched += service_cam(loop, (struct loop_cam *) ptr, events[i].events);
+		}
+	}
+
+	check_stalls(loop, &dispatched);
+	return dispatched;
+}
+
+int helper_loop_run(struct helper_loop *loop)
+{
+	if (!loop)
+	{
+		fprintf(stderr, "Error: trying to run invalid event loop\n");
+		return ERR;
+	}
+
+	while (!loop->stop_requested)
+	{
+		if (helper_loop_run_once(loop, -1) < 0)
+			return ERR;
+	}
+
+	loop->stop_requested = 0;
+	return 0;
+}
+
+int helper_loop_stop(struct helper_loop *loop)
+{
+	uint64_t one = 1;
+
+	if (!loop)
+	{
+		fprintf(stderr, "Error: trying to stop invalid event loop\n");
+		return ERR;
+	}
+
+	loop->stop_requested = 1;
+	if (write(loop->wake_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		/* Errors ignored; the loop has already been woken up (EAGAIN). */
+	}
+
+	return 0;
+}
+
+int helper_loop_destroy(struct helper_loop *loop)
+{
+	if (!loop)
+	{
+		fprintf(stderr, "Error: trying to destroy invalid event loop\n");
+		return ERR;
+	}
+
+	while (loop->n_cams > 0)
+		helper_loop_remove_cam(loop, loop->cams[0]->ctx);
+
+	close(loop->epoll_fd);
+	close(loop->wake_fd);
+	close(loop->release_fd);
+	free(loop->cams);
+	free(loop);
+	return 0;
+}
+/**
+ * End of public helper functions
+ */
@@ -0,0 +1,407 @@
+/*
+ * opencv_v4l2 - v4l2_helper_mode.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <linux/videodev2.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_mode.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+/*
+ * Cost model of the selection: the CPU time it takes to turn a frame into
+ * BGR, in nanoseconds per pixel for a core of a current desktop or embedded
+ * application processor. Only the ratios matter: decoding MJPEG costs about
+ * six times as much as converting packed YUV, and copying RGB much less.
+ * Unknown uncompressed formats are assumed to need a conversion somewhat
+ * slower than YUV, and other compressed formats (H.264, ...) a decoder.
+ */
+struct format_cost {
+	unsigned int fourcc;
+	double ns_per_pixel;
+};
+
+static const struct format_cost format_costs[] = {
+	{ V4L2_PIX_FMT_BGR24,   0.3 },
+	{ V4L2_PIX_FMT_RGB24,   0.5 },
+	{ V4L2_PIX_FMT_BGR32,   0.4 },
+	{ V4L2_PIX_FMT_RGB32,   0.5 },
+	{ V4L2_PIX_FMT_GREY,    0.4 },
+	{ V4L2_PIX_FMT_Y16,     0.6 },
+	{ V4L2_PIX_FMT_RGB565,  0.7 },
+	{ V4L2_PIX_FMT_YUYV,    1.0 },
+	{ V4L2_PIX_FMT_UYVY,    1.0 },
+	{ V4L2_PIX_FMT_YVYU,    1.0 },
+	{ V4L2_PIX_FMT_VYUY,    1.0 },
+	{ V4L2_PIX_FMT_NV12,    0.9 },
+	{ V4L2_PIX_FMT_NV21,    0.9 },
+	{ V4L2_PIX_FMT_NV12M,   0.9 },
+	{ V4L2_PIX_FMT_NV21M,   0.9 },
+	{ V4L2_PIX_FMT_YUV420,  0.9 },
+	{ V4L2_PIX_FMT_YVU420,  0.9 },
+	{ V4L2_PIX_FMT_NV16,    1.0 },
+	{ V4L2_PIX_FMT_NV61,    1.0 },
+	{ V4L2_PIX_FMT_MJPEG,   6.0 },
+	{ V4L2_PIX_FMT_JPEG,    6.0 },
+};
+
+#define UNKNOWN_NS_PER_PIXEL     1.5
+#define COMPRESSED_NS_PER_PIXEL  10.0
+
+/*
+ * Fixed cost of a frame whatever its size: dequeueing, waking up the
+ * application, requeueing.
+ */
+#define FRAME_COST_NS  20000.0
+
+/*
+ * Frame rates within this ratio of the one asked for are accepted, as
+ * drivers round 60 fps to 59.94 fps and the like.
+ */
+#define FPS_TOLERANCE  0.005
+
+/*
+ * Scores within this ratio of each other are considered equal.
+ */
+#define SCORE_TOLERANCE  0.001
+
+/**
+ * Start of static (internal) helper functions
+ */
+static double ns_per_pixel(unsigned int format, unsigned int format_flags)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(format_costs) / sizeof(format_costs[0]); i++)
+		if (format_costs[i].fourcc == format)
+			return format_costs[i].ns_per_pixel;
+
+	return (format_flags & V4L2_FMT_FLAG_COMPRESSED) ? COMPRESSED_NS_PER_PIXEL : UNKNOWN_NS_PER_PIXEL;
+}
+
+static double fract_fps(const struct v4l2_fract *interval)
+{
+	if (interval->numerator == 0 || interval->denominator == 0)
+		return 0;
+
+	return (double) interval->denominator / interval->numerator;
+}
+
+static int add_mode(struct helper_mode **modes, unsigned int *n_modes, unsigned int *capacity, const struct helper_mode *mode)
+{
+	if (*n_modes == *capacity) {
+		unsigned int new_capacity = (*capacity) ? 2 * *capacity : 64;
+		struct helper_mode *grown = (struct helper_mode *) realloc(*modes, new_capacity * sizeof(*grown));
+
+		if (!grown) {
+			fprintf(stderr, "Out of memory\n");
+			return ERR;
+		}
+		*modes = grown;
+		*capacity = new_capacity;
+	}
+
+	(*modes)[(*n_modes)++] = *mode;
+	return 0;
+}
+
+/*
+ * Adds a mode per frame interval of the size in 'mode' (the largest of its
+ * range), or a single one with an unknown interval if the driver doesn't
+ * enumerate them.
+ */
+static int add_intervals(mode_ioctl_func func, void *dev, struct helper_mode *mode,
+		struct helper_mode **modes, unsigned int *n_modes, unsigned int *capacity)
+{
+	struct v4l2_frmivalenum ival;
+
+	CLEAR(mode->interval);
+	CLEAR(mode->max_interval);
+
+	CLEAR(ival);
+	ival.pixel_format = mode->format;
+	ival.width = mode->max_width;
+	ival.height = mode->max_height;
+	while (0 == func(dev, VIDIOC_ENUM_FRAMEINTERVALS, &ival)) {
+		if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+			mode->interval = mode->max_interval = ival.discrete;
+		} else {
+			mode->interval = ival.stepwise.min;
+			mode->max_interval = ival.stepwise.max;
+		}
+
+		if (add_mode(modes, n_modes, capacity, mode) < 0)
+			return ERR;
+
+		if (ival.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+			return 0;
+		ival.index++;
+	}
+
+	if (ival.index == 0)
+		return add_mode(modes, n_modes, capacity, mode);
+
+	return 0;
+}
+
+/*
+ * Monochrome formats, which are cheap to turn into BGR only because they
+ * have no colour: never an equivalent of a colour format.
+ */
+static const unsigned int mono_formats[] = {
+	V4L2_PIX_FMT_GREY,
+	V4L2_PIX_FMT_Y10,
+	V4L2_PIX_FMT_Y12,
+	V4L2_PIX_FMT_Y16,
+};
+
+static int is_mono(unsigned int format)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(mono_formats) / sizeof(mono_formats[0]); i++)
+		if (mono_formats[i] == format)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Without a list of formats, any colour format is acceptable; monochrome
+ * ones have to be listed.
+ */
+static int format_allowed(const struct helper_mode_target *target, unsigned int format)
+{
+	unsigned int i;
+
+	if (target->n_formats == 0)
+		return !is_mono(format);
+
+	for (i = 0; i < target->n_formats; i++)
+		if (target->formats[i] == format)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Picks the dimension in [low, high] (by 'step') closest to what the target
+ * asks for: the smallest one at least 'want_min' or, without a minimum, the
+ * largest one at most 'want_max' (if given). Returns 0 if none fits.
+ */
+static unsigned int fit_dimension(unsigned int low, unsigned int high, unsigned int step,
+		unsigned int want_min, unsigned int want_max)
+{
+	unsigned int value;
+
+	if (step == 0)
+		step = 1;
+
+	if (want_min) {
+		value = (want_min <= low) ? low : low + (want_min - low + step - 1) / step * step;
+	} else if (want_max && want_max < high) {
+		value = (want_max < low) ? low : low + (want_max - low) / step * step;
+	} else {
+		value = high;
+	}
+
+	if (value > high || value < want_min || (want_max && value > want_max))
+		return 0;
+
+	return value;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int r = a % b;
+
+		a = b;
+		b = r;
+	}
+
+	return a;
+}
+
+/*
+ * Fits the frame interval range of 'mode' to the target: the lowest frame
+ * rate of the range that is at least the one asked for or, without a
+ * minimum, the highest one. Returns ERR if the mode can't be fast enough.
+ */
+static int fit_interval(const struct helper_mode *mode, const struct helper_mode_target *target, struct v4l2_fract *interval)
+{
+	double max_fps = fract_fps(&mode->interval), min_fps = fract_fps(&mode->max_interval);
+	unsigned int divisor;
+
+	*interval = mode->interval;
+
+	if (target->min_fps <= 0)
+		return 0;
+
+	/* An unknown frame rate can't be relied upon */
+	if (max_fps < target->min_fps * (1 - FPS_TOLERANCE))
+		return ERR;
+
+	if (target->min_fps <= min_fps) {
+		*interval = mode->max_interval;
+	} else if (target->min_fps < max_fps) {
+		interval->numerator = 1000;
+		interval->denominator = (unsigned int) (target->min_fps * 1000 + 0.5);
+		divisor = gcd(interval->numerator, interval->denominator);
+		interval->numerator /= divisor;
+		interval->denominator /= divisor;
+	}
+
+	return 0;
+}
+
+/*
+ * Useful throughput per CPU time: the pixels per second delivered, counted
+ * up to what the target asks for (more isn't useful to the application, but
+ * costs as much), over the CPU time they take. Without a known frame rate,
+ * everything is per frame.
+ */
+static double mode_score(const struct helper_mode *mode, const struct helper_mode_target *target, double *useful)
+{
+	double fps = fract_fps(&mode->interval);
+	double width = mode->width, height = mode->height;
+	double frame_ns = width * height * ns_per_pixel(mode->format, mode->format_flags) + FRAME_COST_NS;
+
+	if (target->min_width && target->min_width < width)
+		width = target->min_width;
+	if (target->min_height && target->min_height < height)
+		height = target->min_height;
+
+	if (fps == 0) {
+		*useful = width * height;
+		return *useful / frame_ns;
+	}
+
+	*useful = width * height * ((target->min_fps > 0 && target->min_fps < fps) ? target->min_fps : fps);
+	return *useful / (fps * frame_ns);
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+double helper_mode_frame_cost(unsigned int format, unsigned int width, unsigned int height)
+{
+	unsigned int flags = (format == V4L2_PIX_FMT_MJPEG || format == V4L2_PIX_FMT_JPEG ||
+			format == V4L2_PIX_FMT_H264 || format == V4L2_PIX_FMT_HEVC) ? V4L2_FMT_FLAG_COMPRESSED : 0;
+
+	return ((double) width * height * ns_per_pixel(format, flags) + FRAME_COST_NS) / 1e9;
+}
+
+int mode_enumerate(mode_ioctl_func func, void *dev, unsigned int buf_type, struct helper_mode **modes_out, unsigned int *n_modes_out)
+{
+	struct helper_mode *modes = NULL, mode;
+	unsigned int n_modes = 0, capacity = 0;
+	struct v4l2_fmtdesc desc;
+	struct v4l2_frmsizeenum size;
+
+	CLEAR(desc);
+	desc.type = buf_type;
+	for (; 0 == func(dev, VIDIOC_ENUM_FMT, &desc); desc.index++) {
+		CLEAR(size);
+		size.pixel_format = desc.pixelformat;
+		for (; 0 == func(dev, VIDIOC_ENUM_FRAMESIZES, &size); size.index++) {
+			CLEAR(mode);
+			mode.format = desc.pixelformat;
+			mode.format_flags = desc.flags;
+
+			if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+				mode.width = mode.max_width = size.discrete.width;
+				mode.height = mode.max_height = size.discrete.height;
+			} else {
+				mode.width = size.stepwise.min_width;
+				mode.height = size.stepwise.min_height;
+				mode.max_width = size.stepwise.max_width;
+				mode.max_height = size.stepwise.max_height;
+				mode.step_width = (size.type == V4L2_FRMSIZE_TYPE_STEPWISE) ? size.stepwise.step_width : 1;
+				mode.step_height = (size.type == V4L2_FRMSIZE_TYPE_STEPWISE) ? size.stepwise.step_height : 1;
+			}
+
+			if (add_intervals(func, dev, &mode, &modes, &n_modes, &capacity) < 0) {
+				free(modes);
+				return ERR;
+			}
+
+			if (size.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+				break;
+		}
+	}
+
+	*modes_out = modes;
+	*n_modes_out = n_modes;
+	return 0;
+}
+
+int mode_select(const struct helper_mode *modes, unsigned int n_modes, const struct helper_mode_target *target, struct helper_mode *best)
+{
+	double best_score = -1, best_useful = 0, score, useful;
+	struct helper_mode candidate;
+	unsigned int i, pass;
+
+	/*
+	 * With prefer_uncompressed, compressed formats are only considered
+	 * when no uncompressed one fits.
+	 */
+	for (pass = (target->prefer_uncompressed) ? 0 : 1; pass < 2 && best_score < 0; pass++) {
+		for (i = 0; i < n_modes; i++) {
+			candidate = modes[i];
+
+			if (
+				(pass == 0 && (candidate.format_flags & V4L2_FMT_FLAG_COMPRESSED)) ||
+				!format_allowed(target, candidate.format)
+			)
+			{
+				continue;
+			}
+
+			candidate.width = fit_dimension(modes[i].width, modes[i].max_width, modes[i].step_width,
+					target->min_width, target->max_width);
+			candidate.height = fit_dimension(modes[i].height, modes[i].max_height, modes[i].step_height,
+					target->min_height, target->max_height);
+			if (
+				candidate.width == 0 || candidate.height == 0 ||
+				fit_interval(&modes[i], target, &candidate.interval) < 0
+			)
+			{
+				continue;
+			}
+			candidate.max_width = candidate.width;
+			candidate.max_height = candidate.height;
+			candidate.step_width = candidate.step_height = 0;
+			candidate.max_interval = candidate.interval;
+
+			/* Equal scores: the one delivering more wins */
+			score = mode_score(&candidate, target, &useful);
+			if (
+				score > best_score * (1 + SCORE_TOLERANCE) ||
+				(score >= best_score * (1 - SCORE_TOLERANCE) && useful > best_useful)
+			)
+			{
+				*best = candidate;
+				best_score = score;
+				best_useful = useful;
+			}
+		}
+	}
+
+	if (best_score < 0) {
+		fprintf(stderr, "Error: no capture mode of the device fits the target%s\n",
+				(target->n_formats) ? "" : " (monochrome formats must be listed explicitly)");
+		return ERR;
+	}
+
+	return 0;
+}
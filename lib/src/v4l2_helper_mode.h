@@ -0,0 +1,34 @@
+/*
+ * opencv_v4l2 - v4l2_helper_mode.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Internal header file for the enumeration and selection of capture modes (see helper_ctx_select_mode()).
+
+#ifndef V4L2_HELPER_MODE_H
+#define V4L2_HELPER_MODE_H
+
+#include "v4l2_helper.h"
+
+/*
+ * Issues an enumeration ioctl to the device 'dev'.
+ */
+typedef int (*mode_ioctl_func)(void *dev, unsigned long request, void *arg);
+
+/*
+ * Enumerates the formats of the buffer type 'buf_type', their frame sizes
+ * and, for each size, the frame intervals into an array to be freed by the
+ * caller: an entry per discrete size and interval, or a range. The frame
+ * intervals of a range of sizes are those of the largest size.
+ */
+int mode_enumerate(mode_ioctl_func func, void *dev, unsigned int buf_type, struct helper_mode **modes, unsigned int *n_modes);
+
+/*
+ * Picks the mode of 'modes' that delivers the most of the throughput asked
+ * for by 'target' per unit of CPU time (see helper_ctx_select_mode()),
+ * fitting the ranges to the target. Returns ERR when none fits.
+ */
+int mode_select(const struct helper_mode *modes, unsigned int n_modes, const struct helper_mode_target *target, struct helper_mode *mode);
+
+#endif
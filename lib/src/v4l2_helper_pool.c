@@ -0,0 +1,305 @@
+/*
+ * opencv_v4l2 - v4l2_helper_pool.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#define _GNU_SOURCE             /* pthread_setaffinity_np(), CPU_* macros */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_pool.h"
+
+/*
+ * Used when the size of the L2 cache can't be determined.
+ */
+#define DEFAULT_L2_SIZE	(512 * 1024)
+
+struct helper_pool {
+	pthread_t          *threads;
+	unsigned int        n_workers;
+	size_t              stripe_bytes;
+
+	pthread_mutex_t     lock;
+	pthread_cond_t      start_cond;   /* Signalled when a frame is to be processed */
+	pthread_cond_t      done_cond;    /* Signalled when the workers are done with a frame */
+	unsigned long       generation;   /* Incremented for every frame */
+	unsigned int        busy_workers;
+	int                 stop;
+
+	/*
+	 * Frame being processed
+	 */
+	helper_pool_fn      fn;
+	void               *arg;
+	unsigned int        n_rows;
+	unsigned int        stripe_rows;
+	atomic_uint         next_row;
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static size_t l2_cache_size(void)
+{
+	long size = -1;
+	FILE *fp;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+	/*
+	 * sysconf() doesn't report cache sizes on ARM; fall back to sysfs.
+	 */
+	if (size <= 0) {
+		fp = fopen("/sys/devices/system/cpu/cpu0/cache/index2/size", "r");
+		if (fp) {
+			char unit = 'K';
+
+			if (fscanf(fp, "%ld%c", &size, &unit) < 1)
+				size = -1;
+			else if (unit == 'K')
+				size *= 1024;
+			else if (unit == 'M')
+				size *= 1024 * 1024;
+			fclose(fp);
+		}
+	}
+
+	return (size > 0) ? (size_t) size : DEFAULT_L2_SIZE;
+}
+
+static void process_stripes(struct helper_pool *pool)
+{
+	unsigned int first;
+
+	while ((first = atomic_fetch_add(&pool->next_row, pool->stripe_rows)) < pool->n_rows) {
+		unsigned int n = pool->n_rows - first;
+
+		pool->fn(pool->arg, first, (n < pool->stripe_rows) ? n : pool->stripe_rows);
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct helper_pool *pool = (struct helper_pool *) arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->stop && pool->generation == seen)
+			pthread_cond_wait(&pool->start_cond, &pool->lock);
+
+		if (pool->stop)
+			break;
+
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		process_stripes(pool);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy_workers == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/*
+ * Pins worker 'index' to a CPU of the ones the process may run on. The CPU
+ * the calling thread is likely to run on (the first one) is used last.
+ */
+static void pin_worker(pthread_t thread, unsigned int index)
+{
+	cpu_set_t allowed, cpu;
+	int n_allowed, target, i, n;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return;
+
+	n_allowed = CPU_COUNT(&allowed);
+	if (n_allowed < 2)
+		return;
+
+	target = (index + 1) % n_allowed;
+	for (i = 0, n = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &allowed) && n++ == target) {
+			CPU_ZERO(&cpu);
+			CPU_SET(i, &cpu);
+			if (pthread_setaffinity_np(thread, sizeof(cpu), &cpu) != 0)
+				fprintf(stderr, "Could not pin worker thread to CPU %d\n", i);
+			break;
+		}
+	}
+}
+
+static void stop_workers(struct helper_pool *pool, unsigned int n_started)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < n_started; i++)
+		pthread_join(pool->threads[i], NULL);
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+int helper_pool_create(struct helper_pool **pool_out, unsigned int n_threads, int pin_threads)
+{
+	struct helper_pool *pool;
+	unsigned int i;
+
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		n_threads = (n_cpus > 0) ? (unsigned int) n_cpus : 1;
+	}
+
+	pool = (struct helper_pool *) calloc(1, sizeof(*pool));
+	if (!pool)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	pool->n_workers = n_threads - 1;
+	pool->stripe_bytes = l2_cache_size() / 2;
+	atomic_init(&pool->next_row, 0);
+
+	if (pool->n_workers)
+	{
+		pool->threads = (pthread_t *) calloc(pool->n_workers, sizeof(*pool->threads));
+		if (!pool->threads)
+		{
+			fprintf(stderr, "Out of memory\n");
+			free(pool);
+			return ERR;
+		}
+	}
+
+	if (
+		pthread_mutex_init(&pool->lock, NULL) != 0 ||
+		pthread_cond_init(&pool->start_cond, NULL) != 0 ||
+		pthread_cond_init(&pool->done_cond, NULL) != 0
+	)
+	{
+		fprintf(stderr, "Error occurred when initialising worker pool\n");
+		free(pool->threads);
+		free(pool);
+		return ERR;
+	}
+
+	for (i = 0; i < pool->n_workers; i++)
+	{
+		if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+		{
+			fprintf(stderr, "Error occurred when creating worker thread\n");
+			stop_workers(pool, i);
+			helper_pool_destroy(pool);
+			return ERR;
+		}
+
+		if (pin_threads)
+			pin_worker(pool->threads[i], i);
+	}
+
+	*pool_out = pool;
+	return 0;
+}
+
+int helper_pool_destroy(struct helper_pool *pool)
+{
+	if (!pool)
+		return ERR;
+
+	if (!pool->stop)
+		stop_workers(pool, pool->n_workers);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+	return 0;
+}
+
+unsigned int helper_pool_get_num_threads(const struct helper_pool *pool)
+{
+	return (pool) ? pool->n_workers + 1 : 0;
+}
+
+unsigned int helper_pool_get_stripe_rows(const struct helper_pool *pool, unsigned int n_rows, size_t bytes_per_row)
+{
+	unsigned int n_threads = helper_pool_get_num_threads(pool);
+	unsigned int rows, rows_per_thread;
+
+	if (!pool || n_rows == 0)
+		return 0;
+
+	rows = (bytes_per_row) ? pool->stripe_bytes / bytes_per_row : n_rows;
+	if (rows == 0)
+		rows = 1;
+
+	/*
+	 * Small frames: make sure every thread gets some work.
+	 */
+	rows_per_thread = (n_rows + n_threads - 1) / n_threads;
+	return (rows < rows_per_thread) ? rows : rows_per_thread;
+}
+
+int helper_pool_run_stripes(struct helper_pool *pool, helper_pool_fn fn, void *arg,
+		unsigned int n_rows, size_t bytes_per_row)
+{
+	if (!pool || !fn)
+		return ERR;
+
+	if (n_rows == 0)
+		return 0;
+
+	if (pool->n_workers == 0)
+	{
+		fn(arg, 0, n_rows);
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->n_rows = n_rows;
+	pool->stripe_rows = helper_pool_get_stripe_rows(pool, n_rows, bytes_per_row);
+	atomic_store(&pool->next_row, 0);
+	pool->busy_workers = pool->n_workers;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	/*
+	 * The calling thread processes stripes too instead of just waiting.
+	 */
+	process_stripes(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy_workers)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
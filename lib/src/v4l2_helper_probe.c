@@ -0,0 +1,189 @@
+/*
+ * opencv_v4l2 - v4l2_helper_probe.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_probe.h"
+
+/*
+ * Log-linear histograms of nanoseconds, as in the applications' latency
+ * reports (src/latency_histogram.hpp): values below 128 ns get a bucket each
+ * and each power of two above is split into 64 buckets, so that every value
+ * is known to within 1/64 (1.6 %), up to about 18 minutes.
+ */
+#define SUB_BUCKET_BITS  6
+#define SUB_BUCKETS      (1 << SUB_BUCKET_BITS)
+#define MAX_VALUE_BITS   40
+#define N_BUCKETS        (2 * SUB_BUCKETS + (MAX_VALUE_BITS - SUB_BUCKET_BITS - 1) * SUB_BUCKETS)
+
+struct histogram {
+	atomic_ullong counts[N_BUCKETS];
+	atomic_ullong sum_ns;
+	atomic_ullong unsynced;
+	atomic_uint   tstamp_src;
+};
+
+struct latency_probe {
+	struct histogram points[HELPER_PROBE_POINTS];
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static unsigned int bucket_index(uint64_t value)
+{
+	unsigned int msb, shift;
+
+	if (value < 2 * SUB_BUCKETS)
+		return (unsigned int) value;
+
+	msb = 63 - __builtin_clzll(value);
+	if (msb >= MAX_VALUE_BITS)
+		return N_BUCKETS - 1;
+
+	/* 'value >> shift' is in [SUB_BUCKETS, 2 * SUB_BUCKETS) */
+	shift = msb - SUB_BUCKET_BITS;
+	return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + (unsigned int) ((value >> shift) - SUB_BUCKETS);
+}
+
+/*
+ * Highest value that falls in bucket 'index'.
+ */
+static uint64_t bucket_value(unsigned int index)
+{
+	unsigned int shift;
+	uint64_t sub;
+
+	if (index < 2 * SUB_BUCKETS)
+		return index;
+
+	shift = (index - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+	sub = (index - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * Value below which 'percentile' percent of the 'total' values in 'counts'
+ * fall.
+ */
+static uint64_t percentile_ns(const unsigned long long *counts, unsigned long long total, double percentile)
+{
+	unsigned long long target, seen = 0;
+	unsigned int i;
+
+	if (total == 0)
+		return 0;
+
+	target = (unsigned long long) (percentile / 100.0 * total + 0.5);
+	if (target < 1)
+		target = 1;
+
+	for (i = 0; i < N_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= target)
+			return bucket_value(i);
+	}
+
+	return bucket_value(N_BUCKETS - 1);
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+struct latency_probe *probe_create(void)
+{
+	struct latency_probe *probe = malloc(sizeof(*probe));
+
+	if (probe)
+		probe_reset(probe);
+
+	return probe;
+}
+
+void probe_destroy(struct latency_probe *probe)
+{
+	free(probe);
+}
+
+void probe_record(struct latency_probe *probe, enum helper_probe_point point, const struct timeval *timestamp, unsigned int flags)
+{
+	struct histogram *hist = &probe->points[point];
+	struct timespec now;
+	uint64_t now_ns, stamp_ns, value;
+
+	if ((flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+		atomic_fetch_add_explicit(&hist->unsynced, 1, memory_order_relaxed);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+	stamp_ns = (uint64_t) timestamp->tv_sec * 1000000000ULL + (uint64_t) timestamp->tv_usec * 1000ULL;
+	value = (now_ns > stamp_ns) ? now_ns - stamp_ns : 0;
+
+	atomic_fetch_add_explicit(&hist->counts[bucket_index(value)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->sum_ns, value, memory_order_relaxed);
+	atomic_store_explicit(&hist->tstamp_src, flags & V4L2_BUF_FLAG_TSTAMP_SRC_MASK, memory_order_relaxed);
+}
+
+int probe_get_stats(struct latency_probe *probe, enum helper_probe_point point, struct helper_latency_stats *stats)
+{
+	struct histogram *hist = &probe->points[point];
+	unsigned long long *counts = malloc(sizeof(unsigned long long) * N_BUCKETS);
+	unsigned long long total = 0;
+	unsigned int i;
+
+	if (!counts) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	stats->unsynced_frames = atomic_load_explicit(&hist->unsynced, memory_order_relaxed);
+	stats->tstamp_src = atomic_load_explicit(&hist->tstamp_src, memory_order_relaxed);
+
+	/*
+	 * The counts are read one by one while frames may be recorded; the
+	 * percentiles are computed from the counts read, which are consistent
+	 * enough for statistics.
+	 */
+	for (i = 0; i < N_BUCKETS; i++) {
+		counts[i] = atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+		total += counts[i];
+	}
+
+	stats->frames = total;
+	stats->mean_us = (total) ? atomic_load_explicit(&hist->sum_ns, memory_order_relaxed) / 1e3 / total : 0;
+	stats->p50_us = percentile_ns(counts, total, 50) / 1e3;
+	stats->p90_us = percentile_ns(counts, total, 90) / 1e3;
+	stats->p99_us = percentile_ns(counts, total, 99) / 1e3;
+	stats->p99_9_us = percentile_ns(counts, total, 99.9) / 1e3;
+	stats->max_us = percentile_ns(counts, total, 100) / 1e3;
+
+	free(counts);
+
+	return 0;
+}
+
+void probe_reset(struct latency_probe *probe)
+{
+	unsigned int p, i;
+
+	for (p = 0; p < HELPER_PROBE_POINTS; p++) {
+		struct histogram *hist = &probe->points[p];
+
+		for (i = 0; i < N_BUCKETS; i++)
+			atomic_store_explicit(&hist->counts[i], 0, memory_order_relaxed);
+		atomic_store_explicit(&hist->sum_ns, 0, memory_order_relaxed);
+		atomic_store_explicit(&hist->unsynced, 0, memory_order_relaxed);
+		atomic_store_explicit(&hist->tstamp_src, 0, memory_order_relaxed);
+	}
+}
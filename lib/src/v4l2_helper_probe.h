@@ -0,0 +1,33 @@
+/*
+ * opencv_v4l2 - v4l2_helper_probe.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Internal header file for the latency probe (see helper_ctx_set_latency_probe()).
+
+#ifndef V4L2_HELPER_PROBE_H
+#define V4L2_HELPER_PROBE_H
+
+#include "v4l2_helper.h"
+
+/*
+ * A latency histogram per probe point.
+ */
+struct latency_probe;
+
+struct latency_probe *probe_create(void);
+
+void probe_destroy(struct latency_probe *probe);
+
+/*
+ * Records the time elapsed since 'timestamp' at 'point', provided 'flags'
+ * say the time stamp is CLOCK_MONOTONIC based. Wait-free.
+ */
+void probe_record(struct latency_probe *probe, enum helper_probe_point point, const struct timeval *timestamp, unsigned int flags);
+
+int probe_get_stats(struct latency_probe *probe, enum helper_probe_point point, struct helper_latency_stats *stats);
+
+void probe_reset(struct latency_probe *probe);
+
+#endif
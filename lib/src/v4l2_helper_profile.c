@@ -0,0 +1,268 @@
+/*
+ * opencv_v4l2 - v4l2_helper_profile.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_profile.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+/*
+ * The profiles are stored as text, a block of lines per device:
+ *
+ *   device <driver> <card> <bus info> <version>     (tab separated)
+ *   crop <supported> <left> <top> <width> <height>
+ *   modes <buffer type> <count>
+ *   mode <fourcc> <flags> <width> <height> <max width> <max height>
+ *        <step width> <step height> <interval> <max interval>
+ *
+ * the crop and modes lines being there only when probed. Lines starting
+ * with '#' are comments.
+ */
+#define PROFILE_HEADER    "# v4l2_helper device profiles\n"
+#define PROFILE_MAX_LINE  512
+
+/**
+ * Start of static (internal) helper functions
+ */
+
+/*
+ * Copies a string of struct v4l2_capability, which isn't terminated when it
+ * fills its array, without the characters that would break the format.
+ */
+static void copy_cap_string(char *dst, size_t dst_size, const unsigned char *src, size_t src_size)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < dst_size && i < src_size && src[i]; i++)
+		dst[i] = (src[i] == '\t' || src[i] == '\n' || src[i] == '\r') ? ' ' : (char) src[i];
+	dst[i] = '\0';
+}
+
+/*
+ * Splits the next tab separated field off 'line'.
+ */
+static char *next_field(char **line)
+{
+	char *field = *line, *tab;
+
+	if (!field)
+		return NULL;
+
+	tab = strchr(field, '\t');
+	if (tab) {
+		*tab = '\0';
+		*line = tab + 1;
+	} else {
+		field[strcspn(field, "\n")] = '\0';
+		*line = NULL;
+	}
+	return field;
+}
+
+/*
+ * Whether the device line 'line' is that of the device of 'profile', and
+ * of the same driver version if 'version' is given.
+ */
+static int is_device_line(const char *line, const struct device_profile *profile, unsigned int *version)
+{
+	char copy[PROFILE_MAX_LINE], *rest = copy;
+	char *driver, *card, *bus_info, *ver;
+
+	if (strncmp(line, "device\t", 7) != 0)
+		return 0;
+
+	snprintf(copy, sizeof(copy), "%s", line + 7);
+	driver = next_field(&rest);
+	card = next_field(&rest);
+	bus_info = next_field(&rest);
+	ver = next_field(&rest);
+	if (!driver || !card || !bus_info || !ver)
+		return 0;
+
+	if (strcmp(driver, profile->driver) || strcmp(card, profile->card) || strcmp(bus_info, profile->bus_info))
+		return 0;
+
+	if (version)
+		*version = (unsigned int) strtoul(ver, NULL, 16);
+	return 1;
+}
+
+static int parse_mode(const char *line, struct helper_mode *mode)
+{
+	CLEAR(*mode);
+	return sscanf(line, "mode %x %x %u %u %u %u %u %u %u/%u %u/%u",
+			&mode->format, &mode->format_flags, &mode->width, &mode->height,
+			&mode->max_width, &mode->max_height, &mode->step_width, &mode->step_height,
+			&mode->interval.numerator, &mode->interval.denominator,
+			&mode->max_interval.numerator, &mode->max_interval.denominator) == 12;
+}
+
+/*
+ * Parses the lines following the device line of the profile. Returns 0 if
+ * they're malformed.
+ */
+static int parse_profile(FILE *file, struct device_profile *profile)
+{
+	char line[PROFILE_MAX_LINE];
+	unsigned int n_modes = 0;
+
+	while (fgets(line, sizeof(line), file) && strncmp(line, "device\t", 7) != 0) {
+		struct v4l2_rect *rect = &profile->crop_default;
+
+		if (strncmp(line, "crop ", 5) == 0) {
+			if (sscanf(line, "crop %d %d %d %u %u", &profile->crop_supported,
+					&rect->left, &rect->top, &rect->width, &rect->height) != 5)
+				return 0;
+			profile->has_crop = 1;
+		} else if (strncmp(line, "modes ", 6) == 0) {
+			if (profile->has_modes || sscanf(line, "modes %u %u", &profile->modes_buf_type, &n_modes) != 2)
+				return 0;
+			profile->has_modes = 1;
+			if (n_modes) {
+				profile->modes = (struct helper_mode *) calloc(n_modes, sizeof(*profile->modes));
+				if (!profile->modes)
+					return 0;
+			}
+		} else if (strncmp(line, "mode ", 5) == 0) {
+			if (profile->n_modes >= n_modes || !parse_mode(line, &profile->modes[profile->n_modes]))
+				return 0;
+			profile->n_modes++;
+		}
+	}
+
+	return profile->n_modes == n_modes;
+}
+
+static void write_profile(FILE *file, const struct device_profile *profile)
+{
+	unsigned int i;
+
+	fprintf(file, "device\t%s\t%s\t%s\t%x\n", profile->driver, profile->card, profile->bus_info, profile->version);
+
+	if (profile->has_crop) {
+		const struct v4l2_rect *rect = &profile->crop_default;
+
+		fprintf(file, "crop %d %d %d %u %u\n", profile->crop_supported, rect->left, rect->top, rect->width, rect->height);
+	}
+
+	if (profile->has_modes) {
+		fprintf(file, "modes %u %u\n", profile->modes_buf_type, profile->n_modes);
+		for (i = 0; i < profile->n_modes; i++) {
+			const struct helper_mode *mode = &profile->modes[i];
+
+			fprintf(file, "mode %08x %x %u %u %u %u %u %u %u/%u %u/%u\n",
+					mode->format, mode->format_flags, mode->width, mode->height,
+					mode->max_width, mode->max_height, mode->step_width, mode->step_height,
+					mode->interval.numerator, mode->interval.denominator,
+					mode->max_interval.numerator, mode->max_interval.denominator);
+		}
+	}
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+void profile_init(struct device_profile *profile, const struct v4l2_capability *cap)
+{
+	CLEAR(*profile);
+	copy_cap_string(profile->driver, sizeof(profile->driver), cap->driver, sizeof(cap->driver));
+	copy_cap_string(profile->card, sizeof(profile->card), cap->card, sizeof(cap->card));
+	copy_cap_string(profile->bus_info, sizeof(profile->bus_info), cap->bus_info, sizeof(cap->bus_info));
+	profile->version = cap->version;
+}
+
+int profile_load(const char *path, struct device_profile *profile)
+{
+	char line[PROFILE_MAX_LINE];
+	unsigned int version;
+	FILE *file;
+	int found = 0;
+
+	file = fopen(path, "r");
+	if (!file) {
+		if (errno != ENOENT)
+			fprintf(stderr, "Warning: could not read the device profiles of %s\n", path);
+		return 0;
+	}
+
+	while (!found && fgets(line, sizeof(line), file)) {
+		if (is_device_line(line, profile, &version) && version == profile->version)
+			found = 1;
+	}
+
+	if (found && !parse_profile(file, profile)) {
+		fprintf(stderr, "Warning: the profile of the device in %s is malformed; probing it again\n", path);
+		found = 0;
+	}
+
+	fclose(file);
+
+	if (!found) {
+		free(profile->modes);
+		profile->modes = NULL;
+		profile->n_modes = 0;
+		profile->has_modes = profile->has_crop = 0;
+	}
+	return found;
+}
+
+int profile_save(const char *path, const struct device_profile *profile)
+{
+	char line[PROFILE_MAX_LINE], *tmp_path;
+	FILE *old, *file;
+	int skip = 0;
+	size_t len = strlen(path) + 32;
+
+	tmp_path = (char *) malloc(len);
+	if (!tmp_path) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	snprintf(tmp_path, len, "%s.%ld.tmp", path, (long) getpid());
+
+	file = fopen(tmp_path, "w");
+	if (!file) {
+		fprintf(stderr, "Warning: could not write the device profiles to %s\n", path);
+		free(tmp_path);
+		return ERR;
+	}
+
+	fputs(PROFILE_HEADER, file);
+
+	/* The profiles of the other devices are kept */
+	old = fopen(path, "r");
+	if (old) {
+		while (fgets(line, sizeof(line), old)) {
+			if (line[0] == '#')
+				continue;
+			if (strncmp(line, "device\t", 7) == 0)
+				skip = is_device_line(line, profile, NULL);
+			if (!skip)
+				fputs(line, file);
+		}
+		fclose(old);
+	}
+
+	write_profile(file, profile);
+
+	if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+		fprintf(stderr, "Warning: could not write the device profiles to %s\n", path);
+		unlink(tmp_path);
+		free(tmp_path);
+		return ERR;
+	}
+
+	free(tmp_path);
+	return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * opencv_v4l2 - v4l2_helper_profile.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Internal header file for the device profile cache (see 'profile_path' in struct helper_cam_params).
+
+#ifndef V4L2_HELPER_PROFILE_H
+#define V4L2_HELPER_PROFILE_H
+
+#include "v4l2_helper.h"
+
+/*
+ * What was learnt by probing a device, so that it needn't be probed again
+ * the next time it's initialised. Profiles are identified by the driver,
+ * card and bus of the device; one probed with another driver version is
+ * stale.
+ */
+struct device_profile {
+	char driver[16];
+	char card[32];
+	char bus_info[32];
+	unsigned int version;
+
+	int has_crop;                   /* Cropping was probed */
+	int crop_supported;
+	struct v4l2_rect crop_default;
+
+	int has_modes;                  /* The capture modes were enumerated */
+	unsigned int modes_buf_type;
+	struct helper_mode *modes;
+	unsigned int n_modes;
+};
+
+/*
+ * Initialises an empty profile for the device described by 'cap'.
+ */
+void profile_init(struct device_profile *profile, const struct v4l2_capability *cap);
+
+/*
+ * Looks the profile of the device up in the file 'path'. Returns 1 when it's
+ * found, with the modes in an array to be freed by the caller, and 0 when
+ * the file doesn't exist or has no up-to-date profile of the device.
+ */
+int profile_load(const char *path, struct device_profile *profile);
+
+/*
+ * Stores 'profile' in the file 'path', replacing the previous profile of the
+ * device and keeping those of the other devices. The file is replaced
+ * atomically, so that processes starting concurrently never read a partial
+ * one.
+ */
+int profile_save(const char *path, const struct device_profile *profile);
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * opencv_v4l2 - v4l2_helper_record.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#define _GNU_SOURCE             /* O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <linux/videodev2.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_record.h"
+
+/*
+ * io_uring is used through its system calls directly, so that the library
+ * doesn't depend on liburing. Only what the recorder needs is implemented:
+ * the submission and completion rings shared with the kernel, with a single
+ * producer and a single consumer (the recorder).
+ */
+struct record_ring {
+	int fd;
+
+	void *sq_map;
+	size_t sq_map_len;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	void *cq_map;
+	size_t cq_map_len;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/*
+ * A frame being written; its lease is released when the write completes.
+ */
+struct record_slot {
+	struct helper_lease lease;
+	struct iovec iov[2 * HELPER_MAX_PLANES];  /* A plane, and its padding if past the buffer */
+	unsigned int n_iov;
+	size_t length;          /* Bytes to write */
+	uint64_t entry;         /* Index entry of the frame */
+};
+
+struct helper_recorder {
+	struct helper_ctx *ctx;
+	int fd;
+	int direct;
+	struct record_ring ring;
+
+	unsigned int queue_depth;
+	unsigned int batch;
+	unsigned int to_submit;   /* Frames queued in the submission ring, not yet submitted */
+	struct record_slot *slots;
+	unsigned int *free_slots;
+	unsigned int n_free;
+
+	struct helper_record_header header;
+	struct helper_record_entry *entries;
+	uint64_t capacity;
+	uint64_t offset;          /* Of the next frame */
+
+	struct helper_recorder_stats stats;
+	struct timespec first_submit;
+	struct timespec last_complete;
+};
+
+/* Padding of the planes whose buffer ends before the next aligned block */
+static unsigned char zero_padding[HELPER_RECORD_ALIGNMENT] __attribute__((aligned(HELPER_RECORD_ALIGNMENT)));
+
+/**
+ * Start of static (internal) helper functions
+ */
+static size_t round_up(size_t size, size_t align)
+{
+	return ((size + align - 1) / align) * align;
+}
+
+static double seconds_between(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void ring_unmap(struct record_ring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_len);
+	if (ring->sq_map)
+		munmap(ring->sq_map, ring->sq_map_len);
+	if (ring->fd != -1)
+		close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+static int ring_setup(struct record_ring *ring, unsigned int entries)
+{
+	struct io_uring_params p;
+	unsigned char *sq, *cq;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		fprintf(stderr, "Error occurred when setting up io_uring: %s\n", strerror(errno));
+		ring->fd = -1;
+		return ERR;
+	}
+
+	ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_map_len > ring->sq_map_len)
+			ring->sq_map_len = ring->cq_map_len;
+		ring->cq_map_len = ring->sq_map_len;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring->sq_map) {
+		ring->sq_map = NULL;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring->cq_map) {
+			ring->cq_map = NULL;
+			goto fail;
+		}
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if (MAP_FAILED == ring->sqes) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	sq = (unsigned char *) ring->sq_map;
+	ring->sq_head = (unsigned int *) (sq + p.sq_off.head);
+	ring->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+
+	cq = (unsigned char *) ring->cq_map;
+	ring->cq_head = (unsigned int *) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	fprintf(stderr, "Error occurred when mapping the io_uring rings: %s\n", strerror(errno));
+	ring_unmap(ring);
+	return ERR;
+}
+
+/*
+ * Submits the queued frames and, if 'wait' is non-zero, waits for a
+ * completion.
+ */
+static int ring_enter(struct helper_recorder *rec, int wait)
+{
+	unsigned int flags = (wait) ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	if (rec->to_submit == 0 && !wait)
+		return 0;
+
+	do {
+		ret = (int) syscall(__NR_io_uring_enter, rec->ring.fd, rec->to_submit, (wait) ? 1 : 0, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		fprintf(stderr, "Error occurred when submitting to io_uring: %s\n", strerror(errno));
+		return ERR;
+	}
+
+	rec->to_submit -= ((unsigned int) ret < rec->to_submit) ? (unsigned int) ret : rec->to_submit;
+	return 0;
+}
+
+/*
+ * Turns O_DIRECT off for the writes to come, those in flight are unaffected.
+ */
+static void disable_direct(struct helper_recorder *rec, const char *reason)
+{
+	int flags = fcntl(rec->fd, F_GETFL);
+
+	if (!rec->direct)
+		return;
+
+	fprintf(stderr, "Warning: %s, the recording is written without O_DIRECT\n", reason);
+	if (flags != -1)
+		fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT);
+	rec->direct = 0;
+}
+
+/*
+ * Writes 'size' bytes of 'data' at 'offset', padded with zeroes to the
+ * alignment, from an aligned copy as required by O_DIRECT.
+ */
+static int write_aligned(struct helper_recorder *rec, const void *data, size_t size, uint64_t offset)
+{
+	size_t length = round_up(size, HELPER_RECORD_ALIGNMENT), done = 0;
+	unsigned char *copy;
+	ssize_t ret;
+
+	if (size == 0)
+		return 0;
+
+	if (posix_memalign((void **) &copy, HELPER_RECORD_ALIGNMENT, length) != 0) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	memcpy(copy, data, size);
+	memset(copy + size, 0, length - size);
+
+	while (done < length) {
+		ret = pwrite(rec->fd, copy + done, length - done, (off_t) (offset + done));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EINVAL && rec->direct) {
+			disable_direct(rec, "the file system doesn't support O_DIRECT");
+			continue;
+		}
+		if (ret <= 0) {
+			fprintf(stderr, "Error occurred when writing the recording: %s\n",
+					(ret < 0) ? strerror(errno) : "short write");
+			free(copy);
+			return ERR;
+		}
+		done += ret;
+	}
+
+	free(copy);
+	return 0;
+}
+
+static int write_header(struct helper_recorder *rec)
+{
+	return write_aligned(rec, &rec->header, sizeof(rec->header), 0);
+}
+
+/*
+ * Releases the leases of the completed writes. Returns their number.
+ */
+static int reap_completions(struct helper_recorder *rec)
+{
+	struct record_ring *ring = &rec->ring;
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	while (head != tail) {
+		const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		unsigned int index = (unsigned int) cqe->user_data;
+		struct record_slot *slot = &rec->slots[index];
+
+		if (cqe->res < 0 || (size_t) cqe->res != slot->length) {
+			if (rec->stats.write_errors == 0)
+				fprintf(stderr, "Error occurred when writing frame %u: %s\n", slot->lease.sequence,
+						(cqe->res < 0) ? strerror(-cqe->res) : "short write");
+			rec->stats.write_errors++;
+			rec->entries[slot->entry].flags |= V4L2_BUF_FLAG_ERROR;
+		} else {
+			rec->stats.frames++;
+			rec->stats.bytes += slot->length;
+		}
+
+		helper_ctx_release_lease(rec->ctx, &slot->lease);
+		rec->free_slots[rec->n_free++] = index;
+		rec->stats.in_flight--;
+		head++;
+		n++;
+	}
+
+	if (n) {
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		clock_gettime(CLOCK_MONOTONIC, &rec->last_complete);
+	}
+	return n;
+}
+
+static struct helper_record_entry *add_entry(struct helper_recorder *rec)
+{
+	if (rec->header.n_frames == rec->capacity) {
+		uint64_t capacity = (rec->capacity) ? rec->capacity * 2 : 1024;
+		struct helper_record_entry *entries = realloc(rec->entries, capacity * sizeof(*entries));
+
+		if (!entries) {
+			fprintf(stderr, "Out of memory\n");
+			return NULL;
+		}
+		rec->entries = entries;
+		rec->capacity = capacity;
+	}
+
+	return &rec->entries[rec->header.n_frames++];
+}
+
+static void free_recorder(struct helper_recorder *rec)
+{
+	ring_unmap(&rec->ring);
+	if (rec->fd != -1)
+		close(rec->fd);
+	free(rec->slots);
+	free(rec->free_slots);
+	free(rec->entries);
+	free(rec);
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+int helper_recorder_create(struct helper_recorder **rec_out, struct helper_ctx *ctx, const char *path,
+		unsigned int queue_depth, unsigned int batch)
+{
+	struct helper_recorder *rec;
+	unsigned int i, n_buffers;
+
+	if (!ctx || !path) {
+		fprintf(stderr, "Error: trying to record without successfully initialising camera\n");
+		return ERR;
+	}
+
+	/*
+	 * By default, one buffer is left to the driver so that capturing goes
+	 * on while all the others are being written.
+	 */
+	n_buffers = helper_ctx_get_num_buffers(ctx);
+	if (queue_depth == 0)
+		queue_depth = (n_buffers > 1) ? n_buffers - 1 : 1;
+	if (batch == 0)
+		batch = 1;
+	if (batch > queue_depth)
+		batch = queue_depth;
+
+	rec = (struct helper_recorder *) calloc(1, sizeof(*rec));
+	if (!rec) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	rec->ctx = ctx;
+	rec->ring.fd = -1;
+	rec->queue_depth = queue_depth;
+	rec->batch = batch;
+
+	rec->slots = (struct record_slot *) calloc(queue_depth, sizeof(*rec->slots));
+	rec->free_slots = (unsigned int *) calloc(queue_depth, sizeof(*rec->free_slots));
+	if (!rec->slots || !rec->free_slots) {
+		fprintf(stderr, "Out of memory\n");
+		rec->fd = -1;
+		free_recorder(rec);
+		return ERR;
+	}
+	for (i = 0; i < queue_depth; i++)
+		rec->free_slots[i] = queue_depth - 1 - i;
+	rec->n_free = queue_depth;
+
+	rec->direct = 1;
+	rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+	if (-1 == rec->fd && errno == EINVAL) {
+		fprintf(stderr, "Warning: the file system doesn't support O_DIRECT, the recording is written without it\n");
+		rec->direct = 0;
+		rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if (-1 == rec->fd) {
+		fprintf(stderr, "Cannot create '%s': %d, %s\n", path, errno, strerror(errno));
+		free_recorder(rec);
+		return ERR;
+	}
+
+	/*
+	 * The header is written now, as a placeholder, and rewritten with the
+	 * number of frames and the offset of the index when closing.
+	 */
+	memcpy(rec->header.magic, HELPER_RECORD_MAGIC, sizeof(rec->header.magic));
+	rec->header.version = HELPER_RECORD_VERSION;
+	rec->header.alignment = HELPER_RECORD_ALIGNMENT;
+	helper_ctx_get_format(ctx, &rec->header.width, &rec->header.height, &rec->header.pixelformat);
+	rec->offset = HELPER_RECORD_ALIGNMENT;
+
+	if (write_header(rec) < 0 || ring_setup(&rec->ring, queue_depth) < 0) {
+		free_recorder(rec);
+		return ERR;
+	}
+
+	*rec_out = rec;
+	return 0;
+}
+
+int helper_recorder_submit(struct helper_recorder *rec, struct helper_lease *lease)
+{
+	struct record_ring *ring = &rec->ring;
+	struct helper_record_entry *entry;
+	struct record_slot *slot;
+	struct io_uring_sqe *sqe;
+	unsigned int index, tail, p, sizeimage = 0;
+
+	rec->stats.dropped += lease->dropped;
+
+	if (lease->n_mem_planes == 0) {
+		fprintf(stderr, "Error: the lease has no buffer memory to record\n");
+		return ERR;
+	}
+
+	/* Completions are reaped first, to free a slot if possible */
+	reap_completions(rec);
+	if (rec->n_free == 0) {
+		rec->stats.rejected++;
+		return HELPER_AGAIN;
+	}
+
+	entry = add_entry(rec);
+	if (!entry)
+		return ERR;
+
+	index = rec->free_slots[--rec->n_free];
+	slot = &rec->slots[index];
+	slot->lease = *lease;
+	slot->entry = rec->header.n_frames - 1;
+	slot->n_iov = 0;
+	slot->length = 0;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->offset = rec->offset;
+	entry->tv_sec = lease->timestamp.tv_sec;
+	entry->tv_usec = lease->timestamp.tv_usec;
+	entry->sequence = lease->sequence;
+	entry->flags = lease->flags;
+
+	/*
+	 * Whole aligned blocks are written from the buffer memory, which
+	 * usually spans whole pages; the padding is whatever follows the data.
+	 * Each plane takes whole blocks in the recording, as its replay
+	 * expects: a buffer that ends before the last block of its plane is
+	 * completed with zeroes.
+	 */
+	for (p = 0; p < lease->n_mem_planes; p++) {
+		const struct helper_mem_plane *plane = &lease->mem_planes[p];
+		size_t bytesused = (plane->bytesused < plane->length) ? plane->bytesused : plane->length;
+		size_t padded = round_up(bytesused, HELPER_RECORD_ALIGNMENT);
+		size_t length = (padded > plane->length) ? plane->length : padded;
+
+		if ((length % HELPER_RECORD_ALIGNMENT) || ((uintptr_t) plane->data % HELPER_RECORD_ALIGNMENT))
+			disable_direct(rec, "the buffers aren't aligned for O_DIRECT");
+
+		slot->iov[slot->n_iov].iov_base = plane->data;
+		slot->iov[slot->n_iov++].iov_len = length;
+		if (padded > length) {
+			slot->iov[slot->n_iov].iov_base = zero_padding;
+			slot->iov[slot->n_iov++].iov_len = padded - length;
+		}
+		slot->length += padded;
+		entry->bytesused[p] = bytesused;
+		sizeimage += bytesused;
+	}
+
+	if (rec->header.n_frames == 1) {
+		rec->header.n_mem_planes = lease->n_mem_planes;
+		rec->header.bytesperline = lease->planes[0].bytesperline;
+		clock_gettime(CLOCK_MONOTONIC, &rec->first_submit);
+	}
+	if (sizeimage > rec->header.sizeimage)
+		rec->header.sizeimage = sizeimage;
+
+	/*
+	 * The buffer memory is written in the same (single) operation for all
+	 * the memory planes of the frame.
+	 */
+	tail = *ring->sq_tail;
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = rec->fd;
+	sqe->addr = (uintptr_t) slot->iov;
+	sqe->len = slot->n_iov;
+	sqe->off = rec->offset;
+	sqe->user_data = index;
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	rec->offset += round_up(slot->length, HELPER_RECORD_ALIGNMENT);
+	rec->to_submit++;
+	rec->stats.in_flight++;
+	if (rec->stats.in_flight > rec->stats.max_in_flight)
+		rec->stats.max_in_flight = rec->stats.in_flight;
+
+	if (rec->to_submit >= rec->batch || rec->n_free == 0)
+		return (ring_enter(rec, 0) < 0) ? ERR : 0;
+
+	return 0;
+}
+
+int helper_recorder_reap(struct helper_recorder *rec, int wait)
+{
+	int n = reap_completions(rec);
+
+	if (n || !wait || rec->stats.in_flight == 0)
+		return n;
+
+	if (ring_enter(rec, 1) < 0)
+		return ERR;
+
+	return reap_completions(rec);
+}
+
+int helper_recorder_get_stats(struct helper_recorder *rec, struct helper_recorder_stats *stats)
+{
+	if (!rec) {
+		fprintf(stderr, "Error: trying to get the stats of a recorder that wasn't created\n");
+		return ERR;
+	}
+
+	*stats = rec->stats;
+	stats->direct = rec->direct;
+	if (rec->stats.frames) {
+		stats->seconds = seconds_between(&rec->first_submit, &rec->last_complete);
+		if (stats->seconds > 0)
+			stats->mb_per_s = stats->bytes / stats->seconds / 1e6;
+	}
+
+	return 0;
+}
+
+int helper_recorder_close(struct helper_recorder *rec)
+{
+	int ret = 0;
+
+	if (!rec)
+		return ERR;
+
+	while (rec->stats.in_flight) {
+		if (helper_recorder_reap(rec, 1) < 0) {
+			fprintf(stderr, "Error: %u frames still being written are lost\n", rec->stats.in_flight);
+			ret = ERR;
+			break;
+		}
+	}
+
+	rec->header.dropped = rec->stats.dropped;
+	rec->header.index_offset = rec->offset;
+	if (
+		write_aligned(rec, rec->entries, rec->header.n_frames * sizeof(*rec->entries), rec->offset) < 0 ||
+		write_header(rec) < 0
+	)
+	{
+		ret = ERR;
+	}
+
+	free_recorder(rec);
+	return ret;
+}
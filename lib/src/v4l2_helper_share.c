@@ -0,0 +1,1070 @@
+/*
+ * opencv_v4l2 - v4l2_helper_share.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#define _GNU_SOURCE             /* memfd_create(), F_ADD_SEALS, accept4() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <linux/udmabuf.h>
+
+#include "v4l2_helper.h"
+#include "v4l2_helper_share.h"
+
+#define SHARE_MAGIC     "V4L2SHR1"
+#define SHARE_WRITING   UINT64_MAX  /* Frame number of a slot being written */
+#define SHARE_MAX_FDS   4
+#define SHARE_HANDSHAKE_MS  1000    /* For a connection to send its request */
+
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010  /* Linux 5.1 */
+#endif
+
+/*
+ * The ring, in a memfd written by the publisher only:
+ *
+ *   struct share_header, followed by the 'n_slots' struct share_slot
+ *   'data_offset'   the frames, one slot of 'slot_size' bytes each
+ *
+ * and the entry of each subscriber, in a memfd of its own written by that
+ * subscriber. Once the publisher has mapped the ring, it's sealed against
+ * new writable mappings (F_SEAL_FUTURE_WRITE), so that subscribers can only
+ * read it. The publisher never trusts what the subscribers can write: the
+ * geometry of the ring and the policies are its own copies, and the entries
+ * are only compared with frame numbers.
+ *
+ * The frame numbers count the frames published. A slot holds frame 'frame'
+ * (the slot index being 'frame' modulo 'n_slots'), which is SHARE_WRITING
+ * while it's being overwritten.
+ *
+ * Frames are read in place: a subscriber announces the frame it reads in
+ * 'holding' and then checks that its slot still holds it, while the
+ * publisher marks the slot as being written and then checks that no
+ * subscriber holds it. Both being sequentially consistent, one of them sees
+ * the other and backs off.
+ */
+struct share_subscriber {
+	uint64_t cursor;           /* Next frame to read */
+	uint64_t holding;          /* Frame held + 1, 0 if none */
+	uint64_t frames;
+	uint64_t dropped;
+};
+
+struct share_plane {
+	uint64_t offset;           /* In the slot */
+	uint32_t bytesperline;
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved;
+};
+
+struct share_slot {
+	uint64_t frame;
+	int64_t tv_sec;
+	int64_t tv_usec;
+	uint32_t sequence;
+	uint32_t flags;
+	uint32_t bytesused;
+	uint32_t reserved;
+};
+
+struct share_header {
+	char magic[8];
+	uint32_t n_slots;
+	uint32_t n_planes;
+	uint64_t slot_size;
+	uint64_t data_offset;
+	uint64_t map_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pixelformat;
+	uint32_t closed;           /* Set when the publisher goes away */
+	uint64_t published;        /* Number of frames published */
+	struct share_plane planes[HELPER_MAX_PLANES];
+	struct share_slot slots[];
+};
+
+/*
+ * Messages exchanged when a subscriber connects. The reply carries the
+ * memfds of the ring and of the subscriber entry, the eventfd of the
+ * subscriber and, if any, the dma-buf of the ring.
+ */
+struct share_request {
+	uint32_t policy;
+};
+
+struct share_reply {
+	int32_t status;
+	uint32_t reserved;
+};
+
+/* A connection whose request hasn't been received yet */
+struct share_pending {
+	int sock;
+	uint64_t deadline_ms;
+};
+
+struct share_peer {
+	int sock;
+	int event_fd;
+	struct share_subscriber *entry;
+	enum helper_share_policy policy;
+	uint64_t blocked;
+};
+
+struct helper_publisher {
+	struct helper_ctx *ctx;
+	int listen_fd;
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+	unsigned int n_slots;
+
+	int memfd;
+	int dmabuf_fd;
+	struct share_header *hdr;
+	size_t slot_size;
+	size_t data_offset;
+	size_t map_size;
+	uint64_t published;
+	size_t mem_offsets[HELPER_MAX_PLANES];  /* Of the memory planes in a slot */
+	unsigned int n_mem_planes;
+
+	struct share_pending pending[HELPER_SHARE_MAX_SUBSCRIBERS];
+	struct share_peer peers[HELPER_SHARE_MAX_SUBSCRIBERS];
+	uint64_t blocked;
+};
+
+struct helper_subscriber {
+	int sock;
+	int memfd;
+	int entry_fd;
+	int event_fd;
+	int dmabuf_fd;
+	const struct share_header *hdr;
+	size_t map_size;
+	struct share_subscriber *self;
+	enum helper_share_policy policy;
+	uint64_t next;             /* Next frame to read */
+	uint64_t missed;           /* Frames dropped since the last lease */
+	int holding;
+	unsigned int held_slot;
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static size_t round_up(size_t size, size_t align)
+{
+	return ((size + align - 1) / align) * align;
+}
+
+static uint64_t load(const uint64_t *value)
+{
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Fills in the address of the socket at 'path', in the abstract namespace
+ * when it starts with '@'.
+ */
+static int socket_address(const char *path, struct sockaddr_un *addr, socklen_t *addr_len)
+{
+	size_t len = strlen(path);
+
+	if (len == 0 || len >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "Invalid socket path '%s'\n", path);
+		return ERR;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path, len);
+	if (path[0] == '@')
+		addr->sun_path[0] = '\0';
+	*addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+	return 0;
+}
+
+static int send_fds(int sock, const void *msg, size_t size, const int *fds, unsigned int n_fds)
+{
+	char control[CMSG_SPACE(SHARE_MAX_FDS * sizeof(int))];
+	struct iovec iov = { (void *) msg, size };
+	struct msghdr hdr;
+	struct cmsghdr *cmsg;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(control, 0, sizeof(control));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	if (n_fds) {
+		hdr.msg_control = control;
+		hdr.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+	}
+
+	return (sendmsg(sock, &hdr, MSG_NOSIGNAL) == (ssize_t) size) ? 0 : ERR;
+}
+
+/*
+ * Receives a message of 'size' bytes and up to SHARE_MAX_FDS fds. Returns
+ * the number of fds received or ERR.
+ */
+static int recv_fds(int sock, void *msg, size_t size, int *fds)
+{
+	char control[CMSG_SPACE(SHARE_MAX_FDS * sizeof(int))];
+	struct iovec iov = { msg, size };
+	struct msghdr hdr;
+	struct cmsghdr *cmsg;
+	int n_fds = 0;
+	ssize_t ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control;
+	hdr.msg_controllen = sizeof(control);
+
+	do {
+		ret = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+
+	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+		}
+	}
+
+	if (ret != (ssize_t) size) {
+		while (n_fds > 0)
+			close(fds[--n_fds]);
+		return ERR;
+	}
+	return n_fds;
+}
+
+/*
+ * Exports [offset, offset + size) of the memfd as a dma-buf. Returns -1 if
+ * udmabuf isn't available, which isn't an error.
+ */
+static int export_udmabuf(int memfd, size_t offset, size_t size)
+{
+	struct udmabuf_create create;
+	int devfd, dmabuf_fd;
+
+	devfd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (-1 == devfd)
+		return -1;
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = offset;
+	create.size = size;
+
+	dmabuf_fd = ioctl(devfd, UDMABUF_CREATE, &create);
+	close(devfd);
+	return dmabuf_fd;
+}
+
+/*
+ * Adds 'seals' to memfd 'fd', leaving F_SEAL_FUTURE_WRITE out on kernels
+ * that don't have it.
+ */
+static int add_seals(int fd, int seals)
+{
+	if (
+		-1 == fcntl(fd, F_ADD_SEALS, seals) &&
+		(!(seals & F_SEAL_FUTURE_WRITE) || -1 == fcntl(fd, F_ADD_SEALS, seals & ~F_SEAL_FUTURE_WRITE))
+	)
+	{
+		fprintf(stderr, "Error occurred when sealing memfd: %d, %s\n", errno, strerror(errno));
+		return ERR;
+	}
+	return 0;
+}
+
+/*
+ * Creates a memfd of 'size' bytes, mapped at '*map', with 'seals' added once
+ * it's mapped.
+ */
+static int create_memfd(const char *name, size_t size, int seals, void **map)
+{
+	int fd;
+
+	fd = memfd_create(name, MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	if (-1 == fd || -1 == ftruncate(fd, size)) {
+		fprintf(stderr, "Error occurred when creating memfd: %d, %s\n", errno, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	*map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == *map) {
+		fprintf(stderr, "Error occurred when mapping memfd: %d, %s\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (add_seals(fd, seals) < 0) {
+		munmap(*map, size);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Allocates the ring for frames laid out as that of 'lease': the memory
+ * planes of its buffer one after the other, each spanning whole pages.
+ */
+static int create_ring(struct helper_publisher *pub, const struct helper_lease *lease)
+{
+	size_t page_size = getpagesize(), slot_size = 0, header_size, map_size;
+	struct share_header *hdr;
+	void *map;
+	unsigned int m, p;
+
+	if (lease->n_mem_planes == 0) {
+		fprintf(stderr, "Error: the lease has no buffer memory to publish\n");
+		return ERR;
+	}
+
+	for (m = 0; m < lease->n_mem_planes; m++) {
+		pub->mem_offsets[m] = slot_size;
+		slot_size += round_up(lease->mem_planes[m].length, page_size);
+	}
+	pub->n_mem_planes = lease->n_mem_planes;
+
+	header_size = round_up(sizeof(*hdr) + pub->n_slots * sizeof(struct share_slot), page_size);
+	map_size = header_size + pub->n_slots * slot_size;
+
+	/* Subscribers can't resize the ring under the feet of the others */
+	pub->memfd = create_memfd("v4l2_helper_share", map_size, F_SEAL_SHRINK | F_SEAL_GROW, &map);
+	if (-1 == pub->memfd)
+		return ERR;
+	hdr = (struct share_header *) map;
+
+	pub->slot_size = slot_size;
+	pub->data_offset = header_size;
+	pub->map_size = map_size;
+
+	/* For the subscribers only */
+	memcpy(hdr->magic, SHARE_MAGIC, sizeof(hdr->magic));
+	hdr->n_slots = pub->n_slots;
+	hdr->slot_size = slot_size;
+	hdr->data_offset = header_size;
+	hdr->map_size = map_size;
+	helper_ctx_get_format(pub->ctx, &hdr->width, &hdr->height, &hdr->pixelformat);
+
+	/* The color planes are found in the memory planes they belong to */
+	hdr->n_planes = lease->n_planes;
+	for (p = 0; p < lease->n_planes; p++) {
+		const struct helper_plane *plane = &lease->planes[p];
+
+		for (m = 0; m < lease->n_mem_planes; m++) {
+			const struct helper_mem_plane *mem = &lease->mem_planes[m];
+
+			if (plane->data >= mem->data && plane->data < mem->data + mem->length) {
+				hdr->planes[p].offset = pub->mem_offsets[m] + (plane->data - mem->data);
+				break;
+			}
+		}
+		hdr->planes[p].bytesperline = plane->bytesperline;
+		hdr->planes[p].width = plane->width;
+		hdr->planes[p].height = plane->height;
+	}
+
+	for (p = 0; p < pub->n_slots; p++)
+		hdr->slots[p].frame = SHARE_WRITING;
+
+	/*
+	 * Nor write to it, once exported: udmabuf refuses memfds sealed against
+	 * writing. The dma-buf only spans the frames, never what the publisher
+	 * relies on.
+	 */
+	pub->dmabuf_fd = export_udmabuf(pub->memfd, header_size, pub->n_slots * slot_size);
+	if (add_seals(pub->memfd, F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+		munmap(hdr, map_size);
+		close(pub->memfd);
+		pub->memfd = -1;
+		if (pub->dmabuf_fd != -1)
+			close(pub->dmabuf_fd);
+		pub->dmabuf_fd = -1;
+		return ERR;
+	}
+
+	pub->hdr = hdr;
+	return 0;
+}
+
+static void remove_subscriber(struct helper_publisher *pub, unsigned int i)
+{
+	munmap(pub->peers[i].entry, sizeof(*pub->peers[i].entry));
+	close(pub->peers[i].sock);
+	close(pub->peers[i].event_fd);
+	pub->peers[i].sock = pub->peers[i].event_fd = -1;
+	pub->peers[i].entry = NULL;
+}
+
+/*
+ * Answers the request of connection 'sock', which is readable.
+ */
+static void add_subscriber(struct helper_publisher *pub, int sock)
+{
+	struct share_request request;
+	struct share_reply reply;
+	int fds[SHARE_MAX_FDS], n_fds = 3, event_fd, entry_fd = -1;
+	void *map = NULL;
+	unsigned int i;
+
+	if (recv_fds(sock, &request, sizeof(request), fds) != 0 || request.policy > HELPER_SHARE_BACKPRESSURE) {
+		close(sock);
+		return;
+	}
+
+	memset(&reply, 0, sizeof(reply));
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS && pub->peers[i].sock != -1; i++)
+		;
+	event_fd = (i < HELPER_SHARE_MAX_SUBSCRIBERS) ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+	if (-1 != event_fd)
+		entry_fd = create_memfd("v4l2_helper_share_subscriber", sizeof(struct share_subscriber),
+				F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL, &map);
+	if (-1 == entry_fd) {
+		fprintf(stderr, "Warning: subscriber refused (%s)\n",
+				(i < HELPER_SHARE_MAX_SUBSCRIBERS) ? strerror(errno) : "too many subscribers");
+		if (-1 != event_fd)
+			close(event_fd);
+		reply.status = ERR;
+		send_fds(sock, &reply, sizeof(reply), NULL, 0);
+		close(sock);
+		return;
+	}
+
+	/* The subscriber starts with the next frame (the memfd is zeroed) */
+	pub->peers[i].entry = (struct share_subscriber *) map;
+	__atomic_store_n(&pub->peers[i].entry->cursor, pub->published, __ATOMIC_SEQ_CST);
+	pub->peers[i].sock = sock;
+	pub->peers[i].event_fd = event_fd;
+	pub->peers[i].policy = (enum helper_share_policy) request.policy;
+	pub->peers[i].blocked = 0;
+
+	fds[0] = pub->memfd;
+	fds[1] = entry_fd;
+	fds[2] = event_fd;
+	if (pub->dmabuf_fd != -1)
+		fds[n_fds++] = pub->dmabuf_fd;
+
+	if (send_fds(sock, &reply, sizeof(reply), fds, n_fds) < 0)
+		remove_subscriber(pub, i);
+	close(entry_fd);
+}
+
+/*
+ * Accepts the pending connections and answers those whose request has
+ * arrived, without waiting for the others, which are answered on a later
+ * call or dropped after SHARE_HANDSHAKE_MS.
+ */
+static void accept_subscribers(struct helper_publisher *pub)
+{
+	struct pollfd pfds[HELPER_SHARE_MAX_SUBSCRIBERS];
+	uint64_t now = now_ms();
+	unsigned int i, n = 0;
+	int sock;
+
+	/* Connections beyond the free pending entries wait in the backlog */
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->pending[i].sock != -1)
+			continue;
+		sock = accept4(pub->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (-1 == sock)
+			break;
+		pub->pending[i].sock = sock;
+		pub->pending[i].deadline_ms = now + SHARE_HANDSHAKE_MS;
+	}
+
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->pending[i].sock != -1) {
+			pfds[n].fd = pub->pending[i].sock;
+			pfds[n].events = POLLIN;
+			pfds[n].revents = 0;
+			n++;
+		}
+	}
+	if (n == 0 || poll(pfds, n, 0) < 0)
+		return;
+
+	for (i = 0, n = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->pending[i].sock == -1)
+			continue;
+		if (pfds[n++].revents)
+			add_subscriber(pub, pub->pending[i].sock);
+		else if (now < pub->pending[i].deadline_ms)
+			continue;
+		else
+			close(pub->pending[i].sock);
+		pub->pending[i].sock = -1;
+	}
+}
+
+/*
+ * Accepts the pending connections and removes the subscribers that went
+ * away (a subscriber sends nothing after connecting).
+ */
+static void service_subscribers(struct helper_publisher *pub)
+{
+	struct pollfd pfds[HELPER_SHARE_MAX_SUBSCRIBERS];
+	unsigned int i, n = 0;
+
+	accept_subscribers(pub);
+
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->peers[i].sock != -1) {
+			pfds[n].fd = pub->peers[i].sock;
+			pfds[n].events = POLLIN;
+			pfds[n].revents = 0;
+			n++;
+		}
+	}
+	if (n == 0 || poll(pfds, n, 0) <= 0)
+		return;
+
+	for (i = 0, n = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->peers[i].sock == -1)
+			continue;
+		if (pfds[n++].revents)
+			remove_subscriber(pub, i);
+	}
+}
+
+/*
+ * Returns non-zero if 'frame' can't be written to its slot because of a
+ * subscriber, which is charged for it.
+ */
+static int slot_blocked(struct helper_publisher *pub, uint64_t frame)
+{
+	struct share_slot *slot = &pub->hdr->slots[frame % pub->n_slots];
+	uint64_t previous = slot->frame;
+	unsigned int i;
+
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (
+			pub->peers[i].sock != -1 && pub->peers[i].policy == HELPER_SHARE_BACKPRESSURE &&
+			frame - load(&pub->peers[i].entry->cursor) >= pub->n_slots
+		)
+		{
+			pub->peers[i].blocked++;
+			return 1;
+		}
+	}
+
+	__atomic_store_n(&slot->frame, SHARE_WRITING, __ATOMIC_SEQ_CST);
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		uint64_t holding;
+
+		if (pub->peers[i].sock == -1)
+			continue;
+
+		holding = __atomic_load_n(&pub->peers[i].entry->holding, __ATOMIC_SEQ_CST);
+		if (holding && (holding - 1) % pub->n_slots == frame % pub->n_slots) {
+			__atomic_store_n(&slot->frame, previous, __ATOMIC_SEQ_CST);
+			pub->peers[i].blocked++;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Whether the ring described by 'hdr' fits in the 'map_size' bytes mapped.
+ */
+static int valid_ring(const struct share_header *hdr, size_t map_size)
+{
+	unsigned int p;
+
+	if (
+		memcmp(hdr->magic, SHARE_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->n_slots == 0 || hdr->slot_size == 0 || hdr->n_planes > HELPER_MAX_PLANES ||
+		hdr->data_offset < sizeof(*hdr) + (uint64_t) hdr->n_slots * sizeof(struct share_slot) ||
+		hdr->data_offset > map_size || hdr->slot_size > (map_size - hdr->data_offset) / hdr->n_slots
+	)
+		return 0;
+
+	for (p = 0; p < hdr->n_planes; p++) {
+		if (hdr->planes[p].offset >= hdr->slot_size)
+			return 0;
+	}
+	return 1;
+}
+
+static void unmap_subscriber(struct helper_subscriber *sub)
+{
+	if (sub->hdr)
+		munmap((void *) sub->hdr, sub->map_size);
+	if (sub->self)
+		munmap(sub->self, sizeof(*sub->self));
+	if (sub->memfd != -1)
+		close(sub->memfd);
+	if (sub->entry_fd != -1)
+		close(sub->entry_fd);
+	if (sub->event_fd != -1)
+		close(sub->event_fd);
+	if (sub->dmabuf_fd != -1)
+		close(sub->dmabuf_fd);
+	if (sub->sock != -1)
+		close(sub->sock);
+	free(sub);
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+int helper_publisher_create(struct helper_publisher **pub_out, struct helper_ctx *ctx, const char *socket_path,
+		unsigned int n_slots)
+{
+	struct helper_publisher *pub;
+	unsigned int i;
+
+	if (!ctx || !socket_path) {
+		fprintf(stderr, "Error: trying to publish without successfully initialising camera\n");
+		return ERR;
+	}
+
+	pub = (struct helper_publisher *) calloc(1, sizeof(*pub));
+	if (!pub) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	pub->ctx = ctx;
+	pub->n_slots = (n_slots) ? n_slots : 8;
+	pub->memfd = pub->dmabuf_fd = -1;
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		pub->pending[i].sock = -1;
+		pub->peers[i].sock = pub->peers[i].event_fd = -1;
+	}
+
+	if (socket_address(socket_path, &pub->addr, &pub->addr_len) < 0) {
+		free(pub);
+		return ERR;
+	}
+
+	/* A socket left by a publisher that didn't exit cleanly is replaced */
+	if (socket_path[0] != '@')
+		unlink(socket_path);
+
+	pub->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (
+		-1 == pub->listen_fd ||
+		-1 == bind(pub->listen_fd, (struct sockaddr *) &pub->addr, pub->addr_len) ||
+		-1 == listen(pub->listen_fd, HELPER_SHARE_MAX_SUBSCRIBERS)
+	)
+	{
+		fprintf(stderr, "Cannot listen on '%s': %d, %s\n", socket_path, errno, strerror(errno));
+		if (pub->listen_fd != -1)
+			close(pub->listen_fd);
+		free(pub);
+		return ERR;
+	}
+
+	*pub_out = pub;
+	return 0;
+}
+
+int helper_publisher_publish(struct helper_publisher *pub, const struct helper_lease *lease)
+{
+	struct share_header *hdr;
+	struct share_slot *slot;
+	unsigned char *data;
+	uint64_t frame;
+	unsigned int m, i;
+	uint64_t one = 1;
+
+	if (!pub->hdr && create_ring(pub, lease) < 0)
+		return ERR;
+	hdr = pub->hdr;
+
+	if (lease->n_mem_planes != pub->n_mem_planes) {
+		fprintf(stderr, "Error: the frame doesn't fit the ring\n");
+		return ERR;
+	}
+
+	service_subscribers(pub);
+
+	frame = pub->published;
+	if (slot_blocked(pub, frame)) {
+		pub->blocked++;
+		return HELPER_AGAIN;
+	}
+
+	/* The single copy of the frame */
+	slot = &hdr->slots[frame % pub->n_slots];
+	data = (unsigned char *) hdr + pub->data_offset + (frame % pub->n_slots) * pub->slot_size;
+	for (m = 0; m < lease->n_mem_planes; m++) {
+		size_t size = lease->mem_planes[m].bytesused;
+		size_t room = ((m + 1 < pub->n_mem_planes) ? pub->mem_offsets[m + 1] : pub->slot_size) - pub->mem_offsets[m];
+
+		memcpy(data + pub->mem_offsets[m], lease->mem_planes[m].data, (size < room) ? size : room);
+	}
+
+	slot->tv_sec = lease->timestamp.tv_sec;
+	slot->tv_usec = lease->timestamp.tv_usec;
+	slot->sequence = lease->sequence;
+	slot->flags = lease->flags;
+	slot->bytesused = lease->bytesused;
+	__atomic_store_n(&slot->frame, frame, __ATOMIC_RELEASE);
+	pub->published = frame + 1;
+	__atomic_store_n(&hdr->published, pub->published, __ATOMIC_RELEASE);
+
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->peers[i].event_fd != -1 && write(pub->peers[i].event_fd, &one, sizeof(one)) != sizeof(one)) {
+			/* Errors ignored; the counter can't overflow in practice */
+		}
+	}
+
+	return 0;
+}
+
+int helper_publisher_get_stats(struct helper_publisher *pub, struct helper_publisher_stats *stats)
+{
+	unsigned int i;
+
+	if (!pub) {
+		fprintf(stderr, "Error: trying to get the stats of a publisher that wasn't created\n");
+		return ERR;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	stats->blocked = pub->blocked;
+	stats->has_dmabuf = (pub->dmabuf_fd != -1);
+	if (!pub->hdr)
+		return 0;
+
+	stats->published = pub->published;
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		struct share_subscriber *sub = pub->peers[i].entry;
+		struct helper_share_subscriber_stats *s = &stats->subscribers[i];
+
+		if (pub->peers[i].sock == -1)
+			continue;
+
+		/* As reported by the subscriber */
+		s->active = 1;
+		s->policy = pub->peers[i].policy;
+		s->frames = load(&sub->frames);
+		s->dropped = load(&sub->dropped);
+		s->blocked = pub->peers[i].blocked;
+		s->lag = stats->published - load(&sub->cursor);
+		stats->n_subscribers++;
+	}
+
+	return 0;
+}
+
+int helper_publisher_destroy(struct helper_publisher *pub)
+{
+	unsigned int i;
+	uint64_t one = 1;
+
+	if (!pub)
+		return ERR;
+
+	if (pub->hdr) {
+		__atomic_store_n(&pub->hdr->closed, 1, __ATOMIC_RELEASE);
+		for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+			if (pub->peers[i].sock == -1)
+				continue;
+			if (write(pub->peers[i].event_fd, &one, sizeof(one)) != sizeof(one)) {
+				/* Errors ignored; the subscriber also sees the socket closed */
+			}
+			remove_subscriber(pub, i);
+		}
+		munmap(pub->hdr, pub->map_size);
+	}
+	for (i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+		if (pub->pending[i].sock != -1)
+			close(pub->pending[i].sock);
+	}
+
+	close(pub->listen_fd);
+	if (pub->addr.sun_path[0] != '\0')
+		unlink(pub->addr.sun_path);
+	if (pub->memfd != -1)
+		close(pub->memfd);
+	if (pub->dmabuf_fd != -1)
+		close(pub->dmabuf_fd);
+	free(pub);
+	return 0;
+}
+
+int helper_subscriber_connect(struct helper_subscriber **sub_out, const char *socket_path, enum helper_share_policy policy)
+{
+	struct helper_subscriber *sub;
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+	struct share_request request;
+	struct share_reply reply;
+	struct stat st, entry_st;
+	void *map;
+	int fds[SHARE_MAX_FDS], n_fds;
+
+	if (socket_address(socket_path, &addr, &addr_len) < 0)
+		return ERR;
+
+	sub = (struct helper_subscriber *) calloc(1, sizeof(*sub));
+	if (!sub) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+	sub->memfd = sub->entry_fd = sub->event_fd = sub->dmabuf_fd = -1;
+	sub->policy = policy;
+
+	sub->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (-1 == sub->sock || -1 == connect(sub->sock, (struct sockaddr *) &addr, addr_len)) {
+		fprintf(stderr, "Cannot connect to '%s': %d, %s\n", socket_path, errno, strerror(errno));
+		unmap_subscriber(sub);
+		return ERR;
+	}
+
+	memset(&request, 0, sizeof(request));
+	request.policy = policy;
+	n_fds = -1;
+	if (send_fds(sub->sock, &request, sizeof(request), NULL, 0) == 0)
+		n_fds = recv_fds(sub->sock, &reply, sizeof(reply), fds);
+	if (n_fds < 0 || reply.status != 0 || n_fds < 3) {
+		fprintf(stderr, "Publisher at '%s' refused the subscription\n", socket_path);
+		while (n_fds > 0)
+			close(fds[--n_fds]);
+		unmap_subscriber(sub);
+		return ERR;
+	}
+	sub->memfd = fds[0];
+	sub->entry_fd = fds[1];
+	sub->event_fd = fds[2];
+	if (n_fds > 3)
+		sub->dmabuf_fd = fds[3];
+
+	if (
+		-1 == fstat(sub->memfd, &st) || (size_t) st.st_size < sizeof(struct share_header) ||
+		-1 == fstat(sub->entry_fd, &entry_st) || (size_t) entry_st.st_size < sizeof(struct share_subscriber)
+	)
+	{
+		fprintf(stderr, "Invalid frame ring\n");
+		unmap_subscriber(sub);
+		return ERR;
+	}
+
+	/* Only the entry of the subscriber is written to */
+	sub->map_size = st.st_size;
+	map = mmap(NULL, sub->map_size, PROT_READ, MAP_SHARED, sub->memfd, 0);
+	sub->hdr = (MAP_FAILED == map) ? NULL : (const struct share_header *) map;
+	map = mmap(NULL, sizeof(*sub->self), PROT_READ | PROT_WRITE, MAP_SHARED, sub->entry_fd, 0);
+	sub->self = (MAP_FAILED == map) ? NULL : (struct share_subscriber *) map;
+	if (!sub->hdr || !sub->self || !valid_ring(sub->hdr, sub->map_size)) {
+		fprintf(stderr, "Error occurred when mapping the frame ring\n");
+		unmap_subscriber(sub);
+		return ERR;
+	}
+
+	sub->next = load(&sub->self->cursor);
+
+	*sub_out = sub;
+	return 0;
+}
+
+int helper_subscriber_acquire(struct helper_subscriber *sub, struct helper_lease *lease, int timeout_ms)
+{
+	const struct share_header *hdr = sub->hdr;
+	uint64_t deadline = (timeout_ms > 0) ? now_ms() + timeout_ms : 0;
+	unsigned int p;
+
+	if (sub->holding) {
+		fprintf(stderr, "Error: the previous frame must be released first\n");
+		return ERR;
+	}
+
+	for (;;) {
+		uint64_t published = load(&hdr->published), count, max_lag;
+		struct pollfd pfds[2];
+		int wait_ms = timeout_ms;
+
+		if (sub->next < published) {
+			const struct share_slot *slot;
+			unsigned int index;
+			unsigned char *data;
+
+			if (sub->policy == HELPER_SHARE_LATEST_ONLY && published - sub->next > 1) {
+				sub->missed += published - 1 - sub->next;
+				sub->next = published - 1;
+			}
+			/*
+			 * Half of the ring is kept between the frame held and the
+			 * one written next, so that holding a frame doesn't stall
+			 * the publisher (see slot_blocked()). A
+			 * HELPER_SHARE_BACKPRESSURE subscriber stalls it instead.
+			 */
+			max_lag = (sub->policy == HELPER_SHARE_BACKPRESSURE || hdr->n_slots < 2) ? hdr->n_slots : hdr->n_slots / 2;
+			if (published - sub->next > max_lag) {
+				sub->missed += published - max_lag - sub->next;
+				sub->next = published - max_lag;
+			}
+
+			index = (unsigned int) (sub->next % hdr->n_slots);
+			slot = &hdr->slots[index];
+			__atomic_store_n(&sub->self->holding, sub->next + 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&slot->frame, __ATOMIC_SEQ_CST) != sub->next) {
+				/* Overwritten (or being overwritten) before it could be held */
+				__atomic_store_n(&sub->self->holding, 0, __ATOMIC_RELEASE);
+				sub->missed++;
+				sub->next++;
+				continue;
+			}
+
+			data = (unsigned char *) hdr + hdr->data_offset + (size_t) index * hdr->slot_size;
+			memset(lease, 0, sizeof(*lease));
+			lease->index = index;
+			lease->data = data + hdr->planes[0].offset;
+			lease->bytesused = slot->bytesused;
+			lease->sequence = slot->sequence;
+			lease->timestamp.tv_sec = slot->tv_sec;
+			lease->timestamp.tv_usec = slot->tv_usec;
+			lease->flags = slot->flags;
+			lease->dropped = (unsigned int) sub->missed;
+			lease->dmabuf_fd = -1;  /* The ring as a whole, see helper_subscriber_get_dmabuf() */
+			lease->n_planes = hdr->n_planes;
+			for (p = 0; p < hdr->n_planes && p < HELPER_MAX_PLANES; p++) {
+				lease->planes[p].data = data + hdr->planes[p].offset;
+				lease->planes[p].bytesperline = hdr->planes[p].bytesperline;
+				lease->planes[p].width = hdr->planes[p].width;
+				lease->planes[p].height = hdr->planes[p].height;
+			}
+			lease->n_mem_planes = 1;
+			lease->mem_planes[0].data = data;
+			lease->mem_planes[0].length = hdr->slot_size;
+			lease->mem_planes[0].bytesused = slot->bytesused;
+
+			__atomic_store_n(&sub->self->dropped, sub->self->dropped + sub->missed, __ATOMIC_RELEASE);
+			__atomic_store_n(&sub->self->frames, sub->self->frames + 1, __ATOMIC_RELEASE);
+			sub->missed = 0;
+			sub->next++;
+			__atomic_store_n(&sub->self->cursor, sub->next, __ATOMIC_RELEASE);
+			sub->holding = 1;
+			sub->held_slot = index;
+			return 0;
+		}
+
+		if (__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE))
+			return ERR;
+
+		if (timeout_ms > 0) {
+			uint64_t now = now_ms();
+
+			if (now >= deadline)
+				return HELPER_AGAIN;
+			wait_ms = (int) (deadline - now);
+		}
+
+		/* The socket becomes readable (end of file) when the publisher exits */
+		pfds[0].fd = sub->event_fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = sub->sock;
+		pfds[1].events = POLLIN;
+		pfds[0].revents = pfds[1].revents = 0;
+		if (poll(pfds, 2, wait_ms) < 0 && errno != EINTR) {
+			fprintf(stderr, "Error occurred when waiting for a frame: %s\n", strerror(errno));
+			return ERR;
+		}
+		if (pfds[1].revents && load(&hdr->published) == sub->next)
+			return ERR;
+		if (pfds[0].revents & POLLIN) {
+			if (read(sub->event_fd, &count, sizeof(count)) != sizeof(count)) {
+				/* Drained by a previous read */
+			}
+		} else if (timeout_ms == 0) {
+			return HELPER_AGAIN;
+		}
+	}
+}
+
+int helper_subscriber_release(struct helper_subscriber *sub, const struct helper_lease *lease)
+{
+	if (!sub->holding || lease->index != sub->held_slot) {
+		fprintf(stderr, "Error: releasing a frame that isn't held\n");
+		return ERR;
+	}
+
+	__atomic_store_n(&sub->self->holding, 0, __ATOMIC_RELEASE);
+	sub->holding = 0;
+	return 0;
+}
+
+int helper_subscriber_get_format(struct helper_subscriber *sub, unsigned int *width, unsigned int *height, unsigned int *format)
+{
+	if (width)
+		*width = sub->hdr->width;
+	if (height)
+		*height = sub->hdr->height;
+	if (format)
+		*format = sub->hdr->pixelformat;
+	return 0;
+}
+
+int helper_subscriber_get_fd(struct helper_subscriber *sub)
+{
+	return sub->event_fd;
+}
+
+int helper_subscriber_get_dmabuf(struct helper_subscriber *sub, const struct helper_lease *lease, int *dmabuf_fd, size_t *offset)
+{
+	if (sub->dmabuf_fd == -1) {
+		fprintf(stderr, "Error: the frame ring isn't exported as a dma-buf (see /dev/udmabuf)\n");
+		return ERR;
+	}
+
+	*dmabuf_fd = sub->dmabuf_fd;
+	*offset = (size_t) lease->index * sub->hdr->slot_size;
+	return 0;
+}
+
+int helper_subscriber_disconnect(struct helper_subscriber *sub)
+{
+	if (!sub)
+		return ERR;
+
+	if (sub->holding)
+		__atomic_store_n(&sub->self->holding, 0, __ATOMIC_RELEASE);
+	unmap_subscriber(sub);
+	return 0;
+}
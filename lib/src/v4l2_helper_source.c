@@ -0,0 +1,1762 @@
+/*
+ * opencv_v4l2 - v4l2_helper_source.c file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+
+#include <linux/videodev2.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_record.h"
+#include "v4l2_helper_source.h"
+
+#define VIRT_MAX_BUFFERS	32
+#define VIRT_MAX_PLANES		2
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+/*
+ * Controls of the virtual sources, those of a typical camera, so that the
+ * control functions can be used without one. They are validated like a
+ * driver would (values are clamped to their range) but don't affect the
+ * frames.
+ */
+struct virt_ctrl {
+	unsigned int id;
+	const char  *name;
+	int          minimum;
+	int          maximum;
+	int          step;
+	int          default_value;
+};
+
+static const struct virt_ctrl virt_ctrls[] = {
+	{ V4L2_CID_BRIGHTNESS,                 "Brightness",                -64,   64,  1,    0 },
+	{ V4L2_CID_CONTRAST,                   "Contrast",                    0,   95,  1,   32 },
+	{ V4L2_CID_AUTO_WHITE_BALANCE,         "White Balance, Automatic",    0,    1,  1,    1 },
+	{ V4L2_CID_GAIN,                       "Gain",                        0,  100,  1,    0 },
+	{ V4L2_CID_WHITE_BALANCE_TEMPERATURE,  "White Balance Temperature", 2800, 6500, 10, 4600 },
+	{ V4L2_CID_EXPOSURE_ABSOLUTE,          "Exposure Time, Absolute",     1, 5000,  1,  156 },
+};
+
+#define VIRT_N_CTRLS	(sizeof(virt_ctrls) / sizeof(virt_ctrls[0]))
+
+/*
+ * Formats enumerated by VIDIOC_ENUM_FMT when the format isn't fixed by the
+ * device path, the last ones only with the multi-planar API (NV12M) and for
+ * file sources (MJPEG). Any even frame size up to VIRT_MAX_SIZE is accepted
+ * and paced sources can be set to any frame rate up to VIRT_MAX_FPS.
+ */
+static const unsigned int virt_formats[] = {
+	V4L2_PIX_FMT_UYVY,
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_GREY,
+	V4L2_PIX_FMT_Y16,
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_NV12M,
+	V4L2_PIX_FMT_MJPEG,
+};
+
+#define VIRT_N_FORMATS	(sizeof(virt_formats) / sizeof(virt_formats[0]))
+#define VIRT_MAX_SIZE	8192
+#define VIRT_MAX_FPS	1000
+
+enum virt_source_type {
+	VIRT_PATTERN,
+	VIRT_FILE,
+	VIRT_RECORD
+};
+
+/*
+ * A memory plane of a buffer; NV12M frames have their CbCr plane in a second
+ * one.
+ */
+struct virt_plane {
+	unsigned long  userptr;     /* USERPTR: memory given when queueing */
+	int            dmabuf_fd;   /* DMABUF: dma-buf given when queueing */
+	unsigned int   length;      /* Length given when queueing */
+
+	/*
+	 * Mapping of the dma-buf, to fill it.
+	 */
+	void          *dmabuf_map;
+	int            dmabuf_map_fd;
+	size_t         dmabuf_map_len;
+};
+
+struct virt_buffer {
+	char           is_queued;
+	struct virt_plane planes[VIRT_MAX_PLANES];
+
+	/*
+	 * Paced sources: first frame the buffer can be filled with (frames due
+	 * before it was queued are not) and the frame it was filled with.
+	 */
+	uint64_t       queued_at;
+	uint64_t       sequence;
+
+	/*
+	 * Pattern sources fill each buffer only once. This identifies the
+	 * memory that has been filled.
+	 */
+	const void    *filled;
+};
+
+struct virt_source {
+	enum virt_source_type type;
+	char            name[64];
+	int             fd;          /* Pollable fd: epoll fd when paced, eventfd otherwise */
+	unsigned int    fps;         /* 0: as fast as possible */
+
+	/*
+	 * Paced sources: the timer expires once per frame and 'done_fd' is
+	 * readable while filled buffers are waiting to be dequeued; 'fd'
+	 * watches both.
+	 */
+	int             timer_fd;
+	int             done_fd;
+	struct timespec start;       /* When streaming was started */
+
+	/*
+	 * Current format. It can't be changed when the format was given in
+	 * the device path.
+	 */
+	char            is_format_fixed;
+	struct v4l2_pix_format pix;
+
+	/* File replay */
+	unsigned char  *file_data;
+	size_t          file_size;
+
+	/*
+	 * MJPEG replay: the frames are found when streaming starts as they
+	 * vary in size.
+	 */
+	size_t         *jpeg_offsets;
+	size_t         *jpeg_sizes;
+	size_t          n_jpeg_frames;
+
+	/* Recording replay: the index is read from the mapping of the file */
+	struct helper_record_header record;
+	const struct helper_record_entry *record_index;
+
+	pthread_mutex_t lock;
+	enum v4l2_buf_type buf_type; /* Single or multi-planar API, set with the buffers */
+	enum v4l2_memory memory;
+	struct virt_buffer buffers[VIRT_MAX_BUFFERS];
+	unsigned int    n_buffers;
+	size_t          buffer_size; /* Sum of the page aligned sizes of the memory planes */
+	unsigned char  *mmap_mem;    /* Memory of the MMAP buffers */
+
+	unsigned int    queue[VIRT_MAX_BUFFERS]; /* FIFO of queued buffers */
+	unsigned int    queue_head, queue_len;
+	unsigned int    done[VIRT_MAX_BUFFERS];  /* Paced: FIFO of filled buffers */
+	unsigned int    done_head, done_len;
+
+	int             ctrl_values[VIRT_N_CTRLS];
+
+	char            is_streaming;
+	uint64_t        frame_count;     /* Frames due since streaming started */
+	uint64_t        delivered_count; /* frame_count at the last delivered frame */
+};
+
+/**
+ * Start of static (internal) helper functions
+ */
+static int fail(int err)
+{
+	errno = err;
+	return -1;
+}
+
+/*
+ * Fills in the line and image sizes for the formats that can be generated
+ * (or replayed). Returns ERR for unknown formats.
+ */
+static int fill_pix_format(struct v4l2_pix_format *pix)
+{
+	switch (pix->pixelformat) {
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_Y16:
+			pix->bytesperline = pix->width * 2;
+			pix->sizeimage = pix->bytesperline * pix->height;
+			break;
+
+		case V4L2_PIX_FMT_GREY:
+			pix->bytesperline = pix->width;
+			pix->sizeimage = pix->bytesperline * pix->height;
+			break;
+
+		case V4L2_PIX_FMT_RGB24:
+			pix->bytesperline = pix->width * 3;
+			pix->sizeimage = pix->bytesperline * pix->height;
+			break;
+
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV12M:
+			pix->bytesperline = pix->width;
+			pix->sizeimage = pix->bytesperline * pix->height * 3 / 2;
+			break;
+
+		case V4L2_PIX_FMT_MJPEG:
+			/* Upper bound of the size of a compressed frame, as drivers do */
+			pix->bytesperline = 0;
+			pix->sizeimage = pix->width * pix->height * 2;
+			break;
+
+		default:
+			return ERR;
+	}
+
+	pix->field = V4L2_FIELD_NONE;
+	pix->colorspace = V4L2_COLORSPACE_SMPTE170M;
+	return 0;
+}
+
+/*
+ * Memory planes of the current format: NV12M has its CbCr plane in a buffer
+ * of its own, which requires the multi-planar API.
+ */
+static unsigned int mem_planes(const struct v4l2_pix_format *pix)
+{
+	return (pix->pixelformat == V4L2_PIX_FMT_NV12M) ? 2 : 1;
+}
+
+static unsigned int plane_size(const struct v4l2_pix_format *pix, unsigned int plane)
+{
+	unsigned int luma = pix->bytesperline * pix->height;
+
+	if (mem_planes(pix) == 1)
+		return pix->sizeimage;
+
+	return (plane == 0) ? luma : pix->sizeimage - luma;
+}
+
+/*
+ * Offset of a memory plane in the MMAP memory of a buffer
+ */
+static size_t plane_offset(const struct virt_source *src, unsigned int plane)
+{
+	size_t page_size = getpagesize();
+
+	if (plane == 0)
+		return 0;
+
+	return ((plane_size(&src->pix, 0) + page_size - 1) / page_size) * page_size;
+}
+
+/*
+ * The CbCr plane of NV12(M) frames: after the luma plane or in the second
+ * memory plane ('second').
+ */
+static unsigned char *chroma_plane(const struct virt_source *src, unsigned char *luma, unsigned char *second)
+{
+	if (mem_planes(&src->pix) > 1)
+		return second;
+
+	return luma + (size_t) src->pix.bytesperline * src->pix.height;
+}
+
+static int parse_format_name(const char *name, size_t len, unsigned int *format)
+{
+	static const struct {
+		const char *name;
+		unsigned int format;
+	} names[] = {
+		{ "uyvy", V4L2_PIX_FMT_UYVY },
+		{ "yuyv", V4L2_PIX_FMT_YUYV },
+		{ "grey", V4L2_PIX_FMT_GREY },
+		{ "y16", V4L2_PIX_FMT_Y16 },
+		{ "rgb24", V4L2_PIX_FMT_RGB24 },
+		{ "nv12", V4L2_PIX_FMT_NV12 },
+		{ "nv12m", V4L2_PIX_FMT_NV12M },
+		{ "mjpeg", V4L2_PIX_FMT_MJPEG }
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strlen(names[i].name) == len && strncasecmp(names[i].name, name, len) == 0) {
+			*format = names[i].format;
+			return 0;
+		}
+	}
+
+	return ERR;
+}
+
+/*
+ * Splits an optional "@<fps>" suffix from 'spec'. Returns the length of the
+ * part before the suffix.
+ */
+static size_t parse_fps_suffix(const char *spec, unsigned int *fps)
+{
+	const char *at = strrchr(spec, '@');
+	const char *c;
+
+	*fps = 0;
+	if (!at || at[1] == '\0')
+		return strlen(spec);
+
+	for (c = at + 1; *c; c++)
+		if (!isdigit((unsigned char) *c))
+			return strlen(spec);
+
+	*fps = (unsigned int) strtoul(at + 1, NULL, 10);
+	return at - spec;
+}
+
+static int parse_pattern(struct virt_source *src, const char *spec)
+{
+	size_t len = parse_fps_suffix(spec, &src->fps);
+	const char *fmt_name, *size;
+	unsigned int width, height;
+	char dims[32];
+
+	/* "pattern" alone: format and resolution from initialisation */
+	if (len == 0)
+		return 0;
+
+	if (spec[0] != ':')
+		return ERR;
+
+	fmt_name = spec + 1;
+	size = memchr(fmt_name, ':', len - 1);
+	if (!size || (size_t) (spec + len - size) >= sizeof(dims))
+		return ERR;
+
+	memcpy(dims, size + 1, spec + len - size - 1);
+	dims[spec + len - size - 1] = '\0';
+
+	if (
+		parse_format_name(fmt_name, size - fmt_name, &src->pix.pixelformat) < 0 ||
+		src->pix.pixelformat == V4L2_PIX_FMT_MJPEG ||
+		sscanf(dims, "%ux%u", &width, &height) != 2 ||
+		width == 0 || height == 0 || (width % 2) || (height % 2)
+	)
+	{
+		return ERR;
+	}
+
+	src->pix.width = width;
+	src->pix.height = height;
+	src->is_format_fixed = 1;
+	return fill_pix_format(&src->pix);
+}
+
+static int open_file(struct virt_source *src, const char *spec)
+{
+	size_t len = parse_fps_suffix(spec, &src->fps);
+	char *path = strndup(spec, len);
+	struct stat st;
+	int file_fd;
+
+	if (!path)
+		return ERR;
+
+	file_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (-1 == file_fd || -1 == fstat(file_fd, &st) || st.st_size == 0) {
+		fprintf(stderr, "Cannot open '%s' for replay: %d, %s\n",
+				path, errno, strerror(errno));
+		if (file_fd != -1)
+			close(file_fd);
+		free(path);
+		return ERR;
+	}
+	free(path);
+
+	/*
+	 * A private mapping is used so that the frames can be read straight
+	 * from the page cache.
+	 */
+	src->file_size = st.st_size;
+	src->file_data = mmap(NULL, src->file_size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+	close(file_fd);
+
+	if (MAP_FAILED == src->file_data) {
+		fprintf(stderr, "Error occurred when mapping replay file\n");
+		src->file_data = NULL;
+		return ERR;
+	}
+
+	madvise(src->file_data, src->file_size, MADV_SEQUENTIAL);
+	return 0;
+}
+
+/*
+ * Checks the header and the index of a recording (see v4l2_helper_record.h)
+ * and takes the format from it.
+ */
+static int open_record(struct virt_source *src, const char *spec)
+{
+	struct helper_record_header *hdr = &src->record;
+	uint64_t n, end;
+	unsigned int p;
+	unsigned int sizeimage;
+
+	if (open_file(src, spec) < 0)
+		return ERR;
+
+	if (src->file_size < sizeof(*hdr)) {
+		fprintf(stderr, "Replay file is not a recording\n");
+		return ERR;
+	}
+	memcpy(hdr, src->file_data, sizeof(*hdr));
+
+	if (memcmp(hdr->magic, HELPER_RECORD_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != HELPER_RECORD_VERSION) {
+		fprintf(stderr, "Replay file is not a recording (or of an unknown version)\n");
+		return ERR;
+	}
+
+	/* A recording that wasn't closed has no index */
+	if (
+		hdr->n_frames == 0 || hdr->alignment == 0 || hdr->index_offset % sizeof(uint64_t) ||
+		hdr->index_offset > src->file_size ||
+		hdr->n_frames > (src->file_size - hdr->index_offset) / sizeof(struct helper_record_entry)
+	)
+	{
+		fprintf(stderr, "Recording has no frame or no index\n");
+		return ERR;
+	}
+	src->record_index = (const struct helper_record_entry *) (src->file_data + hdr->index_offset);
+
+	src->pix.width = hdr->width;
+	src->pix.height = hdr->height;
+	src->pix.pixelformat = hdr->pixelformat;
+	if (
+		hdr->width == 0 || hdr->height == 0 || fill_pix_format(&src->pix) < 0 ||
+		hdr->n_mem_planes != mem_planes(&src->pix) || hdr->n_mem_planes > HELPER_MAX_PLANES
+	)
+	{
+		fprintf(stderr, "Recording format can't be replayed\n");
+		return ERR;
+	}
+
+	/*
+	 * The line and image sizes are those given by the driver when
+	 * recording. Compressed frames only need to fit in the buffers.
+	 */
+	if (hdr->pixelformat == V4L2_PIX_FMT_MJPEG) {
+		if (hdr->sizeimage > src->pix.sizeimage)
+			src->pix.sizeimage = hdr->sizeimage;
+	} else if (hdr->bytesperline >= src->pix.bytesperline && hdr->sizeimage >= src->pix.sizeimage) {
+		src->pix.bytesperline = hdr->bytesperline;
+		src->pix.sizeimage = hdr->sizeimage;
+	}
+	src->is_format_fixed = 1;
+
+	for (n = 0; n < hdr->n_frames; n++) {
+		const struct helper_record_entry *entry = &src->record_index[n];
+
+		end = entry->offset;
+		sizeimage = 0;
+		for (p = 0; p < hdr->n_mem_planes; p++) {
+			end += ((entry->bytesused[p] + hdr->alignment - 1) / hdr->alignment) * hdr->alignment;
+			sizeimage += entry->bytesused[p];
+		}
+		if (end > hdr->index_offset || sizeimage > src->pix.sizeimage) {
+			fprintf(stderr, "Recording index is corrupt (frame %llu)\n", (unsigned long long) n);
+			return ERR;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Color bars: white, yellow, cyan, green, magenta, red, blue, black
+ */
+static const unsigned char bars_yuv[8][3] = {
+	{ 235, 128, 128 }, { 210,  16, 146 }, { 170, 166,  16 }, { 145,  54,  34 },
+	{ 106, 202, 222 }, {  81,  90, 240 }, {  41, 240, 110 }, {  16, 128, 128 }
+};
+static const unsigned char bars_rgb[8][3] = {
+	{ 255, 255, 255 }, { 255, 255,   0 }, {   0, 255, 255 }, {   0, 255,   0 },
+	{ 255,   0, 255 }, { 255,   0,   0 }, {   0,   0, 255 }, {   0,   0,   0 }
+};
+
+/*
+ * Renders color bars, shifted right by 'shift' pixels, into 'dst'. The CbCr
+ * plane of NV12(M) goes to 'chroma'.
+ */
+static void render_pattern(const struct v4l2_pix_format *pix, unsigned char *dst, unsigned char *chroma, unsigned int shift)
+{
+	unsigned int x, y;
+
+	for (y = 0; y < pix->height; y++) {
+		unsigned char *row = dst + (size_t) y * pix->bytesperline;
+
+		for (x = 0; x < pix->width; x += 2) {
+			unsigned int bar = (unsigned int) ((((uint64_t) x + shift) % pix->width) * 8 / pix->width);
+			const unsigned char *yuv = bars_yuv[bar];
+			const unsigned char *rgb = bars_rgb[bar];
+
+			switch (pix->pixelformat) {
+				case V4L2_PIX_FMT_UYVY:
+					row[x * 2 + 0] = yuv[1];
+					row[x * 2 + 1] = yuv[0];
+					row[x * 2 + 2] = yuv[2];
+					row[x * 2 + 3] = yuv[0];
+					break;
+
+				case V4L2_PIX_FMT_YUYV:
+					row[x * 2 + 0] = yuv[0];
+					row[x * 2 + 1] = yuv[1];
+					row[x * 2 + 2] = yuv[0];
+					row[x * 2 + 3] = yuv[2];
+					break;
+
+				case V4L2_PIX_FMT_GREY:
+				case V4L2_PIX_FMT_NV12:
+				case V4L2_PIX_FMT_NV12M:
+					row[x] = row[x + 1] = yuv[0];
+					break;
+
+				case V4L2_PIX_FMT_Y16:
+					/* Little endian, 8 significant bits */
+					row[x * 2 + 0] = row[x * 2 + 2] = 0;
+					row[x * 2 + 1] = row[x * 2 + 3] = yuv[0];
+					break;
+
+				case V4L2_PIX_FMT_RGB24:
+					memcpy(&row[x * 3], rgb, 3);
+					memcpy(&row[x * 3 + 3], rgb, 3);
+					break;
+			}
+		}
+	}
+
+	if (pix->pixelformat == V4L2_PIX_FMT_NV12 || pix->pixelformat == V4L2_PIX_FMT_NV12M) {
+		for (y = 0; y < pix->height / 2; y++) {
+			unsigned char *row = chroma + (size_t) y * pix->bytesperline;
+
+			for (x = 0; x < pix->width; x += 2) {
+				unsigned int bar = (unsigned int) ((((uint64_t) x + shift) % pix->width) * 8 / pix->width);
+
+				row[x] = bars_yuv[bar][1];
+				row[x + 1] = bars_yuv[bar][2];
+			}
+		}
+	}
+}
+
+static void free_buffers(struct virt_source *src)
+{
+	unsigned int i, p;
+
+	for (i = 0; i < src->n_buffers; i++) {
+		for (p = 0; p < VIRT_MAX_PLANES; p++) {
+			struct virt_plane *plane = &src->buffers[i].planes[p];
+
+			if (plane->dmabuf_map)
+				munmap(plane->dmabuf_map, plane->dmabuf_map_len);
+		}
+	}
+
+	free(src->mmap_mem);
+	src->mmap_mem = NULL;
+	memset(src->buffers, 0, sizeof(src->buffers));
+	src->n_buffers = 0;
+	src->queue_head = src->queue_len = 0;
+}
+
+static int request_buffers(struct virt_source *src, struct v4l2_requestbuffers *req)
+{
+	size_t page_size = getpagesize();
+	unsigned int i, p;
+
+	if (
+		(req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE && req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ||
+		(req->type == V4L2_BUF_TYPE_VIDEO_CAPTURE && mem_planes(&src->pix) > 1)
+	)
+	{
+		return fail(EINVAL);
+	}
+
+	if (
+		req->memory != V4L2_MEMORY_MMAP &&
+		req->memory != V4L2_MEMORY_USERPTR &&
+		req->memory != V4L2_MEMORY_DMABUF
+	)
+	{
+		return fail(EINVAL);
+	}
+
+	if (src->is_streaming)
+		return fail(EBUSY);
+
+	free_buffers(src);
+	if (req->count == 0)
+		return 0;
+
+	if (req->count > VIRT_MAX_BUFFERS)
+		req->count = VIRT_MAX_BUFFERS;
+
+	src->buf_type = req->type;
+	src->memory = req->memory;
+	src->buffer_size = 0;
+	for (p = 0; p < mem_planes(&src->pix); p++)
+		src->buffer_size += ((plane_size(&src->pix, p) + page_size - 1) / page_size) * page_size;
+
+	if (src->memory == V4L2_MEMORY_MMAP) {
+		if (posix_memalign((void **) &src->mmap_mem, page_size, src->buffer_size * req->count) != 0) {
+			src->mmap_mem = NULL;
+			return fail(ENOMEM);
+		}
+
+		/*
+		 * Pattern sources render each buffer once, at a different
+		 * offset, so that motion is visible as the buffers cycle.
+		 */
+		if (src->type == VIRT_PATTERN) {
+			for (i = 0; i < req->count; i++) {
+				unsigned char *mem = src->mmap_mem + i * src->buffer_size;
+
+				render_pattern(&src->pix, mem, chroma_plane(src, mem, mem + plane_offset(src, 1)),
+						i * src->pix.width / req->count);
+				src->buffers[i].filled = src->mmap_mem + i * src->buffer_size;
+			}
+		}
+	}
+
+	src->n_buffers = req->count;
+	return 0;
+}
+
+/*
+ * Describes 'pix' in 'fmt', for the API of 'fmt->type'.
+ */
+static void set_format(struct v4l2_format *fmt, const struct v4l2_pix_format *pix)
+{
+	struct v4l2_pix_format_mplane *pix_mp = &fmt->fmt.pix_mp;
+	unsigned int p;
+
+	if (fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+		fmt->fmt.pix = *pix;
+		return;
+	}
+
+	memset(pix_mp, 0, sizeof(*pix_mp));
+	pix_mp->width = pix->width;
+	pix_mp->height = pix->height;
+	pix_mp->pixelformat = pix->pixelformat;
+	pix_mp->field = pix->field;
+	pix_mp->colorspace = pix->colorspace;
+	pix_mp->num_planes = mem_planes(pix);
+	for (p = 0; p < pix_mp->num_planes; p++) {
+		pix_mp->plane_fmt[p].bytesperline = pix->bytesperline;
+		pix_mp->plane_fmt[p].sizeimage = plane_size(pix, p);
+	}
+}
+
+/*
+ * Checks that 'buf' is of the type of the buffers and, with the multi-planar
+ * API, has room for their planes.
+ */
+static int check_buffer_type(struct virt_source *src, const struct v4l2_buffer *buf)
+{
+	if (buf->type != src->buf_type)
+		return ERR;
+
+	if (
+		src->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE &&
+		(!buf->m.planes || buf->length < mem_planes(&src->pix))
+	)
+	{
+		return ERR;
+	}
+
+	return 0;
+}
+
+static int query_buffer(struct virt_source *src, struct v4l2_buffer *buf)
+{
+	unsigned int p;
+
+	if (
+		buf->index >= src->n_buffers || src->memory != V4L2_MEMORY_MMAP ||
+		check_buffer_type(src, buf) < 0
+	)
+	{
+		return fail(EINVAL);
+	}
+
+	buf->memory = V4L2_MEMORY_MMAP;
+	if (src->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		buf->length = mem_planes(&src->pix);
+		for (p = 0; p < mem_planes(&src->pix); p++) {
+			buf->m.planes[p].length = plane_size(&src->pix, p);
+			buf->m.planes[p].m.mem_offset = buf->index * src->buffer_size + plane_offset(src, p);
+		}
+	} else {
+		buf->length = src->buffer_size;
+		buf->m.offset = buf->index * src->buffer_size;
+	}
+	buf->flags = (src->buffers[buf->index].is_queued) ? V4L2_BUF_FLAG_QUEUED : 0;
+	return 0;
+}
+
+/*
+ * Paced: time at which frame 'sequence' was due (the end of its exposure).
+ */
+static struct timespec frame_time(const struct virt_source *src, uint64_t sequence)
+{
+	uint64_t ns = (sequence + 1) * (1000000000ULL / src->fps);
+	struct timespec ts;
+
+	ts.tv_sec = src->start.tv_sec + (time_t) (ns / 1000000000ULL);
+	ts.tv_nsec = src->start.tv_nsec + (long) (ns % 1000000000ULL);
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return ts;
+}
+
+static void drain_done_fd(struct virt_source *src)
+{
+	uint64_t count;
+
+	while (read(src->done_fd, &count, sizeof(count)) == sizeof(count))
+		;
+}
+
+/*
+ * Paced: fills the queued buffers with the frames that became due since the
+ * last call, in order, like a driver does at the end of each frame. A frame
+ * due while no buffer (queued before it) is available is dropped, which
+ * shows up as a gap in the sequence numbers.
+ */
+static void fill_due_buffers(struct virt_source *src)
+{
+	uint64_t count, k;
+	unsigned int was_empty = (src->done_len == 0);
+
+	if (read(src->timer_fd, &count, sizeof(count)) == sizeof(count))
+		src->frame_count += count;
+
+	for (k = src->delivered_count; k < src->frame_count && src->queue_len; k++) {
+		unsigned int index = src->queue[src->queue_head];
+
+		if (src->buffers[index].queued_at > k)
+			continue;
+
+		src->queue_head = (src->queue_head + 1) % VIRT_MAX_BUFFERS;
+		src->queue_len--;
+		src->buffers[index].sequence = k;
+		src->done[(src->done_head + src->done_len) % VIRT_MAX_BUFFERS] = index;
+		src->done_len++;
+	}
+	src->delivered_count = src->frame_count;
+
+	if (was_empty && src->done_len) {
+		count = 1;
+		if (write(src->done_fd, &count, sizeof(count)) != sizeof(count)) {
+			/* Errors ignored; the counter can't overflow in practice */
+		}
+	}
+}
+
+static void signal_frame_available(struct virt_source *src, uint64_t count)
+{
+	if (src->fps == 0 && count > 0) {
+		if (write(src->fd, &count, sizeof(count)) != sizeof(count)) {
+			/* Errors ignored; the counter can't overflow in practice */
+		}
+	}
+}
+
+static int queue_buffer(struct virt_source *src, struct v4l2_buffer *buf)
+{
+	struct virt_buffer *vbuf;
+	unsigned int p;
+
+	if (
+		buf->index >= src->n_buffers || buf->memory != src->memory ||
+		check_buffer_type(src, buf) < 0
+	)
+	{
+		return fail(EINVAL);
+	}
+
+	vbuf = &src->buffers[buf->index];
+	if (vbuf->is_queued)
+		return fail(EINVAL);
+
+	for (p = 0; p < mem_planes(&src->pix); p++) {
+		struct virt_plane *plane = &vbuf->planes[p];
+		unsigned long userptr;
+		unsigned int length;
+		int fd;
+
+		if (src->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+			userptr = buf->m.planes[p].m.userptr;
+			fd = buf->m.planes[p].m.fd;
+			length = buf->m.planes[p].length;
+		} else {
+			userptr = buf->m.userptr;
+			fd = buf->m.fd;
+			length = buf->length;
+		}
+
+		if (src->memory == V4L2_MEMORY_USERPTR) {
+			if (length < plane_size(&src->pix, p) || !userptr)
+				return fail(EINVAL);
+			plane->userptr = userptr;
+			plane->length = length;
+		} else if (src->memory == V4L2_MEMORY_DMABUF) {
+			plane->dmabuf_fd = fd;
+			plane->length = length;
+		}
+	}
+
+	/*
+	 * The frames that were due before the buffer was queued went to the
+	 * buffers queued before it (or were dropped).
+	 */
+	if (src->is_streaming && src->fps) {
+		fill_due_buffers(src);
+		vbuf->queued_at = src->frame_count;
+	} else {
+		vbuf->queued_at = 0;
+	}
+
+	vbuf->is_queued = 1;
+	src->queue[(src->queue_head + src->queue_len) % VIRT_MAX_BUFFERS] = buf->index;
+	src->queue_len++;
+
+	if (src->is_streaming)
+		signal_frame_available(src, 1);
+
+	return 0;
+}
+
+/*
+ * Returns the memory of a plane of a dequeued buffer, mapping the dma-buf if
+ * needed.
+ */
+static unsigned char *buffer_memory(struct virt_source *src, unsigned int index, unsigned int p)
+{
+	struct virt_plane *plane = &src->buffers[index].planes[p];
+
+	switch (src->memory) {
+		case V4L2_MEMORY_MMAP:
+			return src->mmap_mem + index * src->buffer_size + plane_offset(src, p);
+
+		case V4L2_MEMORY_USERPTR:
+			return (unsigned char *) plane->userptr;
+
+		case V4L2_MEMORY_DMABUF:
+			if (plane->dmabuf_map && plane->dmabuf_map_fd != plane->dmabuf_fd) {
+				munmap(plane->dmabuf_map, plane->dmabuf_map_len);
+				plane->dmabuf_map = NULL;
+			}
+			if (!plane->dmabuf_map) {
+				plane->dmabuf_map_len = plane_size(&src->pix, p);
+				plane->dmabuf_map = mmap(NULL, plane->dmabuf_map_len, PROT_READ | PROT_WRITE,
+						MAP_SHARED, plane->dmabuf_fd, 0);
+				if (MAP_FAILED == plane->dmabuf_map) {
+					plane->dmabuf_map = NULL;
+					return NULL;
+				}
+				plane->dmabuf_map_fd = plane->dmabuf_fd;
+			}
+			return (unsigned char *) plane->dmabuf_map;
+
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * As fast as possible: determines whether a frame is due (a buffer was
+ * queued). Returns the sequence number of the frame in 'sequence' or ERR if
+ * no frame is due.
+ */
+static int frame_due(struct virt_source *src, uint64_t *sequence)
+{
+	uint64_t count;
+
+	if (read(src->fd, &count, sizeof(count)) == sizeof(count))
+		src->frame_count++;
+
+	if (src->frame_count == src->delivered_count)
+		return ERR;
+
+	*sequence = src->frame_count - 1;
+	src->delivered_count = src->frame_count;
+	return 0;
+}
+
+static int dequeue_buffer(struct virt_source *src, struct v4l2_buffer *buf)
+{
+	struct virt_buffer *vbuf;
+	unsigned char *dst[VIRT_MAX_PLANES];
+	struct timespec ts;
+	uint64_t sequence;
+	unsigned int index, p, bytesused = src->pix.sizeimage, flags = 0;
+
+	if (!src->is_streaming || check_buffer_type(src, buf) < 0)
+		return fail(EINVAL);
+
+	if (src->fps) {
+		/*
+		 * Paced: the oldest filled buffer, time stamped when its frame
+		 * was due.
+		 */
+		fill_due_buffers(src);
+		if (src->done_len == 0)
+			return fail(EAGAIN);
+
+		index = src->done[src->done_head];
+		src->done_head = (src->done_head + 1) % VIRT_MAX_BUFFERS;
+		if (--src->done_len == 0)
+			drain_done_fd(src);
+
+		sequence = src->buffers[index].sequence;
+		ts = frame_time(src, sequence);
+	} else {
+		if (src->queue_len == 0 || frame_due(src, &sequence) < 0)
+			return fail(EAGAIN);
+
+		index = src->queue[src->queue_head];
+		src->queue_head = (src->queue_head + 1) % VIRT_MAX_BUFFERS;
+		src->queue_len--;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+	}
+
+	vbuf = &src->buffers[index];
+	vbuf->is_queued = 0;
+
+	for (p = 0; p < mem_planes(&src->pix); p++) {
+		dst[p] = buffer_memory(src, index, p);
+		if (!dst[p])
+			return fail(EIO);
+	}
+
+	/*
+	 * Emulate the DMA of the frame into the buffer. Replayed frames are
+	 * copied each time whereas the pattern is rendered only once per
+	 * buffer memory, so that it costs nothing while streaming.
+	 */
+	if (src->type == VIRT_FILE && src->pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
+		size_t frame = (size_t) (sequence % src->n_jpeg_frames);
+
+		/* A frame too large for the buffer is truncated, as a driver would */
+		bytesused = (src->jpeg_sizes[frame] < src->pix.sizeimage) ?
+				(unsigned int) src->jpeg_sizes[frame] : src->pix.sizeimage;
+		if (bytesused < src->jpeg_sizes[frame])
+			flags |= V4L2_BUF_FLAG_ERROR;
+		memcpy(dst[0], src->file_data + src->jpeg_offsets[frame], bytesused);
+	} else if (src->type == VIRT_RECORD) {
+		const struct helper_record_entry *entry = &src->record_index[sequence % src->record.n_frames];
+		const unsigned char *frame = src->file_data + entry->offset;
+		unsigned int alignment = src->record.alignment;
+
+		/* Each plane is padded to the alignment in the recording */
+		bytesused = 0;
+		for (p = 0; p < mem_planes(&src->pix); p++) {
+			unsigned int size = (entry->bytesused[p] < plane_size(&src->pix, p)) ?
+					entry->bytesused[p] : plane_size(&src->pix, p);
+
+			memcpy(dst[p], frame, size);
+			frame += ((size_t) (entry->bytesused[p] + alignment - 1) / alignment) * alignment;
+			bytesused += size;
+		}
+		flags |= entry->flags & V4L2_BUF_FLAG_ERROR;
+	} else if (src->type == VIRT_FILE) {
+		size_t n_frames = src->file_size / src->pix.sizeimage;
+		const unsigned char *frame = src->file_data + (size_t) (sequence % n_frames) * src->pix.sizeimage;
+
+		/* The planes are stored one after the other in the file */
+		for (p = 0; p < mem_planes(&src->pix); p++) {
+			memcpy(dst[p], frame, plane_size(&src->pix, p));
+			frame += plane_size(&src->pix, p);
+		}
+	} else if (vbuf->filled != dst[0]) {
+		render_pattern(&src->pix, dst[0], chroma_plane(src, dst[0], dst[mem_planes(&src->pix) - 1]),
+				index * src->pix.width / src->n_buffers);
+		vbuf->filled = dst[0];
+	}
+
+	buf->memory = src->memory;
+	buf->bytesused = bytesused;
+	buf->flags = V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_EOF | flags;
+	buf->field = V4L2_FIELD_NONE;
+	buf->timestamp.tv_sec = ts.tv_sec;
+	buf->timestamp.tv_usec = ts.tv_nsec / 1000;
+	buf->sequence = (unsigned int) sequence;
+	buf->index = index;
+
+	if (src->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		buf->bytesused = 0;
+		buf->length = mem_planes(&src->pix);
+		for (p = 0; p < mem_planes(&src->pix); p++) {
+			struct v4l2_plane *plane = &buf->m.planes[p];
+
+			memset(plane, 0, sizeof(*plane));
+			plane->bytesused = (mem_planes(&src->pix) > 1) ? plane_size(&src->pix, p) : bytesused;
+
+			switch (src->memory) {
+				case V4L2_MEMORY_MMAP:
+					plane->m.mem_offset = index * src->buffer_size + plane_offset(src, p);
+					plane->length = plane_size(&src->pix, p);
+					break;
+
+				case V4L2_MEMORY_USERPTR:
+					plane->m.userptr = vbuf->planes[p].userptr;
+					plane->length = vbuf->planes[p].length;
+					break;
+
+				case V4L2_MEMORY_DMABUF:
+					plane->m.fd = vbuf->planes[p].dmabuf_fd;
+					plane->length = vbuf->planes[p].length;
+					break;
+
+				default:
+					break;
+			}
+		}
+	} else {
+		switch (src->memory) {
+			case V4L2_MEMORY_MMAP:
+				buf->m.offset = index * src->buffer_size;
+				buf->length = src->buffer_size;
+				break;
+
+			case V4L2_MEMORY_USERPTR:
+				buf->m.userptr = vbuf->planes[0].userptr;
+				buf->length = vbuf->planes[0].length;
+				break;
+
+			case V4L2_MEMORY_DMABUF:
+				buf->m.fd = vbuf->planes[0].dmabuf_fd;
+				buf->length = vbuf->planes[0].length;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static void drain_fd(struct virt_source *src)
+{
+	uint64_t count;
+
+	if (src->fps) {
+		while (read(src->timer_fd, &count, sizeof(count)) == sizeof(count))
+			;
+		drain_done_fd(src);
+	} else {
+		while (read(src->fd, &count, sizeof(count)) == sizeof(count))
+			;
+	}
+}
+
+/*
+ * Returns the size of the JPEG image starting at 'data' (with its SOI
+ * marker), or 0 if it's truncated. The marker segments are skipped by their
+ * length and the entropy coded data is scanned for the next marker, so that
+ * the end of the image isn't mistaken for the one of an embedded thumbnail.
+ */
+static size_t jpeg_frame_size(const unsigned char *data, size_t size)
+{
+	size_t pos = 2;
+
+	while (pos + 4 <= size) {
+		unsigned char marker;
+
+		if (data[pos] != 0xFF)
+			return 0;
+
+		marker = data[pos + 1];
+		if (marker == 0xFF) {
+			/* Fill byte */
+			pos++;
+			continue;
+		}
+
+		if (marker == 0xD9)
+			return pos + 2;
+
+		pos += 2 + ((size_t) data[pos + 2] << 8 | data[pos + 3]);
+
+		if (marker == 0xDA) {
+			/*
+			 * Start of scan: skip the entropy coded data, in which
+			 * 0xFF is followed by 0x00 (stuffing) or a restart
+			 * marker.
+			 */
+			while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] != 0x00 &&
+					(data[pos + 1] < 0xD0 || data[pos + 1] > 0xD7)))
+				pos++;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the JPEG images stored back to back in the replay file (as in a
+ * .mjpeg clip). Returns ERR if there is none.
+ */
+static int index_jpeg_frames(struct virt_source *src)
+{
+	size_t pos = 0, size, capacity = 0;
+
+	if (src->n_jpeg_frames)
+		return 0;
+
+	while (pos + 2 <= src->file_size) {
+		if (src->file_data[pos] != 0xFF || src->file_data[pos + 1] != 0xD8) {
+			pos++;
+			continue;
+		}
+
+		size = jpeg_frame_size(src->file_data + pos, src->file_size - pos);
+		if (size == 0)
+			break;
+
+		if (src->n_jpeg_frames == capacity) {
+			size_t *offsets, *sizes;
+
+			capacity = (capacity) ? capacity * 2 : 64;
+			offsets = realloc(src->jpeg_offsets, capacity * sizeof(*offsets));
+			if (offsets)
+				src->jpeg_offsets = offsets;
+			sizes = realloc(src->jpeg_sizes, capacity * sizeof(*sizes));
+			if (sizes)
+				src->jpeg_sizes = sizes;
+			if (!offsets || !sizes)
+				return ERR;
+		}
+
+		src->jpeg_offsets[src->n_jpeg_frames] = pos;
+		src->jpeg_sizes[src->n_jpeg_frames] = size;
+		src->n_jpeg_frames++;
+		pos += size;
+	}
+
+	return (src->n_jpeg_frames) ? 0 : ERR;
+}
+
+static void close_paced_fds(struct virt_source *src)
+{
+	if (src->timer_fd != -1)
+		close(src->timer_fd);
+	if (src->done_fd != -1)
+		close(src->done_fd);
+	src->timer_fd = src->done_fd = -1;
+}
+
+/*
+ * Creates the timer and the filled buffer notification of a paced source.
+ * Returns an epoll fd watching both or -1 in case of failure.
+ */
+static int open_paced_fds(struct virt_source *src)
+{
+	struct epoll_event ev;
+	int fd;
+
+	src->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	src->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fd = epoll_create1(EPOLL_CLOEXEC);
+	if (-1 == src->timer_fd || -1 == src->done_fd || -1 == fd) {
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	/*
+	 * Filling the buffers is deferred until they are dequeued, so an
+	 * expired timer means a buffer may be ready too.
+	 */
+	CLEAR(ev);
+	ev.events = EPOLLIN;
+	if (
+		-1 == epoll_ctl(fd, EPOLL_CTL_ADD, src->timer_fd, &ev) ||
+		-1 == epoll_ctl(fd, EPOLL_CTL_ADD, src->done_fd, &ev)
+	) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int stream_on(struct virt_source *src)
+{
+	struct itimerspec its;
+
+	if (src->is_streaming)
+		return 0;
+
+	if (src->n_buffers == 0)
+		return fail(EINVAL);
+
+	if (src->type == VIRT_FILE && src->pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
+		if (index_jpeg_frames(src) < 0) {
+			fprintf(stderr, "Replay file contains no JPEG frame\n");
+			return fail(EINVAL);
+		}
+	} else if (src->type == VIRT_FILE && src->file_size < src->pix.sizeimage) {
+		fprintf(stderr, "Replay file is smaller than a single frame\n");
+		return fail(EINVAL);
+	}
+
+	src->frame_count = src->delivered_count = 0;
+	src->is_streaming = 1;
+
+	if (src->fps) {
+		CLEAR(its);
+		its.it_interval.tv_sec = (src->fps == 1) ? 1 : 0;
+		its.it_interval.tv_nsec = (src->fps == 1) ? 0 : 1000000000L / src->fps;
+		its.it_value = its.it_interval;
+		clock_gettime(CLOCK_MONOTONIC, &src->start);
+		if (-1 == timerfd_settime(src->timer_fd, 0, &its, NULL))
+			return -1;
+	} else {
+		signal_frame_available(src, src->queue_len);
+	}
+
+	return 0;
+}
+
+static int stream_off(struct virt_source *src)
+{
+	struct itimerspec its;
+	unsigned int i;
+
+	if (src->fps) {
+		CLEAR(its);
+		timerfd_settime(src->timer_fd, 0, &its, NULL);
+	}
+	drain_fd(src);
+
+	/* All the buffers are returned to the application */
+	for (i = 0; i < src->n_buffers; i++)
+		src->buffers[i].is_queued = 0;
+	src->queue_head = src->queue_len = 0;
+	src->done_head = src->done_len = 0;
+	src->is_streaming = 0;
+	return 0;
+}
+
+/*
+ * Finds the control 'id' or, with V4L2_CTRL_FLAG_NEXT_CTRL, the first one
+ * after it. Returns VIRT_N_CTRLS if there is none.
+ */
+static unsigned int find_ctrl(unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < VIRT_N_CTRLS; i++) {
+		if (
+			((id & V4L2_CTRL_FLAG_NEXT_CTRL) && virt_ctrls[i].id > (id & ~V4L2_CTRL_FLAG_NEXT_CTRL)) ||
+			virt_ctrls[i].id == id
+		)
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+static int clamp_ctrl(const struct virt_ctrl *ctrl, long long value)
+{
+	if (value < ctrl->minimum)
+		value = ctrl->minimum;
+	if (value > ctrl->maximum)
+		value = ctrl->maximum;
+
+	return ctrl->minimum + (int) ((value - ctrl->minimum) / ctrl->step) * ctrl->step;
+}
+
+static int query_ext_ctrl(struct v4l2_query_ext_ctrl *qc)
+{
+	unsigned int i = find_ctrl(qc->id & ~V4L2_CTRL_FLAG_NEXT_COMPOUND);
+
+	if (i == VIRT_N_CTRLS)
+		return fail(EINVAL);
+
+	CLEAR(*qc);
+	qc->id = virt_ctrls[i].id;
+	qc->type = (virt_ctrls[i].maximum == 1) ? V4L2_CTRL_TYPE_BOOLEAN : V4L2_CTRL_TYPE_INTEGER;
+	snprintf(qc->name, sizeof(qc->name), "%s", virt_ctrls[i].name);
+	qc->minimum = virt_ctrls[i].minimum;
+	qc->maximum = virt_ctrls[i].maximum;
+	qc->step = virt_ctrls[i].step;
+	qc->default_value = virt_ctrls[i].default_value;
+	qc->elems = 1;
+	qc->elem_size = sizeof(int);
+	qc->nr_of_dims = 0;
+	return 0;
+}
+
+/*
+ * Returns the 'index'th format that can be set with the buffer type 'type',
+ * or 0 if there is none.
+ */
+static unsigned int nth_format(struct virt_source *src, unsigned int type, unsigned int index)
+{
+	unsigned int i;
+
+	if (src->is_format_fixed)
+		return (index == 0) ? src->pix.pixelformat : 0;
+
+	for (i = 0; i < VIRT_N_FORMATS; i++) {
+		if (
+			(virt_formats[i] == V4L2_PIX_FMT_NV12M && type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ||
+			(virt_formats[i] == V4L2_PIX_FMT_MJPEG && src->type != VIRT_FILE)
+		)
+		{
+			continue;
+		}
+		if (index-- == 0)
+			return virt_formats[i];
+	}
+
+	return 0;
+}
+
+static int has_format(struct virt_source *src, unsigned int format)
+{
+	unsigned int i, f;
+
+	for (i = 0; (f = nth_format(src, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, i)) != 0; i++)
+		if (f == format)
+			return 1;
+
+	return 0;
+}
+
+static int enum_format(struct virt_source *src, struct v4l2_fmtdesc *desc)
+{
+	unsigned int format = nth_format(src, desc->type, desc->index);
+	unsigned int i;
+
+	if (
+		(desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE && desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ||
+		format == 0
+	)
+	{
+		return fail(EINVAL);
+	}
+
+	memset(desc->description, 0, sizeof(desc->description));
+	desc->pixelformat = format;
+	desc->flags = (format == V4L2_PIX_FMT_MJPEG) ? V4L2_FMT_FLAG_COMPRESSED : 0;
+	for (i = 0; i < 4; i++)
+		desc->description[i] = (format >> (8 * i)) & 0xff;
+	return 0;
+}
+
+static int enum_frame_sizes(struct virt_source *src, struct v4l2_frmsizeenum *size)
+{
+	if (size->index != 0 || !has_format(src, size->pixel_format))
+		return fail(EINVAL);
+
+	if (src->is_format_fixed) {
+		size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+		size->discrete.width = src->pix.width;
+		size->discrete.height = src->pix.height;
+	} else {
+		size->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+		size->stepwise.min_width = size->stepwise.min_height = 2;
+		size->stepwise.max_width = size->stepwise.max_height = VIRT_MAX_SIZE;
+		size->stepwise.step_width = size->stepwise.step_height = 2;
+	}
+	return 0;
+}
+
+/*
+ * Only paced sources have a frame interval, which can be set to any whole
+ * number of frames per second.
+ */
+static int enum_frame_intervals(struct virt_source *src, struct v4l2_frmivalenum *ival)
+{
+	if (ival->index != 0 || src->fps == 0 || !has_format(src, ival->pixel_format))
+		return fail(EINVAL);
+
+	ival->type = V4L2_FRMIVAL_TYPE_CONTINUOUS;
+	ival->stepwise.min.numerator = 1;
+	ival->stepwise.min.denominator = VIRT_MAX_FPS;
+	ival->stepwise.max.numerator = 1;
+	ival->stepwise.max.denominator = 1;
+	ival->stepwise.step.numerator = 1;
+	ival->stepwise.step.denominator = 1;
+	return 0;
+}
+
+static int stream_parm(struct virt_source *src, unsigned long request, struct v4l2_streamparm *parm)
+{
+	struct v4l2_captureparm *capture = &parm->parm.capture;
+
+	if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE && parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		return fail(EINVAL);
+
+	if (request == VIDIOC_S_PARM && src->fps && capture->timeperframe.numerator && capture->timeperframe.denominator) {
+		uint64_t fps = ((uint64_t) capture->timeperframe.denominator + capture->timeperframe.numerator / 2) /
+			capture->timeperframe.numerator;
+
+		if (src->is_streaming)
+			return fail(EBUSY);
+		src->fps = (fps < 1) ? 1 : (fps > VIRT_MAX_FPS) ? VIRT_MAX_FPS : (unsigned int) fps;
+	}
+
+	CLEAR(*capture);
+	if (src->fps) {
+		capture->capability = V4L2_CAP_TIMEPERFRAME;
+		capture->timeperframe.numerator = 1;
+		capture->timeperframe.denominator = src->fps;
+	}
+	return 0;
+}
+
+/*
+ * VIDIOC_G/S/TRY_EXT_CTRLS. Like with a driver, either all the controls are
+ * set or none is, 'error_idx' pointing to the faulty one.
+ */
+static int ext_ctrls(struct virt_source *src, unsigned long request, struct v4l2_ext_controls *ctrls)
+{
+	unsigned int n, i;
+
+	if (ctrls->which == V4L2_CTRL_WHICH_REQUEST_VAL)
+		return fail(EACCES);
+
+	for (n = 0; n < ctrls->count; n++) {
+		if (find_ctrl(ctrls->controls[n].id) == VIRT_N_CTRLS) {
+			ctrls->error_idx = (request == VIDIOC_S_EXT_CTRLS) ? ctrls->count : n;
+			return fail(EINVAL);
+		}
+	}
+
+	for (n = 0; n < ctrls->count; n++) {
+		struct v4l2_ext_control *ctrl = &ctrls->controls[n];
+
+		i = find_ctrl(ctrl->id);
+		if (request == VIDIOC_G_EXT_CTRLS) {
+			ctrl->value = (ctrls->which == V4L2_CTRL_WHICH_DEF_VAL) ?
+				virt_ctrls[i].default_value : src->ctrl_values[i];
+		} else {
+			ctrl->value = clamp_ctrl(&virt_ctrls[i], ctrl->value);
+			if (request == VIDIOC_S_EXT_CTRLS)
+				src->ctrl_values[i] = ctrl->value;
+		}
+	}
+
+	return 0;
+}
+/**
+ * End of static (internal) helper functions
+ */
+
+
+int virt_source_is_virtual(const char *dev_name)
+{
+	return strncmp(dev_name, VIRT_SOURCE_FILE_PREFIX, strlen(VIRT_SOURCE_FILE_PREFIX)) == 0 ||
+		strncmp(dev_name, VIRT_SOURCE_RECORD_PREFIX, strlen(VIRT_SOURCE_RECORD_PREFIX)) == 0 ||
+		strncmp(dev_name, VIRT_SOURCE_PATTERN_PREFIX, strlen(VIRT_SOURCE_PATTERN_PREFIX)) == 0;
+}
+
+int virt_source_open(struct virt_source **src_out, const char *dev_name)
+{
+	struct virt_source *src = (struct virt_source *) calloc(1, sizeof(*src));
+	unsigned int i;
+	int ret;
+
+	if (!src) {
+		fprintf(stderr, "Out of memory\n");
+		return ERR;
+	}
+
+	/* Default format, used until one is set */
+	src->pix.width = 640;
+	src->pix.height = 480;
+	src->pix.pixelformat = V4L2_PIX_FMT_UYVY;
+	fill_pix_format(&src->pix);
+
+	for (i = 0; i < VIRT_N_CTRLS; i++)
+		src->ctrl_values[i] = virt_ctrls[i].default_value;
+
+	if (strncmp(dev_name, VIRT_SOURCE_FILE_PREFIX, strlen(VIRT_SOURCE_FILE_PREFIX)) == 0) {
+		src->type = VIRT_FILE;
+		ret = open_file(src, dev_name + strlen(VIRT_SOURCE_FILE_PREFIX));
+	} else if (strncmp(dev_name, VIRT_SOURCE_RECORD_PREFIX, strlen(VIRT_SOURCE_RECORD_PREFIX)) == 0) {
+		src->type = VIRT_RECORD;
+		ret = open_record(src, dev_name + strlen(VIRT_SOURCE_RECORD_PREFIX));
+	} else {
+		src->type = VIRT_PATTERN;
+		ret = parse_pattern(src, dev_name + strlen(VIRT_SOURCE_PATTERN_PREFIX));
+		if (ret < 0)
+			fprintf(stderr, "Invalid pattern source '%s'\n", dev_name);
+	}
+
+	if (ret < 0) {
+		if (src->file_data)
+			munmap(src->file_data, src->file_size);
+		free(src);
+		return ERR;
+	}
+
+	snprintf(src->name, sizeof(src->name), "%s", dev_name);
+
+	src->timer_fd = src->done_fd = -1;
+	if (src->fps)
+		src->fd = open_paced_fds(src);
+	else
+		src->fd = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC);
+
+	if (-1 == src->fd || pthread_mutex_init(&src->lock, NULL) != 0) {
+		fprintf(stderr, "Error occurred when creating virtual source\n");
+		if (src->fd != -1)
+			close(src->fd);
+		close_paced_fds(src);
+		if (src->file_data)
+			munmap(src->file_data, src->file_size);
+		free(src);
+		return ERR;
+	}
+
+	*src_out = src;
+	return src->fd;
+}
+
+int virt_source_close(struct virt_source *src)
+{
+	stream_off(src);
+	free_buffers(src);
+	if (src->file_data)
+		munmap(src->file_data, src->file_size);
+	free(src->jpeg_offsets);
+	free(src->jpeg_sizes);
+	close(src->fd);
+	close_paced_fds(src);
+	pthread_mutex_destroy(&src->lock);
+	free(src);
+	return 0;
+}
+
+int virt_source_ioctl(struct virt_source *src, unsigned long request, void *arg)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&src->lock);
+
+	switch (request) {
+		case VIDIOC_QUERYCAP: {
+			struct v4l2_capability *cap = (struct v4l2_capability *) arg;
+
+			CLEAR(*cap);
+			snprintf((char *) cap->driver, sizeof(cap->driver), "v4l2_helper");
+			snprintf((char *) cap->card, sizeof(cap->card), "%s",
+					(src->type == VIRT_FILE) ? "Virtual file source" :
+					(src->type == VIRT_RECORD) ? "Virtual recording source" : "Virtual pattern source");
+			snprintf((char *) cap->bus_info, sizeof(cap->bus_info), "virtual:%.23s", src->name);
+			cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_STREAMING;
+			cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+			break;
+		}
+
+		case VIDIOC_G_FMT:
+		case VIDIOC_S_FMT:
+		case VIDIOC_TRY_FMT: {
+			struct v4l2_format *fmt = (struct v4l2_format *) arg;
+			int mplane = (fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+			struct v4l2_pix_format pix = fmt->fmt.pix;
+
+			if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE && !mplane) {
+				ret = fail(EINVAL);
+				break;
+			}
+
+			if (request == VIDIOC_G_FMT) {
+				set_format(fmt, &src->pix);
+				break;
+			}
+
+			if (mplane) {
+				CLEAR(pix);
+				pix.width = fmt->fmt.pix_mp.width;
+				pix.height = fmt->fmt.pix_mp.height;
+				pix.pixelformat = fmt->fmt.pix_mp.pixelformat;
+			}
+
+			/*
+			 * Adjust the requested format to a supported one, like a
+			 * driver would.
+			 */
+			if (src->is_format_fixed || pix.width == 0 || pix.height == 0) {
+				pix = src->pix;
+			} else {
+				pix.width &= ~1U;
+				pix.height &= ~1U;
+				if (
+					(src->type == VIRT_PATTERN && pix.pixelformat == V4L2_PIX_FMT_MJPEG) ||
+					(!mplane && mem_planes(&pix) > 1) ||
+					fill_pix_format(&pix) < 0
+				) {
+					pix.pixelformat = V4L2_PIX_FMT_UYVY;
+					fill_pix_format(&pix);
+				}
+			}
+
+			if (request == VIDIOC_S_FMT) {
+				if (src->n_buffers) {
+					ret = fail(EBUSY);
+					break;
+				}
+				src->pix = pix;
+			}
+			set_format(fmt, &pix);
+			break;
+		}
+
+		case VIDIOC_REQBUFS:
+			ret = request_buffers(src, (struct v4l2_requestbuffers *) arg);
+			break;
+
+		case VIDIOC_QUERYBUF:
+			ret = query_buffer(src, (struct v4l2_buffer *) arg);
+			break;
+
+		case VIDIOC_QBUF:
+			ret = queue_buffer(src, (struct v4l2_buffer *) arg);
+			break;
+
+		case VIDIOC_DQBUF:
+			ret = dequeue_buffer(src, (struct v4l2_buffer *) arg);
+			break;
+
+		case VIDIOC_STREAMON:
+			ret = stream_on(src);
+			break;
+
+		case VIDIOC_STREAMOFF:
+			ret = stream_off(src);
+			break;
+
+		case VIDIOC_CROPCAP:
+			ret = fail(EINVAL);
+			break;
+
+		case VIDIOC_ENUM_FMT:
+			ret = enum_format(src, (struct v4l2_fmtdesc *) arg);
+			break;
+
+		case VIDIOC_ENUM_FRAMESIZES:
+			ret = enum_frame_sizes(src, (struct v4l2_frmsizeenum *) arg);
+			break;
+
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+			ret = enum_frame_intervals(src, (struct v4l2_frmivalenum *) arg);
+			break;
+
+		case VIDIOC_G_PARM:
+		case VIDIOC_S_PARM:
+			ret = stream_parm(src, request, (struct v4l2_streamparm *) arg);
+			break;
+
+		case VIDIOC_QUERY_EXT_CTRL:
+			ret = query_ext_ctrl((struct v4l2_query_ext_ctrl *) arg);
+			break;
+
+		case VIDIOC_QUERYCTRL: {
+			struct v4l2_queryctrl *qc = (struct v4l2_queryctrl *) arg;
+			struct v4l2_query_ext_ctrl ext;
+
+			CLEAR(ext);
+			ext.id = qc->id;
+			ret = query_ext_ctrl(&ext);
+			if (ret == 0) {
+				CLEAR(*qc);
+				qc->id = ext.id;
+				qc->type = ext.type;
+				memcpy(qc->name, ext.name, sizeof(qc->name));
+				qc->minimum = (int) ext.minimum;
+				qc->maximum = (int) ext.maximum;
+				qc->step = (int) ext.step;
+				qc->default_value = (int) ext.default_value;
+			}
+			break;
+		}
+
+		case VIDIOC_G_CTRL:
+		case VIDIOC_S_CTRL: {
+			struct v4l2_control *ctrl = (struct v4l2_control *) arg;
+			unsigned int i = find_ctrl(ctrl->id);
+
+			if (i == VIRT_N_CTRLS) {
+				ret = fail(EINVAL);
+			} else if (request == VIDIOC_G_CTRL) {
+				ctrl->value = src->ctrl_values[i];
+			} else {
+				ctrl->value = clamp_ctrl(&virt_ctrls[i], ctrl->value);
+				src->ctrl_values[i] = ctrl->value;
+			}
+			break;
+		}
+
+		case VIDIOC_G_EXT_CTRLS:
+		case VIDIOC_S_EXT_CTRLS:
+		case VIDIOC_TRY_EXT_CTRLS:
+			ret = ext_ctrls(src, request, (struct v4l2_ext_controls *) arg);
+			break;
+
+		default:
+			ret = fail(ENOTTY);
+			break;
+	}
+
+	pthread_mutex_unlock(&src->lock);
+	return ret;
+}
+
+void *virt_source_mmap(struct virt_source *src, size_t length, long offset)
+{
+	void *start = MAP_FAILED;
+
+	pthread_mutex_lock(&src->lock);
+	if (
+		src->mmap_mem && offset >= 0 &&
+		(size_t) offset + length <= src->buffer_size * src->n_buffers
+	)
+	{
+		start = src->mmap_mem + offset;
+	}
+	pthread_mutex_unlock(&src->lock);
+
+	return start;
+}
+
+int virt_source_munmap(struct virt_source *src, void *start, size_t length)
+{
+	(void) src;
+	(void) start;
+	(void) length;
+
+	/* The memory is freed along with the buffers */
+	return 0;
+}
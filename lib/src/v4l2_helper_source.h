@@ -0,0 +1,79 @@
+/*
+ * opencv_v4l2 - v4l2_helper_source.h file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Internal header file for the virtual (camera-less) capture sources.
+
+#ifndef V4L2_HELPER_SOURCE_H
+#define V4L2_HELPER_SOURCE_H
+
+#include <stddef.h>
+
+/*
+ * A virtual source emulates the subset of the V4L2 capture interface used by
+ * the helper (ioctls, mmap and poll) so that the same code paths are used
+ * for virtual sources and real devices. The following device paths select a
+ * virtual source:
+ *
+ *   file:<path>[@<fps>]
+ *       Replays the raw frames stored back to back in the file at <path>,
+ *       in the format and resolution the source is initialised with. With
+ *       the MJPEG format, the file is a recorded MJPEG clip (JPEG images
+ *       back to back) and each buffer gets one image, of variable size.
+ *
+ *   record:<path>[@<fps>]
+ *       Replays the frames of a recording made with a helper_recorder (see
+ *       v4l2_helper_record.h), in a loop, in the format they were recorded
+ *       in. The error flags of the recorded frames are replayed too, their
+ *       sequence numbers and time stamps are not.
+ *
+ *   pattern[:<format>:<width>x<height>][@<fps>]
+ *       Generates color bars. <format> is one of uyvy, yuyv, grey, y16,
+ *       rgb24, nv12, nv12m. When the format and resolution aren't given, the
+ *       ones the source is initialised with are used.
+ *
+ * Both the single and the multi-planar APIs are supported. NV12M frames,
+ * which have their CbCr plane in a second memory plane, are only available
+ * with the latter (and are stored as NV12 in replay files).
+ *
+ * Frames are delivered at <fps> frames per second or, when it isn't given, as
+ * fast as they are consumed. A frame that is due while no buffer is queued
+ * is dropped, just like with a real sensor. When paced, the queued buffers
+ * are filled in order as the frames become due (and time stamped then), so
+ * filled buffers pile up if the application dequeues them slower than <fps>.
+ */
+struct virt_source;
+
+#define VIRT_SOURCE_FILE_PREFIX      "file:"
+#define VIRT_SOURCE_RECORD_PREFIX    "record:"
+#define VIRT_SOURCE_PATTERN_PREFIX   "pattern"
+
+/*
+ * Returns non-zero if the device path selects a virtual source.
+ */
+int virt_source_is_virtual(const char *dev_name);
+
+/*
+ * Opens the virtual source. Returns a file descriptor that can be polled
+ * like that of a real device, or ERR.
+ */
+int virt_source_open(struct virt_source **src, const char *dev_name);
+
+int virt_source_close(struct virt_source *src);
+
+/*
+ * Emulates the ioctl 'request'. Returns -1 and sets errno on failure, like
+ * ioctl().
+ */
+int virt_source_ioctl(struct virt_source *src, unsigned long request, void *arg);
+
+/*
+ * Emulates mmap()/munmap() of the MMAP buffers of the source.
+ */
+void *virt_source_mmap(struct virt_source *src, size_t length, long offset);
+
+int virt_source_munmap(struct virt_source *src, void *start, size_t length);
+
+#endif
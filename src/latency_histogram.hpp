@@ -0,0 +1,281 @@
+/*
+ * opencv_v4l2 - latency_histogram.hpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Low overhead latency histograms (in the spirit of HdrHistogram) used to
+// report the tail latency of the stages of the sample applications.
+
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/time.h>
+
+/*
+ * Nanoseconds on CLOCK_MONOTONIC, the clock the V4L2 buffer time stamps are
+ * usually taken from (see V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC).
+ */
+static inline uint64_t monotonic_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t timeval_ns(const struct timeval &tv)
+{
+	return (uint64_t) tv.tv_sec * 1000000000ULL + (uint64_t) tv.tv_usec * 1000ULL;
+}
+
+/*
+ * Counts of a histogram at some point in time, from which percentiles are
+ * computed. Subtracting an earlier snapshot gives the histogram of the
+ * values recorded in between.
+ */
+struct histogram_snapshot {
+	std::vector<uint64_t> counts;
+
+	uint64_t total() const
+	{
+		uint64_t n = 0;
+
+		for (size_t i = 0; i < counts.size(); i++) {
+			n += counts[i];
+		}
+		return n;
+	}
+
+	histogram_snapshot operator-(const histogram_snapshot &earlier) const
+	{
+		histogram_snapshot diff = *this;
+
+		for (size_t i = 0; i < diff.counts.size() && i < earlier.counts.size(); i++) {
+			diff.counts[i] -= earlier.counts[i];
+		}
+		return diff;
+	}
+};
+
+/*
+ * Log-linear histogram of values in nanoseconds: values below 128 ns get a
+ * bucket each and each power of two above is split into 64 buckets, so that
+ * every value is known to within 1/64 (1.6 %) whatever its magnitude, from
+ * nanoseconds up to about 18 minutes, with 2.3K buckets.
+ *
+ * Recording is wait-free (one relaxed atomic increment) so that the stage
+ * threads can record every frame while another thread reports. Each
+ * histogram should be recorded by a single thread to keep its cache line
+ * private.
+ */
+class latency_histogram {
+public:
+	enum {
+		SUB_BUCKET_BITS = 6,
+		SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+		MAX_VALUE_BITS = 40,
+		N_BUCKETS = 2 * SUB_BUCKETS + (MAX_VALUE_BITS - SUB_BUCKET_BITS - 1) * SUB_BUCKETS
+	};
+
+	latency_histogram() : counts(N_BUCKETS)
+	{
+		for (size_t i = 0; i < counts.size(); i++) {
+			counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void record(uint64_t value_ns)
+	{
+		counts[bucket_index(value_ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+	 * Records the time elapsed since 'start_ns' and returns the current time.
+	 */
+	uint64_t record_since(uint64_t start_ns)
+	{
+		uint64_t now = monotonic_ns();
+
+		record((now > start_ns) ? now - start_ns : 0);
+		return now;
+	}
+
+	histogram_snapshot snapshot() const
+	{
+		histogram_snapshot snap;
+
+		snap.counts.resize(counts.size());
+		for (size_t i = 0; i < counts.size(); i++) {
+			snap.counts[i] = counts[i].load(std::memory_order_relaxed);
+		}
+		return snap;
+	}
+
+	static unsigned int bucket_index(uint64_t value)
+	{
+		unsigned int msb, shift;
+
+		if (value < 2 * SUB_BUCKETS) {
+			return (unsigned int) value;
+		}
+
+		msb = 63 - __builtin_clzll(value);
+		if (msb >= MAX_VALUE_BITS) {
+			return N_BUCKETS - 1;
+		}
+
+		/* 'value >> shift' is in [SUB_BUCKETS, 2 * SUB_BUCKETS) */
+		shift = msb - SUB_BUCKET_BITS;
+		return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + (unsigned int) ((value >> shift) - SUB_BUCKETS);
+	}
+
+	/*
+	 * Highest value that falls in bucket 'index', as reported for the
+	 * values recorded in it.
+	 */
+	static uint64_t bucket_value(unsigned int index)
+	{
+		unsigned int shift;
+		uint64_t sub;
+
+		if (index < 2 * SUB_BUCKETS) {
+			return index;
+		}
+
+		shift = (index - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+		sub = (index - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+		return ((sub + 1) << shift) - 1;
+	}
+
+private:
+	std::vector<std::atomic<uint64_t>> counts;
+};
+
+/*
+ * Value below which 'percentile' percent of the recorded values fall.
+ */
+static inline uint64_t histogram_percentile(const histogram_snapshot &snap, double percentile)
+{
+	uint64_t total = snap.total(), target, seen = 0;
+	size_t i;
+
+	if (total == 0) {
+		return 0;
+	}
+
+	target = (uint64_t) (percentile / 100.0 * total + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+
+	for (i = 0; i < snap.counts.size(); i++) {
+		seen += snap.counts[i];
+		if (seen >= target) {
+			return latency_histogram::bucket_value(i);
+		}
+	}
+	return latency_histogram::bucket_value(snap.counts.size() - 1);
+}
+
+/*
+ * Writes the summary of a histogram as a JSON object: the number of values,
+ * their mean and standard deviation (jitter) and the p50, p90, p99, p99.9
+ * and maximum, all in microseconds.
+ */
+static inline void write_histogram_json(std::ostream &out, const histogram_snapshot &snap)
+{
+	uint64_t total = snap.total();
+	double sum = 0, sum_sq = 0, mean = 0, var = 0;
+	size_t i;
+
+	for (i = 0; i < snap.counts.size(); i++) {
+		double v = latency_histogram::bucket_value(i) / 1e3;
+
+		sum += v * snap.counts[i];
+		sum_sq += v * v * snap.counts[i];
+	}
+	if (total) {
+		mean = sum / total;
+		var = sum_sq / total - mean * mean;
+	}
+
+	out << "{\"count\": " << total
+		<< ", \"mean_us\": " << mean
+		<< ", \"stddev_us\": " << ((var > 0) ? std::sqrt(var) : 0.0)
+		<< ", \"p50_us\": " << histogram_percentile(snap, 50) / 1e3
+		<< ", \"p90_us\": " << histogram_percentile(snap, 90) / 1e3
+		<< ", \"p99_us\": " << histogram_percentile(snap, 99) / 1e3
+		<< ", \"p99_9_us\": " << histogram_percentile(snap, 99.9) / 1e3
+		<< ", \"max_us\": " << histogram_percentile(snap, 100) / 1e3 << "}";
+}
+
+/*
+ * Latency histograms of the named stages of an application. A report is one
+ * line of JSON (so that periodic reports form a JSON Lines file) covering
+ * either the values recorded since the previous interval report or, at exit,
+ * all of them:
+ *
+ *   {"report": "interval", "elapsed_s": 2.0, "frames": 60,
+ *    "stages": {"dequeue": {"count": 60, ..., "max_us": 33.3}, ...}}
+ */
+class latency_report {
+public:
+	latency_report() : start_ns(monotonic_ns()) {}
+
+	latency_histogram &add_stage(const std::string &name)
+	{
+		stages.emplace_back(name);
+		return *stages.back().histogram;
+	}
+
+	void write_interval(std::ostream &out, uint64_t frames)
+	{
+		write(out, "interval", frames, true);
+	}
+
+	void write_total(std::ostream &out, uint64_t frames)
+	{
+		write(out, "total", frames, false);
+	}
+
+private:
+	struct stage {
+		std::string name;
+		std::unique_ptr<latency_histogram> histogram;  /* Doesn't move when stages are added */
+		histogram_snapshot last;
+
+		explicit stage(const std::string &stage_name) : name(stage_name), histogram(new latency_histogram()) {}
+	};
+
+	void write(std::ostream &out, const char *type, uint64_t frames, bool interval)
+	{
+		size_t i;
+
+		out << "{\"report\": \"" << type << "\", \"elapsed_s\": " << (monotonic_ns() - start_ns) / 1e9
+			<< ", \"frames\": " << frames << ", \"stages\": {";
+		for (i = 0; i < stages.size(); i++) {
+			histogram_snapshot snap = stages[i].histogram->snapshot();
+
+			out << ((i) ? ", " : "") << "\"" << stages[i].name << "\": ";
+			write_histogram_json(out, (interval && !stages[i].last.counts.empty()) ? snap - stages[i].last : snap);
+			if (interval) {
+				stages[i].last = snap;
+			}
+		}
+		out << "}}" << std::endl;
+	}
+
+	std::vector<stage> stages;
+	uint64_t start_ns;
+};
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * opencv_v4l2 - leased_frame.hpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// A frame held through a lease (struct helper_lease) on the memory of its owner, a
+// capture context or a subscriber of the frame fan-out, seen as cv::Mat headers.
+
+#ifndef LEASED_FRAME_HPP
+#define LEASED_FRAME_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <memory>
+#include <sys/time.h>
+#include "v4l2_helper.h"
+#include "pixel_format.hpp"
+
+/*
+ * The lease is given back to its owner with 'Release' when the frame is destroyed or
+ * released, so a frame can only be moved, not copied. The matrices returned by mat()
+ * are headers on the memory of the owner: they must not be used after the frame is
+ * gone. A frame keeps its owner alive.
+ */
+template <typename Owner, int (*Release)(Owner *, const struct helper_lease *)>
+class leased_frame {
+public:
+	leased_frame() : lease(), mat_types() {}
+
+	leased_frame(leased_frame &&other) noexcept : owner(std::move(other.owner)), lease(other.lease)
+	{
+		std::copy(other.mat_types, other.mat_types + HELPER_MAX_PLANES, mat_types);
+	}
+
+	leased_frame &operator=(leased_frame &&other) noexcept
+	{
+		if (this != &other) {
+			release();
+			owner = std::move(other.owner);
+			lease = other.lease;
+			std::copy(other.mat_types, other.mat_types + HELPER_MAX_PLANES, mat_types);
+		}
+		return *this;
+	}
+
+	leased_frame(const leased_frame &) = delete;
+	leased_frame &operator=(const leased_frame &) = delete;
+
+	~leased_frame()
+	{
+		release();
+	}
+
+	bool empty() const
+	{
+		return !owner;
+	}
+
+	/*
+	 * Gives the lease back now rather than when the frame is destroyed.
+	 */
+	void release()
+	{
+		if (owner) {
+			Release(owner.get(), &lease);
+			owner.reset();
+		}
+	}
+
+	unsigned int planes() const
+	{
+		return (owner) ? lease.n_planes : 0;
+	}
+
+	/*
+	 * Header on a color plane of the frame (see lease_mat()); no data is copied.
+	 */
+	cv::Mat mat(unsigned int plane = 0) const
+	{
+		return (owner) ? lease_mat(lease, mat_types, plane) : cv::Mat();
+	}
+
+	unsigned int sequence() const
+	{
+		return lease.sequence;
+	}
+
+	const struct timeval &timestamp() const
+	{
+		return lease.timestamp;
+	}
+
+	const struct helper_lease &get_lease() const
+	{
+		return lease;
+	}
+
+protected:
+	/*
+	 * Takes over 'lease', filled in by 'new_owner', whose planes have the OpenCV types
+	 * 'types' (-1: compressed).
+	 */
+	void hold(const std::shared_ptr<Owner> &new_owner, const int *types)
+	{
+		owner = new_owner;
+		std::copy(types, types + HELPER_MAX_PLANES, mat_types);
+	}
+
+	std::shared_ptr<Owner> owner;
+	struct helper_lease lease;
+	int mat_types[HELPER_MAX_PLANES];  /* -1: compressed */
+};
+
+#endif
@@ -7,25 +7,46 @@
 
 #include <opencv2/opencv.hpp>
 #include <iostream>
-#include <sys/time.h>
+#include <fstream>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include "latency_histogram.hpp"
 
 using namespace std;
 using namespace cv;
 
-unsigned int GetTickCount()
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
 {
-        struct timeval tv;
-        if(gettimeofday(&tv, NULL) != 0)
-                return 0;
- 
-        return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	keep_running = false;
 }
 
 int main(int argc, char **argv)
 {
 	unsigned int width, height;
-	unsigned int start, end , fps = 0;
+	unsigned int fps = 0, frames = 0;
+	uint64_t start, end, frame_start, step_start;
 	VideoCapture cap(0 + CAP_V4L2); // open the default camera with V4L2 backend
+	ofstream report_file;
+	ostream *report = NULL;
+
+	/*
+	 * The latency of every frame is recorded in histograms (see latency_histogram.hpp) for
+	 * the tail latencies. The requeue of the buffers isn't visible through VideoCapture: it
+	 * is part of grab().
+	 *
+	 *   dequeue     grab(): waiting for the frame and dequeueing its buffer
+	 *   convert     retrieve(): conversion to BGR
+	 *   display     imshow and waitKey (nothing without display)
+	 *   end_to_end  from the call to grab() to the end of the display
+	 */
+	latency_report latency;
+	latency_histogram &dequeue_latency = latency.add_stage("dequeue");
+	latency_histogram &convert_latency = latency.add_stage("convert");
+	latency_histogram &display_latency = latency.add_stage("display");
+	latency_histogram &end_to_end_latency = latency.add_stage("end_to_end");
 
 	/*
 	 * Re-using the frame matrix(ces) instead of creating new ones (i.e., declaring 'Mat frame'
@@ -37,7 +58,7 @@ int main(int argc, char **argv)
 	cuda::GpuMat gpu_frame;
 	#endif
 
-	if (argc == 3)
+	if (argc == 3 || argc == 4)
 	{
 		/*
 		 * Courtesy: https://stackoverflow.com/a/2797823
@@ -62,10 +83,33 @@ int main(int argc, char **argv)
 			cerr << "Width or Height out of range\n";
 			return EXIT_FAILURE;
 		}
+
+		/*
+		 * The latency report is written as JSON Lines: one line per second with the
+		 * histograms of that second and a last line with those of the whole run.
+		 */
+		if (argc == 4)
+		{
+			if (strcmp(argv[3], "-") == 0)
+			{
+				report = &cout;
+			}
+			else
+			{
+				report_file.open(argv[3]);
+				if (!report_file)
+				{
+					cerr << "Could not open latency report " << argv[3] << '\n';
+					return EXIT_FAILURE;
+				}
+				report = &report_file;
+			}
+		}
 	}
 	else
 	{
-		cout << "Note: This program accepts (only) two arguments. First arg: width, Second arg: height\n";
+		cout << "Note: This program accepts (only) two or three arguments. First arg: width, Second arg: height,\n";
+		cout << "Optional third arg: path of the JSON latency report ('-' for the standard output)\n";
 		cout << "No arguments given. Assuming default values. Width: 640; Height: 480\n";
 		width = 640;
 		height = 480;
@@ -90,9 +134,23 @@ int main(int argc, char **argv)
 	cout << "Note: Click 'Esc' key to exit the window.\n";
 #endif
 
-	start = GetTickCount();
-	while (1) {
-		cap >> frame; // get a new frame from camera
+	/*
+	 * Stop cleanly on Ctrl+C so that the final latency report gets written.
+	 */
+	signal(SIGINT, stop_streaming);
+	signal(SIGTERM, stop_streaming);
+
+	start = monotonic_ns();
+	while (keep_running) {
+		/*
+		 * Same as 'cap >> frame' (get a new frame from camera) but in two steps, so that
+		 * the dequeue and the conversion can be timed separately.
+		 */
+		frame_start = monotonic_ns();
+		cap.grab();
+		step_start = dequeue_latency.record_since(frame_start);
+		cap.retrieve(frame);
+		step_start = convert_latency.record_since(step_start);
 		if (frame.empty())
 		{
 			cerr << "Empty frame received from camera!\n";
@@ -120,15 +178,27 @@ int main(int argc, char **argv)
 
 		if(waitKey(1) == 27) break;
 #endif
+		end = display_latency.record_since(step_start);
+		end_to_end_latency.record_since(frame_start);
+
 		fps++;
-		end = GetTickCount();
-		if ((end - start) >= 1000) {
+		frames++;
+		if ((end - start) >= 1000000000ULL) {
 			cout << "fps = " << fps << endl ;
+			if (report)
+			{
+				latency.write_interval(*report, fps);
+			}
 			fps = 0;
 			start = end;
 		}
 	}
 
+	if (report)
+	{
+		latency.write_total(*report, frames);
+	}
+
 	// the camera will be deinitialized automatically in VideoCapture destructor
 	return 0;
 }
@@ -7,46 +7,500 @@
 
 #include <opencv2/opencv.hpp>
 #include <iostream>
-#include <sys/time.h>
+#include <iomanip>
+#include <fstream>
 #include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include "v4l2_helper.h"
+#include "v4l2_helper_convert.h"
+#ifdef V4L2_HELPER_HAVE_JPEG
+#include "v4l2_helper_jpeg.h"
+#endif
+#include "spsc_ring.hpp"
+#include "latency_histogram.hpp"
+#include "pixel_format.hpp"
 
 using namespace std;
 using namespace cv;
 
-unsigned int GetTickCount()
+static double now_us()
+{
+	return monotonic_ns() / 1e3;
+}
+
+/*
+ * The frames flow through three stages, each running on its own thread, so that the frame
+ * rate is set by the slowest stage instead of by the sum of all of them:
+ *
+ *   capture (dequeue)  --captured-->  convert (to BGR)  --converted-->  consume (display)
+ *                                                            <--free_previews--
+ *
+ * The stages are connected by bounded lock-free single-producer/single-consumer rings (see
+ * spsc_ring.hpp). The 'captured' ring carries capture buffer (lease) indices; the lease is
+ * released by the convert stage as soon as the frame is converted. The 'converted' ring carries
+ * indices of preallocated BGR matrices which are handed back to the convert stage through the
+ * 'free_previews' ring once consumed.
+ *
+ * When a ring is full, the producing stage either waits (block) or drops the oldest frame in the
+ * ring (drop), so that the consumer always gets the most recent frames.
+ *
+ * With MJPEG capture, the convert stage is replaced by a pool of decoding threads (see
+ * v4l2_helper_jpeg.h) fed by a submit thread and drained, in capture order, by a collect
+ * thread:
+ *
+ *   capture  --captured-->  submit  ==decoder pool==>  collect  --converted-->  consume
+ *                             ^ <--recycled_previews--    |
+ *                             +-------------- free_previews <------------------+
+ *
+ * The lease of a frame is released by the collect thread once the frame is decoded. Without
+ * display, the frames are decoded to YUV planes instead of BGR, which skips the color
+ * conversion and chroma upsampling. Previews dropped from the 'converted' ring are handed back
+ * to the submit thread through the 'recycled_previews' ring (each ring has one producer).
+ *
+ * Besides the averages printed every second, the latency of every frame is recorded in
+ * histograms (see latency_histogram.hpp) for the tail latencies:
+ *
+ *   dequeue     time spent waiting for and dequeueing a buffer (helper_ctx_acquire_lease)
+ *   convert     UYVY to BGR conversion (MJPEG: from submission to the decoder to collection)
+ *   requeue     giving the buffer back to the driver (helper_ctx_release_lease)
+ *   display     imshow and waitKey (nothing without display)
+ *   end_to_end  from the capture of the frame (its buffer time stamp when it is
+ *               CLOCK_MONOTONIC based, otherwise its dequeue) to the end of its display
+ */
+struct stage_stats {
+	atomic<unsigned long> frames;
+	atomic<unsigned long> wait_us;   /* Time frames spent in the ring feeding the stage */
+	atomic<unsigned long> busy_us;   /* Time spent processing frames */
+
+	stage_stats() : frames(0), wait_us(0), busy_us(0) {}
+
+	void add(double queued_us, double start_us, double end_us)
+	{
+		frames++;
+		wait_us += (unsigned long) (start_us - queued_us);
+		busy_us += (unsigned long) (end_us - start_us);
+	}
+};
+
+struct pipeline {
+	struct helper_ctx *ctx;
+	struct helper_pool *conversion_pool;
+	unsigned int width, height;
+
+	/*
+	 * Indexed by capture buffer index
+	 */
+	vector<struct helper_lease> leases;
+	vector<double> captured_us;
+	vector<uint64_t> frame_ns;
+	vector<uint64_t> submitted_ns;
+
+	/*
+	 * Indexed by preview index
+	 */
+	vector<Mat> previews;
+	vector<double> preview_captured_us;
+	vector<uint64_t> preview_frame_ns;
+	vector<struct helper_lease> preview_leases;  /* Already released; only their metadata is used */
+	vector<double> converted_us;
+
+	spsc_ring<unsigned int> captured;
+	spsc_ring<unsigned int> converted;
+	spsc_ring<unsigned int> free_previews;
+
+#ifdef V4L2_HELPER_HAVE_JPEG
+	struct helper_jpeg_decoder *decoder;
+	vector<struct helper_jpeg_image> preview_images;
+	spsc_ring<unsigned int> recycled_previews;
+#endif
+
+	stage_stats capture_stats, convert_stats, consume_stats;
+	atomic<unsigned long> end_to_end_us;
+	atomic<unsigned long> decode_errors;
+
+	/*
+	 * Each histogram is recorded by a single stage thread.
+	 */
+	latency_report latency;
+	latency_histogram &dequeue_latency, &convert_latency, &requeue_latency;
+	latency_histogram &display_latency, &end_to_end_latency;
+
+	pipeline(unsigned int ring_size, ring_policy policy, unsigned int n_previews) :
+		ctx(NULL), conversion_pool(NULL), width(0), height(0),
+		captured(ring_size, policy), converted(ring_size, policy),
+		free_previews(n_previews, RING_BLOCK),
+#ifdef V4L2_HELPER_HAVE_JPEG
+		decoder(NULL), recycled_previews(n_previews, RING_BLOCK),
+#endif
+		end_to_end_us(0), decode_errors(0),
+		dequeue_latency(latency.add_stage("dequeue")), convert_latency(latency.add_stage("convert")),
+		requeue_latency(latency.add_stage("requeue")), display_latency(latency.add_stage("display")),
+		end_to_end_latency(latency.add_stage("end_to_end")) {}
+};
+
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
 {
-        struct timeval tv;
-        if(gettimeofday(&tv, NULL) != 0)
-                return 0;
- 
-        return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	keep_running = false;
+}
+
+static void capture_stage(pipeline *p)
+{
+	struct helper_lease lease;
+	unsigned int dropped;
+	bool did_drop;
+	uint64_t start, end;
+
+	while (keep_running) {
+		start = monotonic_ns();
+
+		/*
+		 * Helper function to access camera data. The lease stays valid (the driver doesn't
+		 * overwrite the buffer) until it is released by the convert stage.
+		 */
+		if (helper_ctx_acquire_lease(p->ctx, &lease) < 0) {
+			keep_running = false;
+			break;
+		}
+
+		end = p->dequeue_latency.record_since(start);
+		p->leases[lease.index] = lease;
+		p->captured_us[lease.index] = end / 1e3;
+		p->capture_stats.add(start / 1e3, start / 1e3, end / 1e3);
+
+		/*
+		 * The time stamp is only comparable with the monotonic clock when the driver
+		 * says so; otherwise the frame is considered captured when dequeued.
+		 */
+		p->frame_ns[lease.index] =
+			((lease.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) ?
+			timeval_ns(lease.timestamp) : end;
+
+		if (!p->captured.push(lease.index, &dropped, &did_drop)) {
+			helper_ctx_release_lease(p->ctx, &lease);
+			break;
+		}
+
+		if (did_drop) {
+			helper_ctx_release_lease(p->ctx, &p->leases[dropped]);
+		}
+	}
+
+	p->captured.close();
 }
 
 /*
- * Other formats: To use pixel formats other than UYVY, see related comments (comments with
- * prefix 'Other formats') in corresponding places.
+ * The convert stage is instantiated for each pixel format (see pixel_format.hpp) and the
+ * instance for the capture format is selected once at startup, so that the per-frame loop has
+ * no format dependent branches.
  */
+template <typename Format>
+static void convert_stage(pipeline *p)
+{
+	unsigned int index, preview_index = 0, dropped;
+	bool has_spare = false, did_drop;
+	double start;
+	uint64_t step_start;
+
+	while (p->captured.pop(index)) {
+		start = now_us();
+
+		/*
+		 * A preview dropped from the 'converted' ring is re-used right away;
+		 * otherwise, wait for the consume stage to hand one back.
+		 */
+		if (!has_spare && !p->free_previews.pop(preview_index)) {
+			helper_ctx_release_lease(p->ctx, &p->leases[index]);
+			break;
+		}
+		has_spare = false;
+
+		/*
+		 * 1. We do not use the cv::cuda::cvtColor (along with cv::cuda::GpuMat matrices) for color
+		 *    space conversion as cv::cuda::cvtColor does not support color space conversion from
+		 *    UYVY to BGR (at least in OpenCV 3.3.1 and OpenCV 3.4.2).
+		 *
+		 *    The performance might differ for higher resolutions if it did support the color
+		 *    conversion.
+		 *
+		 * 2. For UYVY and NV12, the helper's SIMD converters (see v4l2_helper_convert.h) are
+		 *    used instead of cv::cvtColor as they are several times faster, which matters at
+		 *    higher resolutions (see opencv-v4l2-convert-bench). They read the planes of the
+		 *    buffer in place and write into the preallocated preview matrix. For the highest
+		 *    resolutions, the conversion can be spread over a pool of threads.
+		 */
+		Mat &preview = p->previews[preview_index];
+		step_start = monotonic_ns();
+		int ret = Format::convert(p->leases[index], preview, p->conversion_pool);
+		step_start = p->convert_latency.record_since(step_start);
+
+		const struct helper_lease &lease = p->leases[index];
+		helper_ctx_probe_frame(p->ctx, HELPER_PROBE_CONVERT, &lease.timestamp, lease.flags);
+		p->preview_leases[preview_index] = lease;
+
+		/*
+		 * The capture buffer isn't needed anymore once converted; give it back to the driver
+		 * right away.
+		 */
+		p->preview_captured_us[preview_index] = p->captured_us[index];
+		p->preview_frame_ns[preview_index] = p->frame_ns[index];
+		if (helper_ctx_release_lease(p->ctx, &p->leases[index]) < 0 || ret < 0) {
+			keep_running = false;
+			break;
+		}
+		p->requeue_latency.record_since(step_start);
+
+		p->converted_us[preview_index] = now_us();
+		p->convert_stats.add(p->preview_captured_us[preview_index], start, p->converted_us[preview_index]);
+
+		if (!p->converted.push(preview_index, &dropped, &did_drop)) {
+			break;
+		}
+
+		if (did_drop) {
+			preview_index = dropped;
+			has_spare = true;
+		}
+	}
+
+	/*
+	 * Release the leases of the frames still in the ring, if any.
+	 */
+	while (p->captured.pop(index)) {
+		helper_ctx_release_lease(p->ctx, &p->leases[index]);
+	}
+
+	p->converted.close();
+}
+
+#ifdef V4L2_HELPER_HAVE_JPEG
+/*
+ * Takes a preview recycled by the collect stage or, failing that, one handed back by the consume
+ * stage. Fails once the consume stage is done.
+ */
+static bool take_preview(pipeline *p, unsigned int &preview_index)
+{
+	while (true) {
+		if (p->recycled_previews.try_pop(preview_index) || p->free_previews.try_pop(preview_index)) {
+			return true;
+		}
+
+		if (p->free_previews.is_closed()) {
+			return false;
+		}
+		this_thread::sleep_for(chrono::microseconds(50));
+	}
+}
+
+static void submit_stage(pipeline *p)
+{
+	unsigned int index, preview_index;
+
+	while (p->captured.pop(index)) {
+		if (!take_preview(p, preview_index)) {
+			helper_ctx_release_lease(p->ctx, &p->leases[index]);
+			break;
+		}
+
+		/*
+		 * The decoder writes into the preview directly; the preview index is found back from
+		 * the image and the capture buffer index is passed as the tag.
+		 */
+		p->preview_captured_us[preview_index] = p->captured_us[index];
+		p->preview_frame_ns[preview_index] = p->frame_ns[index];
+		p->preview_leases[preview_index] = p->leases[index];
+		p->submitted_ns[index] = monotonic_ns();
+		if (helper_jpeg_decoder_submit(p->decoder, p->leases[index].data, p->leases[index].bytesused,
+					&p->preview_images[preview_index], (void *) (uintptr_t) index) < 0) {
+			helper_ctx_release_lease(p->ctx, &p->leases[index]);
+			keep_running = false;
+			break;
+		}
+	}
+
+	while (p->captured.pop(index)) {
+		helper_ctx_release_lease(p->ctx, &p->leases[index]);
+	}
+
+	helper_jpeg_decoder_close(p->decoder);
+}
+
+static void collect_stage(pipeline *p)
+{
+	struct helper_jpeg_image *image;
+	unsigned int index, preview_index, dropped;
+	bool did_drop;
+	void *tag;
+	int status;
+	uint64_t step_start;
+
+	/*
+	 * Frames come out in the order they were captured, whichever decoding thread finished
+	 * first.
+	 */
+	while (helper_jpeg_decoder_collect(p->decoder, &image, &tag, &status) == 0) {
+		index = (unsigned int) (uintptr_t) tag;
+		preview_index = (unsigned int) (image - p->preview_images.data());
+		step_start = p->convert_latency.record_since(p->submitted_ns[index]);
+
+		if (helper_ctx_release_lease(p->ctx, &p->leases[index]) < 0) {
+			keep_running = false;
+		}
+		p->requeue_latency.record_since(step_start);
+
+		if (status < 0) {
+			p->decode_errors++;
+			p->recycled_previews.push(preview_index);
+			continue;
+		}
+
+		const struct helper_lease &lease = p->preview_leases[preview_index];
+		helper_ctx_probe_frame(p->ctx, HELPER_PROBE_CONVERT, &lease.timestamp, lease.flags);
+
+		p->converted_us[preview_index] = now_us();
+		p->convert_stats.add(p->preview_captured_us[preview_index], p->submitted_ns[index] / 1e3,
+			p->converted_us[preview_index]);
+
+		if (!p->converted.push(preview_index, &dropped, &did_drop)) {
+			break;
+		}
+
+		if (did_drop) {
+			p->recycled_previews.push(dropped);
+		}
+	}
+
+	p->converted.close();
+}
+#endif
+
+static void print_ring_stats(const char *name, spsc_ring<unsigned int> &ring, unsigned int capacity)
+{
+	ring_stats stats = ring.take_stats();
+
+	cout << "  ring " << left << setw(10) << name << right << ": occupancy avg = " << fixed << setprecision(1)
+		<< ((stats.pushed) ? (double) stats.occupancy_sum / stats.pushed : 0.0)
+		<< ", max = " << stats.max_occupancy << "/" << capacity << ", drops = " << stats.dropped << '\n';
+}
+
+static void print_stage_stats(const char *name, stage_stats &stats)
+{
+	unsigned long frames = stats.frames.exchange(0);
+	unsigned long wait_us = stats.wait_us.exchange(0);
+	unsigned long busy_us = stats.busy_us.exchange(0);
+
+	cout << "  stage " << left << setw(9) << name << right << ": frames = " << frames << fixed << setprecision(2)
+		<< ", queued avg = " << ((frames) ? wait_us / 1e3 / frames : 0.0) << " ms"
+		<< ", busy avg = " << ((frames) ? busy_us / 1e3 / frames : 0.0) << " ms\n";
+}
+
+/*
+ * Prints the glass to application latency measured by the latency probe of the helper library
+ * (see helper_ctx_set_latency_probe()) since the start: the time from the capture of the frames
+ * (their buffer time stamps) to their dequeue, the end of their conversion and their display.
+ * With 'all', the whole distributions are printed instead of the median and the tail.
+ */
+static void print_probe_stats(struct helper_ctx *ctx, bool all)
+{
+	static const char *names[HELPER_PROBE_POINTS] = { "dequeue", "convert", "display" };
+	struct helper_latency_stats stats;
+	unsigned int point;
+
+	for (point = 0; point < HELPER_PROBE_POINTS; point++) {
+		if (helper_ctx_get_latency_stats(ctx, (enum helper_probe_point) point, &stats) < 0) {
+			return;
+		}
+
+		if (stats.frames == 0) {
+			if (stats.unsynced_frames) {
+				cout << "  glass to " << names[point] << ": unknown, the time stamps aren't CLOCK_MONOTONIC based\n";
+			}
+			continue;
+		}
+
+		cout << "  glass to " << left << setw(7) << names[point] << right << fixed << setprecision(2);
+		if (all) {
+			cout << ": frames = " << stats.frames << ", mean = " << stats.mean_us / 1e3
+				<< " ms, p50 = " << stats.p50_us / 1e3 << " ms, p90 = " << stats.p90_us / 1e3
+				<< " ms, p99 = " << stats.p99_us / 1e3 << " ms, p99.9 = " << stats.p99_9_us / 1e3
+				<< " ms, max = " << stats.max_us / 1e3 << " ms";
+		} else {
+			cout << ": p50 = " << stats.p50_us / 1e3 << " ms, p99 = " << stats.p99_us / 1e3 << " ms";
+		}
+
+		/*
+		 * End of frame time stamps leave out the exposure and the read out.
+		 */
+		cout << (((stats.tstamp_src & V4L2_BUF_FLAG_TSTAMP_SRC_MASK) == V4L2_BUF_FLAG_TSTAMP_SRC_SOE) ?
+			" (from start of exposure)\n" : " (from end of frame)\n");
+	}
+}
+
+/*
+ * The capture format chosen on the command line, filled in from its traits (see
+ * pixel_format.hpp) by visit_pixel_format().
+ */
+struct capture_format {
+	uint32_t fourcc;
+	bool compressed;
+	void (*stage)(pipeline *);  /* Convert stage; NULL for compressed formats */
+
+	template <typename Format>
+	void apply()
+	{
+		fourcc = Format::fourcc;
+		compressed = Format::compressed;
+		select_stage<Format>(integral_constant<bool, Format::compressed>());
+	}
+
+	/*
+	 * Compressed frames are decoded by the MJPEG stages instead.
+	 */
+	template <typename Format>
+	void select_stage(true_type)
+	{
+		stage = NULL;
+	}
+
+	template <typename Format>
+	void select_stage(false_type)
+	{
+		stage = convert_stage<Format>;
+	}
+};
+
 int main(int argc, char **argv)
 {
-	unsigned int width, height;
+	unsigned int width, height, conversion_threads = 1, ring_size = 2, n_previews, in_flight = 0, i;
 	static const char* default_videodev = "/dev/video0";
 	const char *videodev;
-	unsigned int start, end, fps = 0;
-	unsigned char* ptr_cam_frame;
-	int bytes_used;
+	ring_policy policy = RING_BLOCK;
+	uint64_t start, end;
+	unsigned int fps = 0;
+	struct helper_stats stats, prev_stats = helper_stats();
+	struct helper_cam_params params;
+	unsigned int preview_index;
+	thread capture_thread, convert_thread, collect_thread;
+	bool mjpeg = false;
+	capture_format format;
+	ofstream report_file;
+	ostream *report = NULL;
 
-	/*
-	 * Re-using the frame matrix(ces) instead of creating new ones (i.e., declaring 'Mat frame'
-	 * (and cuda::GpuMat gpu_frame) outside the 'while (1)' loop instead of declaring it
-	 * within the loop) improves the performance for higher resolutions.
-	 */
-	Mat yuyv_frame, preview;
 #if defined(ENABLE_DISPLAY) && defined(ENABLE_GL_DISPLAY) && defined(ENABLE_GPU_UPLOAD)
 	cuda::GpuMat gpu_frame;
 #endif
 
-	if (argc == 4) {
+	visit_pixel_format("uyvy", format);
+
+	if (argc >= 4 && argc <= 9) {
 		videodev = argv[1];
 
 		/*
@@ -65,6 +519,14 @@ int main(int argc, char **argv)
 			if (pos < height_str.size()) {
 				cerr << "Trailing characters after height: " << height_str << '\n';
 			}
+
+			if (argc >= 5) {
+				conversion_threads = stoi(argv[4]);
+			}
+
+			if (argc >= 6) {
+				ring_size = stoi(argv[5]);
+			}
 		} catch (invalid_argument const &ex) {
 			cerr << "Invalid width or height\n";
 			return EXIT_FAILURE;
@@ -72,9 +534,51 @@ int main(int argc, char **argv)
 			cerr << "Width or Height out of range\n";
 			return EXIT_FAILURE;
 		}
+
+		if (argc >= 7) {
+			if (strcmp(argv[6], "drop") == 0) {
+				policy = RING_DROP_OLDEST;
+			} else if (strcmp(argv[6], "block") != 0) {
+				cerr << "Ring policy must be 'block' or 'drop'\n";
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (ring_size < 1) {
+			cerr << "Ring size must be at least 1\n";
+			return EXIT_FAILURE;
+		}
+
+		/*
+		 * The latency report is written as JSON Lines: one line per second with the
+		 * histograms of that second and a last line with those of the whole run.
+		 */
+		if (argc >= 8 && argv[7][0] != '\0') {
+			if (strcmp(argv[7], "-") == 0) {
+				report = &cout;
+			} else {
+				report_file.open(argv[7]);
+				if (!report_file) {
+					cerr << "Could not open latency report " << argv[7] << '\n';
+					return EXIT_FAILURE;
+				}
+				report = &report_file;
+			}
+		}
+
+		if (argc >= 9 && !visit_pixel_format(argv[8], format)) {
+			cerr << "Format must be one of " << pixel_format_names() << '\n';
+			return EXIT_FAILURE;
+		}
 	} else {
-		cout << "Note: This program accepts (only) three arguments.\n";
+		cout << "Note: This program accepts (only) three to eight arguments.\n";
 		cout << "First arg: device file path, Second arg: width, Third arg: height\n";
+		cout << "Optional args: number of threads used for color conversion (0: one per CPU),\n";
+		cout << "               size of the rings between the stages, ring policy (block or drop),\n";
+		cout << "               path of the JSON latency report ('-' for the standard output, '' for none),\n";
+		cout << "               capture format (" << pixel_format_names() << "; nv12m is NV12 with\n";
+		cout << "               separate planes; with mjpeg, the number of threads is that of the decoding\n";
+		cout << "               threads)\n";
 		cout << "No arguments given. Assuming default values.\n";
 		cout << "Device file path: " << default_videodev << "; Width: 640; Height: 480\n";
 		videodev = default_videodev;
@@ -82,6 +586,8 @@ int main(int argc, char **argv)
 		height = 480;
 	}
 
+	mjpeg = format.compressed;
+
 	/*
 	 * Helper function to initialize camera to a specific resolution and format
 	 *
@@ -89,16 +595,120 @@ int main(int argc, char **argv)
 	 *    it avoids a spurious copy from kernel space to user space which happens in case of
 	 *    the Memory mapping streaming I/O method.
 	 *
-	 * 2. Other formats: To use formats other that UYVY, the 4th parameter for this function
-	 *    must be modified accordingly to pass a valid value for the 'pixelformat' member of
-	 *    'struct v4l2_pix_format'[1].
+	 *    When the frames are to be passed on to other devices (encoders, GPUs) or processes,
+	 *    IO_METHOD_DMABUF (or exporting MMAP buffers via helper_ctx_export_buffer()) allows
+	 *    sharing the buffers as dma-bufs without any CPU copy at all.
+	 *
+	 * 2. The format is that chosen on the command line, among those with traits in
+	 *    pixel_format.hpp; other formats can be supported by adding traits there, with the
+	 *    pixelformat[1] to request and the conversion to BGR.
+	 *
+	 * 3. Enough buffers are needed for the frames waiting in the 'captured' ring, the frame
+	 *    being converted and the frame being filled by the driver, plus one so that the driver
+	 *    always has a buffer to fill.
+	 *
+	 *    With MJPEG, the frames in flight in the decoder also hold a buffer (and a preview).
 	 *
 	 * [1]: https://linuxtv.org/downloads/v4l-dvb-apis/uapi/v4l/pixfmt-v4l2.html#c.v4l2_pix_format
 	 */
-	if (helper_init_cam(videodev, width, height, V4L2_PIX_FMT_UYVY, IO_METHOD_USERPTR) < 0) {
+#ifdef V4L2_HELPER_HAVE_JPEG
+	struct helper_jpeg_decoder *decoder = NULL;
+
+	if (mjpeg) {
+		if (helper_jpeg_decoder_create(&decoder, conversion_threads, 0) < 0) {
+			return EXIT_FAILURE;
+		}
+		in_flight = helper_jpeg_decoder_get_max_in_flight(decoder);
+	}
+#else
+	if (mjpeg) {
+		cerr << "MJPEG capture needs the helper library to be built with libjpeg\n";
+		return EXIT_FAILURE;
+	}
+#endif
+
+	pipeline p(ring_size, policy, ring_size + 2 + in_flight);
+	p.width = width;
+	p.height = height;
+#ifdef V4L2_HELPER_HAVE_JPEG
+	p.decoder = decoder;
+#endif
+
+	helper_cam_params_init(&params, width, height, format.fourcc, IO_METHOD_USERPTR);
+	params.num_buffers = ring_size + 3 + in_flight;
+	if (helper_ctx_init_cam_params(&p.ctx, videodev, &params) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * Along with the latency report, the glass to application latency is measured from the
+	 * buffer time stamps.
+	 */
+	if (report && helper_ctx_set_latency_probe(p.ctx, 1) < 0) {
+		helper_ctx_deinit_cam(p.ctx);
 		return EXIT_FAILURE;
 	}
 
+	/*
+	 * For higher resolutions, even the SIMD conversion can't keep up with the sensor when
+	 * run on a single core. So, the conversion can be spread over a pool of threads that is
+	 * created once, here, and re-used for every frame.
+	 */
+	if (!mjpeg && conversion_threads != 1 && helper_pool_create(&p.conversion_pool, conversion_threads, 1) < 0) {
+		helper_ctx_deinit_cam(p.ctx);
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * Re-using the frame matrices instead of creating new ones for every frame improves the
+	 * performance for higher resolutions. A preview is needed for every frame waiting in the
+	 * 'converted' ring, the frame being converted and the frame being consumed.
+	 *
+	 * MJPEG frames are decoded straight into the previews. Unless they are displayed, they are
+	 * decoded to YUV: the Y, Cb and Cr planes are stacked in a single channel matrix of 3 times
+	 * the height (the chroma planes only use part of their rows when subsampled).
+	 */
+	n_previews = ring_size + 2 + in_flight;
+	p.leases.resize(helper_ctx_get_num_buffers(p.ctx));
+	p.captured_us.resize(p.leases.size());
+	p.frame_ns.resize(p.leases.size());
+	p.submitted_ns.resize(p.leases.size());
+	p.preview_captured_us.resize(n_previews);
+	p.preview_frame_ns.resize(n_previews);
+	p.preview_leases.resize(n_previews);
+	p.converted_us.resize(n_previews);
+	for (i = 0; i < n_previews; i++) {
+#if defined(V4L2_HELPER_HAVE_JPEG) && !defined(ENABLE_DISPLAY)
+		if (mjpeg) {
+			struct helper_jpeg_image image = helper_jpeg_image();
+
+			p.previews.push_back(Mat(height * 3, width, CV_8UC1));
+			image.output = HELPER_JPEG_YUV;
+			for (unsigned int plane = 0; plane < 3; plane++) {
+				image.planes[plane] = p.previews.back().ptr(plane * height);
+				image.strides[plane] = p.previews.back().step;
+			}
+			image.width = width;
+			image.height = height;
+			p.preview_images.push_back(image);
+			p.free_previews.push(i);
+			continue;
+		}
+#endif
+		p.previews.push_back(Mat(height, width, CV_8UC3));
+#ifdef V4L2_HELPER_HAVE_JPEG
+		struct helper_jpeg_image image = helper_jpeg_image();
+
+		image.output = HELPER_JPEG_BGR;
+		image.width = width;
+		image.height = height;
+		image.planes[0] = p.previews.back().data;
+		image.strides[0] = p.previews.back().step;
+		p.preview_images.push_back(image);
+#endif
+		p.free_previews.push(i);
+	}
+
 #ifdef ENABLE_DISPLAY
 	/*
 	 * Using a window with OpenGL support to display the frames improves the performance
@@ -112,56 +722,28 @@ int main(int argc, char **argv)
 	cout << "Note: Click 'Esc' key to exit the window.\n";
 #endif
 
-	/*
-	 * 1. As we re-use the matrix across loops for increased performance in case of higher resolutions
-	 *    we construct it with the common parameters: rows (height), columns (width), type of data in
-	 *    matrix.
-	 *
-	 *    Re-using the matrix is possible as the resolution of the frame doesn't change dynamically
-	 *    in the middle of obtaining frames from the camera. If resolutions change in the middle we
-	 *    would have to re-construct the matrix accordingly.
-	 *
-	 * 2. Other formats: To use formats other than UYVY the 3rd parameter must be modified accordingly
-	 *    to pass a valid OpenCV array type for the new pixelformat[2].
-	 *
-	 * [2]: https://docs.opencv.org/3.4.2/d3/d63/classcv_1_1Mat.html#a2ec3402f7d165ca34c7fd6e8498a62ca
-	 */
-	yuyv_frame = Mat(height, width, CV_8UC2);
-	start = GetTickCount();
-	while(1) {
-		/*
-		 * Helper function to access camera data
-		 */
-		if (helper_get_cam_frame(&ptr_cam_frame, &bytes_used) < 0) {
-			break;
-		}
+	signal(SIGINT, stop_streaming);
+	signal(SIGTERM, stop_streaming);
 
-		/*
-		 * It's easy to re-use the matrix for our case (V4L2 user pointer) by changing the
-		 * member 'data' to point to the data obtained from the V4L2 helper.
-		 */
-		yuyv_frame.data = ptr_cam_frame;
-		if(yuyv_frame.empty()) {
-			cout << "Img load failed" << endl;
-			break;
-		}
+	capture_thread = thread(capture_stage, &p);
+#ifdef V4L2_HELPER_HAVE_JPEG
+	if (mjpeg) {
+		convert_thread = thread(submit_stage, &p);
+		collect_thread = thread(collect_stage, &p);
+	} else
+#endif
+	convert_thread = thread(format.stage, &p);
 
-		/*
-		 * 1. We do not use the cv::cuda::cvtColor (along with cv::cuda::GpuMat matrices) for color
-		 *    space conversion as cv::cuda::cvtColor does not support color space conversion from
-		 *    UYVY to BGR (at least in OpenCV 3.3.1 and OpenCV 3.4.2).
-		 *
-		 *    The performance might differ for higher resolutions if it did support the color
-		 *    conversion.
-		 *
-		 * 2. Other formats: To use formats other than UYVY, the third parameter of cv::cvtColor must
-		 *    be modified to the corresponding color converison code[3].
-		 *
-		 * [3]: https://docs.opencv.org/3.4.2/d7/d1b/group__imgproc__misc.html#ga4e0972be5de079fed4e3a10e24ef5ef0
-		 */
-		cvtColor(yuyv_frame, preview, COLOR_YUV2BGR_UYVY);
+	/*
+	 * The consume stage runs on the main thread as the highgui functions must be called from it.
+	 */
+	start = monotonic_ns();
+	while (p.converted.pop(preview_index)) {
+		uint64_t consume_start = monotonic_ns();
 
 #ifdef ENABLE_DISPLAY
+		Mat &preview = p.previews[preview_index];
+
 	/*
 	 * It is possible to use a GpuMat for display (imshow) only
 	 * when window is created with OpenGL support. So,
@@ -179,44 +761,92 @@ int main(int argc, char **argv)
 	#else
 		imshow("OpenCV V4L2", preview);
 	#endif
-#endif
 
-		/*
-		 * Helper function to release camera data. This must be called for every
-		 * call to helper_get_cam_frame()
-		 */
-		if (helper_release_cam_frame() < 0)
-		{
-			break;
-		}
-
-#ifdef ENABLE_DISPLAY
-		if(waitKey(1) == 27) break;
+		if(waitKey(1) == 27) keep_running = false;
 #endif
 
+		uint64_t consume_end = p.display_latency.record_since(consume_start);
+		const struct helper_lease &lease = p.preview_leases[preview_index];
+		helper_ctx_probe_frame(p.ctx, HELPER_PROBE_DISPLAY, &lease.timestamp, lease.flags);
+		p.end_to_end_latency.record_since(p.preview_frame_ns[preview_index]);
+		p.consume_stats.add(p.converted_us[preview_index], consume_start / 1e3, consume_end / 1e3);
+		p.end_to_end_us += (unsigned long) (consume_end / 1e3 - p.preview_captured_us[preview_index]);
+		p.free_previews.push(preview_index);
+
 		fps++;
-		end = GetTickCount();
-		if ((end - start) >= 1000) {
-			cout << "fps = " << fps << endl ;
+		end = consume_end;
+		if ((end - start) >= 1000000000ULL) {
+			/*
+			 * The framerate alone doesn't tell frames dropped by the driver (because
+			 * no buffer was available) from frames that were merely slow. So, the
+			 * drops reported by the helper are printed along with it.
+			 */
+			if (helper_ctx_get_stats(p.ctx, &stats) == 0) {
+				cout << "fps = " << fps << ", dropped = " << stats.dropped_frames - prev_stats.dropped_frames
+					<< ", errors = " << stats.error_frames - prev_stats.error_frames;
+				if (mjpeg) {
+					cout << ", decode errors = " << p.decode_errors.exchange(0);
+				}
+				cout << endl;
+				prev_stats = stats;
+			} else {
+				cout << "fps = " << fps << endl ;
+			}
+
+			/*
+			 * The stage with the highest busy time sets the frame rate; frames queue up in
+			 * the ring in front of it.
+			 */
+			unsigned long consumed = p.consume_stats.frames.load();
+			cout << "  end-to-end latency avg = " << fixed << setprecision(2)
+				<< ((consumed) ? p.end_to_end_us.exchange(0) / 1e3 / consumed : 0.0) << " ms\n";
+			print_stage_stats("capture", p.capture_stats);
+			print_ring_stats("captured", p.captured, ring_size);
+			print_stage_stats((mjpeg) ? "decode" : "convert", p.convert_stats);
+			print_ring_stats("converted", p.converted, ring_size);
+			print_stage_stats("consume", p.consume_stats);
+			if (report) {
+				print_probe_stats(p.ctx, false);
+			}
+			cout << endl;
+
+			if (report) {
+				p.latency.write_interval(*report, fps);
+			}
+
 			fps = 0;
 			start = end;
 		}
+	}
 
-		/*
-		 * Releasing the Matrix is not required.
-		 *
-		 * 1. release() is called by default in the destructor.
-		 * 2. The cv::Mat documentation says:
-		 * "If the matrix header points to an external data set (see Mat::Mat),
-		 * the reference counter is NULL, and the method has no effect in this case."
-		 * yuyv_frame.release();
-		 */
+	keep_running = false;
+	p.free_previews.close();
+	capture_thread.join();
+	convert_thread.join();
+	if (collect_thread.joinable()) {
+		collect_thread.join();
+	}
+
+	if (report) {
+		p.latency.write_total(*report, p.end_to_end_latency.snapshot().total());
+		cout << "Glass to application latency:\n";
+		print_probe_stats(p.ctx, true);
+	}
+
+	if (p.conversion_pool) {
+		helper_pool_destroy(p.conversion_pool);
+	}
+
+#ifdef V4L2_HELPER_HAVE_JPEG
+	if (p.decoder) {
+		helper_jpeg_decoder_destroy(p.decoder);
 	}
+#endif
 
 	/*
 	 * Helper function to free allocated resources and close the camera device.
 	 */
-	if (helper_deinit_cam() < 0)
+	if (helper_ctx_deinit_cam(p.ctx) < 0)
 	{
 		return EXIT_FAILURE;
 	}
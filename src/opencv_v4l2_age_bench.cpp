@@ -0,0 +1,155 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_age_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include "v4l2_helper.h"
+
+using namespace std;
+
+/*
+ * Measures the age of the frames a slow consumer gets, i.e., the time from
+ * the capture of a frame (its buffer time stamp) to the moment the consumer
+ * gets it, with the default mode (every frame is delivered in order) and with
+ * the latest frame only mode (see helper_ctx_set_latest_frame_only()).
+ *
+ * The consumer is simulated by sleeping for a fixed time per frame. When that
+ * is longer than the frame period, the filled buffers pile up in the default
+ * mode and the consumer gets frames that are up to a whole ring old.
+ */
+
+struct age_result {
+	vector<double> ages_ms;
+	unsigned long skipped;
+	unsigned long dropped;
+};
+
+static double monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int measure(const char *dev, const struct helper_cam_params *params,
+		unsigned int consumer_ms, unsigned int seconds, age_result &result)
+{
+	struct helper_ctx *ctx;
+	struct helper_lease lease;
+	double start;
+	int ret = 0;
+
+	if (helper_ctx_init_cam_params(&ctx, dev, params) < 0) {
+		cerr << "Could not initialise " << dev << '\n';
+		return ERR;
+	}
+
+	result.skipped = result.dropped = 0;
+	start = monotonic_ms();
+	while (monotonic_ms() - start < seconds * 1e3) {
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			ret = ERR;
+			break;
+		}
+
+		/*
+		 * The buffer time stamps are CLOCK_MONOTONIC based.
+		 */
+		result.ages_ms.push_back(monotonic_ms() - (lease.timestamp.tv_sec * 1e3 + lease.timestamp.tv_usec / 1e3));
+		result.skipped += lease.skipped;
+		result.dropped += lease.dropped;
+
+		usleep(consumer_ms * 1000);
+
+		if (helper_ctx_release_lease(ctx, &lease) < 0) {
+			ret = ERR;
+			break;
+		}
+	}
+
+	if (helper_ctx_deinit_cam(ctx) < 0) {
+		ret = ERR;
+	}
+
+	return ret;
+}
+
+static void print_result(const char *mode, age_result &result)
+{
+	vector<double> &ages = result.ages_ms;
+	double sum = 0;
+	unsigned int i;
+
+	if (ages.empty()) {
+		cout << mode << ": no frames\n";
+		return;
+	}
+
+	for (i = 0; i < ages.size(); i++) {
+		sum += ages[i];
+	}
+	sort(ages.begin(), ages.end());
+
+	cout << left << setw(8) << mode << right << fixed << setprecision(2)
+		<< "  frames = " << setw(6) << ages.size()
+		<< "  skipped = " << setw(6) << result.skipped
+		<< "  dropped = " << setw(6) << result.dropped
+		<< "  age (ms): avg = " << setw(7) << sum / ages.size()
+		<< "  p50 = " << setw(7) << ages[ages.size() / 2]
+		<< "  p99 = " << setw(7) << ages[(ages.size() * 99) / 100]
+		<< "  max = " << setw(7) << ages.back() << '\n';
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, consumer_ms, seconds, num_buffers = 4;
+	struct helper_cam_params params;
+	age_result normal, latest;
+
+	if (argc < 6 || argc > 7) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> <consumer ms> <seconds> [<buffers>]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		consumer_ms = stoi(argv[4]);
+		seconds = stoi(argv[5]);
+		if (argc > 6) {
+			num_buffers = stoi(argv[6]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height, consumer time, duration or number of buffers\n";
+		return EXIT_FAILURE;
+	}
+
+	helper_cam_params_init(&params, width, height, V4L2_PIX_FMT_UYVY, IO_METHOD_MMAP);
+	params.num_buffers = num_buffers;
+
+	if (measure(argv[1], &params, consumer_ms, seconds, normal) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	params.latest_frame_only = 1;
+	if (measure(argv[1], &params, consumer_ms, seconds, latest) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	cout << "consumer time = " << consumer_ms << " ms, buffers = " << num_buffers << '\n';
+	print_result("normal", normal);
+	print_result("latest", latest);
+
+	return EXIT_SUCCESS;
+}
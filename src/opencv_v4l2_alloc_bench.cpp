@@ -0,0 +1,297 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_alloc_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_convert.h"
+#include "v4l2_helper_pool.h"
+
+using namespace std;
+
+/*
+ * Measures the UYVY to BGR conversion throughput of frames captured into
+ * USERPTR buffers allocated with each of the allocation options of the helper
+ * library (see 'alloc_pages' in struct helper_cam_params): heap memory, base
+ * pages, transparent huge pages and hugetlbfs pages, with and without
+ * locking, all bound to the same NUMA node if one is given.
+ *
+ * Only the conversion is timed; it reads whole frames from the capture
+ * buffers, so that the cost of the TLB misses taken on them shows up. The
+ * destination is the same for every allocator. The data TLB misses are
+ * counted with perf events when the kernel allows it.
+ */
+
+struct buffer_allocator {
+	const char *name;
+	enum helper_alloc_pages pages;
+	int lock;
+};
+
+static const buffer_allocator allocators[] = {
+	{ "heap", HELPER_ALLOC_HEAP, 0 },
+	{ "4k", HELPER_ALLOC_SMALL_PAGES, 0 },
+	{ "4k+mlock", HELPER_ALLOC_SMALL_PAGES, 1 },
+	{ "thp", HELPER_ALLOC_THP, 0 },
+	{ "thp+mlock", HELPER_ALLOC_THP, 1 },
+	{ "hugetlb", HELPER_ALLOC_HUGETLB, 0 },
+	{ "hugetlb+mlock", HELPER_ALLOC_HUGETLB, 1 }
+};
+
+static const char *pages_name(enum helper_alloc_pages pages)
+{
+	switch (pages) {
+		case HELPER_ALLOC_HEAP:
+			return "heap";
+		case HELPER_ALLOC_SMALL_PAGES:
+			return "4k";
+		case HELPER_ALLOC_THP:
+			return "thp";
+		case HELPER_ALLOC_HUGETLB:
+			return "hugetlb";
+	}
+	return "?";
+}
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Counter of the data TLB read misses of the calling thread and of the
+ * threads it creates afterwards (the conversion pool). -1 when perf events
+ * aren't available (e.g., perf_event_paranoid or no PMU in a VM).
+ */
+static int open_dtlb_counter()
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_counter(int fd)
+{
+	uint64_t value = 0;
+
+	if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+		return 0;
+	}
+	return value;
+}
+
+/*
+ * Page size and transparent huge pages of the mapping containing 'addr', as
+ * reported in /proc/self/smaps, to check what the kernel actually did.
+ */
+static string mapping_pages(const void *addr)
+{
+	ifstream smaps("/proc/self/smaps");
+	uintptr_t target = (uintptr_t) addr;
+	string line, page_size = "?", anon_huge = "?";
+	bool in_range = false;
+
+	while (getline(smaps, line)) {
+		uintptr_t start, end;
+		char dash;
+		istringstream fields(line);
+
+		if (fields >> hex >> start >> dash >> end && dash == '-') {
+			if (in_range) {
+				break;
+			}
+			in_range = (target >= start && target < end);
+			continue;
+		}
+		if (!in_range) {
+			continue;
+		}
+
+		string key, value, unit;
+		istringstream entry(line);
+
+		entry >> key >> value >> unit;
+		if (key == "KernelPageSize:") {
+			page_size = value + " " + unit;
+		} else if (key == "AnonHugePages:") {
+			anon_huge = value + " " + unit;
+		}
+	}
+
+	return "page " + page_size + ", thp " + anon_huge;
+}
+
+static int run_allocator(const char *dev, unsigned int width, unsigned int height, const buffer_allocator &alloc,
+	int numa_node, unsigned int frames, struct helper_pool *pool, int dtlb_fd, vector<unsigned char> &bgr)
+{
+	struct helper_cam_params params;
+	struct helper_ctx *ctx;
+	struct helper_buffer_memory memory;
+	struct helper_lease lease;
+	vector<double> times;
+	uint64_t misses = 0;
+	string mapping = "?";
+	unsigned int i;
+	int ret = 0;
+
+	helper_cam_params_init(&params, width, height, V4L2_PIX_FMT_UYVY, IO_METHOD_USERPTR);
+	params.alloc_pages = alloc.pages;
+	params.lock_buffers = alloc.lock;
+	params.numa_node = numa_node;
+
+	if (helper_ctx_init_cam_params(&ctx, dev, &params) < 0) {
+		cerr << "Could not initialise " << dev << " with " << alloc.name << " buffers\n";
+		return -1;
+	}
+	helper_ctx_get_buffer_memory(ctx, &memory);
+
+	/*
+	 * The first frames warm up the caches and the conversion pool.
+	 */
+	for (i = 0; i < frames + 5; i++) {
+		double start;
+		uint64_t count;
+
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			ret = -1;
+			break;
+		}
+		if (i == 0) {
+			mapping = mapping_pages(lease.data);
+		}
+
+		count = read_counter(dtlb_fd);
+		start = wall_seconds();
+		helper_convert_uyvy_to_bgr_parallel(pool, lease.data, lease.planes[0].bytesperline, bgr.data(), 3 * width,
+			width, height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+		if (i >= 5) {
+			times.push_back(wall_seconds() - start);
+			misses += read_counter(dtlb_fd) - count;
+		}
+
+		helper_ctx_release_lease(ctx, &lease);
+	}
+
+	helper_ctx_deinit_cam(ctx);
+	if (ret < 0 || times.empty()) {
+		return -1;
+	}
+
+	sort(times.begin(), times.end());
+
+	double sum = 0, ms, bytes = 5.0 * width * height;  /* 2 bytes read and 3 written per pixel */
+	for (i = 0; i < times.size(); i++) {
+		sum += times[i];
+	}
+	ms = 1e3 * sum / times.size();
+
+	cout << "  " << left << setw(14) << alloc.name << right << fixed << setprecision(3)
+		<< setw(9) << ms << " ms" << setw(9) << 1e3 * times[times.size() * 99 / 100] << " ms"
+		<< setprecision(1) << setw(8) << 1e3 / ms << " fps" << setprecision(2)
+		<< setw(7) << bytes / ms / 1e6 << " GB/s";
+	if (dtlb_fd >= 0) {
+		cout << setw(10) << misses / times.size() << " dTLB";
+	} else {
+		cout << setw(15) << "n/a";
+	}
+	cout << "   got " << pages_name(memory.pages) << ((memory.locked) ? "+mlock" : "");
+	if (memory.numa_node >= 0) {
+		cout << " node " << memory.numa_node;
+	}
+	cout << ", " << memory.bytes / (1024 * 1024) << " MB (" << mapping << ")\n";
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, frames = 100, threads = 1, i;
+	int numa_node = -1, dtlb_fd, ret = EXIT_SUCCESS;
+	struct helper_pool *pool = NULL;
+
+	if (argc < 4 || argc > 7) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> [<frames> [<conversion threads> [local|<numa node>]]]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		if (argc > 4) {
+			frames = stoi(argv[4]);
+		}
+		if (argc > 5) {
+			threads = stoi(argv[5]);
+		}
+		if (argc > 6) {
+			numa_node = (strcmp(argv[6], "local") == 0) ? HELPER_NUMA_LOCAL : stoi(argv[6]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height, number of frames, threads or NUMA node\n";
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * The counter is opened before the pool is created so that it follows
+	 * the pool's threads.
+	 */
+	dtlb_fd = open_dtlb_counter();
+	if (dtlb_fd >= 0) {
+		ioctl(dtlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	if (threads != 1 && helper_pool_create(&pool, threads, 1) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	vector<unsigned char> bgr(3 * width * height, 0);
+
+	cout << argv[1] << " " << width << "x" << height << " UYVY, " << frames << " frames, "
+		<< ((pool) ? helper_pool_get_num_threads(pool) : 1) << " conversion thread(s)\n";
+	cout << "  allocator           mean       p99      fps   throughput  misses/frame\n";
+
+	for (i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+		if (run_allocator(argv[1], width, height, allocators[i], numa_node, frames, pool, dtlb_fd, bgr) < 0) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	if (pool) {
+		helper_pool_destroy(pool);
+	}
+	if (dtlb_fd >= 0) {
+		close(dtlb_fd);
+	}
+
+	return ret;
+}
@@ -0,0 +1,913 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_bench_matrix.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <strings.h>
+#include <unistd.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_convert.h"
+#include "latency_histogram.hpp"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Runs the benchmark matrix of results/test_results.txt unattended: every
+ * resolution with V4L2 (the helper library) and with VideoCapture, with and
+ * without display. The V4L2 column is further broken down by I/O method,
+ * number of buffers and color conversion backend.
+ *
+ * Every configuration is streamed for a warm-up period (frames not counted)
+ * followed by a number of timed trials. The frame loop is that of the
+ * original sample applications: get a frame, convert it to BGR, optionally
+ * display it and give the buffer back, on a single thread, so that the cost
+ * of the whole path shows up in the frame rate.
+ *
+ * The results are written as CSV (one row per configuration), JSON and in the
+ * ASCII table layout of results/test_results.txt. With a virtual source (see
+ * the README), the matrix can be run without a camera, e.g., to track
+ * performance regressions between releases.
+ */
+
+struct resolution {
+	const char *name;
+	unsigned int width;
+	unsigned int height;
+};
+
+static const resolution all_resolutions[] = {
+	{ "VGA", 640, 480 },
+	{ "HD720", 1280, 720 },
+	{ "HD1080", 1920, 1080 },
+	{ "4K", 3840, 2160 },
+	{ "13MP", 4224, 3156 }
+};
+
+struct io_name {
+	const char *name;
+	enum io_method io;
+};
+
+static const io_name all_io_methods[] = {
+	{ "read", IO_METHOD_READ },
+	{ "mmap", IO_METHOD_MMAP },
+	{ "userptr", IO_METHOD_USERPTR },
+	{ "dmabuf", IO_METHOD_DMABUF }
+};
+
+struct backend_name {
+	const char *name;
+	enum helper_convert_backend backend;
+};
+
+static const backend_name all_backends[] = {
+	{ "auto", HELPER_CONVERT_AUTO },
+	{ "scalar", HELPER_CONVERT_SCALAR },
+	{ "sse4", HELPER_CONVERT_SSE4 },
+	{ "avx2", HELPER_CONVERT_AVX2 },
+	{ "neon", HELPER_CONVERT_NEON }
+};
+
+struct options {
+	string device;
+	vector<resolution> resolutions;
+	vector<io_name> io_methods;
+	vector<unsigned int> buffer_counts;
+	vector<backend_name> backends;
+	bool display;
+	bool videocapture;
+	double warmup_s;
+	double trial_s;
+	unsigned int trials;
+	string output;
+	string profile;           /* Device profile cache, empty for none */
+};
+
+struct config {
+	resolution res;
+	bool v4l2;                /* false: VideoCapture */
+	io_name io;
+	unsigned int buffers;
+	backend_name backend;
+	bool display;
+};
+
+struct result {
+	config cfg;
+	string status;            /* "ok" or why the configuration couldn't be run */
+	vector<double> fps;       /* One per trial */
+	histogram_snapshot frame_times;
+	unsigned long long dropped;
+	unsigned long long errors;
+
+	/*
+	 * Glass to application latency (V4L2 only), measured at each probe point
+	 */
+	bool has_glass;
+	struct helper_latency_stats glass[HELPER_PROBE_POINTS];
+
+	/*
+	 * Time to first frame and the initialisation phases (V4L2 only)
+	 */
+	bool has_init;
+	struct helper_init_times init;
+
+	result(const config &c) : cfg(c), status("ok"), dropped(0), errors(0), has_glass(false), glass(),
+		has_init(false), init() {}
+};
+
+static const char *window_name = "OpenCV V4L2 benchmark";
+
+/**
+ * Start of option parsing helpers
+ */
+static vector<string> split(const string &list)
+{
+	vector<string> items;
+	stringstream ss(list);
+	string item;
+
+	while (getline(ss, item, ',')) {
+		if (!item.empty()) {
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+template <typename T, size_t N>
+static bool parse_names(const string &list, const T (&known)[N], vector<T> &out)
+{
+	vector<string> names = split(list);
+	size_t i, k;
+
+	out.clear();
+	for (i = 0; i < names.size(); i++) {
+		for (k = 0; k < N; k++) {
+			if (strcasecmp(names[i].c_str(), known[k].name) == 0) {
+				out.push_back(known[k]);
+				break;
+			}
+		}
+		if (k == N) {
+			cerr << "Unknown value '" << names[i] << "'\n";
+			return false;
+		}
+	}
+	return !out.empty();
+}
+
+static void usage(const char *prog)
+{
+	cout << "Usage: " << prog << " [options] <device file path>\n"
+		<< "  -r <list>   resolutions (VGA,HD720,HD1080,4K,13MP; default: all)\n"
+		<< "  -i <list>   I/O methods (read,mmap,userptr,dmabuf; default: mmap,userptr,dmabuf)\n"
+		<< "  -b <list>   numbers of buffers (default: 4)\n"
+		<< "  -c <list>   conversion backends (auto,scalar,sse4,avx2,neon; default: all those supported)\n"
+		<< "  -d          also run with display (needs a display)\n"
+		<< "  -v          also run with VideoCapture (needs a /dev/videoN device)\n"
+		<< "  -w <s>      warm-up duration per configuration in seconds (default: 1)\n"
+		<< "  -t <s>      duration of a trial in seconds (default: 2)\n"
+		<< "  -n <n>      number of trials (default: 3)\n"
+		<< "  -o <prefix> output files prefix; <prefix>.csv, <prefix>.json and <prefix>.txt are written\n"
+		<< "              (default: bench_results)\n"
+		<< "  -p <file>   device profile cache, so that all the V4L2 configurations but the first start warm\n";
+}
+
+static bool parse_options(int argc, char **argv, options &opts)
+{
+	size_t i;
+	int c;
+
+	opts.resolutions.assign(all_resolutions, all_resolutions + sizeof(all_resolutions) / sizeof(all_resolutions[0]));
+	opts.io_methods.assign(all_io_methods + 1, all_io_methods + sizeof(all_io_methods) / sizeof(all_io_methods[0]));
+	opts.buffer_counts.assign(1, 4);
+	for (i = 1; i < sizeof(all_backends) / sizeof(all_backends[0]); i++) {
+		if (helper_convert_backend_supported(all_backends[i].backend)) {
+			opts.backends.push_back(all_backends[i]);
+		}
+	}
+	opts.display = false;
+	opts.videocapture = false;
+	opts.warmup_s = 1;
+	opts.trial_s = 2;
+	opts.trials = 3;
+	opts.output = "bench_results";
+
+	try {
+		while ((c = getopt(argc, argv, "r:i:b:c:dvw:t:n:o:p:h")) != -1) {
+			switch (c) {
+				case 'r':
+					if (!parse_names(optarg, all_resolutions, opts.resolutions)) {
+						return false;
+					}
+					break;
+
+				case 'i':
+					if (!parse_names(optarg, all_io_methods, opts.io_methods)) {
+						return false;
+					}
+					break;
+
+				case 'b': {
+					vector<string> counts = split(optarg);
+
+					opts.buffer_counts.clear();
+					for (i = 0; i < counts.size(); i++) {
+						opts.buffer_counts.push_back(stoi(counts[i]));
+					}
+					if (opts.buffer_counts.empty()) {
+						return false;
+					}
+					break;
+				}
+
+				case 'c':
+					if (!parse_names(optarg, all_backends, opts.backends)) {
+						return false;
+					}
+					break;
+
+				case 'd':
+					opts.display = true;
+					break;
+
+				case 'v':
+					opts.videocapture = true;
+					break;
+
+				case 'w':
+					opts.warmup_s = stod(optarg);
+					break;
+
+				case 't':
+					opts.trial_s = stod(optarg);
+					break;
+
+				case 'n':
+					opts.trials = stoi(optarg);
+					break;
+
+				case 'o':
+					opts.output = optarg;
+					break;
+
+				case 'p':
+					opts.profile = optarg;
+					break;
+
+				default:
+					return false;
+			}
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid numeric option\n";
+		return false;
+	}
+
+	if (optind != argc - 1 || opts.trials < 1) {
+		return false;
+	}
+
+	opts.device = argv[optind];
+	return true;
+}
+/**
+ * End of option parsing helpers
+ */
+
+
+/**
+ * Start of measurement helpers
+ */
+
+/*
+ * A source of frames for the timed loop: either a helper context or a
+ * VideoCapture.
+ */
+struct frame_source {
+	struct helper_ctx *ctx;
+	VideoCapture *cap;
+	Mat preview;
+	struct helper_lease lease;   /* Of the last frame, already released */
+
+	/*
+	 * Gets a frame, converts it to BGR into 'preview' and gives the buffer
+	 * back. Returns false in case of failure.
+	 */
+	bool next()
+	{
+		if (cap) {
+			return cap->read(preview) && !preview.empty();
+		}
+
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			return false;
+		}
+
+		/* The lines are as far apart as the driver put them, which may be padded */
+		int ret = helper_convert_uyvy_to_bgr(lease.planes[0].data, lease.planes[0].bytesperline, preview.data,
+			preview.step, preview.cols, preview.rows, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+		helper_ctx_probe_frame(ctx, HELPER_PROBE_CONVERT, &lease.timestamp, lease.flags);
+
+		return helper_ctx_release_lease(ctx, &lease) == 0 && ret == 0;
+	}
+};
+
+/*
+ * Streams for 'seconds' and returns the frame rate, or a negative value in
+ * case of failure. Frame times are recorded in 'frame_times' if given.
+ */
+static double run_for(frame_source &src, double seconds, bool display, latency_histogram *frame_times)
+{
+	uint64_t start = monotonic_ns(), frame_start = start, end = start;
+	unsigned long frames = 0;
+
+	while ((end - start) / 1e9 < seconds) {
+		if (!src.next()) {
+			return -1;
+		}
+
+		if (display) {
+			imshow(window_name, src.preview);
+			waitKey(1);
+			if (src.ctx) {
+				helper_ctx_probe_frame(src.ctx, HELPER_PROBE_DISPLAY, &src.lease.timestamp, src.lease.flags);
+			}
+		}
+
+		frames++;
+		end = monotonic_ns();
+		if (frame_times) {
+			frame_times->record(end - frame_start);
+		}
+		frame_start = end;
+	}
+
+	return frames / ((end - start) / 1e9);
+}
+
+static void run_trials(frame_source &src, const options &opts, result &res)
+{
+	latency_histogram frame_times;
+	unsigned int i;
+	double fps;
+
+	if (run_for(src, opts.warmup_s, res.cfg.display, NULL) < 0) {
+		res.status = "capture failed";
+		return;
+	}
+
+	if (src.ctx) {
+		helper_ctx_reset_stats(src.ctx);
+	}
+
+	for (i = 0; i < opts.trials; i++) {
+		fps = run_for(src, opts.trial_s, res.cfg.display, &frame_times);
+		if (fps < 0) {
+			res.status = "capture failed";
+			return;
+		}
+		res.fps.push_back(fps);
+	}
+	res.frame_times = frame_times.snapshot();
+
+	if (src.ctx) {
+		struct helper_stats stats;
+
+		if (helper_ctx_get_stats(src.ctx, &stats) == 0) {
+			res.dropped = stats.dropped_frames;
+			res.errors = stats.error_frames;
+		}
+
+		res.has_glass = true;
+		for (unsigned int point = 0; point < HELPER_PROBE_POINTS; point++) {
+			if (helper_ctx_get_latency_stats(src.ctx, (enum helper_probe_point) point, &res.glass[point]) < 0) {
+				res.has_glass = false;
+			}
+		}
+	}
+}
+
+static void run_v4l2(const options &opts, result &res)
+{
+	struct helper_cam_params params;
+	frame_source src;
+
+	if (
+		res.cfg.backend.backend != HELPER_CONVERT_AUTO &&
+		!helper_convert_backend_supported(res.cfg.backend.backend)
+	) {
+		res.status = "backend not supported";
+		return;
+	}
+	helper_convert_set_backend(res.cfg.backend.backend);
+
+	helper_cam_params_init(&params, res.cfg.res.width, res.cfg.res.height, V4L2_PIX_FMT_UYVY, res.cfg.io.io);
+	params.num_buffers = res.cfg.buffers;
+	params.profile_path = (opts.profile.empty()) ? NULL : opts.profile.c_str();
+
+	src.cap = NULL;
+	if (helper_ctx_init_cam_params(&src.ctx, opts.device.c_str(), &params) < 0) {
+		res.status = "init failed";
+		return;
+	}
+
+	/*
+	 * The I/O method and the number of buffers affect the latency as well as the frame rate,
+	 * so the glass to application latency is measured too.
+	 */
+	helper_ctx_set_latency_probe(src.ctx, 1);
+
+	/* The frames are converted at the resolution the driver settled on */
+	unsigned int width, height;
+
+	helper_ctx_get_format(src.ctx, &width, &height, NULL);
+	src.preview = Mat(height, width, CV_8UC3);
+	run_trials(src, opts, res);
+
+	/* The first frame was dequeued during the warm-up */
+	res.has_init = (helper_ctx_get_init_times(src.ctx, &res.init) == 0 && res.init.first_frame_ns);
+
+	if (helper_ctx_deinit_cam(src.ctx) < 0) {
+		res.status = "deinit failed";
+	}
+}
+
+static void run_videocapture(const options &opts, result &res)
+{
+	unsigned int index;
+	frame_source src;
+
+	if (sscanf(opts.device.c_str(), "/dev/video%u", &index) != 1) {
+		res.status = "not a /dev/videoN device";
+		return;
+	}
+
+	VideoCapture cap(index + CAP_V4L2);
+	if (!cap.isOpened()) {
+		res.status = "open failed";
+		return;
+	}
+
+	cap.set(CV_CAP_PROP_FRAME_WIDTH, res.cfg.res.width);
+	cap.set(CV_CAP_PROP_FRAME_HEIGHT, res.cfg.res.height);
+	if (
+		(unsigned int) cap.get(CV_CAP_PROP_FRAME_WIDTH) != res.cfg.res.width ||
+		(unsigned int) cap.get(CV_CAP_PROP_FRAME_HEIGHT) != res.cfg.res.height
+	) {
+		res.status = "resolution not supported";
+		return;
+	}
+
+	src.ctx = NULL;
+	src.cap = &cap;
+	run_trials(src, opts, res);
+}
+/**
+ * End of measurement helpers
+ */
+
+
+/**
+ * Start of output helpers
+ */
+static double mean(const vector<double> &v)
+{
+	double sum = 0;
+	size_t i;
+
+	for (i = 0; i < v.size(); i++) {
+		sum += v[i];
+	}
+	return (v.empty()) ? 0 : sum / v.size();
+}
+
+static double stddev(const vector<double> &v)
+{
+	double m = mean(v), sum = 0;
+	size_t i;
+
+	for (i = 0; i < v.size(); i++) {
+		sum += (v[i] - m) * (v[i] - m);
+	}
+	return (v.size() > 1) ? sqrt(sum / (v.size() - 1)) : 0;
+}
+
+static double min_of(const vector<double> &v)
+{
+	return (v.empty()) ? 0 : *min_element(v.begin(), v.end());
+}
+
+static double max_of(const vector<double> &v)
+{
+	return (v.empty()) ? 0 : *max_element(v.begin(), v.end());
+}
+
+/*
+ * Time spent initialising the device, before waiting for the first frame.
+ */
+static double init_ms(const struct helper_init_times &init)
+{
+	unsigned long long ns = 0;
+
+	for (unsigned int phase = 0; phase < HELPER_INIT_FIRST_FRAME; phase++) {
+		ns += init.phase_ns[phase];
+	}
+	return ns / 1e6;
+}
+
+static string io_label(const config &cfg)
+{
+	return (cfg.v4l2) ? cfg.io.name : "mmap";
+}
+
+static void write_csv(ostream &out, const vector<result> &results)
+{
+	size_t i;
+
+	out << "resolution,width,height,api,io,buffers,backend,display,status,trials,"
+		<< "fps_mean,fps_min,fps_max,fps_stddev,frame_p50_ms,frame_p99_ms,frame_max_ms,dropped,errors,"
+		<< "glass_dequeue_p50_ms,glass_dequeue_p99_ms,glass_convert_p99_ms,glass_display_p99_ms,"
+		<< "first_frame_ms,init_ms,warm_start\n";
+	out << fixed << setprecision(2);
+	for (i = 0; i < results.size(); i++) {
+		const result &r = results[i];
+
+		out << r.cfg.res.name << ',' << r.cfg.res.width << ',' << r.cfg.res.height << ','
+			<< ((r.cfg.v4l2) ? "v4l2" : "videocapture") << ',' << io_label(r.cfg) << ','
+			<< ((r.cfg.v4l2) ? to_string(r.cfg.buffers) : "") << ','
+			<< ((r.cfg.v4l2) ? r.cfg.backend.name : "") << ',' << ((r.cfg.display) ? 1 : 0) << ','
+			<< r.status << ',' << r.fps.size() << ','
+			<< mean(r.fps) << ',' << min_of(r.fps) << ',' << max_of(r.fps) << ',' << stddev(r.fps) << ','
+			<< histogram_percentile(r.frame_times, 50) / 1e6 << ','
+			<< histogram_percentile(r.frame_times, 99) / 1e6 << ','
+			<< histogram_percentile(r.frame_times, 100) / 1e6 << ','
+			<< r.dropped << ',' << r.errors << ',';
+		if (r.has_glass && r.glass[HELPER_PROBE_DEQUEUE].frames) {
+			out << r.glass[HELPER_PROBE_DEQUEUE].p50_us / 1e3 << ',' << r.glass[HELPER_PROBE_DEQUEUE].p99_us / 1e3 << ','
+				<< r.glass[HELPER_PROBE_CONVERT].p99_us / 1e3 << ',';
+			if (r.glass[HELPER_PROBE_DISPLAY].frames) {
+				out << r.glass[HELPER_PROBE_DISPLAY].p99_us / 1e3;
+			}
+		} else {
+			out << ",,,";
+		}
+		out << ',';
+		if (r.has_init) {
+			out << r.init.first_frame_ns / 1e6 << ',' << init_ms(r.init) << ',' << r.init.warm_start;
+		} else {
+			out << ",,";
+		}
+		out << '\n';
+	}
+}
+
+/*
+ * Writes the glass to application latency distributions of a result as a JSON object, with
+ * a member per probe point. Points without frames (e.g., display without display, or time
+ * stamps not based on CLOCK_MONOTONIC) are left out.
+ */
+static void write_glass_json(ostream &out, const result &r)
+{
+	static const char *names[HELPER_PROBE_POINTS] = { "dequeue", "convert", "display" };
+	unsigned int point;
+
+	out << "{\"tstamp_src\": \""
+		<< (((r.glass[HELPER_PROBE_DEQUEUE].tstamp_src & V4L2_BUF_FLAG_TSTAMP_SRC_MASK) == V4L2_BUF_FLAG_TSTAMP_SRC_SOE) ?
+			"start_of_exposure" : "end_of_frame")
+		<< "\", \"unsynced_frames\": " << r.glass[HELPER_PROBE_DEQUEUE].unsynced_frames;
+	for (point = 0; point < HELPER_PROBE_POINTS; point++) {
+		const struct helper_latency_stats &stats = r.glass[point];
+
+		if (stats.frames == 0) {
+			continue;
+		}
+		out << ", \"" << names[point] << "\": {\"count\": " << stats.frames << ", \"mean_us\": " << stats.mean_us
+			<< ", \"p50_us\": " << stats.p50_us << ", \"p90_us\": " << stats.p90_us
+			<< ", \"p99_us\": " << stats.p99_us << ", \"p99_9_us\": " << stats.p99_9_us
+			<< ", \"max_us\": " << stats.max_us << "}";
+	}
+	out << "}";
+}
+
+/*
+ * Writes the time to first frame of a result and the time spent in each
+ * initialisation phase as a JSON object.
+ */
+static void write_init_json(ostream &out, const result &r)
+{
+	static const char *names[HELPER_INIT_PHASES] = {
+		"open", "querycap", "profile", "modes", "crop", "format", "buffers", "streamon", "first_frame"
+	};
+	unsigned int phase;
+
+	out << "{\"first_frame_ms\": " << r.init.first_frame_ns / 1e6 << ", \"warm_start\": "
+		<< ((r.init.warm_start) ? "true" : "false") << ", \"phases_ms\": {";
+	for (phase = 0; phase < HELPER_INIT_PHASES; phase++) {
+		out << ((phase) ? ", " : "") << '"' << names[phase] << "\": " << r.init.phase_ns[phase] / 1e6;
+	}
+	out << "}}";
+}
+
+static void write_json(ostream &out, const options &opts, const string &date, const vector<result> &results)
+{
+	size_t i, t;
+
+	out << "{\n  \"device\": \"" << opts.device << "\",\n  \"date\": \"" << date << "\",\n"
+		<< "  \"opencv\": \"" << CV_VERSION << "\",\n  \"warmup_s\": " << opts.warmup_s
+		<< ",\n  \"trial_s\": " << opts.trial_s << ",\n  \"results\": [\n";
+	for (i = 0; i < results.size(); i++) {
+		const result &r = results[i];
+
+		out << "    {\"resolution\": \"" << r.cfg.res.name << "\", \"width\": " << r.cfg.res.width
+			<< ", \"height\": " << r.cfg.res.height
+			<< ", \"api\": \"" << ((r.cfg.v4l2) ? "v4l2" : "videocapture") << "\""
+			<< ", \"io\": \"" << io_label(r.cfg) << "\"";
+		if (r.cfg.v4l2) {
+			out << ", \"buffers\": " << r.cfg.buffers << ", \"backend\": \"" << r.cfg.backend.name << "\"";
+		}
+		out << ", \"display\": " << ((r.cfg.display) ? "true" : "false")
+			<< ", \"status\": \"" << r.status << "\", \"fps\": [";
+		for (t = 0; t < r.fps.size(); t++) {
+			out << ((t) ? ", " : "") << r.fps[t];
+		}
+		out << "], \"frame_time\": ";
+		write_histogram_json(out, r.frame_times);
+		out << ", \"dropped\": " << r.dropped << ", \"errors\": " << r.errors;
+		if (r.has_glass) {
+			out << ", \"glass_to_app\": ";
+			write_glass_json(out, r);
+		}
+		if (r.has_init) {
+			out << ", \"startup\": ";
+			write_init_json(out, r);
+		}
+		out << "}"
+			<< ((i + 1 < results.size()) ? "," : "") << '\n';
+	}
+	out << "  ]\n}\n";
+}
+
+static string center(const string &text, size_t width)
+{
+	size_t left_pad;
+
+	if (text.size() >= width) {
+		return text;
+	}
+	left_pad = (width - text.size()) / 2;
+	return string(left_pad, ' ') + text + string(width - text.size() - left_pad, ' ');
+}
+
+/*
+ * Frame rate as written in results/test_results.txt: a single value when
+ * all the trials agree, the range otherwise.
+ */
+static string table_cell(const result *r)
+{
+	ostringstream cell;
+	long lo, hi;
+
+	if (!r) {
+		return "-";
+	}
+	if (r->status != "ok") {
+		return "n/a";
+	}
+
+	lo = lround(min_of(r->fps));
+	hi = lround(max_of(r->fps));
+	if (lo == hi) {
+		cell << lo;
+	} else {
+		cell << lo << " - " << hi;
+	}
+	return cell.str();
+}
+
+static const result *find_result(const vector<result> &results, const resolution &res, bool v4l2, bool display,
+		const config &reference)
+{
+	size_t i;
+
+	for (i = 0; i < results.size(); i++) {
+		const config &c = results[i].cfg;
+
+		if (
+			strcmp(c.res.name, res.name) == 0 && c.v4l2 == v4l2 && c.display == display &&
+			(!v4l2 || (c.io.io == reference.io.io && c.buffers == reference.buffers &&
+				c.backend.backend == reference.backend.backend))
+		) {
+			return &results[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Writes the results in the layout of results/test_results.txt. The V4L2
+ * column shows the reference configuration (the one used by opencv-v4l2 when
+ * it was measured: USERPTR with the automatically selected backend); all
+ * the V4L2 configurations are listed below the table.
+ */
+static void write_table(ostream &out, const options &opts, const string &date, const vector<result> &results,
+		const config &reference)
+{
+	static const size_t widths[] = { 19, 21, 22, 25 };
+	static const string rule =
+		"_____________________|___________________|_____________________|______________________|_________________________|\n";
+	static const string blank =
+		"                     |                   |                     |                      |                         |\n";
+	size_t i, c;
+
+	out << "----------------\nBenchmark matrix\n----------------\n"
+		<< opts.device << " - " << date << " - opencv " << CV_VERSION << '\n'
+		<< "With V4L2 - " << reference.io.name << ", " << reference.buffers << " buffers, conversion: "
+		<< reference.backend.name << ", With VideoCapture - MMAP\n"
+		<< "Warm-up " << opts.warmup_s << " s, " << opts.trials << " trials of " << opts.trial_s
+		<< " s per configuration (ranges are min - max over the trials)\n\n";
+
+	out << "________________________________________________________________________________________________________________\n"
+		<< "                     |                                         |                                                |\n"
+		<< "                     |                With V4L2                |               With VideoCapture                |\n"
+		<< "_____________________|_________________________________________|________________________________________________|\n"
+		<< blank
+		<< "                     |    With display   |   Without display   |       With display   |      Without display    |\n"
+		<< rule << blank;
+
+	for (i = 0; i < opts.resolutions.size(); i++) {
+		const resolution &res = opts.resolutions[i];
+		ostringstream size, label;
+		const result *cells[4];
+
+		size << res.width << '*' << res.height;
+		label << left << setw(7) << res.name << '(' << center(size.str(), 11) << ") ";
+
+		cells[0] = find_result(results, res, true, true, reference);
+		cells[1] = find_result(results, res, true, false, reference);
+		cells[2] = find_result(results, res, false, true, reference);
+		cells[3] = find_result(results, res, false, false, reference);
+
+		out << label.str() << '|';
+		for (c = 0; c < 4; c++) {
+			out << center(table_cell(cells[c]), widths[c]) << '|';
+		}
+		out << '\n';
+	}
+	out << rule << '\n';
+
+	out << "V4L2 configurations\n-------------------\n" << fixed << setprecision(1);
+	for (i = 0; i < results.size(); i++) {
+		const result &r = results[i];
+
+		if (!r.cfg.v4l2) {
+			continue;
+		}
+
+		out << left << setw(7) << r.cfg.res.name << setw(8) << r.cfg.io.name << right << setw(2)
+			<< r.cfg.buffers << " buffers  " << left << setw(7) << r.cfg.backend.name
+			<< setw(11) << ((r.cfg.display) ? "display" : "no display") << right << ": ";
+		if (r.status != "ok") {
+			out << r.status << '\n';
+			continue;
+		}
+		out << setw(6) << mean(r.fps) << " fps (" << min_of(r.fps) << " - " << max_of(r.fps) << ")"
+			<< ", frame time p99 = " << setprecision(2) << histogram_percentile(r.frame_times, 99) / 1e6
+			<< " ms, dropped = " << r.dropped;
+		if (r.has_glass && r.glass[HELPER_PROBE_DEQUEUE].frames) {
+			out << ", glass to dequeue p99 = " << r.glass[HELPER_PROBE_DEQUEUE].p99_us / 1e3 << " ms";
+		}
+		if (r.has_init) {
+			out << ", first frame after " << r.init.first_frame_ns / 1e6 << " ms"
+				<< ((r.init.warm_start) ? " (warm)" : "");
+		}
+		out << setprecision(1) << '\n';
+	}
+}
+/**
+ * End of output helpers
+ */
+
+
+int main(int argc, char **argv)
+{
+	options opts;
+	vector<result> results;
+	vector<bool> display_modes;
+	config cfg = config(), reference = config();
+	size_t r, i, b, c, d;
+	char date[32];
+	time_t now = time(NULL);
+
+	if (!parse_options(argc, argv, opts)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&now));
+
+	if (opts.display) {
+		namedWindow(window_name);
+		display_modes.push_back(true);
+	}
+	display_modes.push_back(false);
+
+	/*
+	 * Reference configuration shown in the table: the one opencv-v4l2
+	 * uses, when it is part of the matrix.
+	 */
+	reference.io = opts.io_methods[0];
+	for (i = 0; i < opts.io_methods.size(); i++) {
+		if (opts.io_methods[i].io == IO_METHOD_USERPTR) {
+			reference.io = opts.io_methods[i];
+		}
+	}
+	reference.buffers = opts.buffer_counts[0];
+	reference.backend = opts.backends[0];
+	for (i = 0; i < opts.backends.size(); i++) {
+		if (
+			opts.backends[i].backend == HELPER_CONVERT_AUTO ||
+			(reference.backend.backend != HELPER_CONVERT_AUTO && opts.backends[i].backend == helper_convert_get_backend())
+		) {
+			reference.backend = opts.backends[i];
+		}
+	}
+
+	for (r = 0; r < opts.resolutions.size(); r++) {
+		cfg.res = opts.resolutions[r];
+
+		for (d = 0; d < display_modes.size(); d++) {
+			cfg.display = display_modes[d];
+			cfg.v4l2 = true;
+
+			for (i = 0; i < opts.io_methods.size(); i++) {
+				cfg.io = opts.io_methods[i];
+				for (b = 0; b < opts.buffer_counts.size(); b++) {
+					cfg.buffers = opts.buffer_counts[b];
+					for (c = 0; c < opts.backends.size(); c++) {
+						cfg.backend = opts.backends[c];
+
+						results.push_back(result(cfg));
+						run_v4l2(opts, results.back());
+						cout << "[" << results.size() << "] " << cfg.res.name << " v4l2 " << cfg.io.name
+							<< " " << cfg.buffers << " buffers " << cfg.backend.name
+							<< ((cfg.display) ? " display" : "") << ": ";
+						if (results.back().status == "ok") {
+							cout << fixed << setprecision(1) << mean(results.back().fps) << " fps\n";
+						} else {
+							cout << results.back().status << '\n';
+						}
+					}
+				}
+			}
+
+			if (opts.videocapture) {
+				cfg.v4l2 = false;
+				results.push_back(result(cfg));
+				run_videocapture(opts, results.back());
+				cout << "[" << results.size() << "] " << cfg.res.name << " videocapture"
+					<< ((cfg.display) ? " display" : "") << ": ";
+				if (results.back().status == "ok") {
+					cout << fixed << setprecision(1) << mean(results.back().fps) << " fps\n";
+				} else {
+					cout << results.back().status << '\n';
+				}
+			}
+		}
+	}
+
+	if (opts.display) {
+		destroyWindow(window_name);
+	}
+	helper_convert_set_backend(HELPER_CONVERT_AUTO);
+
+	ofstream csv((opts.output + ".csv").c_str()), json((opts.output + ".json").c_str()), table((opts.output + ".txt").c_str());
+	if (!csv || !json || !table) {
+		cerr << "Could not write the results to " << opts.output << ".{csv,json,txt}\n";
+		return EXIT_FAILURE;
+	}
+
+	write_csv(csv, results);
+	write_json(json, opts, date, results);
+	write_table(table, opts, date, results, reference);
+	write_table(cout, opts, date, results, reference);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_capture.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include "latency_histogram.hpp"
+#include "pixel_format.hpp"
+#include "v4l2_capture.hpp"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * opencv_main.cpp ported to v4l2_capture (see v4l2_capture.hpp): the capture loop is
+ * unchanged but the frames come from the helper library rather than from the V4L2
+ * backend of VideoCapture.
+ */
+
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
+{
+	keep_running = false;
+}
+
+/*
+ * Finds the fourcc of the format called 'name' (see pixel_format.hpp).
+ */
+struct format_fourcc {
+	uint32_t fourcc;
+
+	template <typename Format>
+	void apply()
+	{
+		fourcc = Format::fourcc;
+	}
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height;
+	unsigned int fps = 0, frames = 0, dropped = 0, next_sequence = 0;
+	uint64_t start, end, frame_start, step_start;
+	format_fourcc format = { V4L2_PIX_FMT_UYVY };
+	bool use_frames = false;
+	v4l2_capture cap;
+	ofstream report_file;
+	ostream *report = NULL;
+
+	/*
+	 * Same stages as in opencv_main.cpp. In 'frame' mode, 'convert' is the conversion
+	 * of the v4l2_frame and the buffer is requeued when the frame goes out of scope,
+	 * after the display.
+	 */
+	latency_report latency;
+	latency_histogram &dequeue_latency = latency.add_stage("dequeue");
+	latency_histogram &convert_latency = latency.add_stage("convert");
+	latency_histogram &display_latency = latency.add_stage("display");
+	latency_histogram &end_to_end_latency = latency.add_stage("end_to_end");
+
+	Mat frame;
+
+	if (argc < 4 || argc > 7)
+	{
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> [<format> [mat|frame [<latency report>]]]\n";
+		cout << "<format>: " << pixel_format_names() << " (default: uyvy)\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+	} catch (exception const &ex) {
+		cerr << "Invalid width or height\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 4 && !visit_pixel_format(argv[4], format))
+	{
+		cerr << "Unsupported format " << argv[4] << " (" << pixel_format_names() << ")\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 5)
+	{
+		if (strcmp(argv[5], "frame") == 0)
+		{
+			use_frames = true;
+		}
+		else if (strcmp(argv[5], "mat") != 0)
+		{
+			cerr << "Unknown mode " << argv[5] << " (mat|frame)\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc > 6 && argv[6][0] != '\0')
+	{
+		if (strcmp(argv[6], "-") == 0)
+		{
+			report = &cout;
+		}
+		else
+		{
+			report_file.open(argv[6]);
+			if (!report_file)
+			{
+				cerr << "Could not open latency report " << argv[6] << '\n';
+				return EXIT_FAILURE;
+			}
+			report = &report_file;
+		}
+	}
+
+	cap.set(CAP_PROP_FRAME_WIDTH, width);
+	cap.set(CAP_PROP_FRAME_HEIGHT, height);
+	cap.set(CAP_PROP_FOURCC, format.fourcc);
+	if (!cap.open(argv[1]))  // check if we succeeded
+		return EXIT_FAILURE;
+	cout << "Current resolution: Width: " << cap.get(CAP_PROP_FRAME_WIDTH) << " Height: " << cap.get(CAP_PROP_FRAME_HEIGHT)
+		<< " Buffers: " << cap.get(CAP_PROP_BUFFERSIZE) << '\n';
+
+#ifdef ENABLE_DISPLAY
+	namedWindow("preview");
+	cout << "Note: Click 'Esc' key to exit the window.\n";
+#endif
+
+	signal(SIGINT, stop_streaming);
+	signal(SIGTERM, stop_streaming);
+
+	start = monotonic_ns();
+	while (keep_running) {
+		v4l2_frame captured;
+
+		frame_start = monotonic_ns();
+		if (use_frames)
+		{
+			/*
+			 * The frame owns the buffer; 'frame' (the BGR image) doesn't point to it.
+			 */
+			cap.read(captured);
+			step_start = dequeue_latency.record_since(frame_start);
+			if (captured.empty() || !cap.convert_frame(captured, frame))
+			{
+				cerr << "Could not get a frame from the camera!\n";
+				return EXIT_FAILURE;
+			}
+
+			if (frames && captured.sequence() > next_sequence)
+			{
+				dropped += captured.sequence() - next_sequence;
+			}
+			next_sequence = captured.sequence() + 1;
+		}
+		else
+		{
+			cap.grab();
+			step_start = dequeue_latency.record_since(frame_start);
+			cap.retrieve(frame);
+		}
+		step_start = convert_latency.record_since(step_start);
+		if (frame.empty())
+		{
+			cerr << "Empty frame received from camera!\n";
+			return EXIT_FAILURE;
+		}
+
+#ifdef ENABLE_DISPLAY
+		imshow("preview", frame);
+		if(waitKey(1) == 27) break;
+#endif
+		end = display_latency.record_since(step_start);
+		end_to_end_latency.record_since(frame_start);
+
+		fps++;
+		frames++;
+		if ((end - start) >= 1000000000ULL) {
+			cout << "fps = " << fps;
+			if (use_frames)
+			{
+				cout << " dropped = " << dropped;
+				dropped = 0;
+			}
+			cout << endl;
+			if (report)
+			{
+				latency.write_interval(*report, fps);
+			}
+			fps = 0;
+			start = end;
+		}
+	}
+
+	if (report)
+	{
+		latency.write_total(*report, frames);
+	}
+
+	// the device is closed in the v4l2_capture destructor
+	return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_convert_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <time.h>
+#include "v4l2_helper_convert.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Checks the UYVY and NV12 to BGR conversions of the helper library (with
+ * every backend supported by the CPU) against cv::cvtColor and compares their
+ * speed, for the resolutions listed in results/test_results.txt. In 'scaling' mode, the
+ * stripe-parallel conversion is measured with an increasing number of threads
+ * instead.
+ *
+ * The input is random data, so that every combination of Y, U and V values is
+ * likely to be exercised. The conversion is done into preallocated matrices,
+ * as in opencv_v4l2.cpp.
+ */
+
+struct resolution {
+	const char *name;
+	int width;
+	int height;
+};
+
+static const resolution resolutions[] = {
+	{ "VGA", 640, 480 },
+	{ "HD720", 1280, 720 },
+	{ "HD1080", 1920, 1080 },
+	{ "4K", 3840, 2160 },
+	{ "13MP", 4224, 3156 }
+};
+
+static const enum helper_convert_backend backends[] = {
+	HELPER_CONVERT_SCALAR,
+	HELPER_CONVERT_SSE4,
+	HELPER_CONVERT_AVX2,
+	HELPER_CONVERT_NEON
+};
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_result(const string &name, double seconds, unsigned int iterations, const string &check)
+{
+	double ms = 1e3 * seconds / iterations;
+
+	cout << "    " << left << setw(10) << name << right << fixed << setprecision(3)
+		<< setw(9) << ms << " ms" << setprecision(1) << setw(9) << 1e3 / ms << " fps  " << check << '\n';
+}
+
+static int compare_backends(unsigned int iterations)
+{
+	unsigned int i, r, b;
+	int ret = EXIT_SUCCESS;
+
+	for (r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+		const resolution &res = resolutions[r];
+		Mat uyvy_frame(res.height, res.width, CV_8UC2);
+		Mat reference, preview(res.height, res.width, CV_8UC3);
+		double start;
+
+		randu(uyvy_frame, 0, 256);
+		cout << res.name << " (" << res.width << "x" << res.height << "):\n";
+
+		/*
+		 * cv::cvtColor converts UYVY using BT.601 limited range
+		 * coefficients.
+		 */
+		cvtColor(uyvy_frame, reference, COLOR_YUV2BGR_UYVY);
+		start = wall_seconds();
+		for (i = 0; i < iterations; i++) {
+			cvtColor(uyvy_frame, reference, COLOR_YUV2BGR_UYVY);
+		}
+		print_result("cvtColor", wall_seconds() - start, iterations, "");
+
+		for (b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+			string check;
+
+			if (
+				!helper_convert_backend_supported(backends[b]) ||
+				helper_convert_set_backend(backends[b]) < 0
+			) {
+				continue;
+			}
+
+			preview.setTo(0);
+			if (
+				helper_convert_uyvy_to_bgr(uyvy_frame.data, uyvy_frame.step, preview.data, preview.step,
+					res.width, res.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED) < 0
+			) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+
+			/*
+			 * The fixed point arithmetic differs slightly from that of
+			 * cv::cvtColor; a difference of one level is expected.
+			 */
+			if (norm(reference, preview, NORM_INF) <= 1) {
+				check = "(matches cvtColor)";
+			} else {
+				check = "(MISMATCH with cvtColor)";
+				ret = EXIT_FAILURE;
+			}
+
+			start = wall_seconds();
+			for (i = 0; i < iterations; i++) {
+				helper_convert_uyvy_to_bgr(uyvy_frame.data, uyvy_frame.step, preview.data, preview.step,
+					res.width, res.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+			}
+			print_result(helper_convert_backend_name(backends[b]), wall_seconds() - start, iterations, check);
+		}
+		cout << endl;
+	}
+
+	helper_convert_set_backend(HELPER_CONVERT_AUTO);
+	cout << "Backend selected at run time: " << helper_convert_backend_name(helper_convert_get_backend()) << '\n';
+
+	return ret;
+}
+
+/*
+ * NV12 frames captured with the multi-planar API have their Y and CbCr planes
+ * in separate buffers. cv::cvtColor needs them back to back, so it's measured
+ * along with the copy that makes the frame contiguous ("copy+cvtColor")
+ * whereas the helper library converts straight from the planes.
+ */
+static int compare_nv12_backends(unsigned int iterations)
+{
+	unsigned int i, r, b;
+	int ret = EXIT_SUCCESS;
+
+	for (r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+		const resolution &res = resolutions[r];
+		Mat y_plane(res.height, res.width, CV_8UC1), uv_plane(res.height / 2, res.width / 2, CV_8UC2);
+		Mat nv12_frame(res.height * 3 / 2, res.width, CV_8UC1);
+		Mat reference, preview(res.height, res.width, CV_8UC3);
+		double start;
+
+		randu(y_plane, 0, 256);
+		randu(uv_plane, 0, 256);
+		cout << res.name << " NV12 (" << res.width << "x" << res.height << "):\n";
+
+		start = wall_seconds();
+		for (i = 0; i < iterations; i++) {
+			memcpy(nv12_frame.data, y_plane.data, y_plane.total() * y_plane.elemSize());
+			memcpy(nv12_frame.ptr(res.height), uv_plane.data, uv_plane.total() * uv_plane.elemSize());
+			cvtColor(nv12_frame, reference, COLOR_YUV2BGR_NV12);
+		}
+		print_result("copy+cvtColor", wall_seconds() - start, iterations, "");
+
+		for (b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+			string check;
+
+			if (
+				!helper_convert_backend_supported(backends[b]) ||
+				helper_convert_set_backend(backends[b]) < 0
+			) {
+				continue;
+			}
+
+			preview.setTo(0);
+			if (
+				helper_convert_nv12_to_bgr(y_plane.data, y_plane.step, uv_plane.data, uv_plane.step,
+					preview.data, preview.step, res.width, res.height,
+					HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED) < 0
+			) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+
+			if (norm(reference, preview, NORM_INF) <= 1) {
+				check = "(matches cvtColor)";
+			} else {
+				check = "(MISMATCH with cvtColor)";
+				ret = EXIT_FAILURE;
+			}
+
+			start = wall_seconds();
+			for (i = 0; i < iterations; i++) {
+				helper_convert_nv12_to_bgr(y_plane.data, y_plane.step, uv_plane.data, uv_plane.step,
+					preview.data, preview.step, res.width, res.height,
+					HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+			}
+			print_result(helper_convert_backend_name(backends[b]), wall_seconds() - start, iterations, check);
+		}
+		cout << endl;
+	}
+
+	helper_convert_set_backend(HELPER_CONVERT_AUTO);
+
+	return ret;
+}
+
+/*
+ * Converts with the stripe-parallel converter using 1 to 'max_threads'
+ * threads (the backend selected at run time is used). The memory throughput
+ * (bytes read and written per second) is printed along with the speed up, so
+ * that the thread count at which the memory bandwidth saturates shows up as
+ * the point after which the throughput stops increasing.
+ */
+static int thread_scaling(unsigned int iterations, unsigned int max_threads)
+{
+	unsigned int i, r, n;
+	int ret = EXIT_SUCCESS;
+
+	cout << "Backend: " << helper_convert_backend_name(helper_convert_get_backend()) << "\n\n";
+
+	for (r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+		const resolution &res = resolutions[r];
+		Mat uyvy_frame(res.height, res.width, CV_8UC2);
+		Mat reference(res.height, res.width, CV_8UC3), preview(res.height, res.width, CV_8UC3);
+		double single_ms = 0;
+
+		randu(uyvy_frame, 0, 256);
+		helper_convert_uyvy_to_bgr(uyvy_frame.data, uyvy_frame.step, reference.data, reference.step,
+			res.width, res.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+		cout << res.name << " (" << res.width << "x" << res.height << "):\n";
+
+		for (n = 1; n <= max_threads; n++) {
+			struct helper_pool *pool;
+			double start, ms, bytes;
+
+			if (helper_pool_create(&pool, n, 1) < 0) {
+				return EXIT_FAILURE;
+			}
+
+			preview.setTo(0);
+			helper_convert_uyvy_to_bgr_parallel(pool, uyvy_frame.data, uyvy_frame.step, preview.data, preview.step,
+				res.width, res.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+			if (norm(reference, preview, NORM_INF) != 0) {
+				cerr << "Parallel conversion differs from serial conversion\n";
+				ret = EXIT_FAILURE;
+			}
+
+			start = wall_seconds();
+			for (i = 0; i < iterations; i++) {
+				helper_convert_uyvy_to_bgr_parallel(pool, uyvy_frame.data, uyvy_frame.step, preview.data, preview.step,
+					res.width, res.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+			}
+			ms = 1e3 * (wall_seconds() - start) / iterations;
+			if (n == 1) {
+				single_ms = ms;
+			}
+
+			/* 2 bytes read and 3 bytes written per pixel */
+			bytes = 5.0 * res.width * res.height;
+			cout << "    threads = " << setw(2) << n << fixed << setprecision(3) << setw(9) << ms << " ms"
+				<< setprecision(1) << setw(9) << 1e3 / ms << " fps" << setprecision(2)
+				<< setw(7) << bytes / ms / 1e6 << " GB/s" << setw(6) << single_ms / ms << "x"
+				<< "  (stripe = " << helper_pool_get_stripe_rows(pool, res.height, 5 * res.width) << " rows)\n";
+
+			helper_pool_destroy(pool);
+		}
+		cout << endl;
+	}
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 50, max_threads = thread::hardware_concurrency();
+
+	if (argc > 4 || (argc > 2 && strcmp(argv[2], "scaling") != 0)) {
+		cout << "Usage: " << argv[0] << " [<iterations> [scaling [<max threads>]]]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		if (argc > 1) {
+			iterations = stoi(argv[1]);
+		}
+		if (argc > 3) {
+			max_threads = stoi(argv[3]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid number of iterations or threads\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2) {
+		return thread_scaling(iterations, (max_threads) ? max_threads : 1);
+	}
+
+	int uyvy = compare_backends(iterations);
+	int nv12 = compare_nv12_backends(iterations);
+
+	return (uyvy == EXIT_SUCCESS && nv12 == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,243 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_ctrl_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <time.h>
+#include "v4l2_helper.h"
+
+using namespace std;
+
+/*
+ * Runs an automatic exposure like control loop, which updates the exposure
+ * time, the gain and the white balance after every frame, in three ways:
+ *
+ *   set     helper_ctx_set_ctrl() for each control: an ioctl per control
+ *           that changes.
+ *   batch   helper_ctx_stage_ctrl() for each control, then
+ *           helper_ctx_apply_ctrls(): an ioctl per frame.
+ *   frame   helper_ctx_stage_ctrl() for each control in frame controls
+ *           mode: the updates go with the buffer when the lease is released
+ *           (within a request when the driver supports it).
+ *
+ * For each, the control ioctls and the time spent updating the controls
+ * (releasing the lease included) per frame are reported, with the frame
+ * rate.
+ */
+
+enum loop_mode {
+	MODE_SET,
+	MODE_BATCH,
+	MODE_FRAME
+};
+
+static const char *mode_names[] = { "set", "batch", "frame" };
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The controls driven by the loop, among those of the device.
+ */
+struct loop_ctrl {
+	struct helper_ctrl_info info;
+	double period;    /* Frames per oscillation of the target value */
+};
+
+/*
+ * Value of a control at 'frame': a slow oscillation over its range, as an
+ * automatic exposure following a changing scene would set, so that the
+ * value doesn't change with every frame once rounded to the step.
+ */
+static long long target_value(const loop_ctrl &ctrl, unsigned int frame)
+{
+	double low = ctrl.info.minimum, high = ctrl.info.maximum;
+	double mid = (low + high) / 2, amplitude = (high - low) / 4;
+
+	return llround(mid + amplitude * sin(2 * M_PI * frame / ctrl.period));
+}
+
+/*
+ * Looks a control up in the list of the device, as not all devices have
+ * all the controls.
+ */
+static bool find_ctrl(struct helper_ctx *ctx, unsigned int id, struct helper_ctrl_info *info)
+{
+	unsigned int n = helper_ctx_get_num_ctrls(ctx);
+
+	for (unsigned int i = 0; i < n; i++) {
+		if (helper_ctx_enum_ctrl(ctx, i, info) == 0 && info->id == id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void list_ctrls(struct helper_ctx *ctx)
+{
+	struct helper_ctrl_info info;
+	unsigned int n = helper_ctx_get_num_ctrls(ctx);
+
+	cout << n << " controls:\n";
+	for (unsigned int i = 0; i < n; i++) {
+		if (helper_ctx_enum_ctrl(ctx, i, &info) < 0) {
+			continue;
+		}
+		cout << "  0x" << hex << setw(8) << setfill('0') << info.id << dec << setfill(' ') << "  "
+			<< setw(32) << left << info.name << right << " [" << info.minimum << ", " << info.maximum
+			<< "] step " << info.step << " default " << info.default_value;
+		if (info.has_value) {
+			cout << " value " << info.value;
+		}
+		cout << '\n';
+	}
+}
+
+static bool run_loop(struct helper_ctx *ctx, enum loop_mode mode, const vector<loop_ctrl> &ctrls,
+		unsigned int frames, unsigned int first_frame)
+{
+	struct helper_ctrl_stats before, after;
+	struct helper_lease lease;
+	double start, ctrl_seconds = 0;
+
+	if (helper_ctx_set_frame_ctrls(ctx, mode == MODE_FRAME) < 0 || helper_ctx_get_ctrl_stats(ctx, &before) < 0) {
+		return false;
+	}
+
+	start = wall_seconds();
+	for (unsigned int i = 0; i < frames; i++) {
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			return false;
+		}
+
+		/* The frame would be measured here to compute the next values */
+		double ctrl_start = wall_seconds();
+		for (const loop_ctrl &ctrl : ctrls) {
+			long long value = target_value(ctrl, first_frame + i);
+
+			if (mode == MODE_SET) {
+				helper_ctx_set_ctrl(ctx, ctrl.info.id, value);
+			} else {
+				helper_ctx_stage_ctrl(ctx, ctrl.info.id, value);
+			}
+		}
+		if (mode == MODE_BATCH) {
+			helper_ctx_apply_ctrls(ctx);
+		}
+		helper_ctx_release_lease(ctx, &lease);
+		ctrl_seconds += wall_seconds() - ctrl_start;
+	}
+	double seconds = wall_seconds() - start;
+
+	helper_ctx_get_ctrl_stats(ctx, &after);
+	cout << setw(8) << left << mode_names[mode] << right << fixed << setprecision(2)
+		<< setw(12) << double(after.ioctls - before.ioctls) / frames
+		<< setw(12) << double(after.writes - before.writes) / frames
+		<< setw(14) << double(after.unchanged - before.unchanged) / frames
+		<< setw(12) << ctrl_seconds / frames * 1e6
+		<< setw(10) << setprecision(1) << frames / seconds
+		<< ((after.requests) ? "  (requests)" : "") << '\n';
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int loop_ids[] = {
+		V4L2_CID_EXPOSURE_ABSOLUTE, V4L2_CID_GAIN, V4L2_CID_WHITE_BALANCE_TEMPERATURE
+	};
+	static const double periods[] = { 120, 90, 300 };
+	unsigned int width, height, format = V4L2_PIX_FMT_UYVY, frames = 600;
+	struct helper_ctx *ctx;
+	vector<loop_ctrl> ctrls;
+	int ret = EXIT_SUCCESS;
+
+	if (argc < 4 || argc > 6) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> [<fourcc> [<frames>]]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		if (argc > 5) {
+			frames = stoi(argv[5]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height or number of frames\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 4) {
+		if (strlen(argv[4]) != 4) {
+			cerr << "Invalid fourcc " << argv[4] << " (e.g., UYVY, NM12, MJPG)\n";
+			return EXIT_FAILURE;
+		}
+		format = v4l2_fourcc(argv[4][0], argv[4][1], argv[4][2], argv[4][3]);
+	}
+
+	if (frames == 0) {
+		cerr << "At least one frame is needed\n";
+		return EXIT_FAILURE;
+	}
+
+	if (helper_ctx_init_cam(&ctx, argv[1], width, height, format, IO_METHOD_MMAP) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	list_ctrls(ctx);
+
+	/* The automatic modes would override the values set by the loop */
+	struct helper_ctrl_info info;
+	if (find_ctrl(ctx, V4L2_CID_EXPOSURE_AUTO, &info)) {
+		helper_ctx_set_ctrl(ctx, info.id, V4L2_EXPOSURE_MANUAL);
+	}
+	if (find_ctrl(ctx, V4L2_CID_AUTO_WHITE_BALANCE, &info)) {
+		helper_ctx_set_ctrl(ctx, info.id, 0);
+	}
+
+	for (unsigned int i = 0; i < sizeof(loop_ids) / sizeof(loop_ids[0]); i++) {
+		loop_ctrl ctrl;
+
+		if (find_ctrl(ctx, loop_ids[i], &ctrl.info)) {
+			ctrl.period = periods[i];
+			ctrls.push_back(ctrl);
+		}
+	}
+	if (ctrls.empty()) {
+		cerr << "The device has none of the exposure time, gain and white balance temperature controls\n";
+		helper_ctx_deinit_cam(ctx);
+		return EXIT_FAILURE;
+	}
+
+	cout << '\n' << frames << " frames per run, updating";
+	for (const loop_ctrl &ctrl : ctrls) {
+		cout << " '" << ctrl.info.name << "'";
+	}
+	cout << " after each frame\n";
+	cout << setw(8) << left << "mode" << right << setw(12) << "ioctls/fr" << setw(12) << "writes/fr"
+		<< setw(14) << "unchanged/fr" << setw(12) << "us/fr" << setw(10) << "fps" << '\n';
+
+	for (unsigned int mode = MODE_SET; mode <= MODE_FRAME; mode++) {
+		if (!run_loop(ctx, static_cast<enum loop_mode>(mode), ctrls, frames, mode * frames)) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+	}
+
+	helper_ctx_deinit_cam(ctx);
+	return ret;
+}
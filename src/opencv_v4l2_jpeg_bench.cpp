@@ -0,0 +1,287 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_jpeg_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_jpeg.h"
+
+using namespace std;
+
+/*
+ * Measures the MJPEG decoding throughput of the helper library's decoder pool
+ * (see v4l2_helper_jpeg.h) with an increasing number of threads, decoding to
+ * BGR and to YUV, and reports it per core.
+ *
+ * The frames are captured once from the device (usually a recorded clip
+ * replayed by a virtual source, e.g. file:clip.mjpeg) and then decoded from
+ * memory, so that the capture doesn't limit the throughput. Before timing,
+ * every configuration is checked to give the frames back in order and
+ * bit-exact with a serial decode.
+ */
+
+struct frame_set {
+	vector<vector<unsigned char>> frames;
+	unsigned int width;
+	unsigned int height;
+};
+
+struct image_buffer {
+	vector<unsigned char> data;
+	struct helper_jpeg_image image;
+
+	image_buffer(enum helper_jpeg_output output, unsigned int width, unsigned int height)
+	{
+		size_t plane = (size_t) width * height;
+
+		memset(&image, 0, sizeof(image));
+		image.output = output;
+		image.width = width;
+		image.height = height;
+		data.resize(plane * 3);
+		if (output == HELPER_JPEG_BGR) {
+			image.planes[0] = data.data();
+			image.strides[0] = (size_t) width * 3;
+		} else {
+			for (unsigned int p = 0; p < 3; p++) {
+				image.planes[p] = data.data() + p * plane;
+				image.strides[p] = width;
+			}
+		}
+	}
+};
+
+static double clock_seconds(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int capture_frames(const char *dev, unsigned int width, unsigned int height, unsigned int n_frames, frame_set &set)
+{
+	struct helper_ctx *ctx;
+	struct helper_lease lease;
+	int ret = 0;
+
+	if (helper_ctx_init_cam(&ctx, dev, width, height, V4L2_PIX_FMT_MJPEG, IO_METHOD_MMAP) < 0) {
+		cerr << "Could not initialise " << dev << " for MJPEG capture\n";
+		return ERR;
+	}
+
+	set.width = width;
+	set.height = height;
+	while (set.frames.size() < n_frames) {
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			ret = ERR;
+			break;
+		}
+
+		if (!(lease.flags & V4L2_BUF_FLAG_ERROR) && lease.bytesused) {
+			set.frames.push_back(vector<unsigned char>(lease.data, lease.data + lease.bytesused));
+		}
+
+		if (helper_ctx_release_lease(ctx, &lease) < 0) {
+			ret = ERR;
+			break;
+		}
+	}
+
+	if (helper_ctx_deinit_cam(ctx) < 0) {
+		ret = ERR;
+	}
+
+	return ret;
+}
+
+/*
+ * Decodes every frame 'iterations' times through a pool of 'n_threads'
+ * threads. The frames are checked to come back in order and, when
+ * 'reference' is given, to match it.
+ */
+static int run_pool(const frame_set &set, enum helper_jpeg_output output, unsigned int n_threads,
+		unsigned int iterations, const vector<image_buffer> *reference, double &wall, double &cpu)
+{
+	struct helper_jpeg_decoder *dec;
+	struct helper_jpeg_image *image;
+	vector<image_buffer> images;
+	size_t n_frames = set.frames.size(), submitted = 0, collected = 0, total = n_frames * iterations;
+	unsigned int max_in_flight;
+	double wall_start, cpu_start;
+	void *tag;
+	int status, ret = 0;
+
+	if (helper_jpeg_decoder_create(&dec, n_threads, 0) < 0) {
+		return ERR;
+	}
+
+	max_in_flight = helper_jpeg_decoder_get_max_in_flight(dec);
+	images.reserve(max_in_flight);
+	for (unsigned int i = 0; i < max_in_flight; i++) {
+		images.emplace_back(output, set.width, set.height);
+	}
+
+	wall_start = clock_seconds(CLOCK_MONOTONIC);
+	cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+	while (collected < total) {
+		if (submitted < total && submitted - collected < max_in_flight) {
+			const vector<unsigned char> &frame = set.frames[submitted % n_frames];
+
+			if (helper_jpeg_decoder_submit(dec, frame.data(), frame.size(),
+						&images[submitted % max_in_flight].image, (void *) submitted) < 0) {
+				ret = ERR;
+				break;
+			}
+			submitted++;
+			continue;
+		}
+
+		if (helper_jpeg_decoder_collect(dec, &image, &tag, &status) < 0) {
+			ret = ERR;
+			break;
+		}
+
+		if (status < 0) {
+			cerr << "Frame " << collected % n_frames << " couldn't be decoded\n";
+			ret = ERR;
+		} else if ((size_t) tag != collected) {
+			cerr << "Frame " << (size_t) tag << " was collected in place of frame " << collected << '\n';
+			ret = ERR;
+		} else if (reference && memcmp(images[collected % max_in_flight].data.data(),
+					(*reference)[collected % n_frames].data.data(),
+					(*reference)[collected % n_frames].data.size()) != 0) {
+			cerr << "Frame " << collected % n_frames << " differs from the serial decode\n";
+			ret = ERR;
+		}
+		collected++;
+	}
+	cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+	wall = clock_seconds(CLOCK_MONOTONIC) - wall_start;
+
+	helper_jpeg_decoder_close(dec);
+	helper_jpeg_decoder_destroy(dec);
+
+	return ret;
+}
+
+static int bench_output(const frame_set &set, enum helper_jpeg_output output, unsigned int iterations, unsigned int max_threads)
+{
+	vector<image_buffer> reference;
+	double wall, cpu, serial_wall = 0;
+	unsigned int n;
+	int ret = 0;
+
+	/*
+	 * Serial decode, on the calling thread, as the reference
+	 */
+	reference.reserve(set.frames.size());
+	for (size_t i = 0; i < set.frames.size(); i++) {
+		reference.emplace_back(output, set.width, set.height);
+		if (helper_jpeg_decode(set.frames[i].data(), set.frames[i].size(), &reference.back().image) < 0) {
+			cerr << "Frame " << i << " couldn't be decoded\n";
+			return ERR;
+		}
+	}
+
+	cout << ((output == HELPER_JPEG_BGR) ? "BGR" : "YUV") << " output\n"
+		<< "    threads        fps   fps/thread  fps/core-s  speedup  check\n";
+
+	for (n = 1; n <= max_threads; n++) {
+		const char *check = "ok";
+
+		if (run_pool(set, output, n, 1, &reference, wall, cpu) < 0) {
+			check = "FAILED";
+			ret = ERR;
+		}
+
+		if (run_pool(set, output, n, iterations, NULL, wall, cpu) < 0) {
+			return ERR;
+		}
+		if (n == 1) {
+			serial_wall = wall;
+		}
+
+		/*
+		 * fps/core-s: frames decoded per second of CPU time used by the
+		 * process, which doesn't depend on the cores being idle
+		 */
+		double frames = (double) set.frames.size() * iterations;
+
+		cout << fixed << setprecision(1)
+			<< setw(11) << n
+			<< setw(11) << frames / wall
+			<< setw(13) << frames / wall / n
+			<< setw(12) << ((cpu > 0) ? frames / cpu : 0.0)
+			<< setprecision(2) << setw(9) << serial_wall / wall
+			<< "  " << check << '\n';
+	}
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, n_frames = 60, iterations = 5, max_threads;
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	frame_set set;
+
+	max_threads = (n_cpus > 0) ? (unsigned int) n_cpus : 1;
+
+	if (argc < 4 || argc > 7) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> [<frames> [<iterations> [<max threads>]]]\n"
+			<< "e.g.:  " << argv[0] << " file:clip.mjpeg 1280 720\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		if (argc > 4) {
+			n_frames = stoi(argv[4]);
+		}
+		if (argc > 5) {
+			iterations = stoi(argv[5]);
+		}
+		if (argc > 6) {
+			max_threads = stoi(argv[6]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height, number of frames, iterations or threads\n";
+		return EXIT_FAILURE;
+	}
+
+	if (n_frames == 0 || iterations == 0 || max_threads == 0) {
+		cerr << "The number of frames, iterations and threads must be positive\n";
+		return EXIT_FAILURE;
+	}
+
+	if (capture_frames(argv[1], width, height, n_frames, set) < 0 || set.frames.empty()) {
+		cerr << "Could not capture MJPEG frames from " << argv[1] << '\n';
+		return EXIT_FAILURE;
+	}
+
+	size_t bytes = 0;
+
+	for (size_t i = 0; i < set.frames.size(); i++) {
+		bytes += set.frames[i].size();
+	}
+	cout << set.frames.size() << " frames of " << width << "x" << height << ", "
+		<< bytes / set.frames.size() / 1024 << " KiB on average; " << iterations << " iterations, "
+		<< n_cpus << " online CPUs\n";
+
+	int bgr = bench_output(set, HELPER_JPEG_BGR, iterations, max_threads);
+	int yuv = bench_output(set, HELPER_JPEG_YUV, iterations, max_threads);
+
+	return (bgr < 0 || yuv < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_loop_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_loop.h"
+
+using namespace std;
+
+/*
+ * Compares the CPU time spent per frame when streaming from multiple devices
+ * using a thread (and a select() call per frame) per device, as done with
+ * helper_ctx_get_cam_frame(), against a single epoll based event loop
+ * (helper_loop) serving all the devices.
+ *
+ * Frames are released as soon as they are received so that only the cost of
+ * waiting for and dequeueing/queueing frames is measured.
+ */
+
+static double cpu_seconds()
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static atomic<bool> keep_running(true);
+static atomic<unsigned long> total_frames(0);
+static atomic<unsigned long> total_stalls(0);
+
+static void select_stream(struct helper_ctx *ctx)
+{
+	unsigned char* ptr_cam_frame;
+	int bytes_used;
+
+	while (keep_running) {
+		if (
+			helper_ctx_get_cam_frame(ctx, &ptr_cam_frame, &bytes_used) < 0 ||
+			helper_ctx_release_cam_frame(ctx) < 0
+		) {
+			break;
+		}
+		total_frames++;
+	}
+}
+
+static void on_loop_event(const struct helper_loop_event *event, void *)
+{
+	switch (event->type) {
+		case HELPER_LOOP_FRAME:
+			helper_ctx_release_lease(event->ctx, &event->lease);
+			total_frames++;
+			break;
+
+		case HELPER_LOOP_STALL:
+		case HELPER_LOOP_ERROR:
+			total_stalls++;
+			break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, seconds, i;
+	vector<struct helper_ctx*> ctxs;
+	double cpu_start, wall_start, cpu_used, wall_used;
+	int ret = EXIT_SUCCESS;
+
+	if (argc < 6 || (strcmp(argv[1], "select") != 0 && strcmp(argv[1], "epoll") != 0)) {
+		cout << "Usage: " << argv[0] << " <select|epoll> <seconds> <width> <height> <device file path> [<device file path> ...]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		seconds = stoi(argv[2]);
+		width = stoi(argv[3]);
+		height = stoi(argv[4]);
+	} catch (exception const &ex) {
+		cerr << "Invalid duration, width or height\n";
+		return EXIT_FAILURE;
+	}
+
+	for (i = 5; i < (unsigned int) argc; i++) {
+		struct helper_ctx *ctx;
+
+		if (helper_ctx_init_cam(&ctx, argv[i], width, height, V4L2_PIX_FMT_UYVY, IO_METHOD_USERPTR) < 0) {
+			cerr << "Could not initialise " << argv[i] << '\n';
+			ret = EXIT_FAILURE;
+			break;
+		}
+		ctxs.push_back(ctx);
+	}
+
+	if (ret == EXIT_SUCCESS) {
+		cpu_start = cpu_seconds();
+		wall_start = wall_seconds();
+
+		if (strcmp(argv[1], "select") == 0) {
+			vector<thread> threads;
+
+			for (i = 0; i < ctxs.size(); i++) {
+				threads.push_back(thread(select_stream, ctxs[i]));
+			}
+
+			sleep(seconds);
+			keep_running = false;
+
+			for (i = 0; i < threads.size(); i++) {
+				threads[i].join();
+			}
+		} else {
+			struct helper_loop *loop;
+
+			if (helper_loop_create(&loop, 2000) < 0) {
+				ret = EXIT_FAILURE;
+			} else {
+				for (i = 0; i < ctxs.size(); i++) {
+					helper_loop_add_cam(loop, ctxs[i], on_loop_event, NULL);
+				}
+
+				while (wall_seconds() - wall_start < seconds) {
+					if (helper_loop_run_once(loop, 100) < 0) {
+						ret = EXIT_FAILURE;
+						break;
+					}
+				}
+
+				helper_loop_destroy(loop);
+			}
+		}
+
+		cpu_used = cpu_seconds() - cpu_start;
+		wall_used = wall_seconds() - wall_start;
+
+		cout << "mode = " << argv[1] << ", streams = " << ctxs.size() << ", frames = " << total_frames
+			<< ", stalls = " << total_stalls << '\n';
+		cout << "fps (all streams) = " << total_frames / wall_used << '\n';
+		cout << "cpu usage = " << 100.0 * cpu_used / wall_used << " %\n";
+		if (total_frames > 0) {
+			cout << "cpu per frame = " << 1e6 * cpu_used / total_frames << " us\n";
+		}
+	}
+
+	for (i = 0; i < ctxs.size(); i++) {
+		if (helper_ctx_deinit_cam(ctxs[i]) < 0) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,194 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_modes.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include "v4l2_helper.h"
+
+using namespace std;
+
+/*
+ * Lists the capture modes of a device or, given a target, initialises the
+ * device in the mode the library selects for it, then streams to compare
+ * the delivered frame rate with the one asked for, along with the estimated
+ * CPU cost of converting the frames.
+ */
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static string fourcc_str(unsigned int format)
+{
+	string str;
+
+	for (unsigned int i = 0; i < 4; i++) {
+		str += static_cast<char>((format >> (8 * i)) & 0xff);
+	}
+	return str;
+}
+
+static string fps_str(const struct v4l2_fract &interval)
+{
+	ostringstream str;
+
+	if (interval.numerator == 0 || interval.denominator == 0) {
+		return "?";
+	}
+	str << fixed << setprecision(2) << double(interval.denominator) / interval.numerator;
+	return str.str();
+}
+
+static void print_mode(const struct helper_mode &mode)
+{
+	cout << "  " << fourcc_str(mode.format) << ((mode.format_flags & V4L2_FMT_FLAG_COMPRESSED) ? " (compressed)" : "")
+		<< "  " << mode.width << 'x' << mode.height;
+	if (mode.max_width != mode.width || mode.max_height != mode.height) {
+		cout << " - " << mode.max_width << 'x' << mode.max_height << " step " << mode.step_width << 'x' << mode.step_height;
+	}
+	cout << "  " << fps_str(mode.interval);
+	if (mode.max_interval.numerator != mode.interval.numerator || mode.max_interval.denominator != mode.interval.denominator) {
+		cout << " - " << fps_str(mode.max_interval);
+	}
+	cout << " fps\n";
+}
+
+static int list_modes(const char *devname)
+{
+	struct helper_ctx *ctx;
+	struct helper_mode mode;
+	unsigned int n;
+
+	/*
+	 * Any mode will do to open the device: the smallest costs the least.
+	 * Monochrome cameras only have modes in formats that must be listed.
+	 */
+	static const unsigned int mono_formats[] = {
+		V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_Y10, V4L2_PIX_FMT_Y12, V4L2_PIX_FMT_Y16
+	};
+	struct helper_mode_target smallest;
+	struct helper_cam_params params;
+
+	memset(&smallest, 0, sizeof(smallest));
+	smallest.min_width = 1;
+	smallest.min_height = 1;
+	helper_cam_params_init(&params, 0, 0, 0, IO_METHOD_MMAP);
+	params.target = &smallest;
+	if (helper_ctx_init_cam_params(&ctx, devname, &params) < 0) {
+		smallest.formats = mono_formats;
+		smallest.n_formats = sizeof(mono_formats) / sizeof(mono_formats[0]);
+		if (helper_ctx_init_cam_params(&ctx, devname, &params) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	n = helper_ctx_get_num_modes(ctx);
+	cout << n << " modes:\n";
+	for (unsigned int i = 0; i < n; i++) {
+		if (helper_ctx_enum_mode(ctx, i, &mode) == 0) {
+			print_mode(mode);
+		}
+	}
+
+	helper_ctx_deinit_cam(ctx);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	struct helper_mode_target target;
+	struct helper_cam_params params;
+	struct helper_ctx *ctx;
+	struct helper_lease lease;
+	struct helper_mode mode;
+	unsigned int frames = 300;
+	int ret = EXIT_SUCCESS;
+
+	if (argc == 2) {
+		return list_modes(argv[1]);
+	}
+
+	if (argc < 5 || argc > 7) {
+		cout << "Usage: " << argv[0] << " <device file path> [<min width> <min height> <min fps> [uncompressed] [<frames>]]\n";
+		return EXIT_FAILURE;
+	}
+
+	memset(&target, 0, sizeof(target));
+	try {
+		target.min_width = stoi(argv[2]);
+		target.min_height = stoi(argv[3]);
+		target.min_fps = stod(argv[4]);
+		for (int i = 5; i < argc; i++) {
+			if (strcmp(argv[i], "uncompressed") == 0) {
+				target.prefer_uncompressed = 1;
+			} else {
+				frames = stoi(argv[i]);
+			}
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height, frame rate or number of frames\n";
+		return EXIT_FAILURE;
+	}
+
+	if (frames == 0) {
+		cerr << "At least one frame is needed\n";
+		return EXIT_FAILURE;
+	}
+
+	helper_cam_params_init(&params, 0, 0, 0, IO_METHOD_MMAP);
+	params.target = &target;
+	if (helper_ctx_init_cam_params(&ctx, argv[1], &params) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	helper_ctx_get_mode(ctx, &mode);
+	double cost = helper_mode_frame_cost(mode.format, mode.width, mode.height);
+	double rate = (mode.interval.numerator) ? double(mode.interval.denominator) / mode.interval.numerator : 0;
+
+	cout << "Mode set:\n";
+	print_mode(mode);
+
+	double start = 0;
+	for (unsigned int i = 0; i <= frames; i++) {
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		helper_ctx_release_lease(ctx, &lease);
+
+		/* The first frame only starts the clock */
+		if (i == 0) {
+			start = wall_seconds();
+		}
+	}
+
+	if (ret == EXIT_SUCCESS) {
+		double fps = frames / (wall_seconds() - start);
+
+		cout << fixed << setprecision(2)
+			<< "Delivered " << fps << " fps (" << ((target.min_fps > 0) ? fps / target.min_fps * 100 : 100.0)
+			<< "% of the target) of " << double(mode.width) * mode.height * fps / 1e6 << " Mpixel/s\n"
+			<< "Estimated conversion cost " << cost * 1e3 << " ms/frame, " << cost * fps * 100
+			<< "% of a CPU core at the delivered rate";
+		if (rate > 0) {
+			cout << ", " << cost * rate * 100 << "% at the mode's rate";
+		}
+		cout << '\n';
+	}
+
+	helper_ctx_deinit_cam(ctx);
+	return ret;
+}
@@ -0,0 +1,168 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_multi.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <sys/time.h>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "v4l2_helper.h"
+
+using namespace std;
+using namespace cv;
+
+unsigned int GetTickCount()
+{
+        struct timeval tv;
+        if(gettimeofday(&tv, NULL) != 0)
+                return 0;
+
+        return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
+{
+	keep_running = false;
+}
+
+/*
+ * State of a single camera stream. Each stream is served by a separate
+ * thread that owns the corresponding helper context.
+ */
+struct cam_stream {
+	const char *videodev;
+	struct helper_ctx *ctx;
+	atomic<unsigned int> frames;
+	atomic<bool> failed;
+
+	cam_stream() : videodev(NULL), ctx(NULL), frames(0), failed(false) {}
+};
+
+static void stream_cam(cam_stream *stream, unsigned int width, unsigned int height)
+{
+	unsigned char* ptr_cam_frame;
+	int bytes_used;
+
+	/*
+	 * Each thread re-uses it's own matrices, as in opencv_v4l2.cpp.
+	 */
+	Mat yuyv_frame = Mat(height, width, CV_8UC2), preview;
+
+	while (keep_running) {
+		if (helper_ctx_get_cam_frame(stream->ctx, &ptr_cam_frame, &bytes_used) < 0) {
+			stream->failed = true;
+			break;
+		}
+
+		yuyv_frame.data = ptr_cam_frame;
+		cvtColor(yuyv_frame, preview, COLOR_YUV2BGR_UYVY);
+
+		if (helper_ctx_release_cam_frame(stream->ctx) < 0) {
+			stream->failed = true;
+			break;
+		}
+
+		stream->frames++;
+	}
+}
+
+/*
+ * Streams from multiple devices simultaneously from a single process, using
+ * one helper context (and one thread) per device. No display is done; the
+ * framerate achieved for each device is printed once every second.
+ */
+int main(int argc, char **argv)
+{
+	unsigned int width, height, start, end;
+	unsigned int num_cams, i;
+	vector<cam_stream> streams;
+	vector<thread> threads;
+	int ret = EXIT_SUCCESS;
+
+	if (argc < 4) {
+		cout << "Usage: " << argv[0] << " <width> <height> <device file path> [<device file path> ...]\n";
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * Courtesy: https://stackoverflow.com/a/2797823
+	 */
+	string width_str = argv[1];
+	string height_str = argv[2];
+	try {
+		size_t pos;
+		width = stoi(width_str, &pos);
+		if (pos < width_str.size()) {
+			cerr << "Trailing characters after width: " << width_str << '\n';
+		}
+
+		height = stoi(height_str, &pos);
+		if (pos < height_str.size()) {
+			cerr << "Trailing characters after height: " << height_str << '\n';
+		}
+	} catch (invalid_argument const &ex) {
+		cerr << "Invalid width or height\n";
+		return EXIT_FAILURE;
+	} catch (out_of_range const &ex) {
+		cerr << "Width or Height out of range\n";
+		return EXIT_FAILURE;
+	}
+
+	num_cams = argc - 3;
+	streams = vector<cam_stream>(num_cams);
+
+	for (i = 0; i < num_cams; i++) {
+		streams[i].videodev = argv[i + 3];
+		if (helper_ctx_init_cam(&streams[i].ctx, streams[i].videodev, width, height, V4L2_PIX_FMT_UYVY, IO_METHOD_USERPTR) < 0) {
+			cerr << "Could not initialise " << streams[i].videodev << '\n';
+			ret = EXIT_FAILURE;
+			break;
+		}
+	}
+
+	if (ret == EXIT_SUCCESS) {
+		signal(SIGINT, stop_streaming);
+		signal(SIGTERM, stop_streaming);
+
+		for (i = 0; i < num_cams; i++) {
+			threads.push_back(thread(stream_cam, &streams[i], width, height));
+		}
+
+		start = GetTickCount();
+		while (keep_running) {
+			usleep(100 * 1000);
+
+			end = GetTickCount();
+			if ((end - start) >= 1000) {
+				for (i = 0; i < num_cams; i++) {
+					cout << streams[i].videodev << ": fps = " << streams[i].frames.exchange(0)
+						<< (streams[i].failed ? " (failed)" : "") << '\n';
+				}
+				cout << endl;
+				start = end;
+			}
+		}
+
+		for (i = 0; i < threads.size(); i++) {
+			threads[i].join();
+		}
+	}
+
+	for (i = 0; i < num_cams; i++) {
+		if (streams[i].ctx && helper_ctx_deinit_cam(streams[i].ctx) < 0) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	return ret;
+}
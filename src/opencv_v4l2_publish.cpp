@@ -0,0 +1,159 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_publish.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <time.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_share.h"
+
+using namespace std;
+
+/*
+ * Captures from a device and publishes its frames to the local processes that
+ * subscribe to them (see v4l2_helper_share.h and opencv-v4l2-subscribe), and
+ * reports every second the frames published and, for each subscriber, the
+ * frames it read and dropped.
+ */
+
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
+{
+	keep_running = false;
+}
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *policy_name(enum helper_share_policy policy)
+{
+	switch (policy) {
+	case HELPER_SHARE_LATEST_ONLY:
+		return "latest";
+	case HELPER_SHARE_BACKPRESSURE:
+		return "backpressure";
+	default:
+		return "oldest";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, format = V4L2_PIX_FMT_UYVY, slots = 8;
+	struct helper_cam_params params;
+	struct helper_ctx *ctx;
+	struct helper_publisher *pub;
+	struct helper_publisher_stats stats, last;
+	struct helper_lease lease;
+	double interval_start, now;
+	int ret = 0;
+
+	if (argc < 5 || argc > 7) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> <socket path>"
+			" [<fourcc> [<slots>]]\n"
+			"A socket path starting with '@' is in the abstract namespace.\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		if (argc > 6) {
+			slots = stoi(argv[6]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height or number of slots\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 5) {
+		if (strlen(argv[5]) != 4) {
+			cerr << "Invalid fourcc " << argv[5] << " (e.g., UYVY, NM12, MJPG)\n";
+			return EXIT_FAILURE;
+		}
+		format = v4l2_fourcc(argv[5][0], argv[5][1], argv[5][2], argv[5][3]);
+	}
+
+	helper_cam_params_init(&params, width, height, format, IO_METHOD_USERPTR);
+	if (helper_ctx_init_cam_params(&ctx, argv[1], &params) < 0) {
+		return EXIT_FAILURE;
+	}
+	helper_ctx_get_format(ctx, &width, &height, NULL);
+
+	if (helper_publisher_create(&pub, ctx, argv[4], slots) < 0) {
+		helper_ctx_deinit_cam(ctx);
+		return EXIT_FAILURE;
+	}
+
+	cout << "Publishing " << argv[1] << " " << width << "x" << height << " on " << argv[4] << " with "
+		<< slots << " slots\n";
+
+	signal(SIGINT, stop_streaming);
+	signal(SIGTERM, stop_streaming);
+
+	memset(&last, 0, sizeof(last));
+	interval_start = wall_seconds();
+	while (keep_running) {
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			ret = -1;
+			break;
+		}
+
+		/* The frame is copied to the ring, so the buffer is requeued right away */
+		int published = helper_publisher_publish(pub, &lease);
+		helper_ctx_release_lease(ctx, &lease);
+		if (published < 0) {
+			ret = -1;
+			break;
+		}
+
+		now = wall_seconds();
+		if (now - interval_start >= 1.0) {
+			double seconds = now - interval_start;
+
+			helper_publisher_get_stats(pub, &stats);
+			cout << fixed << setprecision(1) << setw(7) << (stats.published - last.published) / seconds
+				<< " fps published, " << stats.blocked - last.blocked << " blocked, "
+				<< stats.n_subscribers << " subscribers" << ((stats.has_dmabuf) ? " (dma-buf)" : "") << '\n';
+			for (unsigned int i = 0; i < HELPER_SHARE_MAX_SUBSCRIBERS; i++) {
+				const struct helper_share_subscriber_stats &s = stats.subscribers[i];
+				const struct helper_share_subscriber_stats &l = last.subscribers[i];
+
+				if (!s.active) {
+					continue;
+				}
+				/* A new subscriber in the slot of a gone one starts from 0 */
+				bool fresh = !l.active || l.frames > s.frames || l.dropped > s.dropped;
+				cout << "  [" << i << "] " << setw(12) << left << policy_name(s.policy) << right
+					<< setw(7) << (s.frames - ((fresh) ? 0 : l.frames)) / seconds << " fps, dropped "
+					<< s.dropped - ((fresh) ? 0 : l.dropped) << ", blocked " << s.blocked - ((fresh) ? 0 : l.blocked)
+					<< ", lag " << s.lag << '\n';
+			}
+			last = stats;
+			interval_start = now;
+		}
+	}
+
+	helper_publisher_get_stats(pub, &stats);
+	helper_publisher_destroy(pub);
+	helper_ctx_deinit_cam(ctx);
+
+	cout << "Total: " << stats.published << " frames published, " << stats.blocked << " blocked\n";
+
+	return (ret < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_record.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <time.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_record.h"
+
+using namespace std;
+
+/*
+ * Records the frames of a device to a file with the recorder of the helper
+ * library (see v4l2_helper_record.h) and reports the sustained write
+ * throughput and the frames lost every second: those dropped by the driver
+ * because all the buffers but one were being written.
+ *
+ * Capturing from a pattern source without a frame rate measures the
+ * throughput of the storage; a recording can then be replayed with the
+ * 'record:' virtual source.
+ */
+
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
+{
+	keep_running = false;
+}
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_stats(const char *label, const struct helper_recorder_stats &stats, double seconds,
+	uint64_t frames, uint64_t bytes, uint64_t dropped, uint64_t rejected)
+{
+	cout << label << fixed << setprecision(1) << setw(8) << bytes / seconds / 1e6 << " MB/s"
+		<< setw(8) << frames / seconds << " fps" << "  dropped " << dropped << "  rejected " << rejected
+		<< "  in flight " << stats.in_flight << "/" << stats.max_in_flight << '\n';
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, format = V4L2_PIX_FMT_UYVY, seconds = 10, buffers = 8, batch = 4;
+	struct helper_cam_params params;
+	struct helper_ctx *ctx;
+	struct helper_recorder *rec;
+	struct helper_recorder_stats stats, last;
+	struct helper_lease lease;
+	double start, interval_start, now;
+	int ret = 0;
+
+	if (argc < 5 || argc > 10) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> <recording>"
+			" [<fourcc> [<seconds> [<buffers> [<batch> [heap|thp]]]]]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		if (argc > 6) {
+			seconds = stoi(argv[6]);
+		}
+		if (argc > 7) {
+			buffers = stoi(argv[7]);
+		}
+		if (argc > 8) {
+			batch = stoi(argv[8]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid width, height, duration, number of buffers or batch size\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 5) {
+		if (strlen(argv[5]) != 4) {
+			cerr << "Invalid fourcc " << argv[5] << " (e.g., UYVY, NM12, MJPG)\n";
+			return EXIT_FAILURE;
+		}
+		format = v4l2_fourcc(argv[5][0], argv[5][1], argv[5][2], argv[5][3]);
+	}
+
+	helper_cam_params_init(&params, width, height, format, IO_METHOD_USERPTR);
+	params.num_buffers = buffers;
+	if (argc > 9) {
+		if (strcmp(argv[9], "thp") == 0) {
+			params.alloc_pages = HELPER_ALLOC_THP;
+		} else if (strcmp(argv[9], "heap") != 0) {
+			cerr << "Unknown buffer memory " << argv[9] << " (heap|thp)\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (helper_ctx_init_cam_params(&ctx, argv[1], &params) < 0) {
+		return EXIT_FAILURE;
+	}
+	helper_ctx_get_format(ctx, &width, &height, NULL);
+
+	/* All the buffers but one can be in flight (the default queue depth) */
+	if (helper_recorder_create(&rec, ctx, argv[4], 0, batch) < 0) {
+		helper_ctx_deinit_cam(ctx);
+		return EXIT_FAILURE;
+	}
+
+	cout << "Recording " << argv[1] << " " << width << "x" << height << " to " << argv[4] << " with "
+		<< helper_ctx_get_num_buffers(ctx) << " buffers, batches of " << batch << " frames\n";
+
+	signal(SIGINT, stop_streaming);
+	signal(SIGTERM, stop_streaming);
+
+	memset(&last, 0, sizeof(last));
+	start = interval_start = wall_seconds();
+	while (keep_running) {
+		/*
+		 * With all the writes in flight, the completion of one is waited
+		 * for: frames the storage can't keep up with are then dropped
+		 * by the driver, which has a single buffer left, rather than
+		 * acquired and rejected.
+		 */
+		helper_recorder_get_stats(rec, &stats);
+		helper_recorder_reap(rec, stats.in_flight + 1 >= helper_ctx_get_num_buffers(ctx));
+
+		if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+			ret = -1;
+			break;
+		}
+
+		/*
+		 * The recorder owns the lease once submitted; a rejected one is
+		 * requeued right away.
+		 */
+		int submitted = helper_recorder_submit(rec, &lease);
+		if (submitted != 0) {
+			helper_ctx_release_lease(ctx, &lease);
+			if (submitted < 0) {
+				ret = -1;
+				break;
+			}
+		}
+
+		now = wall_seconds();
+		if (now - interval_start >= 1.0) {
+			helper_recorder_get_stats(rec, &stats);
+			print_stats("", stats, now - interval_start, stats.frames - last.frames, stats.bytes - last.bytes,
+				stats.dropped - last.dropped, stats.rejected - last.rejected);
+			last = stats;
+			interval_start = now;
+		}
+		if (seconds && now - start >= seconds) {
+			break;
+		}
+	}
+
+	/* The writes in flight are waited for so that they count in the totals */
+	while (helper_recorder_reap(rec, 1) > 0) {
+	}
+	helper_recorder_get_stats(rec, &stats);
+	if (helper_recorder_close(rec) < 0) {
+		ret = -1;
+	}
+	helper_ctx_deinit_cam(ctx);
+
+	cout << "Total: " << stats.frames << " frames, " << stats.bytes / (1024 * 1024) << " MB in "
+		<< fixed << setprecision(2) << stats.seconds << " s, " << ((stats.direct) ? "O_DIRECT" : "buffered")
+		<< ", " << stats.write_errors << " write errors\n";
+	print_stats("Sustained:", stats, (stats.seconds > 0) ? stats.seconds : 1, stats.frames, stats.bytes,
+		stats.dropped, stats.rejected);
+
+	return (ret < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
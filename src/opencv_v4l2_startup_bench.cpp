@@ -0,0 +1,167 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_startup_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "v4l2_helper.h"
+
+using namespace std;
+
+/*
+ * Measures the time to first frame of a device, as seen by a service that is
+ * restarted (e.g., by a watchdog): the device is initialised, the first
+ * frame acquired and the device de-initialised, a number of times.
+ *
+ *   cold   without a device profile: the device is probed every time.
+ *   warm   with the device profile given, written beforehand if needed, so
+ *          that the probing is skipped.
+ *
+ * The mean time spent in each initialisation phase (see
+ * helper_ctx_get_init_times()) and the distribution of the time to first
+ * frame are reported for both.
+ */
+
+static const char *phase_names[HELPER_INIT_PHASES] = {
+	"open", "querycap", "profile", "modes", "crop", "format", "buffers", "streamon", "first frame"
+};
+
+struct startup_times {
+	vector<double> first_frame_ms;
+	double phase_ms[HELPER_INIT_PHASES];
+};
+
+/*
+ * Initialises the device, acquires the first frame and de-initialises the
+ * device, adding the times measured to 'times' if given.
+ */
+static bool restart(const char *devname, const struct helper_cam_params &params, startup_times *times)
+{
+	struct helper_init_times init;
+	struct helper_lease lease;
+	struct helper_ctx *ctx;
+
+	if (helper_ctx_init_cam_params(&ctx, devname, &params) < 0) {
+		return false;
+	}
+
+	if (helper_ctx_acquire_lease(ctx, &lease) < 0 || helper_ctx_get_init_times(ctx, &init) < 0) {
+		helper_ctx_deinit_cam(ctx);
+		return false;
+	}
+	helper_ctx_release_lease(ctx, &lease);
+	helper_ctx_deinit_cam(ctx);
+
+	if (times) {
+		times->first_frame_ms.push_back(init.first_frame_ns / 1e6);
+		for (unsigned int phase = 0; phase < HELPER_INIT_PHASES; phase++) {
+			times->phase_ms[phase] += init.phase_ns[phase] / 1e6;
+		}
+	}
+	return true;
+}
+
+static void print_first_frame(const char *label, vector<double> &ms)
+{
+	double sum = 0;
+
+	sort(ms.begin(), ms.end());
+	for (double t : ms) {
+		sum += t;
+	}
+	cout << setw(14) << left << label << right << fixed << setprecision(2)
+		<< setw(10) << sum / ms.size() << setw(10) << ms[ms.size() / 2] << setw(10) << ms.front()
+		<< setw(10) << ms.back() << " ms\n";
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width, height, format = V4L2_PIX_FMT_UYVY, restarts = 10;
+	struct helper_cam_params params;
+	startup_times cold = startup_times(), warm = startup_times();
+	const char *profile = NULL;
+
+	if (argc < 4 || argc > 7) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> [<fourcc> [<restarts> [<profile>]]]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		width = stoi(argv[2]);
+		height = stoi(argv[3]);
+		if (argc > 5) {
+			restarts = stoi(argv[5]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid resolution or number of restarts\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 4) {
+		if (strlen(argv[4]) != 4) {
+			cerr << "Invalid fourcc " << argv[4] << " (e.g., UYVY, NM12, MJPG)\n";
+			return EXIT_FAILURE;
+		}
+		format = v4l2_fourcc(argv[4][0], argv[4][1], argv[4][2], argv[4][3]);
+	}
+
+	if (argc > 6) {
+		profile = argv[6];
+	}
+
+	if (restarts == 0) {
+		cerr << "At least one restart is needed\n";
+		return EXIT_FAILURE;
+	}
+
+	helper_cam_params_init(&params, width, height, format, IO_METHOD_MMAP);
+	for (unsigned int i = 0; i < restarts; i++) {
+		if (!restart(argv[1], params, &cold)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* The first initialisation with the profile writes it if it's missing or stale */
+	if (profile) {
+		params.profile_path = profile;
+		if (!restart(argv[1], params, NULL)) {
+			return EXIT_FAILURE;
+		}
+		for (unsigned int i = 0; i < restarts; i++) {
+			if (!restart(argv[1], params, &warm)) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	cout << '\n' << restarts << " restarts at " << width << "x" << height << "\n\n"
+		<< setw(14) << left << "phase" << right << setw(10) << "cold";
+	if (profile) {
+		cout << setw(10) << "warm";
+	}
+	cout << " (mean, ms)\n" << fixed << setprecision(3);
+	for (unsigned int phase = 0; phase < HELPER_INIT_PHASES; phase++) {
+		cout << setw(14) << left << phase_names[phase] << right << setw(10) << cold.phase_ms[phase] / restarts;
+		if (profile) {
+			cout << setw(10) << warm.phase_ms[phase] / restarts;
+		}
+		cout << '\n';
+	}
+
+	cout << "\nTime to first frame\n"
+		<< setw(14) << "" << setw(10) << "mean" << setw(10) << "median" << setw(10) << "min" << setw(10) << "max" << '\n';
+	print_first_frame("cold", cold.first_frame_ms);
+	if (profile) {
+		print_first_frame("warm", warm.first_frame_ms);
+	}
+
+	return EXIT_SUCCESS;
+}
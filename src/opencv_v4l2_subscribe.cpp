@@ -0,0 +1,160 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_subscribe.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "latency_histogram.hpp"
+#include "v4l2_subscriber.hpp"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Reads the frames published by opencv-v4l2-publish (see v4l2_subscriber.hpp) with a
+ * drop policy, and reports every second the frames read and dropped. '<work ms>'
+ * simulates a consumer slower than the publisher, to see the policy at work; run
+ * several subscribers with different policies at the same time to compare them.
+ */
+
+static atomic<bool> keep_running(true);
+
+static void stop_streaming(int)
+{
+	keep_running = false;
+}
+
+int main(int argc, char **argv)
+{
+	enum helper_share_policy policy = HELPER_SHARE_DROP_OLDEST;
+	unsigned int fps = 0, dropped = 0, work_ms = 0;
+	uint64_t start, end;
+	bool use_frames = false;
+	v4l2_subscriber sub;
+	Mat frame;
+
+	if (argc < 2 || argc > 5)
+	{
+		cout << "Usage: " << argv[0] << " <socket path> [oldest|latest|backpressure [mat|frame [<work ms>]]]\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+	{
+		if (strcmp(argv[2], "latest") == 0)
+		{
+			policy = HELPER_SHARE_LATEST_ONLY;
+		}
+		else if (strcmp(argv[2], "backpressure") == 0)
+		{
+			policy = HELPER_SHARE_BACKPRESSURE;
+		}
+		else if (strcmp(argv[2], "oldest") != 0)
+		{
+			cerr << "Unknown policy " << argv[2] << " (oldest|latest|backpressure)\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc > 3)
+	{
+		if (strcmp(argv[3], "frame") == 0)
+		{
+			use_frames = true;
+		}
+		else if (strcmp(argv[3], "mat") != 0)
+		{
+			cerr << "Unknown mode " << argv[3] << " (mat|frame)\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	try {
+		if (argc > 4)
+		{
+			work_ms = stoi(argv[4]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid work duration\n";
+		return EXIT_FAILURE;
+	}
+
+	if (!sub.open(argv[1], policy))
+		return EXIT_FAILURE;
+	cout << "Subscribed to " << argv[1] << ": Width: " << sub.get_width() << " Height: " << sub.get_height() << '\n';
+
+#ifdef ENABLE_DISPLAY
+	namedWindow("preview");
+	cout << "Note: Click 'Esc' key to exit the window.\n";
+#endif
+
+	signal(SIGINT, stop_streaming);
+	signal(SIGTERM, stop_streaming);
+
+	start = monotonic_ns();
+	while (keep_running) {
+		v4l2_shared_frame shared;
+
+		if (use_frames)
+		{
+			/*
+			 * 'frame' is a header on the ring, valid while 'shared' holds the slot.
+			 */
+			if (!sub.read(shared, 100))
+			{
+				if (!sub.isOpened())
+					break;
+				continue;
+			}
+			dropped += shared.dropped();
+			frame = shared.mat();
+		}
+		else if (!sub.read(frame, 100))
+		{
+			if (!sub.isOpened())
+				break;
+			continue;
+		}
+
+		if (work_ms)
+		{
+			this_thread::sleep_for(chrono::milliseconds(work_ms));
+		}
+
+#ifdef ENABLE_DISPLAY
+		if (!use_frames)
+		{
+			imshow("preview", frame);
+			if(waitKey(1) == 27) break;
+		}
+#endif
+
+		fps++;
+		end = monotonic_ns();
+		if ((end - start) >= 1000000000ULL) {
+			cout << "fps = " << fps;
+			if (use_frames)
+			{
+				cout << " dropped = " << dropped;
+				dropped = 0;
+			}
+			cout << endl;
+			fps = 0;
+			start = end;
+		}
+	}
+
+	if (!sub.isOpened())
+	{
+		cout << "The publisher is gone\n";
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+/*
+ * opencv_v4l2 - opencv_v4l2_switch_bench.cpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include "v4l2_helper.h"
+
+using namespace std;
+
+/*
+ * Measures the time it takes to switch a device between two resolutions (e.g.,
+ * preview and full resolution still capture), back and forth:
+ *
+ *   reconfigure   helper_ctx_reconfigure(): the device stays open and the
+ *                 USERPTR buffers large enough for the new resolution are
+ *                 reused.
+ *   reinit        helper_ctx_deinit_cam() then helper_ctx_init_cam_params():
+ *                 the device is closed and reopened and every buffer is
+ *                 freed and allocated again.
+ *
+ * For each, the time spent in the calls and the time until the first frame at
+ * the new resolution is dequeued are reported, with the buffer memory
+ * allocated per switch.
+ */
+
+struct switch_times {
+	vector<double> call_ms;
+	vector<double> first_frame_ms;
+	double allocated_mb;
+};
+
+static double wall_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_times(const char *label, const char *what, vector<double> &ms)
+{
+	double sum = 0;
+
+	sort(ms.begin(), ms.end());
+	for (double t : ms) {
+		sum += t;
+	}
+	cout << setw(12) << left << label << setw(12) << what << right << fixed << setprecision(2)
+		<< setw(10) << sum / ms.size() << setw(10) << ms[ms.size() / 2] << setw(10) << ms.front()
+		<< setw(10) << ms.back() << " ms\n";
+}
+
+/*
+ * Buffer memory allocated by the last (re)initialisation: all of it but what
+ * was reused.
+ */
+static double allocated_mb(struct helper_ctx *ctx)
+{
+	struct helper_buffer_memory memory;
+
+	if (helper_ctx_get_buffer_memory(ctx, &memory) < 0) {
+		return 0;
+	}
+	return (memory.bytes - memory.reused_bytes) / 1e6;
+}
+
+/*
+ * Acquires (and releases) the first frame after a switch.
+ */
+static bool first_frame(struct helper_ctx *ctx)
+{
+	struct helper_lease lease;
+
+	if (helper_ctx_acquire_lease(ctx, &lease) < 0) {
+		return false;
+	}
+	helper_ctx_release_lease(ctx, &lease);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int widths[2], heights[2], format = V4L2_PIX_FMT_UYVY, switches = 20, buffers = 4;
+	struct helper_cam_params params;
+	struct helper_ctx *ctx;
+	switch_times reconfigure, reinit;
+	double start, called;
+
+	if (argc < 6 || argc > 9) {
+		cout << "Usage: " << argv[0] << " <device file path> <width> <height> <other width> <other height>"
+			" [<fourcc> [<switches> [<buffers>]]]\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		widths[0] = stoi(argv[2]);
+		heights[0] = stoi(argv[3]);
+		widths[1] = stoi(argv[4]);
+		heights[1] = stoi(argv[5]);
+		if (argc > 7) {
+			switches = stoi(argv[7]);
+		}
+		if (argc > 8) {
+			buffers = stoi(argv[8]);
+		}
+	} catch (exception const &ex) {
+		cerr << "Invalid resolution, number of switches or number of buffers\n";
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 6) {
+		if (strlen(argv[6]) != 4) {
+			cerr << "Invalid fourcc " << argv[6] << " (e.g., UYVY, NM12, MJPG)\n";
+			return EXIT_FAILURE;
+		}
+		format = v4l2_fourcc(argv[6][0], argv[6][1], argv[6][2], argv[6][3]);
+	}
+
+	if (switches == 0 || buffers == 0) {
+		cerr << "At least one switch and one buffer are needed\n";
+		return EXIT_FAILURE;
+	}
+
+	helper_cam_params_init(&params, widths[0], heights[0], format, IO_METHOD_USERPTR);
+	params.num_buffers = buffers;
+	if (helper_ctx_init_cam_params(&ctx, argv[1], &params) < 0) {
+		return EXIT_FAILURE;
+	}
+	buffers = helper_ctx_get_num_buffers(ctx);
+
+	reconfigure.allocated_mb = reinit.allocated_mb = 0;
+	for (unsigned int i = 1; i <= switches; i++) {
+		unsigned int mode = i % 2;
+
+		start = wall_seconds();
+		if (helper_ctx_reconfigure(ctx, widths[mode], heights[mode], format) < 0) {
+			helper_ctx_deinit_cam(ctx);
+			return EXIT_FAILURE;
+		}
+		called = wall_seconds();
+		if (!first_frame(ctx)) {
+			helper_ctx_deinit_cam(ctx);
+			return EXIT_FAILURE;
+		}
+		reconfigure.first_frame_ms.push_back((wall_seconds() - start) * 1e3);
+		reconfigure.call_ms.push_back((called - start) * 1e3);
+		reconfigure.allocated_mb += allocated_mb(ctx);
+	}
+
+	for (unsigned int i = 1; i <= switches; i++) {
+		unsigned int mode = (switches + i) % 2;
+
+		start = wall_seconds();
+		helper_ctx_deinit_cam(ctx);
+		params.width = widths[mode];
+		params.height = heights[mode];
+		if (helper_ctx_init_cam_params(&ctx, argv[1], &params) < 0) {
+			return EXIT_FAILURE;
+		}
+		called = wall_seconds();
+		if (!first_frame(ctx)) {
+			helper_ctx_deinit_cam(ctx);
+			return EXIT_FAILURE;
+		}
+		reinit.first_frame_ms.push_back((wall_seconds() - start) * 1e3);
+		reinit.call_ms.push_back((called - start) * 1e3);
+		reinit.allocated_mb += allocated_mb(ctx);
+	}
+	helper_ctx_deinit_cam(ctx);
+
+	cout << '\n' << switches << " switches between " << widths[0] << "x" << heights[0] << " and " << widths[1] << "x"
+		<< heights[1] << " with " << buffers << " USERPTR buffers\n";
+	cout << setw(24) << "" << setw(10) << "mean" << setw(10) << "median" << setw(10) << "min" << setw(10) << "max" << '\n';
+	print_times("reconfigure", "switch", reconfigure.call_ms);
+	print_times("", "first frame", reconfigure.first_frame_ms);
+	print_times("reinit", "switch", reinit.call_ms);
+	print_times("", "first frame", reinit.first_frame_ms);
+	cout << setprecision(1) << "Buffer memory allocated per switch: reconfigure " << reconfigure.allocated_mb / switches
+		<< " MB, reinit " << reinit.allocated_mb / switches << " MB\n";
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,377 @@
+/*
+ * opencv_v4l2 - pixel_format.hpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Compile-time traits of the pixel formats the applications can capture, so
+// that the per-frame code is specialized for a format chosen at startup.
+
+#ifndef PIXEL_FORMAT_HPP
+#define PIXEL_FORMAT_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include "v4l2_helper.h"
+#include "v4l2_helper_convert.h"
+#ifdef V4L2_HELPER_HAVE_JPEG
+#include "v4l2_helper_jpeg.h"
+#endif
+
+/*
+ * Wraps a plane of a lease in a matrix header; no data is copied. The plane keeps the
+ * stride of the buffer, which may be larger than its width (padding added by the driver).
+ */
+inline cv::Mat plane_mat(const struct helper_plane &plane, int type)
+{
+	return cv::Mat(plane.height, plane.width, type, plane.data, plane.bytesperline);
+}
+
+/*
+ * Header on a color plane of a lease, with the stride of the buffer, 'mat_types' being
+ * the OpenCV types of the planes (-1 for compressed formats, whose plane 0 is the image
+ * as it is in the buffer, in a single row).
+ */
+inline cv::Mat lease_mat(const struct helper_lease &lease, const int *mat_types, unsigned int plane)
+{
+	if (plane >= lease.n_planes) {
+		return cv::Mat();
+	}
+	if (mat_types[plane] < 0) {
+		return cv::Mat(1, lease.bytesused, CV_8UC1, lease.data);
+	}
+	return plane_mat(lease.planes[plane], mat_types[plane]);
+}
+
+/*
+ * Traits of a pixel format, specialized for each supported fourcc:
+ *
+ *   fourcc           V4L2 pixel format requested from the device
+ *   name             name of the format on the command line
+ *   n_planes         color planes in the leases of its frames (struct helper_lease)
+ *   bytes_per_pixel  bytes per pixel of the first plane (0 for compressed formats)
+ *   mat_type         OpenCV type of the first plane
+ *   compressed       whether the frames must be decoded (see v4l2_helper_jpeg.h)
+ *                    instead of converted
+ *
+ * and, for uncompressed formats,
+ *
+ *   static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *pool)
+ *
+ * which converts a frame to the preallocated 'bgr' matrix (of the frame's size), with
+ * 'pool' (NULL for none) for the converters of the helper library. Returns a negative value
+ * on error.
+ */
+template <uint32_t FourCC>
+struct pixel_format;
+
+template <>
+struct pixel_format<V4L2_PIX_FMT_UYVY> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_UYVY;
+	static constexpr const char *name = "uyvy";
+	static constexpr unsigned int n_planes = 1;
+	static constexpr unsigned int bytes_per_pixel = 2;
+	static constexpr int mat_type = CV_8UC2;
+	static constexpr bool compressed = false;
+
+	static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *pool)
+	{
+		const struct helper_plane &plane = lease.planes[0];
+
+		return helper_convert_uyvy_to_bgr_parallel(pool, plane.data, plane.bytesperline, bgr.data, bgr.step,
+			plane.width, plane.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+	}
+};
+
+/*
+ * The helper library has no YUYV converter; cv::cvtColor is used, which runs its own
+ * threads.
+ */
+template <>
+struct pixel_format<V4L2_PIX_FMT_YUYV> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_YUYV;
+	static constexpr const char *name = "yuyv";
+	static constexpr unsigned int n_planes = 1;
+	static constexpr unsigned int bytes_per_pixel = 2;
+	static constexpr int mat_type = CV_8UC2;
+	static constexpr bool compressed = false;
+
+	static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *)
+	{
+		cv::cvtColor(plane_mat(lease.planes[0], mat_type), bgr, cv::COLOR_YUV2BGR_YUYV);
+		return 0;
+	}
+};
+
+/*
+ * NV12 is converted straight from its Y and interleaved CbCr planes, wherever they are:
+ * cv::cvtColor(COLOR_YUV2BGR_NV12) would need them back to back.
+ */
+template <>
+struct pixel_format<V4L2_PIX_FMT_NV12> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_NV12;
+	static constexpr const char *name = "nv12";
+	static constexpr unsigned int n_planes = 2;
+	static constexpr unsigned int bytes_per_pixel = 1;
+	static constexpr int mat_type = CV_8UC1;
+	static constexpr bool compressed = false;
+
+	static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *pool)
+	{
+		const struct helper_plane &y = lease.planes[0], &uv = lease.planes[1];
+
+		return helper_convert_nv12_to_bgr_parallel(pool, y.data, y.bytesperline, uv.data, uv.bytesperline,
+			bgr.data, bgr.step, y.width, y.height, HELPER_YUV_BT601, HELPER_YUV_RANGE_LIMITED);
+	}
+};
+
+/*
+ * NV12 with the CbCr plane in a memory plane of its own (multi-planar API only).
+ */
+template <>
+struct pixel_format<V4L2_PIX_FMT_NV12M> : pixel_format<V4L2_PIX_FMT_NV12> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_NV12M;
+	static constexpr const char *name = "nv12m";
+};
+
+template <>
+struct pixel_format<V4L2_PIX_FMT_GREY> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_GREY;
+	static constexpr const char *name = "grey";
+	static constexpr unsigned int n_planes = 1;
+	static constexpr unsigned int bytes_per_pixel = 1;
+	static constexpr int mat_type = CV_8UC1;
+	static constexpr bool compressed = false;
+
+	static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *)
+	{
+		cv::cvtColor(plane_mat(lease.planes[0], mat_type), bgr, cv::COLOR_GRAY2BGR);
+		return 0;
+	}
+};
+
+/*
+ * 16 bit little endian luma (e.g., from monochrome sensors with more than 8 bits per
+ * pixel, left aligned). Only the 8 most significant bits are shown.
+ */
+template <>
+struct pixel_format<V4L2_PIX_FMT_Y16> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_Y16;
+	static constexpr const char *name = "y16";
+	static constexpr unsigned int n_planes = 1;
+	static constexpr unsigned int bytes_per_pixel = 2;
+	static constexpr int mat_type = CV_16UC1;
+	static constexpr bool compressed = false;
+
+	static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *)
+	{
+		const struct helper_plane &plane = lease.planes[0];
+		unsigned int row, col;
+
+		for (row = 0; row < plane.height; row++) {
+			const uint16_t *src = reinterpret_cast<const uint16_t *>(plane.data + (size_t) row * plane.bytesperline);
+			unsigned char *dst = bgr.ptr(row);
+
+			for (col = 0; col < plane.width; col++) {
+				dst[col * 3] = dst[col * 3 + 1] = dst[col * 3 + 2] = (unsigned char) (src[col] >> 8);
+			}
+		}
+		return 0;
+	}
+};
+
+template <>
+struct pixel_format<V4L2_PIX_FMT_RGB24> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_RGB24;
+	static constexpr const char *name = "rgb24";
+	static constexpr unsigned int n_planes = 1;
+	static constexpr unsigned int bytes_per_pixel = 3;
+	static constexpr int mat_type = CV_8UC3;
+	static constexpr bool compressed = false;
+
+	static int convert(const struct helper_lease &lease, cv::Mat &bgr, struct helper_pool *)
+	{
+		cv::cvtColor(plane_mat(lease.planes[0], mat_type), bgr, cv::COLOR_RGB2BGR);
+		return 0;
+	}
+};
+
+/*
+ * A frame is a JPEG image of variable size (the lease's 'bytesused'), decoded by a
+ * helper_jpeg_decoder rather than converted.
+ */
+template <>
+struct pixel_format<V4L2_PIX_FMT_MJPEG> {
+	static constexpr uint32_t fourcc = V4L2_PIX_FMT_MJPEG;
+	static constexpr const char *name = "mjpeg";
+	static constexpr unsigned int n_planes = 1;
+	static constexpr unsigned int bytes_per_pixel = 0;
+	static constexpr int mat_type = CV_8UC1;
+	static constexpr bool compressed = true;
+};
+
+template <typename... Formats>
+struct pixel_format_list {};
+
+/*
+ * The formats the applications can capture, in the order they are listed in their usage.
+ */
+typedef pixel_format_list<
+	pixel_format<V4L2_PIX_FMT_UYVY>,
+	pixel_format<V4L2_PIX_FMT_YUYV>,
+	pixel_format<V4L2_PIX_FMT_NV12>,
+	pixel_format<V4L2_PIX_FMT_NV12M>,
+	pixel_format<V4L2_PIX_FMT_GREY>,
+	pixel_format<V4L2_PIX_FMT_Y16>,
+	pixel_format<V4L2_PIX_FMT_RGB24>,
+	pixel_format<V4L2_PIX_FMT_MJPEG>
+> supported_pixel_formats;
+
+template <typename Visitor>
+inline bool visit_pixel_format(pixel_format_list<>, const char *, Visitor &)
+{
+	return false;
+}
+
+/*
+ * Calls 'visitor.template apply<Format>()' with the traits of the format called 'name'.
+ * This is how a format chosen at run time selects code instantiated for it at compile time.
+ * Returns false if the format isn't supported.
+ */
+template <typename Visitor, typename Format, typename... Formats>
+inline bool visit_pixel_format(pixel_format_list<Format, Formats...>, const char *name, Visitor &visitor)
+{
+	if (strcmp(name, Format::name) == 0) {
+		visitor.template apply<Format>();
+		return true;
+	}
+
+	return visit_pixel_format(pixel_format_list<Formats...>(), name, visitor);
+}
+
+template <typename Visitor>
+inline bool visit_pixel_format(const char *name, Visitor &visitor)
+{
+	return visit_pixel_format(supported_pixel_formats(), name, visitor);
+}
+
+template <typename Visitor>
+inline bool visit_pixel_format(pixel_format_list<>, uint32_t, Visitor &)
+{
+	return false;
+}
+
+/*
+ * Same as above, with the format given by its fourcc.
+ */
+template <typename Visitor, typename Format, typename... Formats>
+inline bool visit_pixel_format(pixel_format_list<Format, Formats...>, uint32_t fourcc, Visitor &visitor)
+{
+	if (fourcc == Format::fourcc) {
+		visitor.template apply<Format>();
+		return true;
+	}
+
+	return visit_pixel_format(pixel_format_list<Formats...>(), fourcc, visitor);
+}
+
+template <typename Visitor>
+inline bool visit_pixel_format(uint32_t fourcc, Visitor &visitor)
+{
+	return visit_pixel_format(supported_pixel_formats(), fourcc, visitor);
+}
+
+/*
+ * Binds the traits of a format chosen at run time (see visit_pixel_format()): its
+ * conversion to BGR (NULL for compressed formats) and the OpenCV types of the color
+ * planes of its frames, for lease_mat(). The chroma planes of semi-planar formats
+ * (2 planes) hold interleaved Cb/Cr pairs; those of fully planar formats a single
+ * component.
+ */
+struct format_binder {
+	typedef int (*convert_func)(const struct helper_lease &, cv::Mat &, struct helper_pool *);
+
+	convert_func convert;
+	bool compressed;
+	int mat_types[HELPER_MAX_PLANES];  /* -1: compressed */
+
+	template <typename Format>
+	void apply()
+	{
+		compressed = Format::compressed;
+		mat_types[0] = (Format::compressed) ? -1 : Format::mat_type;
+		for (unsigned int i = 1; i < HELPER_MAX_PLANES; i++) {
+			mat_types[i] = (Format::n_planes == 2) ? CV_8UC2 : CV_8UC1;
+		}
+		bind<Format>(std::integral_constant<bool, Format::compressed>());
+	}
+
+	template <typename Format>
+	void bind(std::false_type)
+	{
+		convert = Format::convert;
+	}
+
+	template <typename Format>
+	void bind(std::true_type)
+	{
+		convert = NULL;
+	}
+};
+
+/*
+ * Converts the frame of a lease of the format bound by 'format' to BGR into 'bgr', which
+ * is only allocated when its size changes. MJPEG frames are decoded when the helper
+ * library is built with libjpeg.
+ */
+inline bool lease_to_bgr(const struct helper_lease &lease, const format_binder &format, cv::Mat &bgr,
+	struct helper_pool *pool)
+{
+	if (format.compressed) {
+#ifdef V4L2_HELPER_HAVE_JPEG
+		struct helper_jpeg_image image = helper_jpeg_image();
+
+		if (helper_jpeg_get_size(lease.data, lease.bytesused, &image.width, &image.height) < 0) {
+			return false;
+		}
+		bgr.create(image.height, image.width, CV_8UC3);
+		image.output = HELPER_JPEG_BGR;
+		image.planes[0] = bgr.data;
+		image.strides[0] = bgr.step;
+		return helper_jpeg_decode(lease.data, lease.bytesused, &image) == 0;
+#else
+		return false;
+#endif
+	}
+
+	bgr.create(lease.planes[0].height, lease.planes[0].width, CV_8UC3);
+	return format.convert(lease, bgr, pool) >= 0;
+}
+
+inline void list_pixel_formats(pixel_format_list<>, std::string &)
+{
+}
+
+/*
+ * Appends the names of the supported formats, separated by '|', to 'names'.
+ */
+template <typename Format, typename... Formats>
+inline void list_pixel_formats(pixel_format_list<Format, Formats...>, std::string &names)
+{
+	names += (names.empty()) ? "" : "|";
+	names += Format::name;
+	list_pixel_formats(pixel_format_list<Formats...>(), names);
+}
+
+inline std::string pixel_format_names()
+{
+	std::string names;
+
+	list_pixel_formats(supported_pixel_formats(), names);
+	return names;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * opencv_v4l2 - spsc_ring.hpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// Bounded lock-free single-producer/single-consumer ring used to connect the
+// stages of the capture pipeline.
+
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * What the producer does when the ring is full.
+ */
+enum ring_policy {
+	RING_BLOCK,        /* Wait until the consumer makes room */
+	RING_DROP_OLDEST   /* Drop the oldest item to make room (the newest items are kept) */
+};
+
+/*
+ * Statistics of a ring since the last call to spsc_ring::take_stats().
+ */
+struct ring_stats {
+	unsigned long pushed;
+	unsigned long dropped;
+	unsigned long occupancy_sum;  /* Sum of the occupancy seen at each push */
+	unsigned int max_occupancy;
+};
+
+/*
+ * A bounded ring with one producer thread and one consumer thread. Neither
+ * side takes a lock; a side that has to wait (the consumer on an empty ring or
+ * the producer on a full ring with RING_BLOCK) polls with an increasing back
+ * off, up to 'max_wait_us' between polls.
+ *
+ * With RING_DROP_OLDEST, the producer removes the oldest item itself, so the
+ * read index is advanced with a compare-and-swap by both sides. That's why
+ * the items are kept in atomics and must be small trivially copyable values
+ * (e.g., indices of frame slots).
+ */
+template <typename T>
+class spsc_ring {
+public:
+	spsc_ring(unsigned int ring_capacity, ring_policy ring_full_policy, unsigned int ring_max_wait_us = 200) :
+		slots(ring_capacity), capacity(ring_capacity), policy(ring_full_policy), max_wait_us(ring_max_wait_us),
+		head(0), tail(0), closed(false)
+	{
+		reset_stats();
+	}
+
+	/*
+	 * Adds 'item' to the ring. With RING_DROP_OLDEST, returns true and sets
+	 * 'dropped' if an item had to be dropped to make room; the caller owns
+	 * the dropped item. Returns false without waiting for room once the ring
+	 * is closed (with RING_BLOCK).
+	 */
+	bool push(T item, T *dropped = nullptr, bool *did_drop = nullptr)
+	{
+		unsigned long t = tail.load(std::memory_order_relaxed);
+		unsigned int wait_us = 0;
+		bool drop = false;
+
+		while (t - head.load(std::memory_order_acquire) >= capacity) {
+			if (policy == RING_DROP_OLDEST) {
+				unsigned long h = head.load(std::memory_order_acquire);
+				T oldest = slots[h % capacity].load(std::memory_order_relaxed);
+
+				if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel)) {
+					if (dropped) {
+						*dropped = oldest;
+					}
+					drop = true;
+					n_dropped.fetch_add(1, std::memory_order_relaxed);
+				}
+			} else {
+				if (closed.load(std::memory_order_relaxed)) {
+					return false;
+				}
+				back_off(wait_us);
+			}
+		}
+
+		slots[t % capacity].store(item, std::memory_order_relaxed);
+		tail.store(t + 1, std::memory_order_release);
+
+		unsigned long occupancy = t + 1 - head.load(std::memory_order_relaxed);
+		n_pushed.fetch_add(1, std::memory_order_relaxed);
+		occupancy_sum.fetch_add(occupancy, std::memory_order_relaxed);
+		if (occupancy > max_occupancy.load(std::memory_order_relaxed)) {
+			max_occupancy.store(occupancy, std::memory_order_relaxed);
+		}
+
+		if (did_drop) {
+			*did_drop = drop;
+		}
+		return true;
+	}
+
+	/*
+	 * Removes the oldest item, waiting for one if the ring is empty.
+	 * Returns false if the ring is empty and closed.
+	 */
+	bool pop(T &item)
+	{
+		unsigned int wait_us = 0;
+
+		while (true) {
+			unsigned long h = head.load(std::memory_order_acquire);
+
+			if (h == tail.load(std::memory_order_acquire)) {
+				if (closed.load(std::memory_order_acquire)) {
+					return false;
+				}
+				back_off(wait_us);
+				continue;
+			}
+
+			item = slots[h % capacity].load(std::memory_order_relaxed);
+			if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel)) {
+				return true;
+			}
+		}
+	}
+
+	/*
+	 * Removes the oldest item if there is one, without waiting.
+	 */
+	bool try_pop(T &item)
+	{
+		while (true) {
+			unsigned long h = head.load(std::memory_order_acquire);
+
+			if (h == tail.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			item = slots[h % capacity].load(std::memory_order_relaxed);
+			if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel)) {
+				return true;
+			}
+		}
+	}
+
+	/*
+	 * Wakes up the waiting sides; pop() fails once the ring is drained.
+	 */
+	void close()
+	{
+		closed.store(true, std::memory_order_release);
+	}
+
+	bool is_closed() const
+	{
+		return closed.load(std::memory_order_acquire);
+	}
+
+	unsigned int size() const
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	ring_stats take_stats()
+	{
+		ring_stats stats;
+
+		stats.pushed = n_pushed.exchange(0, std::memory_order_relaxed);
+		stats.dropped = n_dropped.exchange(0, std::memory_order_relaxed);
+		stats.occupancy_sum = occupancy_sum.exchange(0, std::memory_order_relaxed);
+		stats.max_occupancy = max_occupancy.exchange(0, std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	void back_off(unsigned int &wait_us)
+	{
+		if (wait_us == 0) {
+			std::this_thread::yield();
+			wait_us = 10;
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+			wait_us = (wait_us * 2 < max_wait_us) ? wait_us * 2 : max_wait_us;
+		}
+	}
+
+	void reset_stats()
+	{
+		n_pushed = 0;
+		n_dropped = 0;
+		occupancy_sum = 0;
+		max_occupancy = 0;
+	}
+
+	std::vector<std::atomic<T>> slots;
+	const unsigned int capacity;
+	const ring_policy policy;
+	const unsigned int max_wait_us;
+
+	/*
+	 * Free running indices; head is advanced by the consumer (and by the
+	 * producer when dropping), tail only by the producer.
+	 */
+	std::atomic<unsigned long> head;
+	std::atomic<unsigned long> tail;
+	std::atomic<bool> closed;
+
+	std::atomic<unsigned long> n_pushed;
+	std::atomic<unsigned long> n_dropped;
+	std::atomic<unsigned long> occupancy_sum;
+	std::atomic<unsigned int> max_occupancy;
+};
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ * opencv_v4l2 - v4l2_capture.hpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// A capture class with the interface of cv::VideoCapture (open, grab, retrieve,
+// read, set, get) over the helper library, for applications written against
+// VideoCapture (see opencv_main.cpp) to get its zero-copy path with few changes.
+
+#ifndef V4L2_CAPTURE_HPP
+#define V4L2_CAPTURE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/time.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_pool.h"
+#include "pixel_format.hpp"
+#include "leased_frame.hpp"
+
+/*
+ * A captured frame: a lease on a buffer of the capture ring (see leased_frame). The
+ * buffer is requeued when the frame is destroyed or released, so a frame can only be
+ * moved, not copied. The matrices returned by mat() are headers on the buffer: they
+ * must not be used after the frame is gone.
+ *
+ * As many frames as there are buffers in the ring (see CAP_PROP_BUFFERSIZE) can be held
+ * at the same time, e.g., to process a frame while the next ones are being captured.
+ * Once all the buffers are held, capturing stops until a frame is released. A frame
+ * keeps the device open, so it may outlive the v4l2_capture it came from.
+ */
+class v4l2_frame : public leased_frame<struct helper_ctx, helper_ctx_release_lease> {
+public:
+	unsigned int bytesused() const
+	{
+		return lease.bytesused;
+	}
+
+private:
+	friend class v4l2_capture;
+};
+
+/*
+ * Captures from a V4L2 device (or a virtual source, see the README) through the helper
+ * library with the interface of cv::VideoCapture:
+ *
+ *   v4l2_capture cap;
+ *   cap.set(CAP_PROP_FRAME_WIDTH, 1920);
+ *   cap.set(CAP_PROP_FRAME_HEIGHT, 1080);
+ *   cap.open("/dev/video0");
+ *   while (cap.read(frame)) ...
+ *
+ * retrieve() and read() into a cv::Mat convert the frame to BGR into the matrix, which
+ * is only allocated when its size changes, and requeue the buffer right away. With
+ * CAP_PROP_CONVERT_RGB set to 0, they return a header on the buffer instead (zero-copy),
+ * valid until the next grab(). retrieve() and read() into a v4l2_frame hand the buffer
+ * itself over, for as long as the frame is kept.
+ *
+ * The supported properties are CAP_PROP_FRAME_WIDTH, CAP_PROP_FRAME_HEIGHT,
+ * CAP_PROP_FOURCC (any format of pixel_format.hpp), CAP_PROP_BUFFERSIZE (number of
+ * buffers in the capture ring) and CAP_PROP_CONVERT_RGB. Changing one of the first four
+ * while the device is open reopens it. The buffers are user pointer buffers.
+ *
+ * The conversion to BGR runs on the calling thread unless set_conversion_threads() is
+ * used. Like the helper context, an instance must not be used from multiple threads at
+ * the same time; frames can be released from any thread.
+ */
+class v4l2_capture {
+public:
+	v4l2_capture() : current(), grabbed(false), format(), convert_rgb(true), pool(NULL)
+	{
+		helper_cam_params_init(&params, 640, 480, V4L2_PIX_FMT_UYVY, IO_METHOD_USERPTR);
+	}
+
+	v4l2_capture(const std::string &device, unsigned int width, unsigned int height,
+		uint32_t fourcc = V4L2_PIX_FMT_UYVY) : v4l2_capture()
+	{
+		params.width = width;
+		params.height = height;
+		params.format = fourcc;
+		open(device);
+	}
+
+	v4l2_capture(const v4l2_capture &) = delete;
+	v4l2_capture &operator=(const v4l2_capture &) = delete;
+
+	~v4l2_capture()
+	{
+		release();
+		if (pool) {
+			helper_pool_destroy(pool);
+		}
+	}
+
+	bool open(const std::string &device)
+	{
+		struct helper_ctx *new_ctx;
+		format_binder new_format;
+
+		release();
+
+		if (!visit_pixel_format(params.format, new_format)) {
+			std::cerr << "Unsupported capture format " << fourcc_string(params.format) << '\n';
+			return false;
+		}
+#ifndef V4L2_HELPER_HAVE_JPEG
+		if (new_format.compressed) {
+			std::cerr << "MJPEG capture needs the helper library to be built with libjpeg\n";
+			return false;
+		}
+#endif
+
+		if (helper_ctx_init_cam_params(&new_ctx, device.c_str(), &params) < 0) {
+			return false;
+		}
+
+		ctx.reset(new_ctx, helper_ctx_deinit_cam);
+		dev = device;
+		format = new_format;
+		return true;
+	}
+
+	bool isOpened() const
+	{
+		return static_cast<bool>(ctx);
+	}
+
+	/*
+	 * Closes the device. Frames still held keep it open until they are released.
+	 */
+	void release()
+	{
+		drop_grabbed();
+		ctx.reset();
+	}
+
+	/*
+	 * Waits for the next frame and dequeues it. A frame grabbed but not retrieved
+	 * is requeued.
+	 */
+	bool grab()
+	{
+		drop_grabbed();
+		if (!ctx) {
+			return false;
+		}
+
+		if (helper_ctx_acquire_lease(ctx.get(), &current) < 0) {
+			return false;
+		}
+		grabbed = true;
+		return true;
+	}
+
+	bool retrieve(cv::Mat &image, int = 0)
+	{
+		if (!grabbed) {
+			image.release();
+			return false;
+		}
+
+		if (!convert_rgb) {
+			image = lease_mat(current, format.mat_types, 0);
+			return true;
+		}
+
+		bool converted = convert_lease(current, image);
+
+		drop_grabbed();
+		return converted;
+	}
+
+	bool retrieve(v4l2_frame &frame)
+	{
+		if (!grabbed) {
+			frame.release();
+			return false;
+		}
+
+		frame.release();
+		frame.lease = current;
+		frame.hold(ctx, format.mat_types);
+		grabbed = false;
+		return true;
+	}
+
+	bool read(cv::Mat &image)
+	{
+		if (!grab()) {
+			image.release();
+			return false;
+		}
+		return retrieve(image);
+	}
+
+	bool read(v4l2_frame &frame)
+	{
+		if (!grab()) {
+			frame.release();
+			return false;
+		}
+		return retrieve(frame);
+	}
+
+	v4l2_capture &operator>>(cv::Mat &image)
+	{
+		read(image);
+		return *this;
+	}
+
+	/*
+	 * Converts a frame to BGR, as retrieve() does.
+	 */
+	bool convert_frame(const v4l2_frame &frame, cv::Mat &bgr)
+	{
+		return !frame.empty() && convert_lease(frame.get_lease(), bgr);
+	}
+
+	bool set(int prop, double value)
+	{
+		unsigned int *param;
+
+		switch (prop) {
+		case cv::CAP_PROP_FRAME_WIDTH:
+			param = &params.width;
+			break;
+		case cv::CAP_PROP_FRAME_HEIGHT:
+			param = &params.height;
+			break;
+		case cv::CAP_PROP_FOURCC:
+			param = &params.format;
+			break;
+		case cv::CAP_PROP_BUFFERSIZE:
+			param = &params.num_buffers;
+			break;
+		case cv::CAP_PROP_CONVERT_RGB:
+			convert_rgb = (value != 0);
+			return true;
+		default:
+			return false;
+		}
+
+		if (value < 0 || *param == static_cast<unsigned int>(value)) {
+			return value >= 0;
+		}
+		if (ctx && ctx.use_count() > 1) {
+			std::cerr << "Can't reconfigure the device while frames are held\n";
+			return false;
+		}
+		*param = static_cast<unsigned int>(value);
+
+		return !ctx || open(dev);
+	}
+
+	double get(int prop) const
+	{
+		switch (prop) {
+		case cv::CAP_PROP_FRAME_WIDTH:
+			return params.width;
+		case cv::CAP_PROP_FRAME_HEIGHT:
+			return params.height;
+		case cv::CAP_PROP_FOURCC:
+			return params.format;
+		case cv::CAP_PROP_BUFFERSIZE:
+			return (ctx) ? helper_ctx_get_num_buffers(ctx.get()) : params.num_buffers;
+		case cv::CAP_PROP_CONVERT_RGB:
+			return convert_rgb;
+		default:
+			return 0;
+		}
+	}
+
+	/*
+	 * Spreads the conversion to BGR over a pool of 'n_threads' threads (0: one per
+	 * CPU), for the formats the helper library converts (see pixel_format.hpp).
+	 */
+	bool set_conversion_threads(unsigned int n_threads)
+	{
+		if (pool) {
+			helper_pool_destroy(pool);
+			pool = NULL;
+		}
+		return n_threads == 1 || helper_pool_create(&pool, n_threads, 1) == 0;
+	}
+
+	/*
+	 * The helper context, for the functions of the helper library that have no
+	 * counterpart here (e.g., helper_ctx_get_stats()). NULL when not open.
+	 */
+	struct helper_ctx *get_ctx() const
+	{
+		return ctx.get();
+	}
+
+private:
+	static std::string fourcc_string(uint32_t fourcc)
+	{
+		std::string s;
+
+		for (unsigned int i = 0; i < 4; i++) {
+			s += static_cast<char>((fourcc >> (8 * i)) & 0xff);
+		}
+		return s;
+	}
+
+	void drop_grabbed()
+	{
+		if (grabbed) {
+			helper_ctx_release_lease(ctx.get(), &current);
+			grabbed = false;
+		}
+	}
+
+	bool convert_lease(const struct helper_lease &lease, cv::Mat &bgr)
+	{
+		return lease_to_bgr(lease, format, bgr, pool);
+	}
+
+	std::shared_ptr<struct helper_ctx> ctx;
+	std::string dev;
+	struct helper_cam_params params;
+
+	struct helper_lease current;  /* Grabbed but not retrieved yet when 'grabbed' */
+	bool grabbed;
+
+	format_binder format;
+
+	bool convert_rgb;
+	struct helper_pool *pool;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * opencv_v4l2 - v4l2_subscriber.hpp file
+ *
+ * Copyright (c) 2017-2018, e-con Systems India Pvt. Ltd.  All rights reserved.
+ *
+ */
+// A client of the frame fan-out of the helper library (see v4l2_helper_share.h): reads
+// the frames published by another process as cv::Mat headers on the shared ring.
+
+#ifndef V4L2_SUBSCRIBER_HPP
+#define V4L2_SUBSCRIBER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/time.h>
+#include "v4l2_helper.h"
+#include "v4l2_helper_share.h"
+#include "pixel_format.hpp"
+#include "leased_frame.hpp"
+
+/*
+ * A frame read from the shared ring. Like v4l2_frame, it holds its slot until it is
+ * destroyed or released, so it can only be moved, and the matrices returned by mat()
+ * are headers on the ring that must not be used after the frame is gone. A subscriber
+ * holds at most one frame: it must be released before the next one is read.
+ */
+class v4l2_shared_frame : public leased_frame<struct helper_subscriber, helper_subscriber_release> {
+public:
+	/*
+	 * Frames published but missed by the subscriber just before this one.
+	 */
+	unsigned int dropped() const
+	{
+		return lease.dropped;
+	}
+
+private:
+	friend class v4l2_subscriber;
+};
+
+/*
+ * Subscribes to a publisher (see helper_publisher_create()):
+ *
+ *   v4l2_subscriber sub;
+ *   sub.open("@camera0", HELPER_SHARE_LATEST_ONLY);
+ *   while (sub.read(frame)) ...
+ *
+ * read() into a v4l2_shared_frame is zero-copy; read() into a cv::Mat converts the
+ * frame to BGR into the matrix and releases the slot right away. Formats that aren't
+ * in pixel_format.hpp can only be read into a v4l2_shared_frame, as plane 0 in a single
+ * row.
+ */
+class v4l2_subscriber {
+public:
+	v4l2_subscriber() : width(0), height(0), fourcc(0), format(), known_format(false) {}
+
+	v4l2_subscriber(const v4l2_subscriber &) = delete;
+	v4l2_subscriber &operator=(const v4l2_subscriber &) = delete;
+
+	/*
+	 * Connects to the publisher listening on 'socket_path', waiting for its next frame.
+	 */
+	bool open(const std::string &socket_path, enum helper_share_policy policy = HELPER_SHARE_DROP_OLDEST)
+	{
+		struct helper_subscriber *new_sub;
+
+		release();
+
+		if (helper_subscriber_connect(&new_sub, socket_path.c_str(), policy) < 0) {
+			return false;
+		}
+		sub.reset(new_sub, helper_subscriber_disconnect);
+		helper_subscriber_get_format(new_sub, &width, &height, &fourcc);
+
+		format = format_binder();
+		std::fill(format.mat_types, format.mat_types + HELPER_MAX_PLANES, -1);
+		known_format = visit_pixel_format(fourcc, format);
+		return true;
+	}
+
+	bool isOpened() const
+	{
+		return static_cast<bool>(sub);
+	}
+
+	/*
+	 * Disconnects. A frame still held keeps the connection until it is released.
+	 */
+	void release()
+	{
+		sub.reset();
+	}
+
+	/*
+	 * Waits up to 'timeout_ms' milliseconds (-1: forever) for the next frame. Returns
+	 * false on timeout, with 'frame' empty, and once the publisher is gone, which also
+	 * closes the subscriber.
+	 */
+	bool read(v4l2_shared_frame &frame, int timeout_ms = -1)
+	{
+		frame.release();
+		if (!sub) {
+			return false;
+		}
+		if (sub.use_count() > 1) {
+			std::cerr << "The previous shared frame must be released first\n";
+			return false;
+		}
+
+		int ret = helper_subscriber_acquire(sub.get(), &frame.lease, timeout_ms);
+		if (ret != 0) {
+			if (ret < 0) {
+				release();
+			}
+			return false;
+		}
+		frame.hold(sub, format.mat_types);
+		return true;
+	}
+
+	bool read(cv::Mat &bgr, int timeout_ms = -1)
+	{
+		v4l2_shared_frame frame;
+
+		if (!read(frame, timeout_ms) || !known_format) {
+			bgr.release();
+			return false;
+		}
+		return lease_to_bgr(frame.get_lease(), format, bgr, NULL);
+	}
+
+	unsigned int get_width() const
+	{
+		return width;
+	}
+
+	unsigned int get_height() const
+	{
+		return height;
+	}
+
+	uint32_t get_fourcc() const
+	{
+		return fourcc;
+	}
+
+	/*
+	 * The subscriber of the helper library, e.g., to poll its fd
+	 * (helper_subscriber_get_fd()). NULL when not open.
+	 */
+	struct helper_subscriber *get_subscriber() const
+	{
+		return sub.get();
+	}
+
+private:
+	std::shared_ptr<struct helper_subscriber> sub;
+	unsigned int width, height;
+	uint32_t fourcc;
+	format_binder format;
+	bool known_format;
+};
+
+#endif